@@ -0,0 +1,575 @@
+#include "apu.h"
+#include "blip_buffer.h"
+#include "host_stats.h"
+#include <stdint.h>
+
+// Amplitude of one output level step of each channel, a linear approximation
+// of the APU mixer scaled to 16-bit samples.
+#define PULSE_WEIGHT 246
+#define TRIANGLE_WEIGHT 279
+#define NOISE_WEIGHT 162
+#define DMC_WEIGHT 110
+
+static const uint8_t length_table[32] = {
+    10, 254, 20, 2,  40, 4,  80, 6,  160, 8,  60, 10, 14, 12, 26, 14,
+    12, 16,  24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30,
+};
+
+static const uint8_t duty_table[4][8] = {
+    {0, 1, 0, 0, 0, 0, 0, 0},
+    {0, 1, 1, 0, 0, 0, 0, 0},
+    {0, 1, 1, 1, 1, 0, 0, 0},
+    {1, 0, 0, 1, 1, 1, 1, 1},
+};
+
+static const uint8_t triangle_table[32] = {
+    15, 14, 13, 12, 11, 10, 9,  8,  7,  6,  5,  4,  3,  2,  1,  0,
+    0,  1,  2,  3,  4,  5,  6,  7,  8,  9,  10, 11, 12, 13, 14, 15,
+};
+
+// NTSC
+static const uint16_t noise_period_table[16] = {
+    4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068,
+};
+
+// NTSC
+static const uint16_t dmc_period_table[16] = {
+    428, 380, 340, 320, 286, 254, 226, 214,
+    190, 160, 142, 128, 106, 84,  72,  54,
+};
+
+// Frame counter steps in CPU cycles from the start of the sequence (NTSC)
+#define FRAME_COUNTER_STEPS 5
+static const uint32_t frame_counter_steps[FRAME_COUNTER_STEPS] = {
+    7457, 14913, 22371, 29829, 37281,
+};
+#define FOUR_STEP_PERIOD 29830
+#define FIVE_STEP_PERIOD 37282
+
+// Reports a change in a channel's output level to the blip buffer.
+static inline void set_output(APU *apu, int *output, int level, int weight,
+                              uint64_t cpu_cycle) {
+    if (level == *output)
+        return;
+
+    blip_buffer_add_delta(&apu->blip, cpu_cycle - apu->frame_start,
+                          (level - *output) * weight);
+    *output = level;
+}
+
+// ----- Envelope, sweep, counters -----
+
+static inline uint8_t envelope_volume(APUEnvelope *envelope) {
+    return envelope->constant_volume ? envelope->volume
+                                     : envelope->decay_level;
+}
+
+static void clock_envelope(APUEnvelope *envelope) {
+    if (envelope->start) {
+        envelope->start = 0;
+        envelope->decay_level = 15;
+        envelope->divider = envelope->volume;
+        return;
+    }
+
+    if (envelope->divider) {
+        envelope->divider--;
+        return;
+    }
+
+    envelope->divider = envelope->volume;
+    if (envelope->decay_level)
+        envelope->decay_level--;
+    else if (envelope->loop)
+        envelope->decay_level = 15;
+}
+
+static inline void clock_length_counter(uint8_t *length_counter,
+                                        uint8_t halt) {
+    if (!halt && *length_counter)
+        (*length_counter)--;
+}
+
+static uint16_t sweep_target_period(APUPulse *pulse) {
+    uint16_t change = pulse->timer_period >> pulse->sweep_shift;
+    if (!pulse->sweep_negate)
+        return pulse->timer_period + change;
+
+    if (change + pulse->ones_complement_negate > pulse->timer_period)
+        return 0;
+    return pulse->timer_period - change - pulse->ones_complement_negate;
+}
+
+// The sweep unit mutes the channel if the period is too low or the target
+// period would overflow, even when sweeping is disabled.
+static inline int sweep_muted(APUPulse *pulse) {
+    return pulse->timer_period < 8 || sweep_target_period(pulse) > 0x7ff;
+}
+
+static void clock_sweep(APUPulse *pulse) {
+    if (!pulse->sweep_divider && pulse->sweep_enabled && pulse->sweep_shift &&
+        !sweep_muted(pulse))
+        pulse->timer_period = sweep_target_period(pulse);
+
+    if (!pulse->sweep_divider || pulse->sweep_reload) {
+        pulse->sweep_divider = pulse->sweep_period;
+        pulse->sweep_reload = 0;
+    } else {
+        pulse->sweep_divider--;
+    }
+}
+
+static void clock_linear_counter(APUTriangle *triangle) {
+    if (triangle->linear_counter_reload)
+        triangle->linear_counter = triangle->linear_counter_reload_value;
+    else if (triangle->linear_counter)
+        triangle->linear_counter--;
+
+    if (!triangle->control)
+        triangle->linear_counter_reload = 0;
+}
+
+static void clock_quarter_frame(APU *apu) {
+    clock_envelope(&apu->pulse_1.envelope);
+    clock_envelope(&apu->pulse_2.envelope);
+    clock_envelope(&apu->noise.envelope);
+    clock_linear_counter(&apu->triangle);
+}
+
+static void clock_half_frame(APU *apu) {
+    clock_length_counter(&apu->pulse_1.length_counter,
+                         apu->pulse_1.envelope.loop);
+    clock_length_counter(&apu->pulse_2.length_counter,
+                         apu->pulse_2.envelope.loop);
+    clock_length_counter(&apu->triangle.length_counter,
+                         apu->triangle.control);
+    clock_length_counter(&apu->noise.length_counter,
+                         apu->noise.envelope.loop);
+    clock_sweep(&apu->pulse_1);
+    clock_sweep(&apu->pulse_2);
+}
+
+static void clock_frame_counter(APU *apu) {
+    uint8_t step = apu->frame_counter_step;
+
+    if (!apu->five_step_mode) {
+        clock_quarter_frame(apu);
+        if (step == 1 || step == 3)
+            clock_half_frame(apu);
+        if (step == 3 && !apu->frame_irq_inhibit)
+            apu->frame_irq_flag = 1;
+    } else if (step != 3) {
+        clock_quarter_frame(apu);
+        if (step == 1 || step == 4)
+            clock_half_frame(apu);
+    }
+
+    apu->frame_counter_step++;
+    if (apu->frame_counter_step == (apu->five_step_mode ? 5 : 4)) {
+        apu->frame_counter_step = 0;
+        apu->frame_counter_start +=
+            apu->five_step_mode ? FIVE_STEP_PERIOD : FOUR_STEP_PERIOD;
+    }
+}
+
+static inline uint64_t next_frame_counter_clock(APU *apu) {
+    return apu->frame_counter_start +
+           frame_counter_steps[apu->frame_counter_step];
+}
+
+// ----- Channels -----
+
+// Advances a timer that has been idle until `start` by whole periods so that
+// its next clock is at or after `end`, without looking at the steps in
+// between.
+static inline uint64_t skip_timer(uint64_t *next_clock, uint32_t period,
+                                  uint64_t start, uint64_t end) {
+    if (*next_clock < start)
+        *next_clock = start;
+    if (*next_clock >= end)
+        return 0;
+
+    uint64_t steps = (end - *next_clock + period - 1) / period;
+    *next_clock += steps * period;
+    return steps;
+}
+
+static void run_pulse(APU *apu, APUPulse *pulse, uint64_t end) {
+    uint32_t period = (pulse->timer_period + 1) * 2;
+    int volume = 0;
+    if (pulse->enabled && pulse->length_counter && !sweep_muted(pulse))
+        volume = envelope_volume(&pulse->envelope);
+
+    // Silent, only the sequencer position needs to be kept
+    if (!volume) {
+        set_output(apu, &pulse->output, 0, PULSE_WEIGHT, apu->time);
+        uint64_t steps = skip_timer(&pulse->next_clock, period, apu->time, end);
+        pulse->sequence_step = (pulse->sequence_step + steps) % 8;
+        return;
+    }
+
+    set_output(apu, &pulse->output,
+               duty_table[pulse->duty][pulse->sequence_step] * volume,
+               PULSE_WEIGHT, apu->time);
+
+    if (pulse->next_clock < apu->time)
+        pulse->next_clock = apu->time;
+
+    for (; pulse->next_clock < end; pulse->next_clock += period) {
+        pulse->sequence_step = (pulse->sequence_step + 1) % 8;
+        set_output(apu, &pulse->output,
+                   duty_table[pulse->duty][pulse->sequence_step] * volume,
+                   PULSE_WEIGHT, pulse->next_clock);
+    }
+}
+
+static void run_triangle(APU *apu, APUTriangle *triangle, uint64_t end) {
+    uint32_t period = triangle->timer_period + 1;
+
+    set_output(apu, &triangle->output,
+               triangle_table[triangle->sequence_step], TRIANGLE_WEIGHT,
+               apu->time);
+
+    // The sequencer halts (keeping its output level) when either counter is
+    // zero. Ultrasonic periods are halted as well, they would only produce
+    // popping.
+    if (!triangle->enabled || !triangle->length_counter ||
+        !triangle->linear_counter || triangle->timer_period < 2) {
+        skip_timer(&triangle->next_clock, period, apu->time, end);
+        return;
+    }
+
+    if (triangle->next_clock < apu->time)
+        triangle->next_clock = apu->time;
+
+    for (; triangle->next_clock < end; triangle->next_clock += period) {
+        triangle->sequence_step = (triangle->sequence_step + 1) % 32;
+        set_output(apu, &triangle->output,
+                   triangle_table[triangle->sequence_step], TRIANGLE_WEIGHT,
+                   triangle->next_clock);
+    }
+}
+
+static inline void clock_noise_shift_register(APUNoise *noise) {
+    uint16_t shift = noise->shift_register;
+    uint16_t feedback = (shift ^ (shift >> (noise->mode ? 6 : 1))) & 1;
+    noise->shift_register = (shift >> 1) | feedback << 14;
+}
+
+static void run_noise(APU *apu, APUNoise *noise, uint64_t end) {
+    uint32_t period = noise->timer_period;
+    int volume = 0;
+    if (noise->enabled && noise->length_counter)
+        volume = envelope_volume(&noise->envelope);
+
+    set_output(apu, &noise->output,
+               (noise->shift_register & 1) ? 0 : volume, NOISE_WEIGHT,
+               apu->time);
+
+    // Only before `apu_init` or a write to 0x400e
+    if (!period)
+        return;
+
+    if (noise->next_clock < apu->time)
+        noise->next_clock = apu->time;
+
+    // The shift register keeps running even when silent
+    for (; noise->next_clock < end; noise->next_clock += period) {
+        clock_noise_shift_register(noise);
+        if (volume)
+            set_output(apu, &noise->output,
+                       (noise->shift_register & 1) ? 0 : volume, NOISE_WEIGHT,
+                       noise->next_clock);
+    }
+}
+
+static void dmc_restart_sample(APUDMC *dmc) {
+    dmc->current_address = dmc->sample_address;
+    dmc->bytes_remaining = dmc->sample_length;
+}
+
+// Fills the sample buffer from memory if it's empty and there are bytes left.
+static void dmc_fetch_sample(APU *apu, APUDMC *dmc) {
+    if (!dmc->sample_buffer_empty || !dmc->bytes_remaining)
+        return;
+
+    dmc->sample_buffer = apu->dmc_read
+                             ? apu->dmc_read(apu->dmc_read_context,
+                                             dmc->current_address)
+                             : 0;
+    dmc->sample_buffer_empty = 0;
+
+    // Address wraps around to 0x8000
+    dmc->current_address = dmc->current_address == 0xffff
+                               ? 0x8000
+                               : dmc->current_address + 1;
+    dmc->bytes_remaining--;
+
+    if (!dmc->bytes_remaining) {
+        if (dmc->loop)
+            dmc_restart_sample(dmc);
+        else if (dmc->irq_enabled)
+            dmc->irq_flag = 1;
+    }
+}
+
+static void run_dmc(APU *apu, APUDMC *dmc, uint64_t end) {
+    set_output(apu, &dmc->output, dmc->output_level, DMC_WEIGHT, apu->time);
+
+    if (!dmc->timer_period)
+        return;
+
+    // Nothing to play and nothing to fetch
+    if (dmc->silence && dmc->sample_buffer_empty && !dmc->bytes_remaining) {
+        uint64_t steps =
+            skip_timer(&dmc->next_clock, dmc->timer_period, apu->time, end);
+        dmc->bits_remaining = (dmc->bits_remaining + 7 - steps % 8) % 8 + 1;
+        return;
+    }
+
+    if (dmc->next_clock < apu->time)
+        dmc->next_clock = apu->time;
+
+    for (; dmc->next_clock < end; dmc->next_clock += dmc->timer_period) {
+        if (!dmc->silence) {
+            if ((dmc->shift_register & 1) && dmc->output_level <= 125)
+                dmc->output_level += 2;
+            else if (!(dmc->shift_register & 1) && dmc->output_level >= 2)
+                dmc->output_level -= 2;
+            set_output(apu, &dmc->output, dmc->output_level, DMC_WEIGHT,
+                       dmc->next_clock);
+        }
+        dmc->shift_register >>= 1;
+
+        if (--dmc->bits_remaining)
+            continue;
+
+        // Output cycle ends, start a new one from the sample buffer
+        dmc->bits_remaining = 8;
+        dmc->silence = dmc->sample_buffer_empty;
+        if (!dmc->sample_buffer_empty) {
+            dmc->shift_register = dmc->sample_buffer;
+            dmc->sample_buffer_empty = 1;
+            dmc_fetch_sample(apu, dmc);
+        }
+    }
+}
+
+// Runs all channels from `APU.time` to `end`, no frame counter clocks can be
+// in between.
+static void run_channels(APU *apu, uint64_t end) {
+    run_pulse(apu, &apu->pulse_1, end);
+    run_pulse(apu, &apu->pulse_2, end);
+    run_triangle(apu, &apu->triangle, end);
+    run_noise(apu, &apu->noise, end);
+    run_dmc(apu, &apu->dmc, end);
+    apu->time = end;
+}
+
+void apu_run_until(APU *apu, uint64_t cpu_cycle) {
+    if (apu->time >= cpu_cycle)
+        return;
+
+    HOST_STATS_ENTER(HOST_STATS_APU);
+    while (apu->time < cpu_cycle) {
+        uint64_t frame_counter_clock = next_frame_counter_clock(apu);
+
+        if (frame_counter_clock >= cpu_cycle) {
+            run_channels(apu, cpu_cycle);
+            break;
+        }
+
+        run_channels(apu, frame_counter_clock);
+        clock_frame_counter(apu);
+    }
+    HOST_STATS_LEAVE();
+}
+
+// ----- Interface -----
+
+void apu_init(APU *apu, double sample_rate) {
+    apu->noise.shift_register = 1;
+    apu->noise.timer_period = noise_period_table[0];
+    apu->dmc.timer_period = dmc_period_table[0];
+    apu->dmc.bits_remaining = 8;
+    apu->dmc.sample_buffer_empty = 1;
+    apu->dmc.silence = 1;
+    apu->pulse_1.ones_complement_negate = 1;
+    // The triangle sits at its first step at power-on, taking it as the
+    // starting level avoids a pop
+    apu->triangle.output = triangle_table[0];
+
+    apu->sample_rate = sample_rate;
+    blip_buffer_set_rates(&apu->blip, APU_CPU_CLOCK_RATE, sample_rate);
+}
+
+void apu_set_rate_adjustment(APU *apu, double ratio) {
+    blip_buffer_set_rates(&apu->blip, APU_CPU_CLOCK_RATE,
+                          apu->sample_rate * ratio);
+}
+
+static void write_pulse(APUPulse *pulse, uint8_t reg, uint8_t value) {
+    switch (reg) {
+    case 0:
+        pulse->duty = value >> 6;
+        pulse->envelope.loop = (value >> 5) & 1;
+        pulse->envelope.constant_volume = (value >> 4) & 1;
+        pulse->envelope.volume = value & 0xf;
+        break;
+    case 1:
+        pulse->sweep_enabled = value >> 7;
+        pulse->sweep_period = (value >> 4) & 0x7;
+        pulse->sweep_negate = (value >> 3) & 1;
+        pulse->sweep_shift = value & 0x7;
+        pulse->sweep_reload = 1;
+        break;
+    case 2:
+        pulse->timer_period = (pulse->timer_period & 0x700) | value;
+        break;
+    case 3:
+        pulse->timer_period = (pulse->timer_period & 0xff) | (value & 0x7) << 8;
+        if (pulse->enabled)
+            pulse->length_counter = length_table[value >> 3];
+        pulse->sequence_step = 0;
+        pulse->envelope.start = 1;
+        break;
+    }
+}
+
+void apu_write_register(APU *apu, uint16_t address, uint8_t value,
+                        uint64_t cpu_cycle) {
+    apu_run_until(apu, cpu_cycle);
+
+    if (address <= 0x4003) {
+        write_pulse(&apu->pulse_1, address - 0x4000, value);
+        return;
+    }
+    if (address <= 0x4007) {
+        write_pulse(&apu->pulse_2, address - 0x4004, value);
+        return;
+    }
+
+    APUTriangle *triangle = &apu->triangle;
+    APUNoise *noise = &apu->noise;
+    APUDMC *dmc = &apu->dmc;
+
+    switch (address) {
+    case 0x4008:
+        triangle->control = value >> 7;
+        triangle->linear_counter_reload_value = value & 0x7f;
+        break;
+    case 0x400a:
+        triangle->timer_period = (triangle->timer_period & 0x700) | value;
+        break;
+    case 0x400b:
+        triangle->timer_period =
+            (triangle->timer_period & 0xff) | (value & 0x7) << 8;
+        if (triangle->enabled)
+            triangle->length_counter = length_table[value >> 3];
+        triangle->linear_counter_reload = 1;
+        break;
+
+    case 0x400c:
+        noise->envelope.loop = (value >> 5) & 1;
+        noise->envelope.constant_volume = (value >> 4) & 1;
+        noise->envelope.volume = value & 0xf;
+        break;
+    case 0x400e:
+        noise->mode = value >> 7;
+        noise->timer_period = noise_period_table[value & 0xf];
+        break;
+    case 0x400f:
+        if (noise->enabled)
+            noise->length_counter = length_table[value >> 3];
+        noise->envelope.start = 1;
+        break;
+
+    case 0x4010:
+        dmc->irq_enabled = value >> 7;
+        if (!dmc->irq_enabled)
+            dmc->irq_flag = 0;
+        dmc->loop = (value >> 6) & 1;
+        dmc->timer_period = dmc_period_table[value & 0xf];
+        break;
+    case 0x4011:
+        dmc->output_level = value & 0x7f;
+        break;
+    case 0x4012:
+        dmc->sample_address = 0xc000 + value * 64;
+        break;
+    case 0x4013:
+        dmc->sample_length = value * 16 + 1;
+        break;
+
+    case 0x4015:
+        apu->pulse_1.enabled = value & 1;
+        apu->pulse_2.enabled = (value >> 1) & 1;
+        triangle->enabled = (value >> 2) & 1;
+        noise->enabled = (value >> 3) & 1;
+
+        if (!apu->pulse_1.enabled)
+            apu->pulse_1.length_counter = 0;
+        if (!apu->pulse_2.enabled)
+            apu->pulse_2.length_counter = 0;
+        if (!triangle->enabled)
+            triangle->length_counter = 0;
+        if (!noise->enabled)
+            noise->length_counter = 0;
+
+        dmc->irq_flag = 0;
+        if (!((value >> 4) & 1)) {
+            dmc->bytes_remaining = 0;
+        } else if (!dmc->bytes_remaining) {
+            dmc_restart_sample(dmc);
+            dmc_fetch_sample(apu, dmc);
+        }
+        break;
+
+    case 0x4017:
+        apu->five_step_mode = value >> 7;
+        apu->frame_irq_inhibit = (value >> 6) & 1;
+        if (apu->frame_irq_inhibit)
+            apu->frame_irq_flag = 0;
+
+        apu->frame_counter_start = cpu_cycle;
+        apu->frame_counter_step = 0;
+
+        // Five-step mode clocks everything right away
+        if (apu->five_step_mode) {
+            clock_quarter_frame(apu);
+            clock_half_frame(apu);
+        }
+        break;
+    }
+}
+
+uint8_t apu_read_status(APU *apu, uint64_t cpu_cycle) {
+    apu_run_until(apu, cpu_cycle);
+
+    uint8_t status = (apu->pulse_1.length_counter > 0) |
+                     (apu->pulse_2.length_counter > 0) << 1 |
+                     (apu->triangle.length_counter > 0) << 2 |
+                     (apu->noise.length_counter > 0) << 3 |
+                     (apu->dmc.bytes_remaining > 0) << 4 |
+                     apu->frame_irq_flag << 6 | apu->dmc.irq_flag << 7;
+
+    // Reading clears the frame interrupt
+    apu->frame_irq_flag = 0;
+    return status;
+}
+
+int apu_irq_pending(APU *apu) {
+    return apu->frame_irq_flag || apu->dmc.irq_flag;
+}
+
+void apu_end_frame(APU *apu, uint64_t cpu_cycle) {
+    apu_run_until(apu, cpu_cycle);
+    HOST_STATS_ENTER(HOST_STATS_APU);
+    blip_buffer_end_frame(&apu->blip, cpu_cycle - apu->frame_start);
+    HOST_STATS_LEAVE();
+    apu->frame_start = cpu_cycle;
+}
+
+int apu_read_samples(APU *apu, int16_t *out, int max_samples) {
+    return blip_buffer_read_samples(&apu->blip, out, max_samples);
+}
@@ -0,0 +1,172 @@
+// Audio Processing Unit: two pulse channels, a triangle, a noise and a delta
+// modulation (DMC) channel.
+//
+// Like the PPU, the APU isn't stepped along with the CPU. Register writes and
+// the end of every frame run the channels up to the current CPU cycle, and the
+// channels only report when their output changes (see blip_buffer.h).
+
+#ifndef _APU
+#define _APU
+
+#include "blip_buffer.h"
+#include <stdint.h>
+
+#define APU_CPU_CLOCK_RATE 1789773.0
+#define APU_DEFAULT_SAMPLE_RATE 48000
+
+typedef struct {
+    uint8_t start;
+    // Also halts the length counter
+    uint8_t loop;
+    uint8_t constant_volume;
+    // Constant volume, or the period of the decay
+    uint8_t volume;
+    uint8_t divider;
+    uint8_t decay_level;
+} APUEnvelope;
+
+typedef struct {
+    uint8_t enabled;
+    APUEnvelope envelope;
+    uint8_t length_counter;
+
+    uint8_t duty;
+    uint8_t sequence_step;
+    uint16_t timer_period;
+    // CPU cycle on which the sequencer advances next
+    uint64_t next_clock;
+
+    uint8_t sweep_enabled;
+    uint8_t sweep_period;
+    uint8_t sweep_negate;
+    uint8_t sweep_shift;
+    uint8_t sweep_reload;
+    uint8_t sweep_divider;
+    // Pulse 1 negates with one's complement, pulse 2 with two's complement
+    uint8_t ones_complement_negate;
+
+    // Last output level reported to the blip buffer
+    int output;
+} APUPulse;
+
+typedef struct {
+    uint8_t enabled;
+    uint8_t length_counter;
+    // Also halts the length counter
+    uint8_t control;
+    uint8_t linear_counter;
+    uint8_t linear_counter_reload_value;
+    uint8_t linear_counter_reload;
+
+    uint8_t sequence_step;
+    uint16_t timer_period;
+    uint64_t next_clock;
+
+    int output;
+} APUTriangle;
+
+typedef struct {
+    uint8_t enabled;
+    APUEnvelope envelope;
+    uint8_t length_counter;
+
+    // If set, feedback is taken from bit 6 instead of bit 1, giving a short
+    // metallic sounding sequence
+    uint8_t mode;
+    uint16_t shift_register;
+    uint16_t timer_period;
+    uint64_t next_clock;
+
+    int output;
+} APUNoise;
+
+typedef struct {
+    uint8_t irq_enabled;
+    uint8_t irq_flag;
+    uint8_t loop;
+    uint16_t timer_period;
+    uint64_t next_clock;
+
+    uint8_t output_level;
+
+    uint16_t sample_address;
+    uint16_t sample_length;
+    uint16_t current_address;
+    uint16_t bytes_remaining;
+
+    uint8_t sample_buffer;
+    uint8_t sample_buffer_empty;
+    uint8_t shift_register;
+    uint8_t bits_remaining;
+    uint8_t silence;
+
+    int output;
+} APUDMC;
+
+typedef struct {
+    APUPulse pulse_1;
+    APUPulse pulse_2;
+    APUTriangle triangle;
+    APUNoise noise;
+    APUDMC dmc;
+
+    // Frame counter, clocks envelopes, sweeps and length counters
+    uint8_t five_step_mode;
+    uint8_t frame_irq_inhibit;
+    uint8_t frame_irq_flag;
+    // CPU cycle on which the frame counter sequence was last (re)started
+    uint64_t frame_counter_start;
+    uint8_t frame_counter_step;
+
+    // CPU cycle the channels have been run up to
+    uint64_t time;
+    // CPU cycle the current audio frame started on
+    uint64_t frame_start;
+
+    BlipBuffer blip;
+    // Nominal output sample rate, before any rate adjustment
+    double sample_rate;
+
+    // Used by the DMC to fetch samples from CPU memory
+    uint8_t (*dmc_read)(void *context, uint16_t address);
+    void *dmc_read_context;
+} APU;
+
+// Sets up power-on state and the output sample rate. The APU can run without
+// being initialized, it just won't produce any samples.
+void apu_init(APU *apu, double sample_rate);
+
+// Scales the output sample rate by `ratio`, starting from the next frame.
+// Used to keep an audio device that runs on its own clock fed.
+void apu_set_rate_adjustment(APU *apu, double ratio);
+
+// Runs all channels up to `cpu_cycle`.
+void apu_run_until(APU *apu, uint64_t cpu_cycle);
+
+// Handles a write to 0x4000-0x4013, 0x4015 or 0x4017 at `cpu_cycle`.
+void apu_write_register(APU *apu, uint16_t address, uint8_t value,
+                        uint64_t cpu_cycle);
+
+// Handles a read of 0x4015 at `cpu_cycle`.
+uint8_t apu_read_status(APU *apu, uint64_t cpu_cycle);
+
+// Set if the frame counter or the DMC is requesting an interrupt.
+int apu_irq_pending(APU *apu);
+
+// Whether the frame counter or the DMC could request an interrupt without
+// being written to first.
+static inline int apu_irq_possible(APU *apu) {
+    return !apu->frame_irq_inhibit || apu->dmc.irq_enabled ||
+           apu->frame_irq_flag || apu->dmc.irq_flag;
+}
+
+// Runs the channels up to `cpu_cycle` and turns everything up to it into
+// samples that can be read with `apu_read_samples`.
+void apu_end_frame(APU *apu, uint64_t cpu_cycle);
+
+// Reads at most `max_samples` mono 16-bit samples.
+//
+// Returns the number of samples read.
+int apu_read_samples(APU *apu, int16_t *out, int max_samples);
+
+#endif
@@ -0,0 +1,69 @@
+#include "audio.h"
+#include "apu.h"
+#include "ring_buffer.h"
+#include <stdint.h>
+
+// Weight of the newest measurement in the smoothed buffer fill
+#define FILL_SMOOTHING 0.05
+// Samples moved out of the APU at a time
+#define PUSH_CHUNK 512
+
+int audio_init(AudioOutput *audio, double sample_rate) {
+    if (ring_buffer_init(&audio->ring, audio->storage, sizeof(int16_t),
+                         AUDIO_RING_CAPACITY))
+        return 1;
+
+    audio->target_fill = sample_rate * AUDIO_TARGET_LATENCY_MS / 1000;
+    audio->max_fill = sample_rate * AUDIO_MAX_LATENCY_MS / 1000;
+    audio->average_fill = audio->target_fill;
+    audio->rate_adjustment = 1.0;
+    audio->samples_dropped = 0;
+    audio->last_sample = 0;
+    audio->samples_missed = 0;
+    return 0;
+}
+
+double audio_rate_adjustment(double fill, double target) {
+    double error = (target - fill) / target;
+    if (error > 1)
+        error = 1;
+    if (error < -1)
+        error = -1;
+    return 1.0 + error * AUDIO_MAX_RATE_ADJUSTMENT;
+}
+
+void audio_push_frame(AudioOutput *audio, APU *apu) {
+    // What's left of the previous frames is what the device has to go on
+    // until the next one
+    double fill = ring_buffer_count(&audio->ring);
+    audio->average_fill += (fill - audio->average_fill) * FILL_SMOOTHING;
+    audio->rate_adjustment =
+        audio_rate_adjustment(audio->average_fill, audio->target_fill);
+
+    int16_t chunk[PUSH_CHUNK];
+    int count;
+    while ((count = apu_read_samples(apu, chunk, PUSH_CHUNK)) > 0) {
+        size_t buffered = ring_buffer_count(&audio->ring);
+        size_t space =
+            buffered < audio->max_fill ? audio->max_fill - buffered : 0;
+        if ((size_t)count < space)
+            space = count;
+
+        size_t written = ring_buffer_write(&audio->ring, chunk, space);
+        audio->samples_dropped += count - written;
+    }
+
+    apu_set_rate_adjustment(apu, audio->rate_adjustment);
+}
+
+int audio_pull(AudioOutput *audio, int16_t *out, int count) {
+    int read = ring_buffer_read(&audio->ring, out, count);
+
+    if (read > 0)
+        audio->last_sample = out[read - 1];
+    for (int i = read; i < count; i++)
+        out[i] = audio->last_sample;
+
+    audio->samples_missed += count - read;
+    return read;
+}
@@ -0,0 +1,61 @@
+// Hands the samples of every emulated frame over to the audio device.
+//
+// The emulator pushes a frame of samples at a time into a lock-free ring
+// buffer which the audio device drains at its own pace. The two clocks never
+// quite agree, so the APU's output rate is nudged by a fraction of a percent
+// to keep the amount of buffered audio, and with it the latency, steady.
+
+#ifndef _AUDIO
+#define _AUDIO
+
+#include "apu.h"
+#include "ring_buffer.h"
+#include <stdint.h>
+
+// Room for about 85 ms at 48 kHz, enough to ride out a late frame
+#define AUDIO_RING_CAPACITY 4096
+// Audio to have left when the next frame comes in
+#define AUDIO_TARGET_LATENCY_MS 10
+// Anything beyond this is dropped, e.g. while the device is starting up
+#define AUDIO_MAX_LATENCY_MS 30
+// Largest change to the output rate, inaudible as a change in pitch
+#define AUDIO_MAX_RATE_ADJUSTMENT 0.005
+
+typedef struct {
+    RingBuffer ring;
+    int16_t storage[AUDIO_RING_CAPACITY];
+
+    // Producer side
+    double target_fill;
+    size_t max_fill;
+    // Buffer fill smoothed over frames, the device drains it in bursts
+    double average_fill;
+    double rate_adjustment;
+    // Samples that didn't fit into the buffer
+    uint64_t samples_dropped;
+
+    // Consumer side
+    // Repeated when the buffer runs dry instead of dropping to silence
+    int16_t last_sample;
+    uint64_t samples_missed;
+} AudioOutput;
+
+// Returns 1 on failure.
+int audio_init(AudioOutput *audio, double sample_rate);
+
+// Moves the finished samples of `apu` into the buffer and adjusts the APU's
+// output rate for the next frame. Producer only.
+void audio_push_frame(AudioOutput *audio, APU *apu);
+
+// Reads exactly `count` samples. If there aren't enough buffered, the rest is
+// filled with the last sample. Consumer only.
+//
+// Returns the number of samples that came from the buffer.
+int audio_pull(AudioOutput *audio, int16_t *out, int count);
+
+// The output rate ratio for a buffer holding `fill` samples when `target`
+// samples are wanted: above 1 when it's running low, below when it's too
+// full.
+double audio_rate_adjustment(double fill, double target);
+
+#endif
@@ -0,0 +1,109 @@
+#include "battery.h"
+#include "memory.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// Flushes the mapping to disk whenever it has changed since the last time.
+static void *run_sync(void *arg) {
+    Battery *battery = arg;
+
+    while (!atomic_load(&battery->quit)) {
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_nsec += BATTERY_SYNC_INTERVAL_MS % 1000 * 1000000L;
+        until.tv_sec += BATTERY_SYNC_INTERVAL_MS / 1000 +
+                        until.tv_nsec / 1000000000L;
+        until.tv_nsec %= 1000000000L;
+
+        pthread_mutex_lock(&battery->lock);
+        if (!atomic_load(&battery->quit))
+            pthread_cond_timedwait(&battery->woken, &battery->lock, &until);
+        pthread_mutex_unlock(&battery->lock);
+
+        unsigned generation = atomic_load(&battery->generation);
+        if (generation != battery->synced_generation &&
+            !msync(battery->mapping, MEMORY_PRG_RAM_SIZE, MS_SYNC))
+            battery->synced_generation = generation;
+    }
+    return 0;
+}
+
+int battery_open(Battery *battery, Memory *memory, const char *filepath) {
+    memset(battery, 0, sizeof(Battery));
+    battery->fd = open(filepath, O_RDWR | O_CREAT, 0644);
+    struct stat file_stat;
+    if (battery->fd < 0 || fstat(battery->fd, &file_stat) ||
+        (file_stat.st_size < MEMORY_PRG_RAM_SIZE &&
+         ftruncate(battery->fd, MEMORY_PRG_RAM_SIZE))) {
+        perror("Could not open save file");
+        if (battery->fd >= 0)
+            close(battery->fd);
+        return 1;
+    }
+
+    battery->mapping = mmap(0, MEMORY_PRG_RAM_SIZE, PROT_READ | PROT_WRITE,
+                            MAP_SHARED, battery->fd, 0);
+    if (battery->mapping == MAP_FAILED) {
+        perror("Could not map save file");
+        close(battery->fd);
+        return 1;
+    }
+    // Also faults the pages in, so updates don't wait for the disk
+    memcpy(memory->prg_ram, battery->mapping, MEMORY_PRG_RAM_SIZE);
+    memory->prg_ram_dirty = 0;
+
+    pthread_mutex_init(&battery->lock, 0);
+    pthread_cond_init(&battery->woken, 0);
+    if (pthread_create(&battery->thread, 0, run_sync, battery)) {
+        fprintf(stderr, "Could not start save file thread\n");
+        munmap(battery->mapping, MEMORY_PRG_RAM_SIZE);
+        close(battery->fd);
+        return 1;
+    }
+    return 0;
+}
+
+void battery_update(Battery *battery, Memory *memory) {
+    uint8_t dirty = memory->prg_ram_dirty;
+    if (!dirty)
+        return;
+
+    for (int page = 0; page < MEMORY_PRG_RAM_PAGES; page++) {
+        if (!(dirty & 1 << page))
+            continue;
+        int offset = page * MEMORY_PRG_RAM_PAGE_SIZE;
+        int size = MEMORY_PRG_RAM_PAGE_SIZE;
+        // The trainer starts a page, and what was saved under it stays
+        if (memory->trainer_mapped &&
+            offset == MEMORY_TRAINER_ADDRESS - 0x6000) {
+            offset += MEMORY_TRAINER_SIZE;
+            size -= MEMORY_TRAINER_SIZE;
+        }
+        memcpy(battery->mapping + offset, memory->prg_ram + offset, size);
+    }
+    memory->prg_ram_dirty = 0;
+    atomic_fetch_add(&battery->generation, 1);
+}
+
+void battery_close(Battery *battery, Memory *memory) {
+    battery_update(battery, memory);
+
+    pthread_mutex_lock(&battery->lock);
+    atomic_store(&battery->quit, 1);
+    pthread_cond_signal(&battery->woken);
+    pthread_mutex_unlock(&battery->lock);
+    pthread_join(battery->thread, 0);
+
+    if (msync(battery->mapping, MEMORY_PRG_RAM_SIZE, MS_SYNC))
+        perror("Could not write save file");
+    munmap(battery->mapping, MEMORY_PRG_RAM_SIZE);
+    close(battery->fd);
+}
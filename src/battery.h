@@ -0,0 +1,51 @@
+// Battery-backed PRG RAM, persisted to a save file next to the ROM.
+//
+// The save file is mapped into memory. Once a frame the emulation thread
+// copies the pages of PRG RAM written to since into the mapping, which takes
+// no system calls. A background thread flushes the mapping to disk with
+// msync when it has changed, at most every `BATTERY_SYNC_INTERVAL_MS`. So the
+// emulation thread never waits for the disk, and what was copied survives
+// the emulator crashing as the kernel writes it back regardless.
+
+#ifndef _BATTERY
+#define _BATTERY
+
+#include "memory.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+// Appended to the path of the ROM for the save file
+#define BATTERY_FILE_SUFFIX ".sav"
+#define BATTERY_SYNC_INTERVAL_MS 1000
+
+typedef struct Battery {
+    // The save file, `MEMORY_PRG_RAM_SIZE` bytes of it
+    uint8_t *mapping;
+    int fd;
+
+    // Bumped whenever PRG RAM is copied into the mapping
+    atomic_uint generation;
+    // Generation last flushed to disk, sync thread only
+    unsigned synced_generation;
+
+    pthread_t thread;
+    atomic_int quit;
+    pthread_mutex_t lock;
+    pthread_cond_t woken;
+} Battery;
+
+// Maps the save file at `filepath`, creating it if there is none, and loads
+// it into the PRG RAM of `memory`.
+//
+// Returns 1 on failure.
+int battery_open(Battery *battery, Memory *memory, const char *filepath);
+
+// Copies the PRG RAM written to since the last update into the save file.
+// Emulation thread only.
+void battery_update(Battery *battery, Memory *memory);
+
+// Saves what is left and closes the save file.
+void battery_close(Battery *battery, Memory *memory);
+
+#endif
@@ -0,0 +1,134 @@
+#include "blip_buffer.h"
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+// Fixed point scale of the kernel, a step of 1 adds up to this
+#define KERNEL_UNIT (1 << 15)
+// Time constant of the DC-removing high-pass filter, in samples (as a shift)
+#define HIGH_PASS_SHIFT 9
+// Keep at most this many unread samples when nobody is reading
+#define MAX_UNREAD_SAMPLES (BLIP_BUFFER_SIZE / 2)
+
+#define FRACTION_BITS 32
+
+// Band-limited impulse (the derivative of the band-limited step) for every
+// fractional position, each phase sums to `KERNEL_UNIT`.
+static int32_t kernel[BLIP_PHASE_COUNT][BLIP_KERNEL_WIDTH];
+static int kernel_ready = 0;
+
+// Windowed sinc, cut off a little below the Nyquist frequency of the output.
+static void generate_kernel(void) {
+    const double cutoff = 0.9;
+
+    for (int phase = 0; phase < BLIP_PHASE_COUNT; phase++) {
+        double center =
+            BLIP_KERNEL_WIDTH / 2 - 1 + (double)phase / BLIP_PHASE_COUNT;
+        double taps[BLIP_KERNEL_WIDTH];
+        double sum = 0;
+
+        for (int i = 0; i < BLIP_KERNEL_WIDTH; i++) {
+            double x = (i - center) * cutoff;
+            double sinc = x == 0 ? 1.0 : sin(M_PI * x) / (M_PI * x);
+
+            // Blackman window over the width of the kernel
+            double w = (i - center + BLIP_KERNEL_WIDTH / 2.0) /
+                       BLIP_KERNEL_WIDTH;
+            double window = 0.42 - 0.5 * cos(2 * M_PI * w) +
+                            0.08 * cos(4 * M_PI * w);
+            if (w < 0 || w > 1)
+                window = 0;
+
+            taps[i] = sinc * window;
+            sum += taps[i];
+        }
+
+        // Normalize so that a step always ends up at exactly its size
+        int32_t total = 0;
+        for (int i = 0; i < BLIP_KERNEL_WIDTH; i++) {
+            kernel[phase][i] = (int32_t)lround(taps[i] / sum * KERNEL_UNIT);
+            total += kernel[phase][i];
+        }
+        kernel[phase][BLIP_KERNEL_WIDTH / 2 - 1] += KERNEL_UNIT - total;
+    }
+
+    kernel_ready = 1;
+}
+
+void blip_buffer_set_rates(BlipBuffer *blip, double clock_rate,
+                           double sample_rate) {
+    if (!kernel_ready)
+        generate_kernel();
+
+    blip->factor = (uint64_t)(sample_rate / clock_rate *
+                              ((uint64_t)1 << FRACTION_BITS));
+}
+
+void blip_buffer_add_delta(BlipBuffer *blip, uint32_t clock_time,
+                           int32_t delta) {
+    uint64_t position = blip->offset + clock_time * blip->factor;
+    uint64_t index = position >> FRACTION_BITS;
+    int phase = (position >> (FRACTION_BITS - BLIP_PHASE_BITS)) & (BLIP_PHASE_COUNT - 1);
+
+    // Frames longer than the buffer can hold are cut off
+    if (index >= BLIP_BUFFER_SIZE)
+        return;
+
+    int32_t *out = blip->buffer + index;
+    for (int i = 0; i < BLIP_KERNEL_WIDTH; i++)
+        out[i] += kernel[phase][i] * delta;
+}
+
+// Drops the first `count` samples from the buffer.
+static void remove_samples(BlipBuffer *blip, int count) {
+    int remaining = (blip->offset >> FRACTION_BITS) - count;
+    memmove(blip->buffer, blip->buffer + count,
+            (remaining + BLIP_KERNEL_WIDTH) * sizeof(blip->buffer[0]));
+    memset(blip->buffer + remaining + BLIP_KERNEL_WIDTH, 0,
+           count * sizeof(blip->buffer[0]));
+
+    blip->offset -= (uint64_t)count << FRACTION_BITS;
+    blip->samples_available -= count;
+}
+
+void blip_buffer_end_frame(BlipBuffer *blip, uint32_t clock_duration) {
+    blip->offset += clock_duration * blip->factor;
+    if ((blip->offset >> FRACTION_BITS) > BLIP_BUFFER_SIZE)
+        blip->offset = (uint64_t)BLIP_BUFFER_SIZE << FRACTION_BITS;
+
+    blip->samples_available = blip->offset >> FRACTION_BITS;
+
+    if (blip->samples_available > MAX_UNREAD_SAMPLES) {
+        int dropped = blip->samples_available - MAX_UNREAD_SAMPLES;
+
+        // Keep the amplitude of the dropped samples
+        for (int i = 0; i < dropped; i++)
+            blip->integrator += blip->buffer[i] -
+                                (blip->integrator >> HIGH_PASS_SHIFT);
+        remove_samples(blip, dropped);
+    }
+}
+
+int blip_buffer_read_samples(BlipBuffer *blip, int16_t *out, int max_samples) {
+    int count = blip->samples_available;
+    if (count > max_samples)
+        count = max_samples;
+
+    // Integrating the deltas turns them into the waveform, subtracting a bit
+    // of the running sum every sample removes DC
+    int32_t integrator = blip->integrator;
+    for (int i = 0; i < count; i++) {
+        int32_t sample = integrator / KERNEL_UNIT;
+        if (sample > INT16_MAX)
+            sample = INT16_MAX;
+        if (sample < INT16_MIN)
+            sample = INT16_MIN;
+        out[i] = sample;
+
+        integrator += blip->buffer[i] - (integrator >> HIGH_PASS_SHIFT);
+    }
+    blip->integrator = integrator;
+
+    remove_samples(blip, count);
+    return count;
+}
@@ -0,0 +1,60 @@
+// Band-limited step synthesis ("blip buffer").
+//
+// Instead of generating a sample every clock cycle, sound generators only
+// report the clock times at which their output changes (as deltas). Every
+// change is added into a buffer at the output sample rate as a band-limited
+// step, so the samples come out already resampled and free of aliasing.
+
+#ifndef _BLIP_BUFFER
+#define _BLIP_BUFFER
+
+#include <stdint.h>
+
+// Maximum amount of samples held by the buffer, finished or not
+#define BLIP_BUFFER_SIZE 8192
+// Width of the band-limited step in samples
+#define BLIP_KERNEL_WIDTH 16
+// Fractional sample positions the step is precomputed for
+#define BLIP_PHASE_BITS 5
+#define BLIP_PHASE_COUNT (1 << BLIP_PHASE_BITS)
+
+typedef struct {
+    // Deltas to be integrated into samples, starting at the first unread
+    // sample.
+    int32_t buffer[BLIP_BUFFER_SIZE + BLIP_KERNEL_WIDTH];
+
+    // Output samples per clock cycle, 32.32 fixed point.
+    uint64_t factor;
+    // Position of clock 0 of the current frame in output samples, 32.32 fixed
+    // point.
+    uint64_t offset;
+    // Running sum of the deltas read so far, i.e. the current amplitude.
+    int32_t integrator;
+    // Samples in `buffer` that are finished and can be read.
+    int samples_available;
+} BlipBuffer;
+
+// Sets the rate of the clock the deltas are timed in and the output sample
+// rate. Can be changed between frames to adjust the resampling ratio.
+void blip_buffer_set_rates(BlipBuffer *blip, double clock_rate,
+                           double sample_rate);
+
+// Adds a change of `delta` in amplitude at `clock_time` clock cycles from the
+// start of the current frame.
+void blip_buffer_add_delta(BlipBuffer *blip, uint32_t clock_time,
+                           int32_t delta);
+
+// Ends the current frame after `clock_duration` clock cycles, making the
+// samples before that point available for reading. Deltas of the next frame
+// are timed relative to the end of this one.
+//
+// If the finished samples aren't being read, the oldest ones are dropped so
+// that there's always room for new frames.
+void blip_buffer_end_frame(BlipBuffer *blip, uint32_t clock_duration);
+
+// Reads at most `max_samples` finished samples into `out`.
+//
+// Returns the number of samples read.
+int blip_buffer_read_samples(BlipBuffer *blip, int16_t *out, int max_samples);
+
+#endif
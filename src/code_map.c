@@ -0,0 +1,316 @@
+#include "code_map.h"
+#include "decode_instruction.h"
+#include "memory.h"
+#include "trace.h"
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAGIC "NESCDMAP"
+#define MAGIC_SIZE 8
+// Bytes on a line of the listing
+#define LISTING_BYTES_PER_LINE 8
+
+int code_map_init(CodeMap *map, Memory *memory) {
+    *map = (CodeMap){.size = memory->prg_rom_size,
+                     .rom_hash = memory->rom_hash};
+    map->flags = calloc(map->size ? map->size : 1, 1);
+    return !map->flags;
+}
+
+void code_map_free(CodeMap *map) {
+    free(map->flags);
+    map->flags = 0;
+}
+
+// ----- Analysis -----
+
+static inline uint16_t peek_two_bytes(Memory *memory, uint16_t address) {
+    return memory_peek(memory, address + 1) << 8 | memory_peek(memory, address);
+}
+
+typedef struct {
+    uint16_t *addresses;
+    int count;
+} Pending;
+
+// Queues `address` to be disassembled, if it is PRG ROM not disassembled yet.
+static void queue(CodeMap *map, Memory *memory, Pending *pending,
+                  uint16_t address, uint8_t flags) {
+    int offset = memory_prg_rom_offset(memory, address);
+    if (offset < 0)
+        return;
+
+    code_map_mark(map, offset, flags);
+    if (!(map->flags[offset] & CODE_MAP_OPCODE))
+        pending->addresses[pending->count++] = address;
+}
+
+// Whether an instruction of `bytes` at `address` is all in the PRG ROM, and
+// doesn't run into instructions found before.
+static int fits(CodeMap *map, Memory *memory, uint16_t address, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        int offset = memory_prg_rom_offset(memory, address + i);
+        if (offset < 0 || (i && map->flags[offset] & CODE_MAP_OPCODE))
+            return 0;
+    }
+    return 1;
+}
+
+// Disassembles from `address` until the code leaves the PRG ROM, runs into
+// code found before, or jumps or returns.
+static void follow(CodeMap *map, Memory *memory, Pending *pending,
+                   uint16_t address) {
+    for (;;) {
+        int offset = memory_prg_rom_offset(memory, address);
+        if (offset < 0 ||
+            map->flags[offset] & (CODE_MAP_OPCODE | CODE_MAP_OPERAND))
+            return;
+
+        // Unofficial opcodes aren't emulated, so this can't be code
+        Instruction instruction =
+            decode_instruction(memory_peek(memory, address));
+        if (!instruction.mneumonic_str ||
+            !fits(map, memory, address, instruction.bytes))
+            return;
+
+        code_map_mark(map, offset, CODE_MAP_OPCODE);
+        for (int i = 1; i < instruction.bytes; i++)
+            code_map_mark(map, memory_prg_rom_offset(memory, address + i),
+                          CODE_MAP_OPERAND);
+
+        uint16_t operand = peek_two_bytes(memory, address + 1);
+        switch (instruction.mneumonic) {
+        case JSR:
+            queue(map, memory, pending, operand, CODE_MAP_ENTRY);
+            break;
+        case JMP:
+            // Where indirect jumps go is only known while running
+            if (instruction.addressing_mode == ABSOLUTE)
+                queue(map, memory, pending, operand, 0);
+            return;
+        case RTS:
+        case RTI:
+        case BRK:
+            return;
+        default:
+            if (instruction.addressing_mode == RELATIVE)
+                queue(map, memory, pending,
+                      address + 2 + (int8_t)(operand & 0xff), 0);
+        }
+
+        address += instruction.bytes;
+    }
+}
+
+int code_map_analyze(CodeMap *map, Memory *memory) {
+    // Every instruction queues at most one address, and so do the vectors
+    Pending pending = {0};
+    pending.addresses = malloc((map->size + 3) * sizeof(uint16_t));
+    if (!pending.addresses)
+        return 1;
+
+    static const uint16_t vectors[] = {0xfffa, 0xfffc, 0xfffe};
+    for (int i = 0; i < 3; i++)
+        queue(map, memory, &pending, peek_two_bytes(memory, vectors[i]),
+              CODE_MAP_ENTRY);
+
+    while (pending.count)
+        follow(map, memory, &pending, pending.addresses[--pending.count]);
+
+    free(pending.addresses);
+    return 0;
+}
+
+// ----- Files -----
+
+static void write_u16(FILE *fp, uint16_t value) {
+    uint8_t bytes[2] = {value, value >> 8};
+    fwrite(bytes, sizeof(bytes), 1, fp);
+}
+
+static void write_u32(FILE *fp, uint32_t value) {
+    write_u16(fp, value);
+    write_u16(fp, value >> 16);
+}
+
+static void write_u64(FILE *fp, uint64_t value) {
+    write_u32(fp, value);
+    write_u32(fp, value >> 32);
+}
+
+static int read_u16(FILE *fp, uint16_t *value) {
+    uint8_t bytes[2];
+    if (fread(bytes, sizeof(bytes), 1, fp) != 1)
+        return 1;
+
+    *value = bytes[1] << 8 | bytes[0];
+    return 0;
+}
+
+static int read_u32(FILE *fp, uint32_t *value) {
+    uint16_t low, high;
+    if (read_u16(fp, &low) || read_u16(fp, &high))
+        return 1;
+
+    *value = (uint32_t)high << 16 | low;
+    return 0;
+}
+
+static int read_u64(FILE *fp, uint64_t *value) {
+    uint32_t low, high;
+    if (read_u32(fp, &low) || read_u32(fp, &high))
+        return 1;
+
+    *value = (uint64_t)high << 32 | low;
+    return 0;
+}
+
+// Length of the run of bytes with the same flags at `offset`, up to what fits
+// in a run's length.
+static int run_length(CodeMap *map, int offset) {
+    int length = 1;
+    while (offset + length < map->size && length < 0xffff &&
+           map->flags[offset + length] == map->flags[offset])
+        length++;
+    return length;
+}
+
+int code_map_save(CodeMap *map, const char *filepath) {
+    FILE *fp = fopen(filepath, "wb");
+    if (!fp) {
+        perror("Could not open code map file");
+        return 1;
+    }
+
+    uint32_t run_count = 0;
+    for (int offset = 0; offset < map->size; offset += run_length(map, offset))
+        run_count++;
+
+    fwrite(MAGIC, MAGIC_SIZE, 1, fp);
+    write_u32(fp, CODE_MAP_VERSION);
+    write_u64(fp, map->rom_hash);
+    write_u32(fp, map->size);
+    write_u32(fp, run_count);
+
+    for (int offset = 0; offset < map->size;) {
+        int length = run_length(map, offset);
+        write_u16(fp, length);
+        fwrite(&map->flags[offset], 1, 1, fp);
+        offset += length;
+    }
+
+    if (fclose(fp)) {
+        perror("Could not write code map file");
+        return 1;
+    }
+    map->dirty = 0;
+    return 0;
+}
+
+int code_map_load(CodeMap *map, const char *filepath) {
+    FILE *fp = fopen(filepath, "rb");
+    if (!fp) {
+        if (errno != ENOENT)
+            perror("Could not open code map file");
+        return 1;
+    }
+
+    char magic[MAGIC_SIZE];
+    uint32_t version, size, run_count;
+    uint64_t rom_hash;
+    if (fread(magic, MAGIC_SIZE, 1, fp) != 1 ||
+        memcmp(magic, MAGIC, MAGIC_SIZE) || read_u32(fp, &version) ||
+        version != CODE_MAP_VERSION || read_u64(fp, &rom_hash) ||
+        read_u32(fp, &size) || read_u32(fp, &run_count)) {
+        fprintf(stderr, "ERROR: %s is not a code map\n", filepath);
+        fclose(fp);
+        return 1;
+    }
+    if (rom_hash != map->rom_hash || size != map->size) {
+        fprintf(stderr, "Code map %s is for another ROM, ignoring it\n",
+                filepath);
+        fclose(fp);
+        return 1;
+    }
+
+    // Read into a copy, to keep the map as it was if the file is cut short
+    uint8_t *flags = calloc(map->size ? map->size : 1, 1);
+    uint32_t offset = 0;
+    int failed = !flags;
+    for (uint32_t i = 0; i < run_count && !failed; i++) {
+        uint16_t length;
+        uint8_t value;
+        failed = read_u16(fp, &length) || fread(&value, 1, 1, fp) != 1 ||
+                 length > size - offset;
+        if (!failed)
+            memset(flags + offset, value, length);
+        offset += length;
+    }
+    fclose(fp);
+
+    if (failed || offset != size) {
+        fprintf(stderr, "ERROR: code map %s is corrupted\n", filepath);
+        free(flags);
+        return 1;
+    }
+
+    free(map->flags);
+    map->flags = flags;
+    map->dirty = 0;
+    return 0;
+}
+
+// ----- Listing -----
+
+static void write_label(Memory *memory, uint16_t address, FILE *fp) {
+    static const char *vector_names[] = {"nmi", "reset", "irq"};
+    for (int i = 0; i < 3; i++) {
+        if (peek_two_bytes(memory, 0xfffa + i * 2) == address) {
+            fprintf(fp, "\n%s:\n", vector_names[i]);
+            return;
+        }
+    }
+    fprintf(fp, "\nsub_%04X:\n", address);
+}
+
+void code_map_write_listing(CodeMap *map, Memory *memory, FILE *fp) {
+    // A 16 KB PRG ROM is listed where the vectors are
+    uint16_t base = map->size == 0x4000 ? 0xc000 : 0x8000;
+
+    for (int offset = 0; offset < map->size;) {
+        uint16_t address = base + offset;
+        uint8_t flags = map->flags[offset];
+
+        if (flags & CODE_MAP_ENTRY)
+            write_label(memory, address, fp);
+
+        if (flags & CODE_MAP_OPCODE) {
+            char disassembly[TRACE_DISASSEMBLY_SIZE];
+            int bytes = trace_disassemble(memory, address, disassembly);
+
+            char hex[10] = "";
+            for (int i = 0; i < bytes && offset + i < map->size; i++)
+                snprintf(hex + i * 3, sizeof(hex) - i * 3, "%02X ",
+                         memory->prg_rom[offset + i]);
+            fprintf(fp, "%04X  %-9s %s\n", address, hex, disassembly);
+            offset += bytes;
+            continue;
+        }
+
+        // Bytes that aren't code, a line at most of the same kind
+        uint8_t kind = flags & CODE_MAP_DATA;
+        fprintf(fp, "%04X  .byte ", address);
+        int count = 0;
+        do {
+            fprintf(fp, "%s$%02X", count ? "," : "", memory->prg_rom[offset]);
+            offset++;
+            count++;
+        } while (count < LISTING_BYTES_PER_LINE && offset < map->size &&
+                 !(map->flags[offset] & (CODE_MAP_OPCODE | CODE_MAP_ENTRY)) &&
+                 (map->flags[offset] & CODE_MAP_DATA) == kind);
+        fprintf(fp, kind ? "  ; data\n" : "\n");
+    }
+}
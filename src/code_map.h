@@ -0,0 +1,119 @@
+// Code/data map of the PRG ROM: which bytes are instructions and which are
+// read as data.
+//
+// A map is first built by static analysis, disassembling by recursive descent
+// from the NMI, reset and IRQ vectors and following jumps, branches and
+// subroutine calls. While the ROM runs it is completed by what is actually
+// executed and read, which finds code that is only reached through jump
+// tables. Maps are cached in a file next to the ROM, so the analysis is only
+// done once per ROM.
+//
+// File layout (little-endian):
+//   "NESCDMAP", version (u32), ROM hash (u64), PRG ROM size (u32),
+//   run count (u32),
+//   runs of bytes with the same flags: length (u16), flags (u8)
+
+#ifndef _CODE_MAP
+#define _CODE_MAP
+
+#include "memory.h"
+#include <stdint.h>
+#include <stdio.h>
+
+#define CODE_MAP_VERSION 1
+// Appended to the path of the ROM for the cache file
+#define CODE_MAP_FILE_SUFFIX ".codemap"
+
+// Flags of a PRG ROM byte
+
+// The first byte of an instruction
+#define CODE_MAP_OPCODE 0x01
+// The rest of an instruction
+#define CODE_MAP_OPERAND 0x02
+// Read as data while running
+#define CODE_MAP_DATA 0x04
+// Where a subroutine or interrupt handler begins
+#define CODE_MAP_ENTRY 0x08
+// Seen executing, not only found by the analysis
+#define CODE_MAP_EXECUTED 0x10
+
+typedef struct CodeMap {
+    // Flags of every byte of the PRG ROM
+    uint8_t *flags;
+    int size;
+    uint64_t rom_hash;
+    // Whether the flags changed since the map was loaded or saved
+    int dirty;
+
+    // The instruction being executed, whose own bytes aren't data
+    uint16_t instruction_address;
+    uint8_t instruction_bytes;
+} CodeMap;
+
+// Starts an empty map for the ROM loaded into `memory`.
+//
+// Returns 1 on failure.
+int code_map_init(CodeMap *map, Memory *memory);
+void code_map_free(CodeMap *map);
+
+// Adds what is found by disassembling from the interrupt vectors.
+//
+// Returns 1 on failure.
+int code_map_analyze(CodeMap *map, Memory *memory);
+
+// Returns 1 on failure. Loading also fails quietly if there is no file, and
+// with a message if it is for another ROM.
+int code_map_load(CodeMap *map, const char *filepath);
+int code_map_save(CodeMap *map, const char *filepath);
+
+// Writes a disassembly of the whole PRG ROM, with the code as instructions
+// and the rest as bytes.
+void code_map_write_listing(CodeMap *map, Memory *memory, FILE *fp);
+
+// Flags of the byte at `address`, 0 if it isn't in the PRG ROM.
+static inline uint8_t code_map_flags(CodeMap *map, Memory *memory,
+                                     uint16_t address) {
+    int offset = memory_prg_rom_offset(memory, address);
+    return offset >= 0 ? map->flags[offset] : 0;
+}
+
+static inline void code_map_mark(CodeMap *map, int offset, uint8_t flags) {
+    if ((map->flags[offset] & flags) == flags)
+        return;
+    map->flags[offset] |= flags;
+    map->dirty = 1;
+}
+
+// Called before fetching the opcode at `address`.
+static inline void code_map_begin_instruction(CodeMap *map, uint16_t address) {
+    map->instruction_address = address;
+    map->instruction_bytes = 1;
+}
+
+// Called once the instruction at `address` is decoded.
+static inline void code_map_record_instruction(CodeMap *map, Memory *memory,
+                                               uint16_t address,
+                                               uint8_t bytes) {
+    map->instruction_bytes = bytes;
+    for (int i = 0; i < bytes; i++) {
+        int offset = memory_prg_rom_offset(memory, address + i);
+        if (offset >= 0)
+            code_map_mark(map, offset,
+                          (i ? CODE_MAP_OPERAND : CODE_MAP_OPCODE) |
+                              CODE_MAP_EXECUTED);
+    }
+}
+
+// Called on reads by the CPU, marking PRG ROM read by instructions as data.
+static inline void code_map_record_read(CodeMap *map, Memory *memory,
+                                        uint16_t address) {
+    if ((uint16_t)(address - map->instruction_address) <
+        map->instruction_bytes)
+        return;
+
+    int offset = memory_prg_rom_offset(memory, address);
+    if (offset >= 0)
+        code_map_mark(map, offset, CODE_MAP_DATA);
+}
+
+#endif
@@ -0,0 +1,20 @@
+#include "controller.h"
+#include <stdint.h>
+
+void controller_write_strobe(Controller *controller, uint8_t value) {
+    // The shift register is reloaded for as long as the strobe is high, so
+    // it holds the buttons as they were when it went low
+    if (controller->strobe || (value & 1))
+        controller->shift_register = controller->buttons;
+    controller->strobe = value & 1;
+}
+
+uint8_t controller_read(Controller *controller) {
+    if (controller->strobe)
+        return controller->buttons & 1;
+
+    uint8_t bit = controller->shift_register & 1;
+    // Official controllers return 1 after all buttons have been read
+    controller->shift_register = controller->shift_register >> 1 | 0x80;
+    return bit;
+}
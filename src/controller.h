@@ -0,0 +1,40 @@
+// Standard controllers read through 0x4016 and 0x4017.
+//
+// Writing 1 and then 0 to bit 0 of 0x4016 (the strobe) latches the buttons of
+// both controllers into their shift registers, after which every read shifts
+// out one button, in the order of `ControllerButton`.
+
+#ifndef _CONTROLLER
+#define _CONTROLLER
+
+#include <stdint.h>
+
+#define CONTROLLER_PORT_COUNT 2
+
+typedef enum {
+    CONTROLLER_BUTTON_A = 0x01,
+    CONTROLLER_BUTTON_B = 0x02,
+    CONTROLLER_BUTTON_SELECT = 0x04,
+    CONTROLLER_BUTTON_START = 0x08,
+    CONTROLLER_BUTTON_UP = 0x10,
+    CONTROLLER_BUTTON_DOWN = 0x20,
+    CONTROLLER_BUTTON_LEFT = 0x40,
+    CONTROLLER_BUTTON_RIGHT = 0x80,
+} ControllerButton;
+
+typedef struct {
+    // Buttons currently held down, see `ControllerButton`
+    uint8_t buttons;
+    uint8_t shift_register;
+    // While set the shift register keeps getting reloaded
+    uint8_t strobe;
+} Controller;
+
+// Handles a write to 0x4016.
+void controller_write_strobe(Controller *controller, uint8_t value);
+
+// Handles a read of 0x4016 (port 1) or 0x4017 (port 2), returns the next
+// button in bit 0.
+uint8_t controller_read(Controller *controller);
+
+#endif
@@ -1,12 +1,10 @@
 #include "cpu.h"
+#include "code_map.h"
 #include "instructions.h"
 #include <stdint.h>
 #include <stdio.h>
 
-#define EMULATOR_BREAKPOINT(address)                                           \
-    if (ctx->program_counter == address)                                       \
-        asm("int $3");
-
+#ifdef DEBUG
 static void print_cpu_context(CPUContext *ctx) {
     char status[9] = "________\0";
     if (ctx->status_register.negative)
@@ -27,29 +25,76 @@ static void print_cpu_context(CPUContext *ctx) {
     printf("SR: %s  SP: 0x%x  PC: 0x%x  X: 0x%x  Y: 0x%x  A: 0x%x\n", status,
            ctx->stack_pointer, ctx->program_counter, ctx->x, ctx->y, ctx->a);
 }
+#endif
+
+static inline uint16_t reset_vector(Memory *memory) {
+    return memory_read(memory, 0xfffd) << 8 | memory_read(memory, 0xfffc);
+}
+
+void cpu_power_on(CPUContext *ctx, Memory *memory) {
+    *ctx = (CPUContext){.stack_pointer = 0xfd,
+                        .status_register.value = 0x24,
+                        .profiler = ctx->profiler};
+    // The reset sequence, which pushes nothing but still decrements SP from 0
+    memory->cpu_cycle += CPU_INTERRUPT_CYCLES;
+    ctx->program_counter = reset_vector(memory);
+}
+
+void cpu_reset(CPUContext *ctx, Memory *memory) {
+    ctx->stack_pointer -= 3;
+    ctx->status_register.irq_disable = 1;
+    memory->cpu_cycle += CPU_INTERRUPT_CYCLES;
+    ctx->program_counter = reset_vector(memory);
+}
+
+void cpu_enter_nmi(CPUContext *ctx, Memory *memory) {
+    memory->cpu_cycle += CPU_INTERRUPT_CYCLES;
+    non_maskable_interrupt(ctx, memory);
+}
+
+void cpu_enter_irq(CPUContext *ctx, Memory *memory) {
+    memory->cpu_cycle += CPU_INTERRUPT_CYCLES;
+    interrupt_request(ctx, memory);
+}
 
 int cpu_tick(CPUContext *ctx, Memory *memory, int nmi_needed) {
-    // EMULATOR_BREAKPOINT(0x805e);
+    // Interrupts are serviced between instructions
+    if (nmi_needed)
+        cpu_enter_nmi(ctx, memory);
 
-    uint8_t opcode = memory_read(memory, ctx->program_counter);
+    CodeMap *code_map = memory->code_map;
+    if (code_map)
+        code_map_begin_instruction(code_map, ctx->program_counter);
 
-    // We want to exit if it's the BRK instruction / opcode 0
-    if (!opcode) {
-        printf("BRK instruction, exiting...\n");
-        return 1;
-    }
+    uint8_t opcode = memory_read(memory, ctx->program_counter);
     Instruction instruction = decode_instruction(opcode);
+    if (!instruction.mneumonic_str)
+        return CPU_UNSUPPORTED_INSTRUCTION;
     uint16_t instruction_address = ctx->program_counter;
+    if (code_map)
+        code_map_record_instruction(code_map, memory, instruction_address,
+                                    instruction.bytes);
 
     ctx->program_counter += instruction.bytes;
 
+    // Advanced before executing so that memory-mapped I/O done by the
+    // instruction is timestamped at its end, which is where the 6502 does
+    // its writes.
+    memory->cpu_cycle += instruction.cycles;
+
+#ifdef DEBUG
     printf("\n0x%x %s ", opcode, instruction.mneumonic_str);
-    instruction_execute(instruction, instruction_address, ctx, memory);
+#endif
+    int extra_cycles =
+        instruction_execute(instruction, instruction_address, ctx, memory);
 
-    print_cpu_context(ctx);
+    if (ctx->profiler)
+        profiler_count(ctx->profiler, instruction_address,
+                       instruction.cycles + extra_cycles);
 
-    if (nmi_needed)
-        non_maskable_interrupt(ctx, memory);
+#ifdef DEBUG
+    print_cpu_context(ctx);
+#endif
 
-    return 0;
+    return ctx->program_counter == instruction_address ? CPU_LOOPING : 0;
 }
@@ -3,9 +3,18 @@
 
 #include "decode_instruction.h"
 #include "memory.h"
+#include "profiler.h"
 #include <stdint.h>
 #include <stdio.h>
 
+// Cycles taken by the CPU to jump into an interrupt handler
+#define CPU_INTERRUPT_CYCLES 7
+
+// Returned by `cpu_tick` when the instruction jumped or branched to itself,
+// or when its opcode isn't one the CPU emulates
+#define CPU_LOOPING 1
+#define CPU_UNSUPPORTED_INSTRUCTION 2
+
 typedef union {
     struct {
         // Explanations from:
@@ -45,11 +54,31 @@ typedef struct {
     uint8_t stack_pointer;
     uint16_t program_counter;
     CPUStatusRegister status_register;
+
+    // Set to profile the program, see profiler.h
+    Profiler *profiler;
 } CPUContext;
 
-// Performs one CPU cycle.
+// Sets the registers as they are at power-on and runs the reset sequence,
+// jumping to the reset vector. Call with the ROM loaded.
+void cpu_power_on(CPUContext *ctx, Memory *memory);
+// Runs the reset sequence, as when the reset button is pressed.
+void cpu_reset(CPUContext *ctx, Memory *memory);
+
+// Executes one instruction, advancing `Memory.cpu_cycle` by the cycles it
+// takes.
+//
+// If `nmi_needed` is set, a Non-Maskable Interrupt is generated on the CPU
+// before the instruction is fetched.
 //
-// If `nmi_needed` is set, a Non-Maskable Interrupt is generated on the CPU.
+// Returns `CPU_LOOPING` if the instruction jumped or branched to itself, i.e.
+// the CPU spins there until an interrupt. Returns
+// `CPU_UNSUPPORTED_INSTRUCTION` without executing anything if the opcode is
+// an unofficial one, leaving the program counter on it.
 int cpu_tick(CPUContext *ctx, Memory *memory, int nmi_needed);
 
+// Jumps into the NMI or IRQ handler, without executing an instruction.
+void cpu_enter_nmi(CPUContext *ctx, Memory *memory);
+void cpu_enter_irq(CPUContext *ctx, Memory *memory);
+
 #endif
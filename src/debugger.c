@@ -0,0 +1,214 @@
+#include "debugger.h"
+#include "memory.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Hooks the debugger into the memory bus (and through it the CPU) only while
+// it has something to check.
+static void update_armed(Debugger *debugger) {
+    int armed = debugger->breakpoint_count || debugger->watchpoint_count ||
+                debugger->remote;
+    memory_set_debugger(debugger->memory, armed ? debugger : 0);
+    if (!armed)
+        debugger->resuming = 0;
+}
+
+void debugger_init(Debugger *debugger, Memory *memory) {
+    memset(debugger, 0, sizeof(Debugger));
+    debugger->memory = memory;
+    update_armed(debugger);
+}
+
+int debugger_set_breakpoint(Debugger *debugger, uint16_t address) {
+    if (debugger_has_breakpoint(debugger, address))
+        return 1;
+
+    debugger->breakpoints[address >> 3] |= 1 << (address & 7);
+    debugger->breakpoint_count++;
+    update_armed(debugger);
+    return 0;
+}
+
+int debugger_clear_breakpoint(Debugger *debugger, uint16_t address) {
+    if (!debugger_has_breakpoint(debugger, address))
+        return 1;
+
+    debugger->breakpoints[address >> 3] &= ~(1 << (address & 7));
+    debugger->breakpoint_count--;
+    update_armed(debugger);
+    return 0;
+}
+
+static void update_watched_pages(Debugger *debugger) {
+    memset(debugger->watched_pages, 0, sizeof(debugger->watched_pages));
+    for (int i = 0; i < debugger->watchpoint_count; i++) {
+        DebuggerWatchpoint *watchpoint = &debugger->watchpoints[i];
+        for (int page = watchpoint->start >> 8; page <= watchpoint->end >> 8;
+             page++)
+            debugger->watched_pages[page] |= watchpoint->access;
+    }
+}
+
+int debugger_add_watchpoint(Debugger *debugger, uint16_t start, uint16_t end,
+                            uint8_t access) {
+    if (debugger->watchpoint_count == DEBUGGER_MAX_WATCHPOINTS)
+        return 1;
+
+    debugger->watchpoints[debugger->watchpoint_count++] =
+        (DebuggerWatchpoint){.start = start, .end = end, .access = access};
+    update_watched_pages(debugger);
+    update_armed(debugger);
+    return 0;
+}
+
+int debugger_remove_watchpoint(Debugger *debugger, uint16_t start,
+                               uint16_t end) {
+    for (int i = 0; i < debugger->watchpoint_count; i++) {
+        DebuggerWatchpoint *watchpoint = &debugger->watchpoints[i];
+        if (watchpoint->start != start || watchpoint->end != end)
+            continue;
+
+        *watchpoint = debugger->watchpoints[--debugger->watchpoint_count];
+        update_watched_pages(debugger);
+        update_armed(debugger);
+        return 0;
+    }
+    return 1;
+}
+
+int debugger_parse_watchpoint(const char *text, DebuggerWatchpoint *out) {
+    char *end;
+    unsigned long start = strtoul(text, &end, 16);
+    if (end == text || start > 0xffff)
+        return 1;
+
+    out->start = start;
+    out->end = start;
+    out->access = DEBUGGER_READ | DEBUGGER_WRITE;
+
+    if (*end == '-') {
+        text = end + 1;
+        unsigned long last = strtoul(text, &end, 16);
+        if (end == text || last > 0xffff || last < start)
+            return 1;
+        out->end = last;
+    }
+
+    if (!*end)
+        return 0;
+    if (*end != ':')
+        return 1;
+
+    if (!strcmp(end + 1, "r"))
+        out->access = DEBUGGER_READ;
+    else if (!strcmp(end + 1, "w"))
+        out->access = DEBUGGER_WRITE;
+    else if (strcmp(end + 1, "rw"))
+        return 1;
+    return 0;
+}
+
+int debugger_parse_command(const char *line, DebuggerCommand *out) {
+    char command[4];
+    char argument[32];
+    if (sscanf(line, "%3s %31s", command, argument) != 2)
+        return 1;
+
+    if (!strcmp(command, "b") || !strcmp(command, "db")) {
+        char *end;
+        unsigned long address = strtoul(argument, &end, 16);
+        if (*end || address > 0xffff)
+            return 1;
+        out->type = *command == 'b' ? DEBUGGER_COMMAND_BREAK
+                                    : DEBUGGER_COMMAND_DELETE_BREAK;
+        out->address = address;
+        return 0;
+    }
+
+    if (!strcmp(command, "w"))
+        out->type = DEBUGGER_COMMAND_WATCH;
+    else if (!strcmp(command, "dw"))
+        out->type = DEBUGGER_COMMAND_DELETE_WATCH;
+    else
+        return 1;
+    return debugger_parse_watchpoint(argument, &out->watchpoint);
+}
+
+int debugger_apply_command(Debugger *debugger, const DebuggerCommand *command) {
+    const DebuggerWatchpoint *watchpoint = &command->watchpoint;
+    switch (command->type) {
+    case DEBUGGER_COMMAND_BREAK:
+        debugger_set_breakpoint(debugger, command->address);
+        return 0;
+    case DEBUGGER_COMMAND_DELETE_BREAK:
+        debugger_clear_breakpoint(debugger, command->address);
+        return 0;
+    case DEBUGGER_COMMAND_WATCH:
+        return debugger_add_watchpoint(debugger, watchpoint->start,
+                                       watchpoint->end, watchpoint->access);
+    case DEBUGGER_COMMAND_DELETE_WATCH:
+        debugger_remove_watchpoint(debugger, watchpoint->start,
+                                   watchpoint->end);
+        return 0;
+    }
+    return 0;
+}
+
+void debugger_hit_watchpoint(Debugger *debugger, uint16_t address,
+                             uint8_t value, uint8_t access) {
+    if (debugger->stop.reason != DEBUGGER_STOP_NONE)
+        return;
+
+    for (int i = 0; i < debugger->watchpoint_count; i++) {
+        DebuggerWatchpoint *watchpoint = &debugger->watchpoints[i];
+        if (address < watchpoint->start || address > watchpoint->end ||
+            !(watchpoint->access & access))
+            continue;
+
+        debugger->stop = (DebuggerStop){.reason = DEBUGGER_STOP_WATCHPOINT,
+                                        .address = address,
+                                        .value = value,
+                                        .access = access};
+        return;
+    }
+}
+
+void debugger_set_remote(Debugger *debugger, int remote) {
+    debugger->remote = remote;
+    if (!remote)
+        atomic_store(&debugger->interrupt_requested, 0);
+    update_armed(debugger);
+}
+
+void debugger_interrupt(Debugger *debugger) {
+    atomic_store(&debugger->interrupt_requested, 1);
+}
+
+void debugger_resume(Debugger *debugger, uint16_t program_counter) {
+    debugger->stop.reason = DEBUGGER_STOP_NONE;
+    debugger->resuming = 1;
+    debugger->resume_address = program_counter;
+}
+
+void debugger_describe_stop(Debugger *debugger, char *out, int size) {
+    DebuggerStop *stop = &debugger->stop;
+    switch (stop->reason) {
+    case DEBUGGER_STOP_NONE:
+        snprintf(out, size, "Not stopped");
+        return;
+    case DEBUGGER_STOP_BREAKPOINT:
+        snprintf(out, size, "Breakpoint at $%04X", stop->address);
+        return;
+    case DEBUGGER_STOP_INTERRUPT:
+        snprintf(out, size, "Interrupted at $%04X", stop->address);
+        return;
+    case DEBUGGER_STOP_WATCHPOINT:
+        snprintf(out, size, "Watchpoint: %s $%02X %s $%04X",
+                 stop->access == DEBUGGER_READ ? "read" : "wrote",
+                 stop->value, stop->access == DEBUGGER_READ ? "from" : "to",
+                 stop->address);
+        return;
+    }
+}
@@ -0,0 +1,177 @@
+// Debugger: execute breakpoints and read/write watchpoints, set at runtime.
+//
+// Breakpoints are a bit per address, looked up before every instruction.
+// Watchpoints are address ranges, and every page of the address space has
+// flags for the kinds of access some watchpoint in it wants, so that only
+// accesses to watched pages look at the ranges.
+//
+// The debugger is only hooked into the emulator (`Memory.debugger`) while
+// something is armed. Otherwise the memory bus takes accesses without the
+// checks, and the CPU skips it with a check of a null pointer per instruction.
+
+#ifndef _DEBUGGER
+#define _DEBUGGER
+
+#include "memory.h"
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define DEBUGGER_MAX_WATCHPOINTS 16
+
+// Kinds of memory access, combinable
+#define DEBUGGER_READ 1
+#define DEBUGGER_WRITE 2
+
+typedef enum {
+    DEBUGGER_STOP_NONE,
+    DEBUGGER_STOP_BREAKPOINT,
+    DEBUGGER_STOP_WATCHPOINT,
+    // Requested with `debugger_interrupt`
+    DEBUGGER_STOP_INTERRUPT,
+} DebuggerStopReason;
+
+typedef struct {
+    uint16_t start;
+    // Inclusive
+    uint16_t end;
+    uint8_t access;
+} DebuggerWatchpoint;
+
+typedef enum {
+    DEBUGGER_COMMAND_BREAK,
+    DEBUGGER_COMMAND_DELETE_BREAK,
+    DEBUGGER_COMMAND_WATCH,
+    DEBUGGER_COMMAND_DELETE_WATCH,
+} DebuggerCommandType;
+
+// A breakpoint or watchpoint command typed in while running
+typedef struct {
+    DebuggerCommandType type;
+    // Of breakpoint commands
+    uint16_t address;
+    // Of watchpoint commands
+    DebuggerWatchpoint watchpoint;
+} DebuggerCommand;
+
+typedef struct {
+    DebuggerStopReason reason;
+    // Instruction address for breakpoints and interrupts, accessed address for
+    // watchpoints
+    uint16_t address;
+    // Value read or written
+    uint8_t value;
+    uint8_t access;
+} DebuggerStop;
+
+typedef struct Debugger {
+    // Memory the debugger hooks into while armed
+    Memory *memory;
+
+    uint8_t breakpoints[0x10000 / 8];
+    int breakpoint_count;
+
+    DebuggerWatchpoint watchpoints[DEBUGGER_MAX_WATCHPOINTS];
+    int watchpoint_count;
+    // Access flags of all watchpoints overlapping each page
+    uint8_t watched_pages[0x100];
+
+    // Set while a remote debugger is attached, which keeps the debugger armed
+    // so that it can be interrupted
+    int remote;
+    // Set from any thread to stop before the next instruction
+    atomic_int interrupt_requested;
+
+    // Why emulation last stopped, the first hit wins until resumed
+    DebuggerStop stop;
+    // Lets the instruction at `resume_address` execute after resuming, even
+    // if there is a breakpoint on it
+    int resuming;
+    uint16_t resume_address;
+} Debugger;
+
+void debugger_init(Debugger *debugger, Memory *memory);
+
+// Returns 1 if there already is a breakpoint at `address`.
+int debugger_set_breakpoint(Debugger *debugger, uint16_t address);
+// Returns 1 if there is no breakpoint at `address`.
+int debugger_clear_breakpoint(Debugger *debugger, uint16_t address);
+
+// Watches `start`-`end` (inclusive) for the kinds of `access`.
+//
+// Returns 1 if there are too many watchpoints.
+int debugger_add_watchpoint(Debugger *debugger, uint16_t start, uint16_t end,
+                            uint8_t access);
+// Returns 1 if there is no watchpoint on exactly `start`-`end`.
+int debugger_remove_watchpoint(Debugger *debugger, uint16_t start,
+                               uint16_t end);
+
+// Parses a watchpoint like "0200-02ff:w" (hexadecimal, the end and the access
+// being optional, access defaulting to "rw").
+//
+// Returns 1 on failure.
+int debugger_parse_watchpoint(const char *text, DebuggerWatchpoint *out);
+
+// Parses "b ADDRESS" or "db ADDRESS" to set or delete a breakpoint, or
+// "w WATCHPOINT" or "dw WATCHPOINT" to add or remove a watchpoint (see
+// `debugger_parse_watchpoint`), addresses being hexadecimal.
+//
+// Returns 1 on failure.
+int debugger_parse_command(const char *line, DebuggerCommand *out);
+// Returns 1 if there are too many watchpoints to add another.
+int debugger_apply_command(Debugger *debugger, const DebuggerCommand *command);
+
+// Keeps the debugger armed (or not) for a remote debugger.
+void debugger_set_remote(Debugger *debugger, int remote);
+
+// Stops emulation before the next instruction, from any thread. Only takes
+// effect while the debugger is armed.
+void debugger_interrupt(Debugger *debugger);
+
+// Clears the stop so that emulation can continue from `program_counter`
+// without stopping at a breakpoint there right away.
+void debugger_resume(Debugger *debugger, uint16_t program_counter);
+
+// Writes a description of the stop, like "Breakpoint at $C123".
+void debugger_describe_stop(Debugger *debugger, char *out, int size);
+
+static inline int debugger_has_breakpoint(Debugger *debugger,
+                                          uint16_t address) {
+    return debugger->breakpoints[address >> 3] & (1 << (address & 7));
+}
+
+// Called before executing the instruction at `address`.
+//
+// Returns 1 if emulation should stop there.
+static inline int debugger_check_execute(Debugger *debugger,
+                                         uint16_t address) {
+    if (debugger->resuming) {
+        debugger->resuming = 0;
+        if (address == debugger->resume_address)
+            return 0;
+    }
+    if (atomic_load_explicit(&debugger->interrupt_requested,
+                             memory_order_relaxed) &&
+        atomic_exchange(&debugger->interrupt_requested, 0)) {
+        debugger->stop = (DebuggerStop){.reason = DEBUGGER_STOP_INTERRUPT,
+                                        .address = address};
+        return 1;
+    }
+    if (!debugger_has_breakpoint(debugger, address))
+        return 0;
+
+    debugger->stop = (DebuggerStop){.reason = DEBUGGER_STOP_BREAKPOINT,
+                                    .address = address};
+    return 1;
+}
+
+void debugger_hit_watchpoint(Debugger *debugger, uint16_t address,
+                             uint8_t value, uint8_t access);
+
+// Called by the memory bus on every access while armed.
+static inline void debugger_check_access(Debugger *debugger, uint16_t address,
+                                         uint8_t value, uint8_t access) {
+    if (debugger->watched_pages[address >> 8] & access)
+        debugger_hit_watchpoint(debugger, address, value, access);
+}
+
+#endif
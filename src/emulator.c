@@ -0,0 +1,260 @@
+#include "emulator.h"
+#include "apu.h"
+#include "battery.h"
+#include "code_map.h"
+#include "cpu.h"
+#include "debugger.h"
+#include "host_stats.h"
+#include "input_queue.h"
+#include "memory.h"
+#include "ppu.h"
+#include <stdint.h>
+
+static inline uint64_t current_dot(Emulator *emulator) {
+    return emulator->memory.cpu_cycle * PPU_DOTS_PER_CPU_CYCLE;
+}
+
+// Whether an interrupt could still get the CPU out of a loop.
+static inline int interrupt_possible(Emulator *emulator) {
+    PPUContext *ppu_ctx = &emulator->memory.ppu_ctx;
+    if (ppu_ctx->ppuctrl.vblank_nmi_enable || ppu_ctx->nmi_pending)
+        return 1;
+    return !emulator->cpu_ctx.status_register.irq_disable &&
+           apu_irq_possible(&emulator->memory.apu);
+}
+
+// Checks the limits of the run after an instruction, `tick` being what
+// `cpu_tick` returned for it.
+static inline int check_limits(Emulator *emulator, int tick) {
+    EmulatorLimits *limits = &emulator->limits;
+    if (tick == CPU_UNSUPPORTED_INSTRUCTION) {
+        emulator->exit_reason = EMULATOR_EXIT_UNSUPPORTED_INSTRUCTION;
+        return EMULATOR_EXITED;
+    }
+    if (emulator->memory.bus_fault) {
+        emulator->exit_reason = EMULATOR_EXIT_BUS_FAULT;
+        return EMULATOR_EXITED;
+    }
+    if (limits->max_cycles &&
+        emulator->memory.cpu_cycle >= limits->max_cycles) {
+        emulator->exit_reason = EMULATOR_EXIT_CYCLES;
+        return EMULATOR_EXITED;
+    }
+    if (tick == CPU_LOOPING && limits->exit_on_idle_loop &&
+        !interrupt_possible(emulator)) {
+        emulator->exit_reason = EMULATOR_EXIT_IDLE_LOOP;
+        return EMULATOR_EXITED;
+    }
+    return 0;
+}
+
+// Relays a pending vblank NMI from the PPU, or else an IRQ from the APU, to
+// the CPU. The APU is only caught up for the IRQ while one could be taken.
+static inline void take_interrupts(Emulator *emulator) {
+    CPUContext *ctx = &emulator->cpu_ctx;
+    Memory *memory = &emulator->memory;
+
+    if (memory->ppu_ctx.nmi_pending) {
+        memory->ppu_ctx.nmi_pending = 0;
+        cpu_enter_nmi(ctx, memory);
+        return;
+    }
+
+    if (ctx->status_register.irq_disable || !apu_irq_possible(&memory->apu))
+        return;
+    apu_run_until(&memory->apu, memory->cpu_cycle);
+    if (apu_irq_pending(&memory->apu))
+        cpu_enter_irq(ctx, memory);
+}
+
+// Like `execute_instruction`, but stops at breakpoints (including one on
+// an interrupt handler) and after instructions that hit a watchpoint.
+static int execute_debugged_instruction(Emulator *emulator,
+                                        int check_breakpoints) {
+    Debugger *debugger = emulator->memory.debugger;
+
+    take_interrupts(emulator);
+
+    if (check_breakpoints &&
+        debugger_check_execute(debugger, emulator->cpu_ctx.program_counter))
+        return EMULATOR_STOPPED;
+
+    int tick = cpu_tick(&emulator->cpu_ctx, &emulator->memory, 0);
+    if (debugger->stop.reason != DEBUGGER_STOP_NONE)
+        return EMULATOR_STOPPED;
+    return check_limits(emulator, tick);
+}
+
+// Relays pending interrupts to the CPU and executes one instruction.
+static inline int execute_instruction(Emulator *emulator,
+                                      int check_breakpoints) {
+    // Only hooked in while something is armed
+    if (emulator->memory.debugger)
+        return execute_debugged_instruction(emulator, check_breakpoints);
+
+    take_interrupts(emulator);
+    int tick = cpu_tick(&emulator->cpu_ctx, &emulator->memory, 0);
+    return check_limits(emulator, tick);
+}
+
+void emulator_init(Emulator *emulator) {
+    memory_init(&emulator->memory);
+    input_queue_init(&emulator->input);
+}
+
+void emulator_power_on(Emulator *emulator) {
+    cpu_power_on(&emulator->cpu_ctx, &emulator->memory);
+    emulator->exit_reason = EMULATOR_EXIT_NONE;
+}
+
+void emulator_reset(Emulator *emulator) {
+    Memory *memory = &emulator->memory;
+    cpu_reset(&emulator->cpu_ctx, memory);
+
+    // Reset clears PPUCTRL and PPUMASK and silences the APU
+    ppu_write_ppuctrl(0, &memory->ppu_ctx);
+    ppu_write_ppumask(0, &memory->ppu_ctx);
+    apu_write_register(&memory->apu, 0x4015, 0, memory->cpu_cycle);
+    memory->ppu_ctx.nmi_pending = 0;
+}
+
+// Exits once the frame limit is reached, after a frame has ended.
+static inline int check_frame_limit(Emulator *emulator) {
+    uint64_t max_frames = emulator->limits.max_frames;
+    if (!max_frames || emulator->memory.ppu_ctx.frame_count < max_frames)
+        return 0;
+    emulator->exit_reason = EMULATOR_EXIT_FRAMES;
+    return EMULATOR_EXITED;
+}
+
+// Turns the audio of a finished frame into samples and applies the input due
+// for the next one.
+static inline void end_frame(Emulator *emulator) {
+    apu_end_frame(&emulator->memory.apu, emulator->memory.cpu_cycle);
+    if (emulator->memory.battery)
+        battery_update(emulator->memory.battery, &emulator->memory);
+    input_queue_latch(&emulator->input, emulator->memory.cpu_cycle,
+                      emulator->memory.controllers);
+#ifdef HOST_STATS
+    host_stats_end_frame(&host_stats);
+#endif
+}
+
+static int run_frame(Emulator *emulator, uint32_t *framebuffer) {
+    PPUContext *ppu_ctx = &emulator->memory.ppu_ctx;
+    ppu_ctx->framebuffer = framebuffer;
+
+    uint64_t frame = ppu_ctx->frame_count;
+
+    while (ppu_ctx->frame_count == frame) {
+        uint64_t frame_end_dot =
+            ppu_ctx->dots_elapsed + DOTS_PER_FRAME -
+            (ppu_ctx->current_scanline * DOTS_PER_SCANLINE +
+             ppu_ctx->current_dot);
+
+        uint64_t target_dot = ppu_next_event_dot(ppu_ctx);
+        if (frame_end_dot < target_dot)
+            target_dot = frame_end_dot;
+
+        // The PPU might get caught up in between by register accesses
+        while (current_dot(emulator) < target_dot) {
+            int result = execute_instruction(emulator, 1);
+            if (result == EMULATOR_STOPPED && ppu_ctx->frame_count != frame)
+                end_frame(emulator);
+            if (result)
+                return result;
+        }
+
+        ppu_run_until(ppu_ctx, current_dot(emulator));
+    }
+
+    end_frame(emulator);
+    return check_frame_limit(emulator);
+}
+
+// Time not spent in any other subsystem counts as the CPU's
+int emulator_run_frame(Emulator *emulator, uint32_t *framebuffer) {
+    HOST_STATS_ENTER(HOST_STATS_CPU);
+    int result = run_frame(emulator, framebuffer);
+    HOST_STATS_LEAVE();
+    return result;
+}
+
+static int step(Emulator *emulator, uint32_t *framebuffer) {
+    PPUContext *ppu_ctx = &emulator->memory.ppu_ctx;
+    ppu_ctx->framebuffer = framebuffer;
+
+    uint64_t frame = ppu_ctx->frame_count;
+
+    int result = execute_instruction(emulator, 0);
+    if (result == EMULATOR_EXITED)
+        return result;
+
+    ppu_run_until(ppu_ctx, current_dot(emulator));
+    if (ppu_ctx->frame_count != frame) {
+        end_frame(emulator);
+        if (!result)
+            result = check_frame_limit(emulator);
+    }
+    return result;
+}
+
+int emulator_step(Emulator *emulator, uint32_t *framebuffer) {
+    HOST_STATS_ENTER(HOST_STATS_CPU);
+    int result = step(emulator, framebuffer);
+    HOST_STATS_LEAVE();
+    return result;
+}
+
+void emulator_save_state(Emulator *emulator, EmulatorState *state) {
+    state->cpu_ctx = emulator->cpu_ctx;
+    state->memory = emulator->memory;
+}
+
+void emulator_load_state(Emulator *emulator, const EmulatorState *state) {
+    Memory *memory = &emulator->memory;
+
+    // The loaded ROM and pointers into this emulator stay
+    uint8_t *prg_rom = memory->prg_rom;
+    int prg_rom_size = memory->prg_rom_size;
+    uint8_t *chr_rom = memory->chr_rom;
+    int chr_rom_size = memory->chr_rom_size;
+    uint64_t rom_hash = memory->rom_hash;
+    uint32_t *framebuffer = memory->ppu_ctx.framebuffer;
+    PPUOutput output = memory->ppu_ctx.output;
+    Profiler *profiler = emulator->cpu_ctx.profiler;
+    Debugger *debugger = memory->debugger;
+    CodeMap *code_map = memory->code_map;
+    Battery *battery = memory->battery;
+
+    emulator->cpu_ctx = state->cpu_ctx;
+    *memory = state->memory;
+
+    memory->prg_rom = prg_rom;
+    memory->prg_rom_size = prg_rom_size;
+    memory->chr_rom = chr_rom;
+    memory->chr_rom_size = chr_rom_size;
+    memory->rom_hash = rom_hash;
+    memory->ppu_ctx.framebuffer = framebuffer;
+    memory->ppu_ctx.output = output;
+    memory->apu.dmc_read_context = memory;
+    emulator->cpu_ctx.profiler = profiler;
+    memory_set_debugger(memory, debugger);
+    memory_set_code_map(memory, code_map);
+    memory->battery = battery;
+    // All of the PRG RAM is the loaded state's now
+    memory->prg_ram_dirty = (1 << MEMORY_PRG_RAM_PAGES) - 1;
+}
+
+const char *emulator_exit_reason_name(EmulatorExitReason reason) {
+    static const char *names[] = {
+        [EMULATOR_EXIT_NONE] = "still running",
+        [EMULATOR_EXIT_CYCLES] = "reached the cycle limit",
+        [EMULATOR_EXIT_FRAMES] = "reached the frame limit",
+        [EMULATOR_EXIT_IDLE_LOOP] = "CPU is looping with interrupts off",
+        [EMULATOR_EXIT_UNSUPPORTED_INSTRUCTION] =
+            "CPU got to an instruction it doesn't support",
+        [EMULATOR_EXIT_BUS_FAULT] = "CPU accessed an address nothing is at",
+    };
+    return names[reason];
+}
@@ -0,0 +1,100 @@
+// Ties the CPU and the memory bus (and through it the PPU) together and runs
+// them in lockstep, independently of any front end.
+
+#ifndef _EMULATOR
+#define _EMULATOR
+
+#include "cpu.h"
+#include "input_queue.h"
+#include "memory.h"
+#include <stdint.h>
+
+// Returned by `emulator_run_frame` and `emulator_step` when a limit of the run
+// was reached (see `Emulator.exit_reason`), or when the debugger stopped
+// emulation (see `Memory.debugger`)
+#define EMULATOR_EXITED 1
+#define EMULATOR_STOPPED 2
+
+// When a run ends on its own, for batch and headless runs. Zero for no limit.
+typedef struct {
+    // CPU cycle to exit on
+    uint64_t max_cycles;
+    // Frame to exit after
+    uint64_t max_frames;
+    // Exit when the CPU jumps to the instruction itself with no interrupt
+    // able to get it out, like test ROMs do when they are done
+    int exit_on_idle_loop;
+} EmulatorLimits;
+
+typedef enum {
+    EMULATOR_EXIT_NONE,
+    EMULATOR_EXIT_CYCLES,
+    EMULATOR_EXIT_FRAMES,
+    EMULATOR_EXIT_IDLE_LOOP,
+    // The CPU got to an opcode it doesn't emulate, and stays on it
+    EMULATOR_EXIT_UNSUPPORTED_INSTRUCTION,
+    // The CPU accessed an address nothing is mapped to, see
+    // `Memory.bus_fault`
+    EMULATOR_EXIT_BUS_FAULT,
+} EmulatorExitReason;
+
+// What an exit reason means, for reports.
+const char *emulator_exit_reason_name(EmulatorExitReason reason);
+
+typedef struct {
+    CPUContext cpu_ctx;
+    Memory memory;
+    // Controller input, latched at the end of every frame
+    InputQueue input;
+
+    EmulatorLimits limits;
+    EmulatorExitReason exit_reason;
+} Emulator;
+
+// Everything that changes while emulating, i.e. not the ROM. A raw snapshot,
+// so it only loads into the same build of the emulator that saved it.
+typedef struct {
+    CPUContext cpu_ctx;
+    Memory memory;
+} EmulatorState;
+
+// Sets up power-on state, call before loading a ROM.
+void emulator_init(Emulator *emulator);
+
+// Powers the console on with the ROM loaded, starting the CPU from the reset
+// vector.
+void emulator_power_on(Emulator *emulator);
+// Presses the reset button.
+void emulator_reset(Emulator *emulator);
+
+// Runs the emulator until the PPU has completed the current frame.
+//
+// The CPU runs ahead of the PPU and the PPU is only caught up when the CPU
+// accesses its registers, when vblank starts (so the NMI lands on the right
+// instruction) and at the end of the frame.
+//
+// Pixels are written to `framebuffer` (see `ppu_tick`), which can be null.
+// The frame's audio is available from `apu_read_samples` afterwards, and
+// input queued in `Emulator.input` that has come due is applied to the
+// controllers for the next frame.
+//
+// Returns `EMULATOR_EXITED` if a limit was reached, or `EMULATOR_STOPPED` if
+// a breakpoint or watchpoint was hit, in which case running it again
+// continues the frame.
+int emulator_run_frame(Emulator *emulator, uint32_t *framebuffer);
+
+// Executes a single CPU instruction and catches the PPU up with it. Doesn't
+// stop at breakpoints, but does at watchpoints.
+//
+// Returns `EMULATOR_EXITED` if a limit was reached, or `EMULATOR_STOPPED` if
+// a watchpoint was hit.
+int emulator_step(Emulator *emulator, uint32_t *framebuffer);
+
+void emulator_save_state(Emulator *emulator, EmulatorState *state);
+
+// Restores a state saved with `emulator_save_state`. The ROM, the framebuffer
+// and its format, the profiler, the debugger, the save file and queued input
+// are kept as they are.
+void emulator_load_state(Emulator *emulator, const EmulatorState *state);
+
+#endif
@@ -0,0 +1,240 @@
+#include "environment.h"
+#include "emulator.h"
+#include "ppu.h"
+#include "rom_file.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// How the PPU is to render observations.
+//
+// Returns 1 if the downsampling isn't supported.
+static int ppu_output(const EnvironmentConfig *config, PPUOutput *out) {
+    PPUOutputFormat format = PPU_OUTPUT_RGB;
+    if (config->observation_type == ENVIRONMENT_OBSERVATION_GRAY)
+        format = PPU_OUTPUT_GRAY;
+    else if (config->observation_type == ENVIRONMENT_OBSERVATION_PALETTE_INDEX)
+        format = PPU_OUTPUT_PALETTE_INDEX;
+    return ppu_output_init(out, format, config->downsample);
+}
+
+int environment_observation_width(const EnvironmentConfig *config) {
+    PPUOutput output;
+    ppu_output(config, &output);
+    return ppu_output_width(&output);
+}
+
+int environment_observation_height(const EnvironmentConfig *config) {
+    PPUOutput output;
+    ppu_output(config, &output);
+    return ppu_output_height(&output);
+}
+
+int environment_observation_size(const EnvironmentConfig *config) {
+    PPUOutput output;
+    ppu_output(config, &output);
+    return ppu_output_size(&output);
+}
+
+int environment_init(Environment *environment, const Emulator *rom,
+                     const EmulatorState *start_state,
+                     const EnvironmentConfig *config, uint8_t *observation) {
+    memset(environment, 0, sizeof(Environment));
+    PPUOutput output;
+    if (ppu_output(config, &output)) {
+        fprintf(stderr, "ERROR: observations can only be downsampled by 1, 2 "
+                        "or 4, not %d\n",
+                config->downsample);
+        return 1;
+    }
+
+    environment->start_state = start_state;
+    environment->config = *config;
+    environment->observation = observation;
+
+    Emulator *emulator = &environment->emulator;
+    emulator_init(emulator);
+    emulator->memory.prg_rom = rom->memory.prg_rom;
+    emulator->memory.prg_rom_size = rom->memory.prg_rom_size;
+    emulator->memory.chr_rom = rom->memory.chr_rom;
+    emulator->memory.chr_rom_size = rom->memory.chr_rom_size;
+    emulator->memory.rom_hash = rom->memory.rom_hash;
+    emulator->memory.ppu_ctx.output = output;
+    emulator->limits.exit_on_idle_loop = config->done_on_idle_loop;
+
+    environment_reset(environment);
+    return 0;
+}
+
+void environment_reset(Environment *environment) {
+    emulator_load_state(&environment->emulator, environment->start_state);
+    environment->emulator.exit_reason = EMULATOR_EXIT_NONE;
+    environment->episode_frames = 0;
+    environment->done = 0;
+}
+
+int environment_step(Environment *environment, uint8_t action, int frameskip) {
+    if (environment->done)
+        environment_reset(environment);
+    if (frameskip < 1)
+        frameskip = 1;
+
+    Emulator *emulator = &environment->emulator;
+    uint64_t max_frames = environment->config.max_episode_frames;
+    emulator->memory.controllers[0].buttons = action;
+
+    for (int frame = 0; frame < frameskip; frame++) {
+        // Frames in between are only emulated, which is most of the work
+        int last = frame == frameskip - 1;
+        int result = emulator_run_frame(
+            emulator, last ? (uint32_t *)environment->observation : 0);
+        environment->episode_frames++;
+
+        if (result == EMULATOR_EXITED ||
+            (max_frames && environment->episode_frames >= max_frames)) {
+            environment->done = 1;
+            if (!last)
+                return 1;
+        }
+    }
+    return environment->done;
+}
+
+// ----- Batches -----
+
+// Steps environments until there are none left in the current step.
+static void run_step(EnvironmentBatch *batch) {
+    int i;
+    while ((i = atomic_fetch_add(&batch->next, 1)) < batch->count)
+        batch->dones[i] = environment_step(&batch->environments[i],
+                                           batch->actions[i], batch->frameskip);
+}
+
+static void *run_worker(void *arg) {
+    EnvironmentBatch *batch = arg;
+    // Steps start at 1
+    uint64_t step_count = 0;
+
+    pthread_mutex_lock(&batch->lock);
+    while (1) {
+        while (!batch->quit && batch->step_count == step_count)
+            pthread_cond_wait(&batch->step_started, &batch->lock);
+        if (batch->quit)
+            break;
+        step_count = batch->step_count;
+        pthread_mutex_unlock(&batch->lock);
+
+        run_step(batch);
+
+        pthread_mutex_lock(&batch->lock);
+        if (!--batch->working)
+            pthread_cond_signal(&batch->step_finished);
+    }
+    pthread_mutex_unlock(&batch->lock);
+    return 0;
+}
+
+int environment_batch_init(EnvironmentBatch *batch, char *rom_filepath,
+                           int count, int thread_count,
+                           const EnvironmentConfig *config) {
+    memset(batch, 0, sizeof(EnvironmentBatch));
+    batch->config = *config;
+    batch->observation_size = environment_observation_size(config);
+
+    emulator_init(&batch->rom);
+    if (rom_file_read(rom_filepath, &batch->rom.memory, 0, 0))
+        return 1;
+    emulator_power_on(&batch->rom);
+    emulator_save_state(&batch->rom, &batch->start_state);
+
+    batch->environments = calloc(count, sizeof(Environment));
+    batch->observations = calloc(count, batch->observation_size);
+    batch->dones = calloc(count, 1);
+    if (!batch->environments || !batch->observations || !batch->dones) {
+        fprintf(stderr, "ERROR: could not allocate %d environments\n", count);
+        environment_batch_free(batch);
+        return 1;
+    }
+
+    // One at a time, as emulators can't be initialized concurrently
+    for (; batch->count < count; batch->count++) {
+        if (environment_init(&batch->environments[batch->count], &batch->rom,
+                             &batch->start_state, config,
+                             batch->observations +
+                                 batch->count * batch->observation_size)) {
+            environment_batch_free(batch);
+            return 1;
+        }
+    }
+
+    pthread_mutex_init(&batch->lock, 0);
+    pthread_cond_init(&batch->step_started, 0);
+    pthread_cond_init(&batch->step_finished, 0);
+    batch->threads = calloc(thread_count ? thread_count : 1, sizeof(pthread_t));
+    if (!batch->threads) {
+        environment_batch_free(batch);
+        return 1;
+    }
+    for (; batch->thread_count < thread_count; batch->thread_count++) {
+        if (pthread_create(&batch->threads[batch->thread_count], 0, run_worker,
+                           batch)) {
+            fprintf(stderr, "Could not start environment threads\n");
+            environment_batch_free(batch);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void environment_batch_free(EnvironmentBatch *batch) {
+    if (batch->threads) {
+        pthread_mutex_lock(&batch->lock);
+        batch->quit = 1;
+        pthread_cond_broadcast(&batch->step_started);
+        pthread_mutex_unlock(&batch->lock);
+        for (int i = 0; i < batch->thread_count; i++)
+            pthread_join(batch->threads[i], 0);
+        free(batch->threads);
+
+        pthread_mutex_destroy(&batch->lock);
+        pthread_cond_destroy(&batch->step_started);
+        pthread_cond_destroy(&batch->step_finished);
+    }
+
+    free(batch->environments);
+    free(batch->observations);
+    free(batch->dones);
+    free(batch->rom.memory.prg_rom);
+    free(batch->rom.memory.chr_rom);
+    memset(batch, 0, sizeof(EnvironmentBatch));
+}
+
+void environment_batch_reset(EnvironmentBatch *batch) {
+    for (int i = 0; i < batch->count; i++)
+        environment_reset(&batch->environments[i]);
+    memset(batch->dones, 0, batch->count);
+}
+
+void environment_batch_step(EnvironmentBatch *batch, const uint8_t *actions,
+                            int frameskip) {
+    batch->actions = actions;
+    batch->frameskip = frameskip;
+    atomic_store(&batch->next, 0);
+
+    pthread_mutex_lock(&batch->lock);
+    batch->step_count++;
+    batch->working = batch->thread_count;
+    pthread_cond_broadcast(&batch->step_started);
+    pthread_mutex_unlock(&batch->lock);
+
+    // The caller steps environments too rather than waiting idle
+    run_step(batch);
+
+    pthread_mutex_lock(&batch->lock);
+    while (batch->working)
+        pthread_cond_wait(&batch->step_finished, &batch->lock);
+    pthread_mutex_unlock(&batch->lock);
+}
@@ -0,0 +1,145 @@
+// Reinforcement learning environment: the emulator is stepped a few frames at
+// a time with an action held on the first controller, and gives back an
+// observation of the screen, its RAM and whether the episode is done.
+//
+// Environments come in batches that share one loaded ROM and are stepped
+// together on a pool of threads. The observations of a batch are laid out
+// one after another in a single buffer, so it can be handed over as is.
+//
+// Episodes start from the console just powered on, and are done when the
+// frame limit is reached, when the emulator can't go on (see
+// `EmulatorExitReason`) or, optionally, when the game idles in a loop that
+// nothing can get it out of. A done environment is reset by its next step, the
+// others in its batch carry on.
+
+#ifndef _ENVIRONMENT
+#define _ENVIRONMENT
+
+#include "emulator.h"
+#include "memory.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+// The PPU renders straight into the observation, see `PPUOutputFormat`.
+typedef enum {
+    // A `uint32_t` XRGB8888 pixel at a time
+    ENVIRONMENT_OBSERVATION_RGB,
+    // Luma, a byte per pixel, averaged over `downsample` sized squares
+    ENVIRONMENT_OBSERVATION_GRAY,
+    // Which of the 64 colors of the palette each pixel is, a byte per pixel
+    ENVIRONMENT_OBSERVATION_PALETTE_INDEX,
+} EnvironmentObservationType;
+
+typedef struct {
+    EnvironmentObservationType observation_type;
+    // Gray and palette index observations are this many times smaller in both
+    // directions, 1, 2 or 4
+    int downsample;
+    // Frames an episode lasts at most, 0 for no limit
+    uint64_t max_episode_frames;
+    // Also done when the CPU jumps to itself with no interrupt coming
+    int done_on_idle_loop;
+} EnvironmentConfig;
+
+typedef struct {
+    Emulator emulator;
+    // What episodes start from
+    const EmulatorState *start_state;
+    EnvironmentConfig config;
+
+    // Where the observation is written, `environment_observation_size` bytes
+    uint8_t *observation;
+
+    uint64_t episode_frames;
+    int done;
+} Environment;
+
+typedef struct EnvironmentBatch {
+    EnvironmentConfig config;
+    int count;
+    Environment *environments;
+    // The observation of environment i is at `i * observation_size`
+    uint8_t *observations;
+    int observation_size;
+    // Whether environment i was done by the last step
+    uint8_t *dones;
+
+    // The ROM is only loaded into this, the environments share its PRG and
+    // CHR ROM
+    Emulator rom;
+    EmulatorState start_state;
+
+    // The step being run
+    const uint8_t *actions;
+    int frameskip;
+    // Next environment to be stepped by whichever thread gets to it first
+    atomic_int next;
+
+    // Threads helping the caller with steps
+    pthread_t *threads;
+    int thread_count;
+    pthread_mutex_t lock;
+    pthread_cond_t step_started;
+    pthread_cond_t step_finished;
+    // Bumped for every step, workers run a step when it changes
+    uint64_t step_count;
+    // Workers still running the current step
+    int working;
+    int quit;
+} EnvironmentBatch;
+
+int environment_observation_width(const EnvironmentConfig *config);
+int environment_observation_height(const EnvironmentConfig *config);
+// In bytes
+int environment_observation_size(const EnvironmentConfig *config);
+
+// Starts an environment on the ROM loaded in `rom`, sharing its PRG and CHR
+// ROM, with episodes starting from `start_state`. Observations are written to
+// `observation`. Emulators can only be initialized on one thread at a time.
+//
+// Returns 1 on failure.
+int environment_init(Environment *environment, const Emulator *rom,
+                     const EmulatorState *start_state,
+                     const EnvironmentConfig *config, uint8_t *observation);
+
+// Starts a new episode.
+void environment_reset(Environment *environment);
+
+// Runs `frameskip` frames with `action` held on the first controller (see
+// `ControllerButton`), rendering only the last one into the observation.
+// Resets the environment first if it was done.
+//
+// Returns whether the episode is done. If it ended before the last frame, the
+// observation is of the step before.
+int environment_step(Environment *environment, uint8_t action, int frameskip);
+
+// The 2 KB of the console's RAM, where games keep their state.
+static inline uint8_t *environment_ram(Environment *environment) {
+    return environment->emulator.memory.ram;
+}
+
+// Reads any address without side effects, see `memory_peek`.
+static inline uint8_t environment_peek(Environment *environment,
+                                       uint16_t address) {
+    return memory_peek(&environment->emulator.memory, address);
+}
+
+// Loads the ROM at `rom_filepath` into `count` environments, stepped with the
+// caller and `thread_count` more threads.
+//
+// Returns 1 on failure.
+int environment_batch_init(EnvironmentBatch *batch, char *rom_filepath,
+                           int count, int thread_count,
+                           const EnvironmentConfig *config);
+void environment_batch_free(EnvironmentBatch *batch);
+
+// Starts a new episode in all of the environments.
+void environment_batch_reset(EnvironmentBatch *batch);
+
+// Steps every environment, environment i with `actions[i]`, and waits for
+// them all. The observations and `dones` are then of this step.
+void environment_batch_step(EnvironmentBatch *batch, const uint8_t *actions,
+                            int frameskip);
+
+#endif
@@ -0,0 +1,470 @@
+#include "gdb_stub.h"
+#include "debugger.h"
+#include "emulator.h"
+#include "memory.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// How often the stub thread checks for replies to send and for quitting
+#define POLL_INTERVAL_MS 10
+
+// ----- Packets -----
+
+static int hex_digit(char character) {
+    if (character >= '0' && character <= '9')
+        return character - '0';
+    if (character >= 'a' && character <= 'f')
+        return character - 'a' + 10;
+    if (character >= 'A' && character <= 'F')
+        return character - 'A' + 10;
+    return -1;
+}
+
+// Parses a hexadecimal number at `*text`, moving past it.
+//
+// Returns 1 if there are no digits or the number doesn't fit.
+static int parse_hex(const char **text, uint32_t *value) {
+    const char *start = *text;
+    *value = 0;
+    for (; hex_digit(**text) >= 0; (*text)++) {
+        if (*value >> 28)
+            return 1;
+        *value = *value << 4 | hex_digit(**text);
+    }
+    return *text == start;
+}
+
+// Parses two hexadecimal digits into `*byte`.
+//
+// Returns 1 on failure.
+static int parse_hex_byte(const char *text, uint8_t *byte) {
+    int high = hex_digit(text[0]);
+    if (high < 0)
+        return 1;
+    int low = hex_digit(text[1]);
+    if (low < 0)
+        return 1;
+    *byte = high << 4 | low;
+    return 0;
+}
+
+// Parses "ADDRESS,LENGTH" at `*text`, moving past it.
+//
+// Returns 1 on failure.
+static int parse_range(const char **text, uint32_t *address,
+                       uint32_t *length) {
+    if (parse_hex(text, address) || **text != ',')
+        return 1;
+    (*text)++;
+    return parse_hex(text, length) || *address > 0xffff;
+}
+
+static void read_registers(CPUContext *ctx, char *reply) {
+    snprintf(reply, GDB_STUB_PACKET_SIZE, "%02x%02x%02x%02x%02x%02x%02x",
+             ctx->a, ctx->x, ctx->y, ctx->status_register.value,
+             ctx->stack_pointer, ctx->program_counter & 0xff,
+             ctx->program_counter >> 8);
+}
+
+static int write_registers(CPUContext *ctx, const char *text) {
+    uint8_t registers[7];
+    for (int i = 0; i < 7; i++)
+        if (parse_hex_byte(text + i * 2, &registers[i]))
+            return 1;
+
+    ctx->a = registers[0];
+    ctx->x = registers[1];
+    ctx->y = registers[2];
+    ctx->status_register.value = registers[3];
+    ctx->stack_pointer = registers[4];
+    ctx->program_counter = registers[6] << 8 | registers[5];
+    return 0;
+}
+
+static int read_memory(Memory *memory, const char *text, char *reply) {
+    uint32_t address, length;
+    if (parse_range(&text, &address, &length))
+        return 1;
+
+    if (length > (GDB_STUB_PACKET_SIZE - 1) / 2)
+        length = (GDB_STUB_PACKET_SIZE - 1) / 2;
+    for (uint32_t i = 0; i < length; i++)
+        snprintf(reply + i * 2, 3, "%02x",
+                 memory_peek(memory, (address + i) & 0xffff));
+    reply[length * 2] = 0;
+    return 0;
+}
+
+// Only writes if the whole payload decodes and every address can be written,
+// see `memory_poke`.
+static int write_memory_packet(Memory *memory, const char *text) {
+    uint32_t address, length;
+    if (parse_range(&text, &address, &length) || *text++ != ':' ||
+        length > GDB_STUB_PACKET_SIZE / 2 || strlen(text) != length * 2)
+        return 1;
+
+    uint8_t bytes[GDB_STUB_PACKET_SIZE / 2];
+    for (uint32_t i = 0; i < length; i++) {
+        if (parse_hex_byte(text + i * 2, &bytes[i]))
+            return 1;
+        if (!memory_pokeable(memory, (address + i) & 0xffff))
+            return 1;
+    }
+
+    for (uint32_t i = 0; i < length; i++)
+        memory_poke(memory, (address + i) & 0xffff, bytes[i]);
+    return 0;
+}
+
+// Z and z packets: "TYPE,ADDRESS,KIND". Types 0 and 1 are breakpoints, 2, 3
+// and 4 write, read and access watchpoints of KIND bytes.
+static int set_point(Debugger *debugger, const char *text, int insert) {
+    uint32_t type, address, kind;
+    if (parse_hex(&text, &type) || *text++ != ',' ||
+        parse_range(&text, &address, &kind))
+        return 1;
+
+    if (type <= 1) {
+        if (insert)
+            debugger_set_breakpoint(debugger, address);
+        else
+            debugger_clear_breakpoint(debugger, address);
+        return 0;
+    }
+
+    uint8_t access[] = {[2] = DEBUGGER_WRITE,
+                        [3] = DEBUGGER_READ,
+                        [4] = DEBUGGER_READ | DEBUGGER_WRITE};
+    if (type > 4 || kind == 0 || kind > 0x10000 - address)
+        return 1;
+
+    if (insert)
+        return debugger_add_watchpoint(debugger, address, address + kind - 1,
+                                       access[type]);
+    debugger_remove_watchpoint(debugger, address, address + kind - 1);
+    return 0;
+}
+
+void gdb_stub_stop_reply(Debugger *debugger, char *reply) {
+    DebuggerStop *stop = &debugger->stop;
+    if (stop->reason == DEBUGGER_STOP_WATCHPOINT)
+        snprintf(reply, GDB_STUB_PACKET_SIZE, "T05%swatch:%04x;",
+                 stop->access == DEBUGGER_READ ? "r" : "", stop->address);
+    else if (stop->reason == DEBUGGER_STOP_INTERRUPT)
+        snprintf(reply, GDB_STUB_PACKET_SIZE, "S02");
+    else
+        snprintf(reply, GDB_STUB_PACKET_SIZE, "S05");
+}
+
+static void reply_status(char *reply, int failed) {
+    snprintf(reply, GDB_STUB_PACKET_SIZE, failed ? "E01" : "OK");
+}
+
+GdbStubAction gdb_stub_handle_packet(Emulator *emulator, Debugger *debugger,
+                                     const char *packet, char *reply) {
+    CPUContext *ctx = &emulator->cpu_ctx;
+    *reply = 0;
+
+    switch (packet[0]) {
+    case '?':
+        gdb_stub_stop_reply(debugger, reply);
+        return GDB_STUB_STAY;
+    case 'g':
+        read_registers(ctx, reply);
+        return GDB_STUB_STAY;
+    case 'G':
+        reply_status(reply, write_registers(ctx, packet + 1));
+        return GDB_STUB_STAY;
+    case 'm':
+        if (read_memory(&emulator->memory, packet + 1, reply))
+            reply_status(reply, 1);
+        return GDB_STUB_STAY;
+    case 'M':
+        reply_status(reply, write_memory_packet(&emulator->memory, packet + 1));
+        return GDB_STUB_STAY;
+    case 'Z':
+    case 'z':
+        reply_status(reply, set_point(debugger, packet + 1, packet[0] == 'Z'));
+        return GDB_STUB_STAY;
+
+    case 'c':
+    case 's': {
+        // Optionally from another address
+        const char *text = packet + 1;
+        uint32_t address;
+        if (!parse_hex(&text, &address))
+            ctx->program_counter = address;
+        return packet[0] == 'c' ? GDB_STUB_CONTINUE : GDB_STUB_STEP;
+    }
+
+    case 'D':
+    case 'k':
+        reply_status(reply, 0);
+        return GDB_STUB_DETACH;
+
+    case 'H':
+        reply_status(reply, 0);
+        return GDB_STUB_STAY;
+    case 'q':
+        if (!strncmp(packet, "qSupported", 10))
+            snprintf(reply, GDB_STUB_PACKET_SIZE, "PacketSize=%x",
+                     GDB_STUB_PACKET_SIZE);
+        else if (!strcmp(packet, "qAttached"))
+            snprintf(reply, GDB_STUB_PACKET_SIZE, "1");
+        return GDB_STUB_STAY;
+    }
+
+    // Unsupported, the empty reply
+    return GDB_STUB_STAY;
+}
+
+// ----- Emulation thread -----
+
+void gdb_stub_poll(GdbStub *stub) {
+    int connected = atomic_load(&stub->connected);
+    if (connected == stub->attached)
+        return;
+
+    stub->attached = connected;
+    stub->running = 0;
+    debugger_set_remote(stub->debugger, connected);
+    if (connected)
+        debugger_interrupt(stub->debugger);
+}
+
+GdbStubAction gdb_stub_serve(GdbStub *stub, Emulator *emulator) {
+    pthread_mutex_lock(&stub->lock);
+
+    // Only a client that continued or stepped waits for the stop
+    if (stub->running) {
+        gdb_stub_stop_reply(stub->debugger, stub->reply);
+        stub->reply_pending = 1;
+        stub->running = 0;
+    }
+
+    GdbStubAction action = GDB_STUB_STAY;
+    while (action == GDB_STUB_STAY) {
+        while (!stub->packet_pending && atomic_load(&stub->connected) &&
+               !atomic_load(&stub->quit))
+            pthread_cond_wait(&stub->packet_arrived, &stub->lock);
+        if (!stub->packet_pending) {
+            action = GDB_STUB_DETACH;
+            break;
+        }
+
+        char reply[GDB_STUB_PACKET_SIZE];
+        action = gdb_stub_handle_packet(emulator, stub->debugger, stub->packet,
+                                        reply);
+        stub->packet_pending = 0;
+
+        if (action == GDB_STUB_CONTINUE || action == GDB_STUB_STEP) {
+            stub->running = 1;
+        } else {
+            memcpy(stub->reply, reply, GDB_STUB_PACKET_SIZE);
+            stub->reply_pending = 1;
+        }
+    }
+
+    pthread_mutex_unlock(&stub->lock);
+    debugger_resume(stub->debugger, emulator->cpu_ctx.program_counter);
+    return action;
+}
+
+// ----- Stub thread -----
+
+typedef enum {
+    READING_IDLE,
+    READING_DATA,
+    READING_CHECKSUM_HIGH,
+    READING_CHECKSUM_LOW,
+} ReadingState;
+
+typedef struct {
+    ReadingState state;
+    char data[GDB_STUB_PACKET_SIZE];
+    int length;
+    // More data came than fits in `data`
+    int too_long;
+    uint8_t sum;
+    char checksum[2];
+} PacketReader;
+
+static void send_text(int client, const char *text) {
+    send(client, text, strlen(text), MSG_NOSIGNAL);
+}
+
+static void send_packet(int client, const char *data) {
+    uint8_t sum = 0;
+    for (const char *character = data; *character; character++)
+        sum += *character;
+
+    char frame[GDB_STUB_PACKET_SIZE + 4];
+    snprintf(frame, sizeof(frame), "$%s#%02x", data, sum);
+    send_text(client, frame);
+}
+
+// Hands a complete packet over to the emulation thread
+static void deliver_packet(GdbStub *stub, PacketReader *reader) {
+    reader->data[reader->length] = 0;
+    pthread_mutex_lock(&stub->lock);
+    memcpy(stub->packet, reader->data, reader->length + 1);
+    stub->packet_pending = 1;
+    pthread_cond_signal(&stub->packet_arrived);
+    pthread_mutex_unlock(&stub->lock);
+}
+
+static void receive_byte(GdbStub *stub, int client, PacketReader *reader,
+                         char byte) {
+    switch (reader->state) {
+    case READING_IDLE:
+        if (byte == '$') {
+            reader->state = READING_DATA;
+            reader->length = 0;
+            reader->too_long = 0;
+            reader->sum = 0;
+        }
+        // Ctrl-C in the client, acknowledgements are ignored
+        if (byte == 0x03)
+            debugger_interrupt(stub->debugger);
+        return;
+
+    case READING_DATA:
+        if (byte == '#') {
+            reader->state = READING_CHECKSUM_HIGH;
+            return;
+        }
+        reader->sum += byte;
+        if (reader->length < GDB_STUB_PACKET_SIZE - 1)
+            reader->data[reader->length++] = byte;
+        else
+            reader->too_long = 1;
+        return;
+
+    case READING_CHECKSUM_HIGH:
+        reader->checksum[0] = byte;
+        reader->state = READING_CHECKSUM_LOW;
+        return;
+
+    case READING_CHECKSUM_LOW: {
+        reader->checksum[1] = byte;
+        reader->state = READING_IDLE;
+
+        uint8_t checksum;
+        if (parse_hex_byte(reader->checksum, &checksum) ||
+            checksum != reader->sum) {
+            send_text(client, "-");
+            return;
+        }
+        send_text(client, "+");
+        // Received fine, but only part of it could be handled
+        if (reader->too_long) {
+            send_packet(client, "E01");
+            return;
+        }
+        deliver_packet(stub, reader);
+        return;
+    }
+    }
+}
+
+static void serve_client(GdbStub *stub, int client) {
+    PacketReader reader = {.state = READING_IDLE};
+    atomic_store(&stub->connected, 1);
+
+    while (!atomic_load(&stub->quit)) {
+        struct pollfd poll_fd = {.fd = client, .events = POLLIN};
+        if (poll(&poll_fd, 1, POLL_INTERVAL_MS) > 0) {
+            char buffer[256];
+            ssize_t count = recv(client, buffer, sizeof(buffer), 0);
+            if (count <= 0)
+                break;
+            for (ssize_t i = 0; i < count; i++)
+                receive_byte(stub, client, &reader, buffer[i]);
+        }
+
+        pthread_mutex_lock(&stub->lock);
+        if (stub->reply_pending) {
+            send_packet(client, stub->reply);
+            stub->reply_pending = 0;
+        }
+        pthread_mutex_unlock(&stub->lock);
+    }
+
+    // Lets the emulation thread go if it's waiting for packets
+    pthread_mutex_lock(&stub->lock);
+    atomic_store(&stub->connected, 0);
+    stub->packet_pending = 0;
+    stub->reply_pending = 0;
+    pthread_cond_broadcast(&stub->packet_arrived);
+    pthread_mutex_unlock(&stub->lock);
+}
+
+static void *run_stub(void *data) {
+    GdbStub *stub = data;
+
+    while (!atomic_load(&stub->quit)) {
+        struct pollfd poll_fd = {.fd = stub->listen_fd, .events = POLLIN};
+        if (poll(&poll_fd, 1, POLL_INTERVAL_MS) <= 0)
+            continue;
+
+        int client = accept(stub->listen_fd, 0, 0);
+        if (client < 0)
+            continue;
+        serve_client(stub, client);
+        close(client);
+    }
+    return 0;
+}
+
+int gdb_stub_start(GdbStub *stub, Debugger *debugger, int port) {
+    memset(stub, 0, sizeof(GdbStub));
+    stub->debugger = debugger;
+
+    stub->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (stub->listen_fd < 0) {
+        perror("Could not create GDB stub socket");
+        return 1;
+    }
+    int reuse = 1;
+    setsockopt(stub->listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse,
+               sizeof(reuse));
+
+    // Local connections only, the protocol has no authentication
+    struct sockaddr_in address = {.sin_family = AF_INET,
+                                  .sin_port = htons(port),
+                                  .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    if (bind(stub->listen_fd, (struct sockaddr *)&address, sizeof(address)) ||
+        listen(stub->listen_fd, 1)) {
+        perror("Could not listen for GDB");
+        close(stub->listen_fd);
+        return 1;
+    }
+
+    pthread_mutex_init(&stub->lock, 0);
+    pthread_cond_init(&stub->packet_arrived, 0);
+    if (pthread_create(&stub->thread, 0, run_stub, stub)) {
+        fprintf(stderr, "Could not start GDB stub thread\n");
+        close(stub->listen_fd);
+        return 1;
+    }
+    return 0;
+}
+
+void gdb_stub_stop(GdbStub *stub) {
+    atomic_store(&stub->quit, 1);
+    pthread_join(stub->thread, 0);
+    close(stub->listen_fd);
+
+    pthread_mutex_lock(&stub->lock);
+    pthread_cond_broadcast(&stub->packet_arrived);
+    pthread_mutex_unlock(&stub->lock);
+}
@@ -0,0 +1,86 @@
+// Remote debugging over the GDB remote serial protocol, on a localhost TCP
+// port.
+//
+// The stub runs on its own thread, doing the socket I/O and the packet
+// framing. Packets are handed over to the emulation thread, which only looks
+// at them while stopped, i.e. between instructions. Running is interrupted
+// through the debugger (see debugger.h), which is only armed while a client
+// is attached.
+//
+// Registers are, in order: A, X, Y, P, SP (a byte each) and PC (two bytes,
+// little-endian). Supported packets: ?, g, G, m, M, c, s, Z0-Z4, z0-z4, D,
+// k, and the interrupt byte.
+
+#ifndef _GDB_STUB
+#define _GDB_STUB
+
+#include "debugger.h"
+#include "emulator.h"
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define GDB_STUB_DEFAULT_PORT 1234
+#define GDB_STUB_PACKET_SIZE 1024
+
+typedef enum {
+    // Stay stopped and keep answering packets
+    GDB_STUB_STAY,
+    GDB_STUB_CONTINUE,
+    // Execute a single instruction and stop again
+    GDB_STUB_STEP,
+    // The client is gone, continue without it
+    GDB_STUB_DETACH,
+} GdbStubAction;
+
+typedef struct {
+    Debugger *debugger;
+    int listen_fd;
+    pthread_t thread;
+    atomic_int quit;
+
+    // Set by the stub thread while a client is connected
+    atomic_int connected;
+    // Whether the emulation thread has armed the debugger for the client
+    int attached;
+    // Whether the client is waiting for a stop reply
+    int running;
+
+    // Mailbox between the stub thread and the emulation thread
+    pthread_mutex_t lock;
+    pthread_cond_t packet_arrived;
+    char packet[GDB_STUB_PACKET_SIZE];
+    int packet_pending;
+    char reply[GDB_STUB_PACKET_SIZE];
+    int reply_pending;
+} GdbStub;
+
+// Starts listening on `port` of the loopback interface.
+//
+// Returns 1 on failure.
+int gdb_stub_start(GdbStub *stub, Debugger *debugger, int port);
+
+// Stops the stub thread and disconnects the client.
+void gdb_stub_stop(GdbStub *stub);
+
+// Picks up clients attaching and detaching, call on the emulation thread
+// between frames. A client attaching stops emulation.
+void gdb_stub_poll(GdbStub *stub);
+
+// Whether a client is attached, on the emulation thread.
+static inline int gdb_stub_attached(GdbStub *stub) {
+    return stub->attached;
+}
+
+// Answers packets from the client until it continues, steps or detaches. Call
+// on the emulation thread when the emulator has stopped.
+GdbStubAction gdb_stub_serve(GdbStub *stub, Emulator *emulator);
+
+// Handles a single packet (without the framing), writing the reply into
+// `reply`. Continuing and stepping reply nothing.
+GdbStubAction gdb_stub_handle_packet(Emulator *emulator, Debugger *debugger,
+                                     const char *packet, char *reply);
+
+// Writes the reply telling why the emulator stopped.
+void gdb_stub_stop_reply(Debugger *debugger, char *reply);
+
+#endif
@@ -0,0 +1,155 @@
+#include "hash.h"
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define FNV1A_PRIME 0x100000001b3ULL
+// Reflected CRC-32 polynomial
+#define CRC32_POLYNOMIAL 0xedb88320
+
+uint64_t hash_fnv1a(uint64_t hash, const void *data, size_t size) {
+    const uint8_t *bytes = data;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= FNV1A_PRIME;
+    }
+    return hash;
+}
+
+// ----- CRC-32 -----
+
+// Slicing-by-8: `crc32_tables[k][b]` is the CRC of byte `b` followed by `k`
+// zero bytes, so 8 bytes are done with 8 independent lookups
+static uint32_t crc32_tables[8][256];
+static pthread_once_t crc32_tables_once = PTHREAD_ONCE_INIT;
+
+static void build_crc32_tables(void) {
+    for (int byte = 0; byte < 256; byte++) {
+        uint32_t crc = byte;
+        for (int bit = 0; bit < 8; bit++)
+            crc = crc >> 1 ^ (crc & 1 ? CRC32_POLYNOMIAL : 0);
+        crc32_tables[0][byte] = crc;
+    }
+    for (int byte = 0; byte < 256; byte++)
+        for (int k = 1; k < 8; k++) {
+            uint32_t previous = crc32_tables[k - 1][byte];
+            crc32_tables[k][byte] =
+                previous >> 8 ^ crc32_tables[0][previous & 0xff];
+        }
+}
+
+uint32_t hash_crc32(uint32_t crc, const void *data, size_t size) {
+    pthread_once(&crc32_tables_once, build_crc32_tables);
+
+    const uint8_t *bytes = data;
+    crc = ~crc;
+
+    for (; size >= 8; size -= 8, bytes += 8) {
+        uint32_t low = crc ^ (bytes[0] | bytes[1] << 8 | bytes[2] << 16 |
+                              (uint32_t)bytes[3] << 24);
+        crc = crc32_tables[7][low & 0xff] ^ crc32_tables[6][low >> 8 & 0xff] ^
+              crc32_tables[5][low >> 16 & 0xff] ^ crc32_tables[4][low >> 24] ^
+              crc32_tables[3][bytes[4]] ^ crc32_tables[2][bytes[5]] ^
+              crc32_tables[1][bytes[6]] ^ crc32_tables[0][bytes[7]];
+    }
+    for (; size; size--, bytes++)
+        crc = crc >> 8 ^ crc32_tables[0][(crc ^ *bytes) & 0xff];
+
+    return ~crc;
+}
+
+// ----- SHA-1 -----
+
+static inline uint32_t rotate_left(uint32_t value, int bits) {
+    return value << bits | value >> (32 - bits);
+}
+
+static void sha1_block(HashSHA1 *sha1, const uint8_t *block) {
+    uint32_t w[80];
+    for (int i = 0; i < 16; i++)
+        w[i] = (uint32_t)block[i * 4] << 24 | block[i * 4 + 1] << 16 |
+               block[i * 4 + 2] << 8 | block[i * 4 + 3];
+    for (int i = 16; i < 80; i++)
+        w[i] = rotate_left(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+    uint32_t a = sha1->state[0], b = sha1->state[1], c = sha1->state[2],
+             d = sha1->state[3], e = sha1->state[4];
+
+    for (int i = 0; i < 80; i++) {
+        uint32_t f, k;
+        if (i < 20) {
+            f = (b & c) | (~b & d);
+            k = 0x5a827999;
+        } else if (i < 40) {
+            f = b ^ c ^ d;
+            k = 0x6ed9eba1;
+        } else if (i < 60) {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8f1bbcdc;
+        } else {
+            f = b ^ c ^ d;
+            k = 0xca62c1d6;
+        }
+
+        uint32_t temp = rotate_left(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = rotate_left(b, 30);
+        b = a;
+        a = temp;
+    }
+
+    sha1->state[0] += a;
+    sha1->state[1] += b;
+    sha1->state[2] += c;
+    sha1->state[3] += d;
+    sha1->state[4] += e;
+}
+
+void hash_sha1_init(HashSHA1 *sha1) {
+    *sha1 = (HashSHA1){.state = {0x67452301, 0xefcdab89, 0x98badcfe,
+                                 0x10325476, 0xc3d2e1f0}};
+}
+
+void hash_sha1_update(HashSHA1 *sha1, const void *data, size_t size) {
+    const uint8_t *bytes = data;
+    sha1->length += size;
+
+    while (size) {
+        // Whole blocks straight from `data`
+        if (!sha1->block_size && size >= sizeof(sha1->block)) {
+            sha1_block(sha1, bytes);
+            bytes += sizeof(sha1->block);
+            size -= sizeof(sha1->block);
+            continue;
+        }
+
+        size_t count = sizeof(sha1->block) - sha1->block_size;
+        if (count > size)
+            count = size;
+        memcpy(sha1->block + sha1->block_size, bytes, count);
+        sha1->block_size += count;
+        bytes += count;
+        size -= count;
+
+        if (sha1->block_size == sizeof(sha1->block)) {
+            sha1_block(sha1, sha1->block);
+            sha1->block_size = 0;
+        }
+    }
+}
+
+void hash_sha1_final(HashSHA1 *sha1, uint8_t *out) {
+    uint64_t bits = sha1->length * 8;
+
+    // A 1 bit, zeros up to 8 bytes before the end of a block, and the length
+    uint8_t padding[72] = {0x80};
+    int padding_size = (sha1->block_size < 56 ? 56 : 120) - sha1->block_size;
+    for (int i = 0; i < 8; i++)
+        padding[padding_size + i] = bits >> (56 - i * 8);
+    hash_sha1_update(sha1, padding, padding_size + 8);
+
+    for (int i = 0; i < HASH_SHA1_SIZE; i++)
+        out[i] = sha1->state[i / 4] >> (24 - i % 4 * 8);
+}
@@ -0,0 +1,40 @@
+// Hashing, for telling apart ROMs, frames and memory contents. FNV-1a is for
+// hashes that stay within the emulator, CRC-32 and SHA-1 for identifying ROMs
+// like ROM databases do.
+
+#ifndef _HASH
+#define _HASH
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define HASH_FNV1A_INITIAL 0xcbf29ce484222325ULL
+#define HASH_SHA1_SIZE 20
+
+// 64-bit FNV-1a of `size` bytes at `data`, continuing from `hash`. Start with
+// `HASH_FNV1A_INITIAL`.
+uint64_t hash_fnv1a(uint64_t hash, const void *data, size_t size);
+
+// CRC-32 (as in zip and PNG) of `size` bytes at `data`, continuing from `crc`.
+// Start with 0.
+uint32_t hash_crc32(uint32_t crc, const void *data, size_t size);
+
+// What ROMs are identified by
+typedef struct {
+    uint32_t crc32;
+    uint8_t sha1[HASH_SHA1_SIZE];
+} HashDigests;
+
+typedef struct {
+    uint32_t state[5];
+    uint64_t length;
+    uint8_t block[64];
+    int block_size;
+} HashSHA1;
+
+// SHA-1, fed in pieces of any size.
+void hash_sha1_init(HashSHA1 *sha1);
+void hash_sha1_update(HashSHA1 *sha1, const void *data, size_t size);
+void hash_sha1_final(HashSHA1 *sha1, uint8_t *out);
+
+#endif
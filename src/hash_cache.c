@@ -0,0 +1,198 @@
+#include "hash_cache.h"
+#include "hash.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Longest line of the cache file, paths included
+#define LINE_SIZE 4200
+
+void hash_cache_init(HashCache *cache) {
+    *cache = (HashCache){0};
+}
+
+void hash_cache_free(HashCache *cache) {
+    for (int i = 0; i < cache->count; i++)
+        free(cache->entries[i].path);
+    free(cache->entries);
+    free(cache->index);
+    hash_cache_init(cache);
+}
+
+// Slot of the index that `path` is in, or else the empty one it goes in.
+static int *index_slot(HashCache *cache, const char *path) {
+    int mask = cache->capacity * 2 - 1;
+    uint64_t hash = hash_fnv1a(HASH_FNV1A_INITIAL, path, strlen(path));
+    for (int i = hash & mask;; i = (i + 1) & mask) {
+        int *slot = &cache->index[i];
+        if (!*slot || !strcmp(cache->entries[*slot - 1].path, path))
+            return slot;
+    }
+}
+
+static HashCacheEntry *entry_for(HashCache *cache, const char *path) {
+    if (!cache->count)
+        return 0;
+    int *slot = index_slot(cache, path);
+    return *slot ? &cache->entries[*slot - 1] : 0;
+}
+
+// Doubles the capacity, indexing the entries again.
+//
+// Returns 1 on failure.
+static int grow(HashCache *cache) {
+    int capacity = cache->capacity ? cache->capacity * 2 : 64;
+    HashCacheEntry *entries =
+        realloc(cache->entries, capacity * sizeof(HashCacheEntry));
+    if (!entries)
+        return 1;
+    cache->entries = entries;
+    int *index = calloc(capacity * 2, sizeof(int));
+    if (!index)
+        return 1;
+
+    free(cache->index);
+    cache->index = index;
+    cache->capacity = capacity;
+    for (int i = 0; i < cache->count; i++)
+        *index_slot(cache, cache->entries[i].path) = i + 1;
+    return 0;
+}
+
+// The entry for `path`, added if there is none.
+static HashCacheEntry *add_entry(HashCache *cache, const char *path) {
+    HashCacheEntry *entry = entry_for(cache, path);
+    if (entry)
+        return entry;
+    if (cache->count == cache->capacity && grow(cache))
+        return 0;
+
+    char *copy = strdup(path);
+    if (!copy)
+        return 0;
+    entry = &cache->entries[cache->count++];
+    *entry = (HashCacheEntry){.path = copy};
+    *index_slot(cache, path) = cache->count;
+    return entry;
+}
+
+int hash_cache_find(HashCache *cache, const char *path,
+                    const struct stat *stat, HashDigests *out) {
+    HashCacheEntry *entry = entry_for(cache, path);
+    if (!entry || entry->size != stat->st_size ||
+        entry->modified_seconds != stat->st_mtim.tv_sec ||
+        entry->modified_nanoseconds != stat->st_mtim.tv_nsec)
+        return 1;
+
+    *out = entry->digests;
+    return 0;
+}
+
+int hash_cache_store(HashCache *cache, const char *path,
+                     const struct stat *stat, const HashDigests *digests) {
+    HashCacheEntry *entry = add_entry(cache, path);
+    if (!entry)
+        return 1;
+
+    entry->size = stat->st_size;
+    entry->modified_seconds = stat->st_mtim.tv_sec;
+    entry->modified_nanoseconds = stat->st_mtim.tv_nsec;
+    entry->digests = *digests;
+    cache->dirty = 1;
+    return 0;
+}
+
+// ----- Files -----
+
+static int parse_sha1(const char *hex, uint8_t *out) {
+    for (int i = 0; i < HASH_SHA1_SIZE; i++) {
+        unsigned int byte;
+        if (sscanf(hex + i * 2, "%2x", &byte) != 1)
+            return 1;
+        out[i] = byte;
+    }
+    return 0;
+}
+
+int hash_cache_load(HashCache *cache, const char *filepath) {
+    FILE *fp = fopen(filepath, "r");
+    if (!fp) {
+        if (errno != ENOENT)
+            perror("Could not open hash cache");
+        return 1;
+    }
+
+    char line[LINE_SIZE];
+    while (fgets(line, sizeof(line), fp)) {
+        line[strcspn(line, "\n")] = 0;
+
+        int64_t size, seconds;
+        long nanoseconds;
+        uint32_t crc32;
+        char sha1[HASH_SHA1_SIZE * 2 + 1];
+        int path_start = 0;
+        HashDigests digests;
+        if (sscanf(line, "%" SCNd64 " %" SCNd64 " %ld %" SCNx32 " %40s %n",
+                   &size, &seconds, &nanoseconds, &crc32, sha1,
+                   &path_start) < 5 ||
+            !path_start || !line[path_start] ||
+            parse_sha1(sha1, digests.sha1))
+            continue;
+        digests.crc32 = crc32;
+
+        HashCacheEntry *entry = add_entry(cache, line + path_start);
+        if (!entry)
+            break;
+        entry->size = size;
+        entry->modified_seconds = seconds;
+        entry->modified_nanoseconds = nanoseconds;
+        entry->digests = digests;
+    }
+
+    fclose(fp);
+    cache->dirty = 0;
+    return 0;
+}
+
+int hash_cache_save(HashCache *cache, const char *filepath) {
+    char *temp_filepath = malloc(strlen(filepath) + sizeof(".XXXXXX"));
+    if (!temp_filepath)
+        return 1;
+    sprintf(temp_filepath, "%s.XXXXXX", filepath);
+    int fd = mkstemp(temp_filepath);
+    FILE *fp = fd < 0 || fchmod(fd, 0644) ? 0 : fdopen(fd, "w");
+    if (!fp) {
+        perror("Could not open hash cache");
+        if (fd >= 0) {
+            close(fd);
+            remove(temp_filepath);
+        }
+        free(temp_filepath);
+        return 1;
+    }
+
+    for (int i = 0; i < cache->count; i++) {
+        HashCacheEntry *entry = &cache->entries[i];
+        fprintf(fp, "%" PRId64 " %" PRId64 " %ld %08" PRIx32 " ", entry->size,
+                entry->modified_seconds, entry->modified_nanoseconds,
+                entry->digests.crc32);
+        for (int j = 0; j < HASH_SHA1_SIZE; j++)
+            fprintf(fp, "%02x", entry->digests.sha1[j]);
+        fprintf(fp, " %s\n", entry->path);
+    }
+
+    int failed = fclose(fp) || rename(temp_filepath, filepath);
+    if (failed) {
+        perror("Could not write hash cache");
+        remove(temp_filepath);
+    }
+    free(temp_filepath);
+    if (failed)
+        return 1;
+    cache->dirty = 0;
+    return 0;
+}
@@ -0,0 +1,54 @@
+// Digests of files hashed before, keyed by the path, size and modification
+// time of the file, so that files that haven't changed aren't hashed again.
+//
+// Stored as a text file with a line per file: size, modification time
+// (seconds and nanoseconds), CRC-32, SHA-1 and the path, separated by spaces.
+// Saving writes a new file and renames it over the old one, so instances
+// saving at the same time don't corrupt it, the last one wins.
+
+#ifndef _HASH_CACHE
+#define _HASH_CACHE
+
+#include "hash.h"
+#include <stdint.h>
+#include <sys/stat.h>
+
+typedef struct {
+    char *path;
+    int64_t size;
+    int64_t modified_seconds;
+    long modified_nanoseconds;
+    HashDigests digests;
+} HashCacheEntry;
+
+typedef struct HashCache {
+    HashCacheEntry *entries;
+    int count;
+    int capacity;
+    // Open addressing table from the hash of a path to its entry number plus
+    // one, 0 being empty. Twice the capacity in size, so at most half full.
+    int *index;
+    // Whether entries were added since the cache was loaded or saved
+    int dirty;
+} HashCache;
+
+void hash_cache_init(HashCache *cache);
+void hash_cache_free(HashCache *cache);
+
+// Returns 1 on failure. Loading also fails quietly if there is no file yet.
+int hash_cache_load(HashCache *cache, const char *filepath);
+int hash_cache_save(HashCache *cache, const char *filepath);
+
+// Looks up the digests of the file at `path`, with `stat` as it is now.
+//
+// Returns 1 if they aren't cached or the file has changed since.
+int hash_cache_find(HashCache *cache, const char *path,
+                    const struct stat *stat, HashDigests *out);
+
+// Caches the digests of the file at `path`, replacing any old ones.
+//
+// Returns 1 on failure.
+int hash_cache_store(HashCache *cache, const char *path,
+                     const struct stat *stat, const HashDigests *digests);
+
+#endif
@@ -0,0 +1,159 @@
+#include "host_stats.h"
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+static const char *subsystem_names[HOST_STATS_SUBSYSTEM_COUNT] = {
+    [HOST_STATS_CPU] = "cpu", [HOST_STATS_PPU] = "ppu",
+    [HOST_STATS_IO] = "io",   [HOST_STATS_DMA] = "dma",
+    [HOST_STATS_APU] = "apu", [HOST_STATS_PRESENT] = "present",
+};
+
+static uint64_t monotonic_ns(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1000000000ull + time.tv_nsec;
+}
+
+static uint64_t timestamp_ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return monotonic_ns();
+#endif
+}
+
+// Usable before `host_stats_init`, though the conversion to nanoseconds
+// starts off rough
+HostStats host_stats = {
+    .now_ticks = timestamp_ticks, .now_ns = monotonic_ns, .ns_per_tick = 1.0};
+
+int host_stats_enabled(void) {
+#ifdef HOST_STATS
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+void host_stats_init(HostStats *stats, uint64_t (*now_ticks)(void),
+                     uint64_t (*now_ns)(void)) {
+    memset(stats, 0, sizeof(HostStats));
+    stats->now_ticks = now_ticks ? now_ticks : timestamp_ticks;
+    stats->now_ns = now_ns ? now_ns : monotonic_ns;
+
+    stats->start_tick = stats->now_ticks();
+    stats->start_ns = stats->now_ns();
+    stats->last_tick = stats->start_tick;
+    atomic_store(&stats->ns_per_tick, 1.0);
+}
+
+uint64_t host_stats_now(HostStats *stats) {
+    return stats->now_ticks();
+}
+
+// Charges the time since the last event to the innermost subsystem (that fit
+// on the stack)
+static inline void charge(HostStats *stats) {
+    uint64_t now = stats->now_ticks();
+    int depth = stats->depth < HOST_STATS_MAX_DEPTH ? stats->depth
+                                                    : HOST_STATS_MAX_DEPTH;
+    if (depth)
+        stats->ticks[stats->stack[depth - 1]] += now - stats->last_tick;
+    stats->last_tick = now;
+}
+
+void host_stats_enter(HostStats *stats, HostStatsSubsystem subsystem) {
+    charge(stats);
+    if (stats->depth < HOST_STATS_MAX_DEPTH)
+        stats->stack[stats->depth] = subsystem;
+    stats->depth++;
+}
+
+void host_stats_leave(HostStats *stats) {
+    charge(stats);
+    if (stats->depth)
+        stats->depth--;
+}
+
+void host_stats_add(HostStats *stats, HostStatsSubsystem subsystem,
+                    uint64_t ticks) {
+    atomic_fetch_add_explicit(&stats->pending_ticks[subsystem], ticks,
+                              memory_order_relaxed);
+}
+
+void host_stats_end_frame(HostStats *stats) {
+    charge(stats);
+
+    for (int i = 0; i < HOST_STATS_SUBSYSTEM_COUNT; i++) {
+        uint64_t ticks = stats->ticks[i] +
+                         atomic_exchange_explicit(&stats->pending_ticks[i], 0,
+                                                  memory_order_relaxed);
+        stats->ticks[i] = 0;
+
+        atomic_store_explicit(&stats->last_frame_ticks[i], ticks,
+                              memory_order_relaxed);
+        atomic_fetch_add_explicit(&stats->total_ticks[i], ticks,
+                                  memory_order_relaxed);
+        if (ticks > atomic_load_explicit(&stats->max_ticks[i],
+                                         memory_order_relaxed))
+            atomic_store_explicit(&stats->max_ticks[i], ticks,
+                                  memory_order_relaxed);
+    }
+
+    // The longer it runs the more accurate the conversion
+    uint64_t elapsed_ticks = stats->last_tick - stats->start_tick;
+    uint64_t elapsed_ns = stats->now_ns() - stats->start_ns;
+    if (elapsed_ticks && elapsed_ns)
+        atomic_store(&stats->ns_per_tick, (double)elapsed_ns / elapsed_ticks);
+
+    atomic_fetch_add_explicit(&stats->frames, 1, memory_order_release);
+}
+
+void host_stats_get(HostStats *stats, HostStatsSnapshot *snapshot) {
+    snapshot->frames =
+        atomic_load_explicit(&stats->frames, memory_order_acquire);
+    double ns_per_tick = atomic_load(&stats->ns_per_tick);
+
+    for (int i = 0; i < HOST_STATS_SUBSYSTEM_COUNT; i++) {
+        snapshot->last_frame_ns[i] =
+            atomic_load_explicit(&stats->last_frame_ticks[i],
+                                 memory_order_relaxed) *
+            ns_per_tick;
+        snapshot->max_ns[i] =
+            atomic_load_explicit(&stats->max_ticks[i], memory_order_relaxed) *
+            ns_per_tick;
+        snapshot->average_ns[i] =
+            snapshot->frames
+                ? atomic_load_explicit(&stats->total_ticks[i],
+                                       memory_order_relaxed) *
+                      ns_per_tick / snapshot->frames
+                : 0;
+    }
+}
+
+const char *host_stats_subsystem_name(HostStatsSubsystem subsystem) {
+    return subsystem_names[subsystem];
+}
+
+void host_stats_write_json(HostStats *stats, FILE *fp) {
+    HostStatsSnapshot snapshot;
+    host_stats_get(stats, &snapshot);
+
+    fprintf(fp, "{\n  \"frames\": %llu,\n  \"subsystems\": {\n",
+            (unsigned long long)snapshot.frames);
+    for (int i = 0; i < HOST_STATS_SUBSYSTEM_COUNT; i++)
+        fprintf(fp,
+                "    \"%s\": {\"average_ns\": %.0f, \"max_ns\": %.0f, "
+                "\"last_frame_ns\": %.0f}%s\n",
+                subsystem_names[i], snapshot.average_ns[i], snapshot.max_ns[i],
+                snapshot.last_frame_ns[i],
+                i < HOST_STATS_SUBSYSTEM_COUNT - 1 ? "," : "");
+    fprintf(fp, "  }\n}\n");
+}
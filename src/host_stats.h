@@ -0,0 +1,107 @@
+// Host-side instrumentation: how much real time the emulator spends in each of
+// its subsystems, per frame.
+//
+// Only compiled in when `HOST_STATS` is defined (see "make instrumented"),
+// otherwise the `HOST_STATS_ENTER`/`HOST_STATS_LEAVE` markers around the hot
+// paths are empty. Time is charged to the innermost subsystem entered, so a
+// PPU catch-up started from a register read counts for the PPU and not for
+// I/O, and CPU time is whatever's left of the frame.
+//
+// The emulation thread enters and leaves subsystems, other threads add their
+// time with `host_stats_add`. Timestamps come from the TSC where there is one
+// and are converted to nanoseconds against the monotonic clock as frames go
+// by.
+
+#ifndef _HOST_STATS
+#define _HOST_STATS
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define HOST_STATS_MAX_DEPTH 16
+
+typedef enum {
+    HOST_STATS_CPU,
+    HOST_STATS_PPU,
+    // Dispatch of reads and writes to 0x2000-0x401f
+    HOST_STATS_IO,
+    HOST_STATS_DMA,
+    HOST_STATS_APU,
+    // Uploading and showing frames, on the main thread
+    HOST_STATS_PRESENT,
+    HOST_STATS_SUBSYSTEM_COUNT,
+} HostStatsSubsystem;
+
+typedef struct {
+    uint64_t (*now_ticks)(void);
+    uint64_t (*now_ns)(void);
+
+    // Subsystems entered and not yet left, innermost last
+    HostStatsSubsystem stack[HOST_STATS_MAX_DEPTH];
+    int depth;
+    uint64_t last_tick;
+    // Ticks of the frame being measured
+    uint64_t ticks[HOST_STATS_SUBSYSTEM_COUNT];
+    // Added from other threads, collected at the end of the frame
+    _Atomic uint64_t pending_ticks[HOST_STATS_SUBSYSTEM_COUNT];
+
+    uint64_t start_tick;
+    uint64_t start_ns;
+
+    // Published at the end of every frame, readable from any thread
+    _Atomic double ns_per_tick;
+    _Atomic uint64_t frames;
+    _Atomic uint64_t last_frame_ticks[HOST_STATS_SUBSYSTEM_COUNT];
+    _Atomic uint64_t total_ticks[HOST_STATS_SUBSYSTEM_COUNT];
+    _Atomic uint64_t max_ticks[HOST_STATS_SUBSYSTEM_COUNT];
+} HostStats;
+
+typedef struct {
+    uint64_t frames;
+    // Host time in each subsystem, in nanoseconds
+    double last_frame_ns[HOST_STATS_SUBSYSTEM_COUNT];
+    double average_ns[HOST_STATS_SUBSYSTEM_COUNT];
+    double max_ns[HOST_STATS_SUBSYSTEM_COUNT];
+} HostStatsSnapshot;
+
+// The instance the instrumented subsystems report to
+extern HostStats host_stats;
+
+#ifdef HOST_STATS
+#define HOST_STATS_ENTER(subsystem) host_stats_enter(&host_stats, subsystem)
+#define HOST_STATS_LEAVE() host_stats_leave(&host_stats)
+#else
+#define HOST_STATS_ENTER(subsystem)
+#define HOST_STATS_LEAVE()
+#endif
+
+// Whether the build is instrumented.
+int host_stats_enabled(void);
+
+// Starts measuring. The clocks are for testing, null uses the real ones.
+void host_stats_init(HostStats *stats, uint64_t (*now_ticks)(void),
+                     uint64_t (*now_ns)(void));
+
+// Current timestamp of the clock `stats` runs on, for `host_stats_add`.
+uint64_t host_stats_now(HostStats *stats);
+
+void host_stats_enter(HostStats *stats, HostStatsSubsystem subsystem);
+void host_stats_leave(HostStats *stats);
+
+// Adds `ticks` to `subsystem` in the current frame, from any thread.
+void host_stats_add(HostStats *stats, HostStatsSubsystem subsystem,
+                    uint64_t ticks);
+
+// Closes the frame being measured and publishes it, call on the emulation
+// thread.
+void host_stats_end_frame(HostStats *stats);
+
+void host_stats_get(HostStats *stats, HostStatsSnapshot *snapshot);
+
+const char *host_stats_subsystem_name(HostStatsSubsystem subsystem);
+
+// Writes the statistics as a JSON object.
+void host_stats_write_json(HostStats *stats, FILE *fp);
+
+#endif
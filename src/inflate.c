@@ -0,0 +1,389 @@
+#include "inflate.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INPUT_SIZE 0x1000
+#define WINDOW_MASK (INFLATE_WINDOW_SIZE - 1)
+
+#define MAX_CODE_BITS 15
+#define LITERAL_LENGTH_CODES 288
+#define DISTANCE_CODES 30
+#define CODE_LENGTH_CODES 19
+#define END_OF_BLOCK 256
+
+// Codes up to this long are decoded with one table lookup, longer ones a bit
+// at a time
+#define FAST_BITS 9
+#define FAST_MASK ((1 << FAST_BITS) - 1)
+
+// Canonical Huffman code: how many codes there are of each length, and the
+// symbols ordered by code
+typedef struct {
+    short count[MAX_CODE_BITS + 1];
+    short symbol[LITERAL_LENGTH_CODES];
+    // Indexed by the next FAST_BITS bits of input: the symbol << 4 | the
+    // length of its code, 0 if the code is longer
+    uint16_t fast[1 << FAST_BITS];
+} Huffman;
+
+typedef struct {
+    InflateRead read;
+    void *read_context;
+    InflateWrite write;
+    void *write_context;
+
+    uint8_t input[INPUT_SIZE];
+    int input_position;
+    int input_size;
+    int input_ended;
+    // Bits not used yet, the next one lowest
+    uint32_t bit_buffer;
+    int bit_count;
+
+    uint8_t window[INFLATE_WINDOW_SIZE];
+    // Bytes decompressed, and handed to the writer
+    uint64_t total;
+    uint64_t flushed;
+
+    Huffman literal_length;
+    Huffman distance;
+    int error;
+} Inflate;
+
+static const short length_base[29] = {
+    3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+    31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const short length_extra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1,
+                                       1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+                                       4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const short distance_base[DISTANCE_CODES] = {
+    1,    2,    3,    4,    5,    7,     9,     13,    17,  25,
+    33,   49,   65,   97,   129,  193,   257,   385,   513, 769,
+    1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const short distance_extra[DISTANCE_CODES] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6,
+    6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+// Order the code length code lengths are stored in
+static const uint8_t code_length_order[CODE_LENGTH_CODES] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+// ----- Input -----
+
+// Returns 1 at the end of the input.
+static int refill(Inflate *inflate) {
+    if (inflate->input_ended)
+        return 1;
+
+    int size = inflate->read(inflate->read_context, inflate->input, INPUT_SIZE);
+    if (size <= 0) {
+        inflate->input_ended = 1;
+        if (size < 0)
+            inflate->error = 1;
+        return 1;
+    }
+    inflate->input_position = 0;
+    inflate->input_size = size;
+    return 0;
+}
+
+// Tops the bit buffer up to `count` bits, or as many as are left.
+static inline void fill(Inflate *inflate, int count) {
+    while (inflate->bit_count < count) {
+        if (inflate->input_position == inflate->input_size && refill(inflate))
+            return;
+        uint32_t byte = inflate->input[inflate->input_position++];
+        inflate->bit_buffer |= byte << inflate->bit_count;
+        inflate->bit_count += 8;
+    }
+}
+
+// Takes the next `count` bits, up to 16. Running out of input is an error.
+static inline int bits(Inflate *inflate, int count) {
+    fill(inflate, count);
+    if (inflate->bit_count < count) {
+        inflate->error = 1;
+        return 0;
+    }
+
+    int value = inflate->bit_buffer & ((1u << count) - 1);
+    inflate->bit_buffer >>= count;
+    inflate->bit_count -= count;
+    return value;
+}
+
+// ----- Output -----
+
+static void flush(Inflate *inflate) {
+    if (inflate->total == inflate->flushed)
+        return;
+
+    int start = inflate->flushed & WINDOW_MASK;
+    int end = inflate->total & WINDOW_MASK;
+    if (!end)
+        end = INFLATE_WINDOW_SIZE;
+    if (inflate->write(inflate->write_context, inflate->window + start,
+                       end - start))
+        inflate->error = 1;
+    inflate->flushed = inflate->total;
+}
+
+static inline void put(Inflate *inflate, uint8_t byte) {
+    inflate->window[inflate->total++ & WINDOW_MASK] = byte;
+    // Whenever the window fills up, so the unflushed part never wraps around
+    if (!(inflate->total & WINDOW_MASK))
+        flush(inflate);
+}
+
+// ----- Huffman codes -----
+
+// Builds the code with `lengths[symbol]` bit codes for `count` symbols.
+//
+// Returns 0 for a complete code, negative if there are too many codes of
+// some length and positive if there are too few.
+static int construct(Huffman *huffman, const short *lengths, int count) {
+    memset(huffman->count, 0, sizeof(huffman->count));
+    for (int symbol = 0; symbol < count; symbol++)
+        huffman->count[lengths[symbol]]++;
+    memset(huffman->fast, 0, sizeof(huffman->fast));
+    if (huffman->count[0] == count)
+        return 0;
+
+    int left = 1;
+    for (int length = 1; length <= MAX_CODE_BITS; length++) {
+        left <<= 1;
+        left -= huffman->count[length];
+        if (left < 0)
+            return left;
+    }
+
+    short offsets[MAX_CODE_BITS + 1];
+    offsets[1] = 0;
+    for (int length = 1; length < MAX_CODE_BITS; length++)
+        offsets[length + 1] = offsets[length] + huffman->count[length];
+    for (int symbol = 0; symbol < count; symbol++)
+        if (lengths[symbol])
+            huffman->symbol[offsets[lengths[symbol]]++] = symbol;
+
+    // Codes are assigned in order of length and then symbol, and come in
+    // starting from their most significant bit
+    int code = 0, index = 0;
+    for (int length = 1; length <= FAST_BITS; length++) {
+        for (int i = 0; i < huffman->count[length]; i++, code++, index++) {
+            int reversed = 0;
+            for (int bit = 0; bit < length; bit++)
+                reversed |= (code >> bit & 1) << (length - 1 - bit);
+            uint16_t entry = huffman->symbol[index] << 4 | length;
+            for (int rest = reversed; rest < 1 << FAST_BITS;
+                 rest += 1 << length)
+                huffman->fast[rest] = entry;
+        }
+        code <<= 1;
+    }
+    return left;
+}
+
+static int decode(Inflate *inflate, const Huffman *huffman) {
+    fill(inflate, FAST_BITS);
+    if (inflate->bit_count >= FAST_BITS) {
+        uint16_t entry = huffman->fast[inflate->bit_buffer & FAST_MASK];
+        if (entry) {
+            inflate->bit_buffer >>= entry & 0xf;
+            inflate->bit_count -= entry & 0xf;
+            return entry >> 4;
+        }
+    }
+
+    int code = 0, first = 0, index = 0;
+    for (int length = 1; length <= MAX_CODE_BITS; length++) {
+        code |= bits(inflate, 1);
+        int count = huffman->count[length];
+        if (code - count < first)
+            return huffman->symbol[index + (code - first)];
+        index += count;
+        first = (first + count) << 1;
+        code <<= 1;
+    }
+    inflate->error = 1;
+    return 0;
+}
+
+// ----- Blocks -----
+
+static void stored_block(Inflate *inflate) {
+    // Starts at the next byte
+    inflate->bit_buffer >>= inflate->bit_count & 7;
+    inflate->bit_count &= ~7;
+
+    int length = bits(inflate, 16);
+    int complement = bits(inflate, 16);
+    if (length != (~complement & 0xffff)) {
+        inflate->error = 1;
+        return;
+    }
+    while (length-- && !inflate->error)
+        put(inflate, bits(inflate, 8));
+}
+
+static void compressed_block(Inflate *inflate) {
+    while (!inflate->error) {
+        int symbol = decode(inflate, &inflate->literal_length);
+        if (symbol < END_OF_BLOCK) {
+            put(inflate, symbol);
+            continue;
+        }
+        if (symbol == END_OF_BLOCK)
+            return;
+
+        symbol -= END_OF_BLOCK + 1;
+        if (symbol >= 29) {
+            inflate->error = 1;
+            return;
+        }
+        int length = length_base[symbol] +
+                     bits(inflate, length_extra[symbol]);
+
+        symbol = decode(inflate, &inflate->distance);
+        if (symbol >= DISTANCE_CODES) {
+            inflate->error = 1;
+            return;
+        }
+        uint32_t distance = distance_base[symbol] +
+                            bits(inflate, distance_extra[symbol]);
+        if (distance > inflate->total) {
+            inflate->error = 1;
+            return;
+        }
+
+        while (length--)
+            put(inflate,
+                inflate->window[(inflate->total - distance) & WINDOW_MASK]);
+    }
+}
+
+static void fixed_block(Inflate *inflate) {
+    short lengths[LITERAL_LENGTH_CODES];
+    int symbol = 0;
+    for (; symbol < 144; symbol++)
+        lengths[symbol] = 8;
+    for (; symbol < 256; symbol++)
+        lengths[symbol] = 9;
+    for (; symbol < 280; symbol++)
+        lengths[symbol] = 7;
+    for (; symbol < LITERAL_LENGTH_CODES; symbol++)
+        lengths[symbol] = 8;
+    construct(&inflate->literal_length, lengths, LITERAL_LENGTH_CODES);
+
+    for (symbol = 0; symbol < DISTANCE_CODES; symbol++)
+        lengths[symbol] = 5;
+    construct(&inflate->distance, lengths, DISTANCE_CODES);
+
+    compressed_block(inflate);
+}
+
+static void dynamic_block(Inflate *inflate) {
+    int literal_length_count = bits(inflate, 5) + 257;
+    int distance_count = bits(inflate, 5) + 1;
+    int code_length_count = bits(inflate, 4) + 4;
+    if (literal_length_count > 286 || distance_count > DISTANCE_CODES) {
+        inflate->error = 1;
+        return;
+    }
+
+    // The code the code lengths of the other two codes are in
+    short lengths[LITERAL_LENGTH_CODES + DISTANCE_CODES] = {0};
+    for (int i = 0; i < code_length_count; i++)
+        lengths[code_length_order[i]] = bits(inflate, 3);
+    Huffman *code_lengths = &inflate->literal_length;
+    if (construct(code_lengths, lengths, CODE_LENGTH_CODES)) {
+        inflate->error = 1;
+        return;
+    }
+
+    int count = literal_length_count + distance_count;
+    for (int index = 0; index < count && !inflate->error;) {
+        int symbol = decode(inflate, code_lengths);
+        if (symbol < 16) {
+            lengths[index++] = symbol;
+            continue;
+        }
+
+        int length = 0, repeat;
+        if (symbol == 16) {
+            if (!index) {
+                inflate->error = 1;
+                return;
+            }
+            length = lengths[index - 1];
+            repeat = 3 + bits(inflate, 2);
+        } else if (symbol == 17)
+            repeat = 3 + bits(inflate, 3);
+        else
+            repeat = 11 + bits(inflate, 7);
+
+        if (index + repeat > count) {
+            inflate->error = 1;
+            return;
+        }
+        while (repeat--)
+            lengths[index++] = length;
+    }
+    if (inflate->error || !lengths[END_OF_BLOCK]) {
+        inflate->error = 1;
+        return;
+    }
+
+    // Incomplete codes are only allowed if they have a single code
+    int result = construct(&inflate->literal_length, lengths,
+                           literal_length_count);
+    if (result < 0 ||
+        (result && literal_length_count - inflate->literal_length.count[0] !=
+                       1)) {
+        inflate->error = 1;
+        return;
+    }
+    result = construct(&inflate->distance, lengths + literal_length_count,
+                       distance_count);
+    if (result < 0 ||
+        (result && distance_count - inflate->distance.count[0] != 1)) {
+        inflate->error = 1;
+        return;
+    }
+
+    compressed_block(inflate);
+}
+
+int inflate_stream(InflateRead read, void *read_context, InflateWrite write,
+                   void *write_context) {
+    Inflate *inflate = malloc(sizeof(Inflate));
+    if (!inflate)
+        return 1;
+    *inflate = (Inflate){.read = read,
+                         .read_context = read_context,
+                         .write = write,
+                         .write_context = write_context};
+
+    int last = 0;
+    while (!last && !inflate->error) {
+        last = bits(inflate, 1);
+        switch (bits(inflate, 2)) {
+        case 0:
+            stored_block(inflate);
+            break;
+        case 1:
+            fixed_block(inflate);
+            break;
+        case 2:
+            dynamic_block(inflate);
+            break;
+        default:
+            inflate->error = 1;
+        }
+    }
+    if (!inflate->error)
+        flush(inflate);
+
+    int error = inflate->error;
+    free(inflate);
+    return error;
+}
@@ -0,0 +1,36 @@
+// Inflate, decompression of raw deflate data (RFC 1951) as found in zip
+// files.
+//
+// Streams: compressed data is pulled from a reader a few KB at a time and
+// decompressed data pushed to a writer a window (32 KB) at a time, so neither
+// is ever held whole.
+
+#ifndef _INFLATE
+#define _INFLATE
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Size of the window back-references can reach into, and so the most data
+// handed to the writer at once
+#define INFLATE_WINDOW_SIZE 0x8000
+
+// Reads up to `size` bytes of compressed data into `buffer`.
+//
+// Returns how many were read, 0 at the end of the data or negative on
+// failure.
+typedef int (*InflateRead)(void *context, uint8_t *buffer, int size);
+
+// Takes `size` bytes of decompressed data.
+//
+// Returns 1 to stop decompressing.
+typedef int (*InflateWrite)(void *context, const uint8_t *data, size_t size);
+
+// Decompresses all of the deflate data from `read` into `write`.
+//
+// Returns 1 if the data is invalid or cut short, reading failed or the writer
+// stopped.
+int inflate_stream(InflateRead read, void *read_context, InflateWrite write,
+                   void *write_context);
+
+#endif
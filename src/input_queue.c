@@ -0,0 +1,33 @@
+#include "input_queue.h"
+#include "controller.h"
+#include "ring_buffer.h"
+#include <stdint.h>
+#include <stdio.h>
+
+int input_queue_init(InputQueue *queue) {
+    return ring_buffer_init(&queue->ring, queue->storage, sizeof(InputEvent),
+                            INPUT_QUEUE_CAPACITY);
+}
+
+int input_queue_push(InputQueue *queue, uint64_t cpu_cycle, uint8_t port,
+                     uint8_t buttons) {
+    if (port >= CONTROLLER_PORT_COUNT) {
+        fprintf(stderr, "ERROR: no controller port %d\n", port);
+        return 1;
+    }
+
+    InputEvent event = {
+        .cpu_cycle = cpu_cycle, .port = port, .buttons = buttons};
+    return ring_buffer_write(&queue->ring, &event, 1) != 1;
+}
+
+void input_queue_latch(InputQueue *queue, uint64_t cpu_cycle,
+                       Controller controllers[CONTROLLER_PORT_COUNT]) {
+    InputEvent event;
+
+    while (ring_buffer_peek(&queue->ring, &event, 1) &&
+           event.cpu_cycle <= cpu_cycle) {
+        controllers[event.port].buttons = event.buttons;
+        ring_buffer_read(&queue->ring, &event, 1);
+    }
+}
@@ -0,0 +1,45 @@
+// Queue of controller state changes, timestamped in emulated CPU cycles.
+//
+// Input can come from another thread (e.g. the front end's event loop) or
+// from a script, either way it's queued up and applied to the controllers
+// once its time has come, at a frame boundary. The queue is lock-free with
+// one producer and one consumer (see ring_buffer.h).
+
+#ifndef _INPUT_QUEUE
+#define _INPUT_QUEUE
+
+#include "controller.h"
+#include "ring_buffer.h"
+#include <stdint.h>
+
+#define INPUT_QUEUE_CAPACITY 256
+
+typedef struct {
+    // CPU cycle from which on the buttons are held
+    uint64_t cpu_cycle;
+    uint8_t port;
+    // See `ControllerButton`
+    uint8_t buttons;
+} InputEvent;
+
+typedef struct {
+    RingBuffer ring;
+    InputEvent storage[INPUT_QUEUE_CAPACITY];
+} InputQueue;
+
+// Returns 1 on failure.
+int input_queue_init(InputQueue *queue);
+
+// Queues `buttons` to be held on controller `port` from `cpu_cycle` on.
+// Events have to be pushed in the order of their timestamps. Producer only.
+//
+// Returns 1 if the queue is full.
+int input_queue_push(InputQueue *queue, uint64_t cpu_cycle, uint8_t port,
+                     uint8_t buttons);
+
+// Applies the events due by `cpu_cycle` to `controllers`, later ones stay
+// queued. Consumer only.
+void input_queue_latch(InputQueue *queue, uint64_t cpu_cycle,
+                       Controller controllers[CONTROLLER_PORT_COUNT]);
+
+#endif
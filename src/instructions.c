@@ -15,11 +15,18 @@ static inline uint16_t read_two_bytes(uint16_t address, Memory *memory) {
     return high << 8 | low;
 }
 
+// Whether `a` and `b` are on different 256 byte pages.
+static inline int crosses_page(uint16_t a, uint16_t b) {
+    return (a ^ b) >> 8 != 0;
+}
+
 // Gets final `memory` location of instruction parameter depending on the
-// `addressing_mode`.
+// `addressing_mode`. Sets `page_crossed` if indexing carried into the high
+// byte of the address.
 static uint16_t get_effective_address(AddressingMode addressing_mode,
                                       uint16_t instruction_address,
-                                      CPUContext *ctx, Memory *memory) {
+                                      CPUContext *ctx, Memory *memory,
+                                      int *page_crossed) {
     switch (addressing_mode) {
     case ACCUMULATOR:
     case IMPLIED:
@@ -42,25 +49,36 @@ static uint16_t get_effective_address(AddressingMode addressing_mode,
         return ctx->program_counter +
                (int8_t)memory_read(memory, instruction_address + 1);
     case ABSOLUTE_INDEXED_X:
-        return read_two_bytes(instruction_address + 1, memory) + ctx->x;
-    case ABSOLUTE_INDEXED_Y:
-        return read_two_bytes(instruction_address + 1, memory) + ctx->y;
+    case ABSOLUTE_INDEXED_Y: {
+        uint16_t base = read_two_bytes(instruction_address + 1, memory);
+        uint16_t address =
+            base + (addressing_mode == ABSOLUTE_INDEXED_X ? ctx->x : ctx->y);
+        *page_crossed = crosses_page(base, address);
+        return address;
+    }
     case INDIRECT_INDEXED: {
-        uint16_t address = memory_read(memory, instruction_address + 1);
-        return read_two_bytes(address, memory) + ctx->y;
+        uint16_t pointer = memory_read(memory, instruction_address + 1);
+        uint16_t base = read_two_bytes(pointer, memory);
+        *page_crossed = crosses_page(base, base + ctx->y);
+        return base + ctx->y;
     }
 
-    case INDEXED_INDIRECT:
-        fprintf(stderr, "Unsupported 6502 addressing mode %d\n",
-                addressing_mode);
-        abort();
+    case INDEXED_INDIRECT: {
+        // The pointer is in the zero page and wraps around within it
+        uint8_t pointer = memory_read(memory, instruction_address + 1) + ctx->x;
+        uint8_t low = memory_read(memory, pointer);
+        uint8_t high = memory_read(memory, (uint8_t)(pointer + 1));
+        return high << 8 | low;
+    }
     }
 
     return 0;
 }
 
-static inline void branch(uint16_t address, CPUContext *ctx) {
-    ctx->program_counter = address;
+static inline int branch(int taken, uint16_t address, CPUContext *ctx) {
+    if (taken)
+        ctx->program_counter = address;
+    return taken;
 }
 
 static void push_to_stack(uint8_t value, CPUContext *ctx, Memory *memory) {
@@ -78,19 +96,44 @@ static void compare(uint8_t a, uint8_t b, CPUContext *ctx) {
     ctx->status_register = temp.status_register;
 }
 
-void non_maskable_interrupt(CPUContext *ctx, Memory *memory) {
+// Pushes the program counter and the status register and jumps to the handler
+// at `vector`. BRK pushes the status with the B flag set, NMI and IRQ without.
+static void interrupt(CPUContext *ctx, Memory *memory, uint16_t vector,
+                      int from_brk) {
     // Push program counter to stack, high byte first
     push_to_stack(ctx->program_counter >> 8, ctx, memory);
     push_to_stack(ctx->program_counter & 0xff, ctx, memory);
 
     // Push status register
-    php(ctx, memory);
+    uint8_t status = ctx->status_register.value | 0b00100000;
+    if (from_brk)
+        status |= 0b00010000;
+    else
+        status &= ~0b00010000;
+    push_to_stack(status, ctx, memory);
+    ctx->status_register.irq_disable = 1;
+
+    // Read handler vector
+    uint16_t handler_address =
+        memory_read(memory, vector + 1) << 8 | memory_read(memory, vector);
 
-    // Read nmi handler vector
-    uint16_t nmi_handler_address =
-        memory_read(memory, 0xfffb) << 8 | memory_read(memory, 0xfffa);
+    ctx->program_counter = handler_address;
 
-    ctx->program_counter = nmi_handler_address;
+    if (ctx->profiler) {
+        ProfilerInterrupt taken = from_brk          ? PROFILER_BRK
+                                  : vector == 0xfffa ? PROFILER_NMI
+                                                     : PROFILER_IRQ;
+        profiler_enter(ctx->profiler, handler_address, taken,
+                       memory->cpu_cycle);
+    }
+}
+
+void non_maskable_interrupt(CPUContext *ctx, Memory *memory) {
+    interrupt(ctx, memory, 0xfffa, 0);
+}
+
+void interrupt_request(CPUContext *ctx, Memory *memory) {
+    interrupt(ctx, memory, 0xfffe, 0);
 }
 
 // ----- Instructions -----
@@ -119,6 +162,10 @@ void cli(CPUContext *ctx) {
     ctx->status_register.irq_disable = 0;
 }
 
+void clv(CPUContext *ctx) {
+    ctx->status_register.overflow = 0;
+}
+
 void lda(uint8_t param, CPUContext *ctx) {
     ctx->a = param;
 }
@@ -165,6 +212,12 @@ void ora(uint8_t param, CPUContext *ctx) {
     ctx->status_register.negative = (ctx->a & 0b10000000) > 0;
 }
 
+void eor(uint8_t param, CPUContext *ctx) {
+    ctx->a ^= param;
+    ctx->status_register.zero = ctx->a == 0;
+    ctx->status_register.negative = (ctx->a & 0b10000000) > 0;
+}
+
 void jmp(uint16_t address, CPUContext *ctx) {
     ctx->program_counter = address;
 }
@@ -223,18 +276,26 @@ void sty(uint16_t address, CPUContext *ctx, Memory *memory) {
 
 void dex(CPUContext *ctx) {
     ctx->x--;
+    ctx->status_register.zero = ctx->x == 0;
+    ctx->status_register.negative = (ctx->x & 0b10000000) > 0;
 }
 
 void dey(CPUContext *ctx) {
     ctx->y--;
+    ctx->status_register.zero = ctx->y == 0;
+    ctx->status_register.negative = (ctx->y & 0b10000000) > 0;
 }
 
 void inx(CPUContext *ctx) {
     ctx->x++;
+    ctx->status_register.zero = ctx->x == 0;
+    ctx->status_register.negative = (ctx->x & 0b10000000) > 0;
 }
 
 void iny(CPUContext *ctx) {
     ctx->y++;
+    ctx->status_register.zero = ctx->y == 0;
+    ctx->status_register.negative = (ctx->y & 0b10000000) > 0;
 }
 
 void dec(uint16_t address, Memory *memory) {
@@ -263,24 +324,42 @@ void bit(uint8_t param, CPUContext *ctx) {
     ctx->status_register.zero = (param & ctx->a) == 0;
 }
 
-void bpl(uint16_t address, CPUContext *ctx) {
-    if (!ctx->status_register.negative)
-        branch(address, ctx);
+int bpl(uint16_t address, CPUContext *ctx) {
+    return branch(!ctx->status_register.negative, address, ctx);
+}
+
+int bne(uint16_t address, CPUContext *ctx) {
+    return branch(!ctx->status_register.zero, address, ctx);
+}
+
+int bcs(uint16_t address, CPUContext *ctx) {
+    return branch(ctx->status_register.carry, address, ctx);
 }
 
-void bne(uint16_t address, CPUContext *ctx) {
-    if (!ctx->status_register.zero)
-        branch(address, ctx);
+int bcc(uint16_t address, CPUContext *ctx) {
+    return branch(!ctx->status_register.carry, address, ctx);
 }
 
-void bcs(uint16_t address, CPUContext *ctx) {
-    if (ctx->status_register.carry)
-        branch(address, ctx);
+int beq(uint16_t address, CPUContext *ctx) {
+    return branch(ctx->status_register.zero, address, ctx);
 }
 
-void bcc(uint16_t address, CPUContext *ctx) {
-    if (!ctx->status_register.carry)
-        branch(address, ctx);
+int bmi(uint16_t address, CPUContext *ctx) {
+    return branch(ctx->status_register.negative, address, ctx);
+}
+
+int bvc(uint16_t address, CPUContext *ctx) {
+    return branch(!ctx->status_register.overflow, address, ctx);
+}
+
+int bvs(uint16_t address, CPUContext *ctx) {
+    return branch(ctx->status_register.overflow, address, ctx);
+}
+
+void brk(CPUContext *ctx, Memory *memory) {
+    // The byte after BRK is skipped, and can be used as a signature
+    ctx->program_counter++;
+    interrupt(ctx, memory, 0xfffe, 1);
 }
 
 void rti(CPUContext *ctx, Memory *memory) {
@@ -290,6 +369,9 @@ void rti(CPUContext *ctx, Memory *memory) {
     uint8_t high = pull_from_stack(ctx, memory);
 
     ctx->program_counter = high << 8 | low;
+
+    if (ctx->profiler)
+        profiler_leave(ctx->profiler, 1, memory->cpu_cycle);
 }
 
 void rts(CPUContext *ctx, Memory *memory) {
@@ -297,6 +379,9 @@ void rts(CPUContext *ctx, Memory *memory) {
     uint8_t high = pull_from_stack(ctx, memory);
 
     ctx->program_counter = high << 8 | low;
+
+    if (ctx->profiler)
+        profiler_leave(ctx->profiler, 0, memory->cpu_cycle);
 }
 
 void jsr(uint16_t address, CPUContext *ctx, Memory *memory) {
@@ -305,6 +390,9 @@ void jsr(uint16_t address, CPUContext *ctx, Memory *memory) {
     push_to_stack(ctx->program_counter & 0xff, ctx, memory);
 
     ctx->program_counter = address;
+
+    if (ctx->profiler)
+        profiler_enter(ctx->profiler, address, 0, memory->cpu_cycle);
 }
 
 void asl(uint16_t address, int using_accumulator, CPUContext *ctx,
@@ -335,21 +423,84 @@ void lsr(uint16_t address, int using_accumulator, CPUContext *ctx,
     memory_write(memory, address, value);
 }
 
-void instruction_execute(Instruction instruction, uint16_t instruction_address,
-                         CPUContext *ctx, Memory *memory) {
-    if (instruction.mneumonic == STA &&
-        instruction.addressing_mode == INDIRECT_INDEXED)
-        asm("int $3");
+// Sets the zero and negative flags after a rotate.
+static inline uint8_t rotated(uint8_t value, CPUContext *ctx) {
+    ctx->status_register.zero = value == 0;
+    ctx->status_register.negative = (value & 0b10000000) > 0;
+    return value;
+}
+
+void rol(uint16_t address, int using_accumulator, CPUContext *ctx,
+         Memory *memory) {
+    uint8_t value = using_accumulator ? ctx->a : memory_read(memory, address);
+    uint8_t carry = ctx->status_register.carry;
+    ctx->status_register.carry = (value & 0b10000000) > 0;
+    value = rotated(value << 1 | carry, ctx);
+
+    if (using_accumulator)
+        ctx->a = value;
+    else
+        memory_write(memory, address, value);
+}
+
+void ror(uint16_t address, int using_accumulator, CPUContext *ctx,
+         Memory *memory) {
+    uint8_t value = using_accumulator ? ctx->a : memory_read(memory, address);
+    uint8_t carry = ctx->status_register.carry;
+    ctx->status_register.carry = value & 0b00000001;
+    value = rotated(value >> 1 | carry << 7, ctx);
+
+    if (using_accumulator)
+        ctx->a = value;
+    else
+        memory_write(memory, address, value);
+}
+
+// Whether the instruction only reads its operand, and so takes a cycle more
+// when indexing crosses a page. Stores and read-modify-writes always take it.
+static inline int reads_operand(Mneumonic mneumonic) {
+    switch (mneumonic) {
+    case LDA:
+    case LDX:
+    case LDY:
+    case ADC:
+    case SBC:
+    case AND:
+    case ORA:
+    case EOR:
+    case CMP:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+int instruction_execute(Instruction instruction, uint16_t instruction_address,
+                        CPUContext *ctx, Memory *memory) {
+    int page_crossed = 0;
+    uint16_t effective_address =
+        get_effective_address(instruction.addressing_mode, instruction_address,
+                              ctx, memory, &page_crossed);
+
+    // Added to `Memory.cpu_cycle` as they are taken, so that the read is
+    // timestamped after the extra cycle
+    int extra_cycles = page_crossed && reads_operand(instruction.mneumonic);
+    memory->cpu_cycle += extra_cycles;
+    int taken = 0;
 
-    uint16_t effective_address = get_effective_address(
-        instruction.addressing_mode, instruction_address, ctx, memory);
+    // Jumps and branches only use the address, and reading what's there would
+    // make code look like data (see code_map.h)
+    int jumps = instruction.mneumonic == JMP || instruction.mneumonic == JSR ||
+                instruction.addressing_mode == RELATIVE;
 
     // TODO: do this separately in the instructions
     uint8_t param_value = 0;
-    if (effective_address != 0x2007)
+    if (effective_address != 0x2007 && !jumps)
         param_value = memory_read(memory, effective_address);
 
+#ifdef DEBUG
     printf("0x%x at 0x%x\n", param_value, effective_address);
+#endif
 
     switch (instruction.mneumonic) {
     case SEC:
@@ -458,16 +609,16 @@ void instruction_execute(Instruction instruction, uint16_t instruction_address,
         bit(param_value, ctx);
         break;
     case BPL:
-        bpl(effective_address, ctx);
+        taken = bpl(effective_address, ctx);
         break;
     case BNE:
-        bne(effective_address, ctx);
+        taken = bne(effective_address, ctx);
         break;
     case BCS:
-        bcs(effective_address, ctx);
+        taken = bcs(effective_address, ctx);
         break;
     case BCC:
-        bcc(effective_address, ctx);
+        taken = bcc(effective_address, ctx);
         break;
     case CMP:
         cmp(param_value, ctx);
@@ -481,6 +632,9 @@ void instruction_execute(Instruction instruction, uint16_t instruction_address,
     case RTI:
         rti(ctx, memory);
         break;
+    case BRK:
+        brk(ctx, memory);
+        break;
     case ORA:
         ora(param_value, ctx);
         break;
@@ -492,20 +646,43 @@ void instruction_execute(Instruction instruction, uint16_t instruction_address,
         lsr(effective_address, instruction.addressing_mode == ACCUMULATOR, ctx,
             memory);
         break;
-
-    case BRK:
-    case BVC:
-    case BVS:
-    case CLV:
-    case EOR:
-    case NOP:
     case ROL:
+        rol(effective_address, instruction.addressing_mode == ACCUMULATOR, ctx,
+            memory);
+        break;
     case ROR:
+        ror(effective_address, instruction.addressing_mode == ACCUMULATOR, ctx,
+            memory);
+        break;
+    case EOR:
+        eor(param_value, ctx);
+        break;
     case BEQ:
+        taken = beq(effective_address, ctx);
+        break;
     case BMI:
-        fprintf(stderr, "Unsupported 6502 instruction \"%s\"\n",
-                instruction.mneumonic_str);
-        abort();
+        taken = bmi(effective_address, ctx);
         break;
+    case BVC:
+        taken = bvc(effective_address, ctx);
+        break;
+    case BVS:
+        taken = bvs(effective_address, ctx);
+        break;
+    case CLV:
+        clv(ctx);
+        break;
+    case NOP:
+        break;
+    }
+
+    // A taken branch takes a cycle more, and another if it lands on another
+    // page
+    if (taken) {
+        int cycles = 1 + crosses_page(instruction_address + instruction.bytes,
+                                      effective_address);
+        memory->cpu_cycle += cycles;
+        extra_cycles += cycles;
     }
+    return extra_cycles;
 }
@@ -10,10 +10,16 @@
 
 // Executes an `Instruction` updating the `CPUContext` and `Memory`
 // appropriately.
-void instruction_execute(Instruction instruction, uint16_t instruction_address,
-                         CPUContext *ctx, Memory *memory);
+//
+// Returns the cycles it took on top of `Instruction.cycles`, for an indexed
+// read crossing a page or a branch being taken, which are already added to
+// `Memory.cpu_cycle`.
+int instruction_execute(Instruction instruction, uint16_t instruction_address,
+                        CPUContext *ctx, Memory *memory);
 
+// Jump into the NMI or IRQ handler, as the hardware interrupts do.
 void non_maskable_interrupt(CPUContext *ctx, Memory *memory);
+void interrupt_request(CPUContext *ctx, Memory *memory);
 
 // 6502 Instruction set:
 
@@ -29,6 +35,8 @@ void cld(CPUContext *ctx);
 void clc(CPUContext *ctx);
 // Clear interrupt disable flag.
 void cli(CPUContext *ctx);
+// Clear status register overflow flag.
+void clv(CPUContext *ctx);
 // Load into A register.
 void lda(uint8_t param, CPUContext *ctx);
 // Load into X register.
@@ -43,6 +51,8 @@ void sbc(uint8_t param, CPUContext *ctx);
 void and (uint8_t param, CPUContext *ctx);
 // OR memory with A register.
 void ora(uint8_t param, CPUContext *ctx);
+// Exclusive OR memory with A register.
+void eor(uint8_t param, CPUContext *ctx);
 // Set program counter to `address`.
 void jmp(uint16_t address, CPUContext *ctx);
 // Jump to subroutine (save return address and jump)
@@ -91,20 +101,30 @@ void dec(uint16_t address, Memory *memory);
 void inc(uint16_t address, Memory *memory);
 // Test bits
 void bit(uint8_t param, CPUContext *ctx);
-// Branch on status register flag negative == 0
-void bpl(uint16_t address, CPUContext *ctx);
-// Branch on status register flag zero == 0
-void bne(uint16_t address, CPUContext *ctx);
-// Branch on status register flag carry == 1
-void bcs(uint16_t address, CPUContext *ctx);
-// Branch on status register flag carry == 0
-void bcc(uint16_t address, CPUContext *ctx);
+// Branch on status register flag negative == 0, returns whether taken
+int bpl(uint16_t address, CPUContext *ctx);
+// Branch on status register flag zero == 0, returns whether taken
+int bne(uint16_t address, CPUContext *ctx);
+// Branch on status register flag carry == 1, returns whether taken
+int bcs(uint16_t address, CPUContext *ctx);
+// Branch on status register flag carry == 0, returns whether taken
+int bcc(uint16_t address, CPUContext *ctx);
+// Branch on status register flag zero == 1, returns whether taken
+int beq(uint16_t address, CPUContext *ctx);
+// Branch on status register flag negative == 1, returns whether taken
+int bmi(uint16_t address, CPUContext *ctx);
+// Branch on status register flag overflow == 0, returns whether taken
+int bvc(uint16_t address, CPUContext *ctx);
+// Branch on status register flag overflow == 1, returns whether taken
+int bvs(uint16_t address, CPUContext *ctx);
 // Compare memory with A register
 void cmp(uint8_t param, CPUContext *ctx);
 // Compare memory with X register
 void cpx(uint8_t param, CPUContext *ctx);
 // Compare memory with Y register
 void cpy(uint8_t param, CPUContext *ctx);
+// Software interrupt, into the IRQ handler
+void brk(CPUContext *ctx, Memory *memory);
 // Return from interrupt handler
 void rti(CPUContext *ctx, Memory *memory);
 // Arithmetic shift left, leftmost 'falling off' bit stored in carry bit
@@ -113,5 +133,11 @@ void asl(uint16_t address, int using_accumulator, CPUContext *ctx,
 // Logical shift right, rightmost 'falling off' bit stored in carry bit
 void lsr(uint16_t address, int using_accumulator, CPUContext *ctx,
          Memory *memory);
+// Rotate left through the carry bit
+void rol(uint16_t address, int using_accumulator, CPUContext *ctx,
+         Memory *memory);
+// Rotate right through the carry bit
+void ror(uint16_t address, int using_accumulator, CPUContext *ctx,
+         Memory *memory);
 
 #endif
@@ -1,40 +1,855 @@
-#include "cpu.h"
-#include "memory.h"
+#include "apu.h"
+#include "audio.h"
+#include "battery.h"
+#include "code_map.h"
+#include "controller.h"
+#include "debugger.h"
+#include "emulator.h"
+#include "gdb_stub.h"
+#include "hash.h"
+#include "hash_cache.h"
+#include "host_stats.h"
+#include "input_queue.h"
+#include "movie.h"
+#include "pacing.h"
 #include "ppu.h"
+#include "profiler.h"
+#include "rom_db.h"
 #include "rom_file.h"
+#include "stepper.h"
+#include "trace.h"
+#include "triple_buffer.h"
+#include <SDL3/SDL_audio.h>
+#include <SDL3/SDL_gamepad.h>
+#include <SDL3/SDL_keycode.h>
 #include <SDL3/SDL_oldnames.h>
 #include <SDL3/SDL_render.h>
 #include <SDL3/SDL_stdinc.h>
-#include <SDL3/SDL_surface.h>
+#include <SDL3/SDL_thread.h>
+#include <SDL3/SDL_timer.h>
 #include <SDL3/SDL_video.h>
-#include <assert.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #define SDL_MAIN_USE_CALLBACKS 1 /* use the callbacks instead of main() */
 #include <SDL3/SDL.h>
 #include <SDL3/SDL_main.h>
 
-#define CLOCK_CYCLES_PER_FRAME 29780
-
-static CPUContext ctx = {0, .program_counter = 0x8000};
-static Memory memory = {0};
+static Emulator emulator;
+// What the ROM file says about the cartridge, corrected by the game database
+// from `rom_db_filepath` if the ROM is in it
+static RomInfo rom_info;
+static char *rom_db_filepath = 0;
+// Takes stepping commands from stdin (see stepper.h), on with -step, which
+// starts out paused, and with breakpoints and watchpoints
 int step = 0;
+// Not running, only doing what's queued in `stepper`
+static atomic_int paused = 0;
 int headless = 0;
 
-SDL_Texture *framebuffer_texture = 0;
+// Window size as a multiple of the NES picture
+int window_scale = 3;
+// Scale to fill the window instead of by whole multiples
+int stretch = 0;
+// 1 for vsync, 0 for none, or `SDL_RENDERER_VSYNC_ADAPTIVE`
+int vsync = 1;
+double frame_rate = PACING_NTSC_RATE;
+// Frames rendered out of every `fast_forward_cycle` while fast-forwarding
+int fast_forward_render_count = 1;
+int fast_forward_cycle = 4;
+// Toggled from the main thread, picked up by the emulation thread
+static atomic_int fast_forward = 0;
 
 static SDL_Window *window = 0;
+static SDL_Renderer *renderer = 0;
+static SDL_Texture *framebuffer_texture = 0;
+
+static AudioOutput audio_output = {0};
+static SDL_AudioStream *audio_stream = 0;
+
+// The emulation thread renders into one of these while the main thread shows
+// another
+static uint32_t framebuffers[3][PPU_FRAMEBUFFER_LENGTH];
+static TripleBuffer frames;
+
+static SDL_Thread *emulation_thread = 0;
+// Set by the main thread to stop the emulation thread
+static atomic_int quit_requested = 0;
+// Set by the emulation thread when it stops on its own
+static atomic_int emulation_finished = 0;
+// Set by the main thread to press the reset button (F2)
+static atomic_int reset_requested = 0;
+
+// Input movie being recorded to or played back from `movie_filepath`
+static Movie movie;
+static char *movie_filepath = 0;
+static int recording = 0;
+static int playing = 0;
+
+// Runs the CPU alone from 0xc000, printing a nestest.log style trace or
+// comparing it to the golden log at `nestest_log_filepath`
+static int nestest = 0;
+static char *nestest_log_filepath = 0;
+
+static Stepper stepper;
+static SDL_Thread *command_thread = 0;
+
+// Breakpoints and watchpoints, pausing when hit
+static Debugger debugger;
+
+// GDB remote serial protocol stub, listening on `gdb_port` if set
+static GdbStub gdb_stub;
+static int gdb_port = 0;
+static int gdb_stub_running = 0;
+
+// Guest profile, written as folded stacks to `profile_filepath` on exit
+static Profiler *profiler = 0;
+static char *profile_filepath = 0;
+
+// Battery-backed PRG RAM of the ROM, saved to `battery_filepath` next to it
+static Battery battery;
+static char *battery_filepath = 0;
+
+// Code/data map of the ROM, cached in `code_map_filepath` next to it. Recorded
+// into while running with -code-map, or written out as a disassembly listing
+// to `disassembly_filepath`.
+static CodeMap code_map;
+static int code_map_requested = 0;
+static char *code_map_filepath = 0;
+static char *disassembly_filepath = 0;
+
+// Host time per subsystem, shown on screen (toggled with F1) and written as
+// JSON to `host_stats_filepath` or stdout on exit. Needs an instrumented build.
+static int show_host_stats = 0;
+static int host_stats_requested = 0;
+static char *host_stats_filepath = 0;
+
+// CPU cycle the emulation thread has got to, input is timestamped with it
+static _Atomic uint64_t emulated_cycle = 0;
+
+// Buttons held on each controller port, as last sent to the emulator
+static uint8_t held_buttons[CONTROLLER_PORT_COUNT] = {0};
+// Gamepads plugged into the controller ports
+static SDL_JoystickID gamepad_ids[CONTROLLER_PORT_COUNT] = {0};
+
+// Frames between pacing reports
+#define PACING_REPORT_INTERVAL 600
+
+// Samples handed to SDL at a time from the audio callback
+#define AUDIO_CALLBACK_CHUNK 256
+
+// Runs on SDL's audio thread whenever the device wants more samples.
+static void SDLCALL audio_callback(void *userdata, SDL_AudioStream *stream,
+                                   int additional_amount, int total_amount) {
+    int16_t samples[AUDIO_CALLBACK_CHUNK];
+    int remaining = additional_amount / (int)sizeof(int16_t);
+
+    while (remaining > 0) {
+        int count =
+            remaining < AUDIO_CALLBACK_CHUNK ? remaining : AUDIO_CALLBACK_CHUNK;
+        audio_pull(&audio_output, samples, count);
+        SDL_PutAudioStreamData(stream, samples, count * sizeof(int16_t));
+        remaining -= count;
+    }
+}
+
+static uint64_t clock_now(void *context) {
+    return SDL_GetTicksNS();
+}
+
+static void clock_sleep(void *context, uint64_t duration) {
+    SDL_DelayNS(duration);
+}
+
+static void report_pacing(Pacing *pacing) {
+    PacingStats stats;
+    pacing_get_stats(pacing, &stats);
+    SDL_Log("%.2f fps, frame time jitter p50 %.3f ms, p95 %.3f ms, p99 %.3f "
+            "ms",
+            stats.fps, stats.jitter_p50_ns / 1e6, stats.jitter_p95_ns / 1e6,
+            stats.jitter_p99_ns / 1e6);
+}
+
+// Feeds the movie with the input of the frame about to be emulated, or the
+// other way around.
+//
+// Returns 1 if the movie being played has ended.
+static int begin_movie_frame(void) {
+    uint8_t buttons[CONTROLLER_PORT_COUNT];
+    Controller *controllers = emulator.memory.controllers;
+
+    if (recording) {
+        for (int i = 0; i < CONTROLLER_PORT_COUNT; i++)
+            buttons[i] = controllers[i].buttons;
+        movie_record_frame(&movie, buttons);
+    }
+
+    if (playing) {
+        if (movie_next_frame(&movie, buttons))
+            return 1;
+        for (int i = 0; i < CONTROLLER_PORT_COUNT; i++)
+            controllers[i].buttons = buttons[i];
+    }
+    return 0;
+}
+
+// Whether the movie needs a framebuffer hash at the end of `frame`.
+static int movie_needs_checkpoint(uint32_t frame) {
+    if (recording)
+        return (frame + 1) % MOVIE_CHECKPOINT_INTERVAL == 0;
+    if (playing)
+        return movie_has_checkpoint(&movie, frame);
+    return 0;
+}
+
+static void end_movie_frame(uint32_t frame, uint32_t *framebuffer) {
+    uint64_t hash = hash_fnv1a(HASH_FNV1A_INITIAL, framebuffer,
+                               PPU_FRAMEBUFFER_LENGTH * sizeof(uint32_t));
+    if (recording)
+        movie_add_checkpoint(&movie, frame, hash);
+    if (playing)
+        movie_verify_checkpoint(&movie, frame, hash);
+}
+
+static void print_position(void) {
+    char line[TRACE_LINE_SIZE];
+    trace_format(&emulator.cpu_ctx, &emulator.memory, line);
+    printf("%s\n", line);
+}
+
+// Prints why the debugger stopped and where the CPU is, and clears the stop.
+static void report_stop(void) {
+    char description[64];
+    debugger_describe_stop(&debugger, description, sizeof(description));
+    printf("\n%s\n", description);
+    print_position();
+
+    debugger_resume(&debugger, emulator.cpu_ctx.program_counter);
+}
+
+// Applies a breakpoint or watchpoint command, see `debugger_parse_command`.
+//
+// Returns 1 if it isn't one.
+static int apply_debugger_command(char *line) {
+    DebuggerCommand command;
+    if (debugger_parse_command(line, &command))
+        return 1;
+
+    if (debugger_apply_command(&debugger, &command))
+        printf("Too many watchpoints\n");
+    if (command.type == DEBUGGER_COMMAND_BREAK && code_map_filepath &&
+        code_map_flags(&code_map, &emulator.memory, command.address) &
+            (CODE_MAP_OPERAND | CODE_MAP_DATA))
+        printf("Note: $%04X looks like data or the middle of an instruction\n",
+               command.address);
+    return 0;
+}
+
+static void report_exit(void) {
+    printf("\nExited after %llu frames and %llu CPU cycles, %s\n",
+           (unsigned long long)emulator.memory.ppu_ctx.frame_count,
+           (unsigned long long)emulator.memory.cpu_cycle,
+           emulator_exit_reason_name(emulator.exit_reason));
+    if (emulator.exit_reason == EMULATOR_EXIT_BUS_FAULT)
+        printf("Address: 0x%04x\n", emulator.memory.bus_fault_address);
+    print_position();
+}
+
+// Reads stepping commands from stdin and queues them for the emulation
+// thread, so that it never waits for input itself.
+static int SDLCALL read_commands(void *data) {
+    char line[64];
+    StepperCommand command;
+
+    while (fgets(line, sizeof(line), stdin)) {
+        line[strcspn(line, "\r\n")] = 0;
+        if (stepper_parse(line, &command)) {
+            printf("Unknown command: %s\n", line);
+            continue;
+        }
+        if (stepper_push(&stepper, &command))
+            printf("Too many commands queued, dropped: %s\n", line);
+    }
+
+    command = (StepperCommand){.type = STEPPER_QUIT};
+    while (stepper_push(&stepper, &command))
+        SDL_Delay(10);
+    return 0;
+}
+
+// Carries out a command that doesn't run the emulator.
+//
+// Returns 1 to quit.
+static int apply_command(StepperCommand *command) {
+    switch (command->type) {
+    case STEPPER_QUIT:
+        return 1;
+    case STEPPER_CONTINUE:
+        debugger_resume(&debugger, emulator.cpu_ctx.program_counter);
+        atomic_store(&paused, 0);
+        return 0;
+    case STEPPER_PAUSE:
+        atomic_store(&paused, 1);
+        print_position();
+        return 0;
+    case STEPPER_DEBUGGER:
+        if (apply_debugger_command(command->text))
+            printf("Invalid command: %s\n", command->text);
+        return 0;
+    default:
+        return 0;
+    }
+}
+
+// Picks up commands queued while running. Ones that step pause first.
+//
+// Returns 1 to quit.
+static int poll_commands(void) {
+    StepperCommand command;
+    while (!stepper_peek(&stepper, &command)) {
+        if (stepper_runs(&command)) {
+            atomic_store(&paused, 1);
+            return 0;
+        }
+        stepper_pop(&stepper, &command);
+        if (apply_command(&command))
+            return 1;
+    }
+    return 0;
+}
+
+// Shows the frame being stepped through as far as it has been drawn.
+//
+// Returns the buffer to go on drawing into.
+static uint32_t *publish_partial_frame(uint32_t *framebuffer) {
+    uint32_t *back = triple_buffer_publish(&frames);
+    memcpy(back, framebuffer, PPU_FRAMEBUFFER_LENGTH * sizeof(uint32_t));
+    return back;
+}
+
+// Hands the stopped emulator over to the GDB client until it continues,
+// stepping for it in between.
+//
+// Returns 1 if the CPU requested to exit.
+static int serve_gdb(uint32_t *framebuffer) {
+    while (gdb_stub_serve(&gdb_stub, &emulator) == GDB_STUB_STEP) {
+        if (emulator_step(&emulator, framebuffer) == EMULATOR_EXITED)
+            return 1;
+    }
+    return 0;
+}
+
+// Runs the emulator frame after frame, handing every finished frame and its
+// audio over to the main thread and SDL's audio thread.
+static int SDLCALL run_emulation(void *data) {
+    uint32_t *framebuffer = triple_buffer_back(&frames);
+
+    Pacing pacing;
+    pacing_init(&pacing, frame_rate, clock_now, clock_sleep, 0);
+    // Nothing to keep up with without a window, go as fast as possible
+    if (headless)
+        pacing_set_fast_forward(&pacing, 1, 0, 1);
+
+    // Frames since the movie started
+    uint32_t movie_frame = 0;
+
+    while (!atomic_load(&quit_requested)) {
+        if (gdb_stub_running)
+            gdb_stub_poll(&gdb_stub);
+        if (atomic_exchange(&reset_requested, 0))
+            emulator_reset(&emulator);
+
+        uint64_t frame = emulator.memory.ppu_ctx.frame_count;
+        int render = !headless && pacing_should_render(&pacing);
+
+        if (begin_movie_frame())
+            break;
+        int checkpoint = movie_needs_checkpoint(movie_frame);
+        render |= checkpoint;
+
+        if (step && poll_commands())
+            break;
+
+        if (atomic_load(&paused)) {
+            StepperCommand command;
+            if (stepper_pop(&stepper, &command)) {
+                SDL_Delay(1);
+                continue;
+            }
+            if (!stepper_runs(&command)) {
+                if (apply_command(&command))
+                    break;
+                continue;
+            }
+
+            int result = stepper_run(&command, &emulator, framebuffer);
+            if (result == EMULATOR_STOPPED)
+                report_stop();
+            else if (result)
+                break;
+            else
+                print_position();
+
+            if (emulator.memory.ppu_ctx.frame_count == frame) {
+                if (!headless)
+                    framebuffer = publish_partial_frame(framebuffer);
+                continue;
+            }
+        } else {
+            int result =
+                emulator_run_frame(&emulator, render ? framebuffer : 0);
+            if (result == EMULATOR_STOPPED && gdb_stub_attached(&gdb_stub)) {
+                if (serve_gdb(framebuffer))
+                    break;
+                continue;
+            }
+            if (result == EMULATOR_STOPPED) {
+                report_stop();
+                atomic_store(&paused, 1);
+                continue;
+            }
+            if (result)
+                break;
+        }
+
+        atomic_store(&emulated_cycle, emulator.memory.cpu_cycle);
+        if (checkpoint)
+            end_movie_frame(movie_frame, framebuffer);
+        movie_frame++;
+        if (render)
+            framebuffer = triple_buffer_publish(&frames);
+        if (audio_stream)
+            audio_push_frame(&audio_output, &emulator.memory.apu);
+
+        if (atomic_load(&paused))
+            continue;
+
+        int fast_forward_requested = atomic_load(&fast_forward);
+        if (!headless && fast_forward_requested != pacing.fast_forward)
+            pacing_set_fast_forward(&pacing, fast_forward_requested,
+                                    fast_forward_render_count,
+                                    fast_forward_cycle);
+
+        pacing_end_frame(&pacing);
+        if (pacing.frame_index % PACING_REPORT_INTERVAL == 0)
+            report_pacing(&pacing);
+    }
+
+    if (emulator.exit_reason != EMULATOR_EXIT_NONE)
+        report_exit();
+    atomic_store(&emulation_finished, 1);
+    return 0;
+}
+
+// Draws the host time of the last frame and the average per subsystem, in
+// milliseconds, over the picture.
+static void draw_host_stats(void) {
+    HostStatsSnapshot snapshot;
+    host_stats_get(&host_stats, &snapshot);
+
+    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+    SDL_RenderDebugText(renderer, 4, 4, "       last   avg");
+    for (int i = 0; i < HOST_STATS_SUBSYSTEM_COUNT; i++) {
+        char line[32];
+        snprintf(line, sizeof(line), "%-7s%5.2f %5.2f",
+                 host_stats_subsystem_name(i),
+                 snapshot.last_frame_ns[i] / 1000000,
+                 snapshot.average_ns[i] / 1000000);
+        SDL_RenderDebugText(renderer, 4, 4 + (i + 1) * 10, line);
+    }
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+}
+
+// Uploads the newest finished frame to the texture and presents it, if there
+// is one. Scaling is left to the renderer.
+static void present_frame(void) {
+    if (!triple_buffer_consume(&frames)) {
+        SDL_Delay(1);
+        return;
+    }
+
+    uint64_t start = host_stats_now(&host_stats);
+
+    void *pixels;
+    int pitch;
+    if (!SDL_LockTexture(framebuffer_texture, 0, &pixels, &pitch)) {
+        SDL_Log("Couldn't lock texture: %s", SDL_GetError());
+        return;
+    }
+
+    uint32_t *frame = triple_buffer_front(&frames);
+    int row_size = PPU_VISIBLE_AREA_WIDTH * sizeof(uint32_t);
+    if (pitch == row_size) {
+        memcpy(pixels, frame, PPU_FRAMEBUFFER_LENGTH * sizeof(uint32_t));
+    } else {
+        for (int y = 0; y < PPU_VISIBLE_AREA_HEIGTH; y++)
+            memcpy((uint8_t *)pixels + y * pitch,
+                   frame + y * PPU_VISIBLE_AREA_WIDTH, row_size);
+    }
+    SDL_UnlockTexture(framebuffer_texture);
+
+    SDL_RenderClear(renderer);
+    SDL_RenderTexture(renderer, framebuffer_texture, 0, 0);
+    if (show_host_stats)
+        draw_host_stats();
+    SDL_RenderPresent(renderer);
+
+    if (host_stats_requested)
+        host_stats_add(&host_stats, HOST_STATS_PRESENT,
+                       host_stats_now(&host_stats) - start);
+}
 
 static void parse_flag(char *argument) {
     if (!strcmp("-step", argument)) {
         step = 1;
+        atomic_store(&paused, 1);
         return;
     }
     if (!strcmp("-headless", argument)) {
         headless = 1;
         return;
     }
+    if (!strncmp("-scale=", argument, 7)) {
+        window_scale = atoi(argument + 7);
+        if (window_scale < 1)
+            window_scale = 1;
+        return;
+    }
+    if (!strcmp("-stretch", argument)) {
+        stretch = 1;
+        return;
+    }
+    if (!strcmp("-vsync=off", argument)) {
+        vsync = SDL_RENDERER_VSYNC_DISABLED;
+        return;
+    }
+    if (!strcmp("-vsync=on", argument)) {
+        vsync = 1;
+        return;
+    }
+    if (!strncmp("-record=", argument, 8)) {
+        recording = 1;
+        movie_filepath = argument + 8;
+        return;
+    }
+    if (!strncmp("-play=", argument, 6)) {
+        playing = 1;
+        movie_filepath = argument + 6;
+        return;
+    }
+    if (!strcmp("-nestest", argument)) {
+        nestest = 1;
+        return;
+    }
+    if (!strncmp("-nestest=", argument, 9)) {
+        nestest = 1;
+        nestest_log_filepath = argument + 9;
+        return;
+    }
+    if (!strncmp("-profile=", argument, 9)) {
+        profile_filepath = argument + 9;
+        return;
+    }
+    if (!strncmp("-max-cycles=", argument, 12)) {
+        emulator.limits.max_cycles = strtoull(argument + 12, 0, 10);
+        return;
+    }
+    if (!strncmp("-max-frames=", argument, 12)) {
+        emulator.limits.max_frames = strtoull(argument + 12, 0, 10);
+        return;
+    }
+    if (!strcmp("-exit-on-idle", argument)) {
+        emulator.limits.exit_on_idle_loop = 1;
+        return;
+    }
+    if (!strncmp("-romdb=", argument, 7)) {
+        rom_db_filepath = argument + 7;
+        return;
+    }
+    if (!strcmp("-code-map", argument)) {
+        code_map_requested = 1;
+        return;
+    }
+    if (!strncmp("-disassemble=", argument, 13)) {
+        disassembly_filepath = argument + 13;
+        return;
+    }
+    if (!strcmp("-host-stats", argument)) {
+        host_stats_requested = 1;
+        return;
+    }
+    if (!strncmp("-host-stats=", argument, 12)) {
+        host_stats_requested = 1;
+        host_stats_filepath = argument + 12;
+        return;
+    }
+    if (!strncmp("-break=", argument, 7)) {
+        char *end;
+        unsigned long address = strtoul(argument + 7, &end, 16);
+        if (*end || end == argument + 7 || address > 0xffff)
+            fprintf(stderr, "Invalid breakpoint address: %s\n", argument + 7);
+        else
+            debugger_set_breakpoint(&debugger, address);
+        return;
+    }
+    // -watch=START[-END][:r|w|rw], addresses in hexadecimal
+    if (!strncmp("-watch=", argument, 7)) {
+        DebuggerWatchpoint watchpoint;
+        if (debugger_parse_watchpoint(argument + 7, &watchpoint))
+            fprintf(stderr, "Invalid watchpoint: %s\n", argument + 7);
+        else if (debugger_add_watchpoint(&debugger, watchpoint.start,
+                                         watchpoint.end, watchpoint.access))
+            fprintf(stderr, "Too many watchpoints\n");
+        return;
+    }
+    if (!strcmp("-gdb", argument)) {
+        gdb_port = GDB_STUB_DEFAULT_PORT;
+        return;
+    }
+    if (!strncmp("-gdb=", argument, 5)) {
+        gdb_port = atoi(argument + 5);
+        return;
+    }
+    if (!strcmp("-pal", argument)) {
+        frame_rate = PACING_PAL_RATE;
+        return;
+    }
+    // -fast-forward=N/M, start fast-forwarding rendering N out of every M
+    // frames
+    if (!strncmp("-fast-forward", argument, 13)) {
+        sscanf(argument + 13, "=%d/%d", &fast_forward_render_count,
+               &fast_forward_cycle);
+        atomic_store(&fast_forward, 1);
+        return;
+    }
+    if (!strcmp("-vsync=adaptive", argument)) {
+        vsync = SDL_RENDERER_VSYNC_ADAPTIVE;
+        return;
+    }
+}
+
+// Opens the window and the audio device.
+//
+// Returns 1 on failure.
+static int setup_presentation(void) {
+    // Setup graphics window
+
+    if (!SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_GAMEPAD)) {
+        SDL_Log("Couldn't initialize SDL: %s", SDL_GetError());
+        return 1;
+    }
+
+    if (!SDL_CreateWindowAndRenderer(
+            "NES emulator", PPU_VISIBLE_AREA_WIDTH * window_scale,
+            PPU_VISIBLE_AREA_HEIGTH * window_scale, SDL_WINDOW_RESIZABLE,
+            &window, &renderer)) {
+        SDL_Log("Couldn't create window: %s", SDL_GetError());
+        return 1;
+    }
+
+    // The renderer scales the NES picture to the window, so any window size
+    // costs the same on the CPU
+    SDL_SetRenderLogicalPresentation(
+        renderer, PPU_VISIBLE_AREA_WIDTH, PPU_VISIBLE_AREA_HEIGTH,
+        stretch ? SDL_LOGICAL_PRESENTATION_LETTERBOX
+                : SDL_LOGICAL_PRESENTATION_INTEGER_SCALE);
+
+    if (!SDL_SetRenderVSync(renderer, vsync))
+        SDL_Log("Couldn't set vsync mode %d: %s", vsync, SDL_GetError());
+
+    framebuffer_texture = SDL_CreateTexture(
+        renderer, SDL_PIXELFORMAT_XRGB8888, SDL_TEXTUREACCESS_STREAMING,
+        PPU_VISIBLE_AREA_WIDTH, PPU_VISIBLE_AREA_HEIGTH);
+    if (!framebuffer_texture) {
+        SDL_Log("Couldn't create texture: %s", SDL_GetError());
+        return 1;
+    }
+    SDL_SetTextureScaleMode(framebuffer_texture, SDL_SCALEMODE_NEAREST);
+
+    // Setup audio, the emulator keeps running without it
+
+    if (audio_init(&audio_output, APU_DEFAULT_SAMPLE_RATE))
+        return 1;
+
+    SDL_AudioSpec audio_spec = {.format = SDL_AUDIO_S16,
+                                .channels = 1,
+                                .freq = APU_DEFAULT_SAMPLE_RATE};
+    audio_stream =
+        SDL_OpenAudioDeviceStream(SDL_AUDIO_DEVICE_DEFAULT_PLAYBACK,
+                                  &audio_spec, audio_callback, 0);
+    if (audio_stream)
+        SDL_ResumeAudioStreamDevice(audio_stream);
+    else
+        SDL_Log("Couldn't open audio device: %s", SDL_GetError());
+
+    return 0;
+}
+
+static SDL_AppResult run_nestest(void) {
+    trace_start_nestest(&emulator);
+
+    if (!nestest_log_filepath) {
+        trace_compare(&emulator, 0, stdout);
+        return SDL_APP_SUCCESS;
+    }
+
+    // The golden log is streamed, not loaded
+    FILE *golden = fopen(nestest_log_filepath, "r");
+    if (!golden) {
+        perror("Could not open nestest log");
+        return SDL_APP_FAILURE;
+    }
+
+    int failed = trace_compare(&emulator, golden, 0);
+    fclose(golden);
+
+    if (failed)
+        return SDL_APP_FAILURE;
+    printf("Trace matches %s\n", nestest_log_filepath);
+    return SDL_APP_SUCCESS;
+}
+
+// Loads the code map cached next to the ROM, or analyzes the ROM if there is
+// none yet.
+//
+// Returns 1 on failure.
+static int open_code_map(const char *rom_filepath) {
+    code_map_filepath =
+        malloc(strlen(rom_filepath) + sizeof(CODE_MAP_FILE_SUFFIX));
+    if (!code_map_filepath || code_map_init(&code_map, &emulator.memory))
+        return 1;
+    sprintf(code_map_filepath, "%s%s", rom_filepath, CODE_MAP_FILE_SUFFIX);
+
+    if (!code_map_load(&code_map, code_map_filepath))
+        return 0;
+    return code_map_analyze(&code_map, &emulator.memory);
+}
+
+// Loads the save file of a battery-backed ROM, and keeps it up to date from
+// then on.
+//
+// Returns 1 on failure.
+static int open_battery(const char *rom_filepath) {
+    // Movies start from PRG RAM as it is at power-on
+    if (recording || playing) {
+        printf("Not using the save file while recording or playing a movie\n");
+        return 0;
+    }
+
+    battery_filepath =
+        malloc(strlen(rom_filepath) + sizeof(BATTERY_FILE_SUFFIX));
+    if (!battery_filepath)
+        return 1;
+    sprintf(battery_filepath, "%s%s", rom_filepath, BATTERY_FILE_SUFFIX);
+    if (battery_open(&battery, &emulator.memory, battery_filepath))
+        return 1;
+
+    emulator.memory.battery = &battery;
+    // Over what was saved there, which is kept in the save file regardless
+    if (rom_info.trainer)
+        memory_map_trainer(&emulator.memory);
+    return 0;
+}
+
+static SDL_AppResult write_disassembly(void) {
+    FILE *fp = fopen(disassembly_filepath, "w");
+    if (!fp) {
+        perror("Could not open disassembly file");
+        return SDL_APP_FAILURE;
+    }
+    code_map_write_listing(&code_map, &emulator.memory, fp);
+    fclose(fp);
+    printf("Disassembly written to %s\n", disassembly_filepath);
+
+    if (code_map.dirty && code_map_save(&code_map, code_map_filepath))
+        return SDL_APP_FAILURE;
+    return SDL_APP_SUCCESS;
+}
+
+// Path of the ROM hash cache in the user's cache directory, null if there is
+// no home directory. Has to be freed.
+static char *hash_cache_filepath(void) {
+    const char *name = "/nes-emulator-rom-hashes";
+    const char *directory = getenv("XDG_CACHE_HOME");
+    char *path = 0;
+    if (directory && *directory) {
+        path = malloc(strlen(directory) + strlen(name) + 1);
+        if (path)
+            sprintf(path, "%s%s", directory, name);
+        return path;
+    }
+
+    const char *home = getenv("HOME");
+    if (!home || !*home)
+        return 0;
+    path = malloc(strlen(home) + strlen("/.cache") + strlen(name) + 1);
+    if (!path)
+        return 0;
+    sprintf(path, "%s/.cache", home);
+    // Fails if it is there already, and otherwise saving the cache will
+    mkdir(path, 0700);
+    strcat(path, name);
+    return path;
+}
+
+static const char *mirroring_name(PPUMirroring mirroring) {
+    switch (mirroring) {
+    case PPU_MIRRORING_HORIZONTAL:
+        return "horizontal";
+    case PPU_MIRRORING_VERTICAL:
+        return "vertical";
+    case PPU_MIRRORING_FOUR_SCREEN:
+        return "four-screen";
+    default:
+        return "other";
+    }
+}
+
+static void print_rom_summary(void) {
+    static const char *timing_names[] = {"NTSC", "PAL", "NTSC/PAL", "Dendy"};
+    printf("ROM: %s%sCRC-32 %08X, %s, mapper %d, %s mirroring, %d KB PRG, "
+           "%d KB CHR\n",
+           rom_info.title, *rom_info.title ? ", " : "", rom_info.digests.crc32,
+           rom_info.nes_2_0 ? "NES 2.0" : "iNES", rom_info.mapper,
+           mirroring_name(rom_info.mirroring), rom_info.prg_rom_size / 1024,
+           rom_info.chr_rom_size / 1024);
+    if (rom_info.timing != ROM_TIMING_NTSC)
+        printf("     %s timing\n", timing_names[rom_info.timing]);
+    if (rom_info.corrected)
+        printf("     corrected by the game database\n");
+}
+
+// Reads the ROM, identifying it by its hashes, cached across runs, in the
+// game database if there is one.
+//
+// Returns 1 on failure.
+static int load_rom(char *rom_filepath) {
+    RomDatabase database = {0};
+    HashCache hash_cache;
+    hash_cache_init(&hash_cache);
+    RomFileOptions options = {.hash_cache = &hash_cache};
+    if (rom_db_filepath && !rom_db_load(&database, rom_db_filepath))
+        options.database = &database;
+
+    char *cache_filepath = hash_cache_filepath();
+    if (cache_filepath)
+        hash_cache_load(&hash_cache, cache_filepath);
+
+    int result =
+        rom_file_read(rom_filepath, &emulator.memory, &rom_info, &options);
+    if (!result && cache_filepath && hash_cache.dirty)
+        hash_cache_save(&hash_cache, cache_filepath);
+
+    free(cache_filepath);
+    hash_cache_free(&hash_cache);
+    rom_db_free(&database);
+    // The nestest trace goes to stdout
+    if (!result && !nestest)
+        print_rom_summary();
+    return result;
 }
 
 /* This function runs once at startup. */
@@ -43,6 +858,8 @@ SDL_AppResult SDL_AppInit(void **appstate, int argc, char *argv[]) {
 
     char *rom_filepath = 0;
 
+    debugger_init(&debugger, &emulator.memory);
+
     for (int i = 1; i < argc; i++) {
         if (*argv[i] == '-')
             parse_flag(argv[i]);
@@ -55,71 +872,305 @@ SDL_AppResult SDL_AppInit(void **appstate, int argc, char *argv[]) {
         return 1;
     }
 
-    if (rom_file_read(rom_filepath, &memory))
+    emulator_init(&emulator);
+
+    if (load_rom(rom_filepath))
         return 1;
 
+    if (nestest)
+        return run_nestest();
+
+    if ((code_map_requested || disassembly_filepath) &&
+        open_code_map(rom_filepath)) {
+        fprintf(stderr, "Could not set up the code map\n");
+        return SDL_APP_FAILURE;
+    }
+    if (disassembly_filepath)
+        return write_disassembly();
+
+    if (rom_info.battery && open_battery(rom_filepath))
+        fprintf(stderr, "Continuing without saving\n");
+
+    emulator_power_on(&emulator);
+    if (code_map_requested)
+        memory_set_code_map(&emulator.memory, &code_map);
+
+    if (profile_filepath) {
+        profiler = malloc(sizeof(Profiler));
+        profiler_init(profiler, emulator.memory.cpu_cycle);
+        emulator.cpu_ctx.profiler = profiler;
+    }
+
+    if (host_stats_requested && !host_stats_enabled()) {
+        fprintf(stderr, "Host statistics need an instrumented build, see "
+                        "\"make instrumented\"\n");
+        host_stats_requested = 0;
+    }
+    if (host_stats_requested) {
+        host_stats_init(&host_stats, 0, 0);
+        show_host_stats = !headless;
+    }
+
     printf("\n\n\n\n");
 
+    if (emulator.memory.debugger)
+        step = 1;
     if (step)
-        printf("Press enter to run one CPU tick... (q+enter to quit)");
+        printf("Commands, followed by enter: (nothing) or s [N] steps "
+               "instructions, cy N CPU cycles, l [N] scanlines, f [N] frames, "
+               "n to the next NMI, c continues, p pauses, b/db ADDR sets/"
+               "deletes a breakpoint, w/dw START[-END][:r|w|rw] a watchpoint, "
+               "q quits\n");
 
-    if (headless)
-        return SDL_APP_CONTINUE;
+    // Setup movie
 
-    // Setup graphics window
+    // Stopping would throw the movie off its frames
+    if ((recording || playing) &&
+        (step || gdb_port)) {
+        fprintf(stderr, "Movies can't be used in step mode or with "
+                        "breakpoints and watchpoints\n");
+        return SDL_APP_FAILURE;
+    }
+    if (recording)
+        movie_init(&movie, emulator.memory.rom_hash, 0);
+    if (playing && (movie_load(&movie, movie_filepath) ||
+                    movie_start_playback(&movie, &emulator)))
+        return SDL_APP_FAILURE;
 
-    if (!SDL_Init(SDL_INIT_VIDEO)) {
-        SDL_Log("Couldn't initialize SDL: %s", SDL_GetError());
+    if (!headless && setup_presentation())
         return SDL_APP_FAILURE;
+
+    if (gdb_port) {
+        if (gdb_stub_start(&gdb_stub, &debugger, gdb_port))
+            return SDL_APP_FAILURE;
+        gdb_stub_running = 1;
+        printf("GDB stub listening on localhost:%d\n", gdb_port);
     }
 
-    window = SDL_CreateWindow("NES emulator", PPU_VISIBLE_AREA_WIDTH,
-                              PPU_VISIBLE_AREA_HEIGTH, 0);
-    if (!window) {
-        SDL_Log("Couldn't create window: %s", SDL_GetError());
+    // Start emulating
+
+    void *buffers[] = {framebuffers[0], framebuffers[1], framebuffers[2]};
+    triple_buffer_init(&frames, buffers);
+
+    if (step) {
+        stepper_init(&stepper);
+        command_thread = SDL_CreateThread(read_commands, "commands", 0);
+        if (!command_thread) {
+            SDL_Log("Couldn't start command thread: %s", SDL_GetError());
+            return SDL_APP_FAILURE;
+        }
+    }
+
+    emulation_thread = SDL_CreateThread(run_emulation, "emulation", 0);
+    if (!emulation_thread) {
+        SDL_Log("Couldn't start emulation thread: %s", SDL_GetError());
         return SDL_APP_FAILURE;
     }
 
     return SDL_APP_CONTINUE;
 }
 
+static uint8_t keyboard_button(SDL_Keycode key) {
+    switch (key) {
+    case SDLK_X:
+        return CONTROLLER_BUTTON_A;
+    case SDLK_Z:
+        return CONTROLLER_BUTTON_B;
+    case SDLK_RSHIFT:
+        return CONTROLLER_BUTTON_SELECT;
+    case SDLK_RETURN:
+        return CONTROLLER_BUTTON_START;
+    case SDLK_UP:
+        return CONTROLLER_BUTTON_UP;
+    case SDLK_DOWN:
+        return CONTROLLER_BUTTON_DOWN;
+    case SDLK_LEFT:
+        return CONTROLLER_BUTTON_LEFT;
+    case SDLK_RIGHT:
+        return CONTROLLER_BUTTON_RIGHT;
+    }
+    return 0;
+}
+
+// Laid out like on the NES controller, B to the left of A
+static uint8_t gamepad_button(uint8_t button) {
+    switch (button) {
+    case SDL_GAMEPAD_BUTTON_EAST:
+        return CONTROLLER_BUTTON_A;
+    case SDL_GAMEPAD_BUTTON_SOUTH:
+        return CONTROLLER_BUTTON_B;
+    case SDL_GAMEPAD_BUTTON_BACK:
+        return CONTROLLER_BUTTON_SELECT;
+    case SDL_GAMEPAD_BUTTON_START:
+        return CONTROLLER_BUTTON_START;
+    case SDL_GAMEPAD_BUTTON_DPAD_UP:
+        return CONTROLLER_BUTTON_UP;
+    case SDL_GAMEPAD_BUTTON_DPAD_DOWN:
+        return CONTROLLER_BUTTON_DOWN;
+    case SDL_GAMEPAD_BUTTON_DPAD_LEFT:
+        return CONTROLLER_BUTTON_LEFT;
+    case SDL_GAMEPAD_BUTTON_DPAD_RIGHT:
+        return CONTROLLER_BUTTON_RIGHT;
+    }
+    return 0;
+}
+
+// Returns the controller port of a gamepad, or -1 if it has none.
+static int gamepad_port(SDL_JoystickID id) {
+    for (int i = 0; i < CONTROLLER_PORT_COUNT; i++)
+        if (gamepad_ids[i] == id)
+            return i;
+    return -1;
+}
+
+// Presses or releases `button` on `port` and sends the new state over to the
+// emulation thread.
+static void set_button(int port, uint8_t button, int down) {
+    // The movie has the controllers
+    if (!button || port < 0 || playing)
+        return;
+
+    uint8_t buttons = held_buttons[port];
+    if (down)
+        buttons |= button;
+    else
+        buttons &= ~button;
+    if (buttons == held_buttons[port])
+        return;
+
+    if (input_queue_push(&emulator.input, atomic_load(&emulated_cycle), port,
+                         buttons))
+        SDL_Log("Input queue full, dropped input");
+    else
+        held_buttons[port] = buttons;
+}
+
 SDL_AppResult SDL_AppEvent(void *appstate, SDL_Event *event) {
     if (event->type == SDL_EVENT_QUIT) {
         return SDL_APP_SUCCESS;
     }
+    // Tab toggles fast-forward
+    if (event->type == SDL_EVENT_KEY_DOWN && event->key.key == SDLK_TAB &&
+        !event->key.repeat) {
+        atomic_fetch_xor(&fast_forward, 1);
+    }
+    // F2 resets, except while a movie is recorded or played back, as movies
+    // only hold input
+    if (event->type == SDL_EVENT_KEY_DOWN && event->key.key == SDLK_F2 &&
+        !event->key.repeat && !recording && !playing) {
+        atomic_store(&reset_requested, 1);
+    }
+    // F1 toggles the host statistics overlay
+    if (event->type == SDL_EVENT_KEY_DOWN && event->key.key == SDLK_F1 &&
+        !event->key.repeat && host_stats_requested) {
+        show_host_stats = !show_host_stats;
+    }
+
+    // The keyboard plays controller 1
+    if (event->type == SDL_EVENT_KEY_DOWN || event->type == SDL_EVENT_KEY_UP)
+        set_button(0, keyboard_button(event->key.key), event->key.down);
+
+    if (event->type == SDL_EVENT_GAMEPAD_BUTTON_DOWN ||
+        event->type == SDL_EVENT_GAMEPAD_BUTTON_UP)
+        set_button(gamepad_port(event->gbutton.which),
+                   gamepad_button(event->gbutton.button),
+                   event->gbutton.down);
+
+    // Gamepads take the first free port
+    if (event->type == SDL_EVENT_GAMEPAD_ADDED) {
+        int port = gamepad_port(0);
+        if (port >= 0 && SDL_OpenGamepad(event->gdevice.which))
+            gamepad_ids[port] = event->gdevice.which;
+    }
+    if (event->type == SDL_EVENT_GAMEPAD_REMOVED) {
+        int port = gamepad_port(event->gdevice.which);
+        if (port >= 0) {
+            set_button(port, 0xff, 0);
+            gamepad_ids[port] = 0;
+        }
+    }
+
     return SDL_APP_CONTINUE;
 }
 
 SDL_AppResult SDL_AppIterate(void *appstate) {
-    SDL_Surface dummy_surface = {0};
-    SDL_Surface *surface = &dummy_surface;
-
-    if (!headless) {
-        surface = SDL_GetWindowSurface(window);
-        assert(surface);
-        assert(surface->pixels);
-        assert(surface->w == PPU_VISIBLE_AREA_WIDTH);
-        assert(surface->h == PPU_VISIBLE_AREA_HEIGTH);
-    }
-
-    for (int i = 0; i < CLOCK_CYCLES_PER_FRAME; i++) {
-        if (step) {
-            int character = getchar();
-            if (character == 'q')
-                return SDL_APP_SUCCESS;
-        }
+    if (atomic_load(&emulation_finished))
+        return playing && movie.checkpoints_failed ? SDL_APP_FAILURE
+                                                   : SDL_APP_SUCCESS;
 
-        int nmi_needed = 0;
-        ppu_tick(&memory.ppu_ctx, (uint32_t *)surface->pixels, &nmi_needed);
-        ppu_tick(&memory.ppu_ctx, (uint32_t *)surface->pixels, &nmi_needed);
-        ppu_tick(&memory.ppu_ctx, (uint32_t *)surface->pixels, &nmi_needed);
+    if (headless)
+        SDL_Delay(10);
+    else
+        present_frame();
+    return SDL_APP_CONTINUE;
+}
+
+static void write_profile(void) {
+    profiler_charge(profiler, emulator.memory.cpu_cycle);
 
-        cpu_tick(&ctx, &memory, nmi_needed);
+    FILE *fp = fopen(profile_filepath, "w");
+    if (!fp) {
+        perror("Could not write profile");
+        return;
     }
+    profiler_write_folded(profiler, fp);
+    fclose(fp);
 
-    if (!headless)
-        SDL_UpdateWindowSurface(window);
-    return SDL_APP_CONTINUE;
+    profiler_write_report(profiler, &emulator.memory, stdout);
+    printf("\nFolded stacks written to %s\n", profile_filepath);
 }
 
-void SDL_AppQuit(void *appstate, SDL_AppResult result) {}
+static void write_host_stats(void) {
+    if (!host_stats_filepath) {
+        host_stats_write_json(&host_stats, stdout);
+        return;
+    }
+
+    FILE *fp = fopen(host_stats_filepath, "w");
+    if (!fp) {
+        perror("Could not write host statistics");
+        return;
+    }
+    host_stats_write_json(&host_stats, fp);
+    fclose(fp);
+}
+
+void SDL_AppQuit(void *appstate, SDL_AppResult result) {
+    if (emulation_thread) {
+        atomic_store(&quit_requested, 1);
+        // Could be stopped for the GDB client
+        if (gdb_stub_running)
+            gdb_stub_stop(&gdb_stub);
+        SDL_WaitThread(emulation_thread, 0);
+    }
+    // Stuck waiting for input
+    if (command_thread)
+        SDL_DetachThread(command_thread);
+
+    if (emulator.memory.battery)
+        battery_close(&battery, &emulator.memory);
+
+    if (recording && !movie_save(&movie, movie_filepath))
+        printf("Recorded %u frames to %s\n", movie.frame_count,
+               movie_filepath);
+    if (playing)
+        printf("Played back %u frames, %d of %d checkpoints failed\n",
+               movie.frame, movie.checkpoints_failed, movie.checkpoint_count);
+
+    if (profiler)
+        write_profile();
+    if (code_map_requested && code_map.dirty &&
+        !code_map_save(&code_map, code_map_filepath))
+        printf("Code map written to %s\n", code_map_filepath);
+    if (host_stats_requested)
+        write_host_stats();
+
+    if (audio_stream)
+        SDL_DestroyAudioStream(audio_stream);
+    if (framebuffer_texture)
+        SDL_DestroyTexture(framebuffer_texture);
+    if (renderer)
+        SDL_DestroyRenderer(renderer);
+    if (window)
+        SDL_DestroyWindow(window);
+}
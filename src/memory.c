@@ -1,16 +1,45 @@
 #include "memory.h"
+#include "code_map.h"
+#include "controller.h"
+#include "debugger.h"
+#include "host_stats.h"
 #include "ppu.h"
-#include <stdio.h>
-#include <stdlib.h>
 
-// To abort with an error message if a non-implemented memory address is read or
-// written:
+// To stop emulation (see `Memory.bus_fault`) if a non-implemented memory
+// address is read or written:
 // #define _STRICT_READ
 #define _STRICT_WRITE
 
-uint8_t memory_read(Memory *memory, uint16_t address) {
-    if (address <= 0x1fff)
-        return memory->ram[address % MEMORY_RAM_SIZE];
+// PPU registers are mirrored every 8 bytes in 0x2000-0x3fff
+#define IS_PPU_REGISTER(address) ((address) >= 0x2000 && (address) <= 0x3fff)
+#define PPU_REGISTER(address) (0x2000 | ((address) & 0x7))
+
+// Runs the PPU up to the current CPU time so that accesses to its registers
+// see (and affect) the state it would be in on real hardware.
+static inline void sync_ppu(Memory *memory) {
+    ppu_run_until(&memory->ppu_ctx,
+                  memory->cpu_cycle * PPU_DOTS_PER_CPU_CYCLE);
+}
+
+#if defined(_STRICT_READ) || defined(_STRICT_WRITE)
+// Records an access nothing answers, instead of carrying on as if it did
+static inline void fault(Memory *memory, uint16_t address) {
+    memory->bus_fault = 1;
+    memory->bus_fault_address = address;
+}
+#endif
+
+// Used by the APU's DMC channel to fetch samples
+static uint8_t dmc_read(void *memory, uint16_t address) {
+    return memory_read((Memory *)memory, address);
+}
+
+// Reads of memory-mapped I/O in 0x2000-0x401f
+static inline uint8_t read_register(Memory *memory, uint16_t address) {
+    if (IS_PPU_REGISTER(address)) {
+        sync_ppu(memory);
+        address = PPU_REGISTER(address);
+    }
 
     if (address == 0x2002)
         return ppu_read_ppustatus(&memory->ppu_ctx);
@@ -19,23 +48,56 @@ uint8_t memory_read(Memory *memory, uint16_t address) {
     if (address == 0x2007)
         return ppu_read_ppudata(&memory->ppu_ctx);
 
-    if (address >= 0x8000 && address < 0x8000 + memory->prg_rom_size)
-        return memory->prg_rom[address - 0x8000];
+    if (address == 0x4015)
+        return apu_read_status(&memory->apu, memory->cpu_cycle);
+
+    // Controllers, the upper bits are usually left over from the address
+    // (open bus)
+    if (address == 0x4016 || address == 0x4017)
+        return 0x40 | controller_read(&memory->controllers[address - 0x4016]);
 
 #ifdef _STRICT_READ
-    fprintf(stderr, "Out of bounds memory read 0x%x\n", address);
-    abort();
+    fault(memory, address);
 #endif
     return 0;
 }
 
-void memory_write(Memory *memory, uint16_t address, uint8_t data) {
-    if (address >= 0x0200 && address <= 0x02ff)
-        asm("int $3");
+static inline uint8_t bus_read(Memory *memory, uint16_t address) {
+    if (address <= 0x1fff)
+        return memory->ram[address % MEMORY_RAM_SIZE];
 
-    if (address <= 0x1fff) {
-        memory->ram[address % MEMORY_RAM_SIZE] = data;
-        return;
+    if (address <= 0x401f) {
+        HOST_STATS_ENTER(HOST_STATS_IO);
+        uint8_t value = read_register(memory, address);
+        HOST_STATS_LEAVE();
+        return value;
+    }
+
+    if (address >= 0x6000 && address <= 0x7fff)
+        return memory->prg_ram[address - 0x6000];
+
+    int offset = memory_prg_rom_offset(memory, address);
+    if (offset >= 0)
+        return memory->prg_rom[offset];
+
+#ifdef _STRICT_READ
+    fault(memory, address);
+#endif
+    return 0;
+}
+
+uint8_t memory_peek(Memory *memory, uint16_t address) {
+    if (address >= 0x2000 && address <= 0x401f)
+        return 0xff;
+    return bus_read(memory, address);
+}
+
+// Writes to memory-mapped I/O in 0x2000-0x401f
+static inline void write_register(Memory *memory, uint16_t address,
+                                  uint8_t data) {
+    if (IS_PPU_REGISTER(address)) {
+        sync_ppu(memory);
+        address = PPU_REGISTER(address);
     }
 
     if (address == 0x2000) {
@@ -69,25 +131,125 @@ void memory_write(Memory *memory, uint16_t address, uint8_t data) {
 
     // OAMDMA
     if (address == 0x4014) {
+        HOST_STATS_ENTER(HOST_STATS_DMA);
+        sync_ppu(memory);
         for (uint16_t i = 0; i < 0x100; i++) {
             ppu_write_oamdata(memory_read(memory, data << 8 | i),
                               &memory->ppu_ctx);
         }
+        memory->cpu_cycle += MEMORY_OAM_DMA_CYCLES;
+        HOST_STATS_LEAVE();
+        return;
+    }
+
+    // Strobes both controllers
+    if (address == 0x4016) {
+        for (int i = 0; i < CONTROLLER_PORT_COUNT; i++)
+            controller_write_strobe(&memory->controllers[i], data);
+        return;
+    }
+
+    // APU
+    if ((address >= 0x4000 && address <= 0x4013) || address == 0x4015 ||
+        address == 0x4017) {
+        apu_write_register(&memory->apu, address, data, memory->cpu_cycle);
         return;
     }
 
-    if (address == 0x4017) {
-        printf("TODO: register 0x4017\n");
+#ifdef _STRICT_WRITE
+    fault(memory, address);
+#endif
+}
+
+static inline void bus_write(Memory *memory, uint16_t address, uint8_t data) {
+    if (address <= 0x1fff) {
+        memory->ram[address % MEMORY_RAM_SIZE] = data;
+        return;
+    }
+
+    if (address <= 0x401f) {
+        HOST_STATS_ENTER(HOST_STATS_IO);
+        write_register(memory, address, data);
+        HOST_STATS_LEAVE();
         return;
     }
 
-    if (address == 0x4010) {
-        printf("TODO: register 0x4017\n");
+    if (address >= 0x6000 && address <= 0x7fff) {
+        memory->prg_ram[address - 0x6000] = data;
+        memory->prg_ram_dirty |= 1 << (address - 0x6000) /
+                                          MEMORY_PRG_RAM_PAGE_SIZE;
         return;
     }
 
 #ifdef _STRICT_WRITE
-    fprintf(stderr, "Out of bounds memory write 0x%x\n", address);
-    abort();
+    fault(memory, address);
 #endif
 }
+
+static uint8_t plain_read(Memory *memory, uint16_t address) {
+    return bus_read(memory, address);
+}
+
+static uint8_t hooked_read(Memory *memory, uint16_t address) {
+    uint8_t value = bus_read(memory, address);
+    if (memory->debugger)
+        debugger_check_access(memory->debugger, address, value, DEBUGGER_READ);
+    if (memory->code_map)
+        code_map_record_read(memory->code_map, memory, address);
+    return value;
+}
+
+static void plain_write(Memory *memory, uint16_t address, uint8_t data) {
+    bus_write(memory, address, data);
+}
+
+static void hooked_write(Memory *memory, uint16_t address, uint8_t data) {
+    if (memory->debugger)
+        debugger_check_access(memory->debugger, address, data, DEBUGGER_WRITE);
+    bus_write(memory, address, data);
+}
+
+// Accesses pay for the hooks only while something is hooked in, rather than
+// checking for them every time
+static void update_access(Memory *memory) {
+    int hooked = memory->debugger || memory->code_map;
+    memory->read = hooked ? hooked_read : plain_read;
+    memory->write = hooked ? hooked_write : plain_write;
+}
+
+void memory_set_debugger(Memory *memory, struct Debugger *debugger) {
+    memory->debugger = debugger;
+    update_access(memory);
+}
+
+void memory_set_code_map(Memory *memory, struct CodeMap *code_map) {
+    memory->code_map = code_map;
+    update_access(memory);
+}
+
+void memory_init(Memory *memory) {
+    apu_init(&memory->apu, APU_DEFAULT_SAMPLE_RATE);
+    memory->apu.dmc_read = dmc_read;
+    memory->apu.dmc_read_context = memory;
+    update_access(memory);
+}
+
+int memory_poke(Memory *memory, uint16_t address, uint8_t data) {
+    if (address <= 0x1fff) {
+        memory->ram[address % MEMORY_RAM_SIZE] = data;
+        return 0;
+    }
+
+    if (address >= 0x6000 && address <= 0x7fff) {
+        memory->prg_ram[address - 0x6000] = data;
+        memory->prg_ram_dirty |= 1 << (address - 0x6000) /
+                                          MEMORY_PRG_RAM_PAGE_SIZE;
+        return 0;
+    }
+
+    int offset = memory_prg_rom_offset(memory, address);
+    if (offset < 0)
+        return 1;
+    memory->prg_rom[offset] = data;
+    return 0;
+}
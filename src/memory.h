@@ -4,28 +4,118 @@
 #ifndef _MEMORY
 #define _MEMORY
 
+#include "apu.h"
+#include "controller.h"
 #include "ppu.h"
 #include <stdint.h>
+#include <string.h>
 #define MEMORY_RAM_SIZE 0x800
 #define MEMORY_TRAINER_SIZE 0x200
+// Where the trainer appears in PRG RAM
+#define MEMORY_TRAINER_ADDRESS 0x7000
+// Cartridge RAM at 0x6000-0x7fff, test ROMs also report their results here
+#define MEMORY_PRG_RAM_SIZE 0x2000
+// PRG RAM written to is tracked in pages of this size
+#define MEMORY_PRG_RAM_PAGE_SIZE 0x400
+#define MEMORY_PRG_RAM_PAGES (MEMORY_PRG_RAM_SIZE / MEMORY_PRG_RAM_PAGE_SIZE)
+// Cycles the CPU is stalled for during an OAM DMA transfer
+#define MEMORY_OAM_DMA_CYCLES 513
 
-typedef struct {
+struct Debugger;
+struct CodeMap;
+struct Battery;
+
+typedef struct Memory {
     uint8_t ram[MEMORY_RAM_SIZE];
     uint8_t trainer[MEMORY_TRAINER_SIZE];
+    uint8_t prg_ram[MEMORY_PRG_RAM_SIZE];
+    // Bit per page of PRG RAM written to, for saving it (see battery.h)
+    uint8_t prg_ram_dirty;
+    // Whether the trainer is at 0x7000, it isn't saved with the PRG RAM then
+    uint8_t trainer_mapped;
     // Contains game code, no fixed size
     uint8_t *prg_rom;
     int prg_rom_size;
     // Contains sprites, no fixed size
     uint8_t *chr_rom;
     int chr_rom_size;
+    // Hash of the whole ROM file, see hash.h
+    uint64_t rom_hash;
 
     //  NOTE: Makes the most sense to have this here since PPU is only
     //  controlled through memory-mapped I/O. This prevents us from having to
     //  pass PPUContext as a parameter everywhere.
     PPUContext ppu_ctx;
+    APU apu;
+    Controller controllers[CONTROLLER_PORT_COUNT];
+
+    // CPU cycles elapsed since power-on. Used as the timestamp that lazily
+    // run components (like the PPU) are caught up to when accessed.
+    uint64_t cpu_cycle;
+    // Set by an access to an address nothing is mapped to, with strict reads
+    // or writes (see memory.c), for the emulator to stop on
+    uint8_t bus_fault;
+    uint16_t bus_fault_address;
+
+    // Checks accesses for watchpoints while set, see debugger.h
+    struct Debugger *debugger;
+    // Records what the PRG ROM is used for while set, see code_map.h
+    struct CodeMap *code_map;
+    // Accesses, only going through the checks above while one of them is
+    // set. Picked by `memory_set_debugger` and `memory_set_code_map`.
+    uint8_t (*read)(struct Memory *memory, uint16_t address);
+    void (*write)(struct Memory *memory, uint16_t address, uint8_t data);
+    // Saves the PRG RAM while set, see battery.h
+    struct Battery *battery;
 } Memory;
 
-uint8_t memory_read(Memory *memory, uint16_t address);
-void memory_write(Memory *memory, uint16_t address, uint8_t data);
+// Offset into the PRG ROM that `address` reads from, or -1 if it isn't in the
+// PRG ROM.
+static inline int memory_prg_rom_offset(Memory *memory, uint16_t address) {
+    if (address < 0x8000)
+        return -1;
+
+    int offset = address - 0x8000;
+    // A 16 KB PRG ROM is mirrored to 0xc000-0xffff
+    if (memory->prg_rom_size == 0x4000)
+        offset &= 0x3fff;
+    return offset < memory->prg_rom_size ? offset : -1;
+}
+
+// Whether `memory_poke` can write to `address`.
+static inline int memory_pokeable(Memory *memory, uint16_t address) {
+    return address <= 0x1fff || (address >= 0x6000 && address <= 0x7fff) ||
+           memory_prg_rom_offset(memory, address) >= 0;
+}
+
+// Copies the trainer to where the CPU sees it in PRG RAM. It's part of the ROM,
+// so it doesn't count as written.
+static inline void memory_map_trainer(Memory *memory) {
+    memcpy(memory->prg_ram + MEMORY_TRAINER_ADDRESS - 0x6000, memory->trainer,
+           MEMORY_TRAINER_SIZE);
+    memory->trainer_mapped = 1;
+}
+
+// Sets up the parts of `memory` that aren't zero at power-on.
+void memory_init(Memory *memory);
+// Hooks `debugger` into every access, or unhooks it if null.
+void memory_set_debugger(Memory *memory, struct Debugger *debugger);
+// Has reads recorded into `code_map`, or stops if null.
+void memory_set_code_map(Memory *memory, struct CodeMap *code_map);
+
+static inline uint8_t memory_read(Memory *memory, uint16_t address) {
+    return memory->read(memory, address);
+}
+// Reads without side effects, for tracing and debugging. Memory-mapped I/O
+// reads as 0xff.
+uint8_t memory_peek(Memory *memory, uint16_t address);
+static inline void memory_write(Memory *memory, uint16_t address,
+                                uint8_t data) {
+    memory->write(memory, address, data);
+}
+// Writes without side effects, for debugging. PRG ROM is patched in place.
+//
+// Returns 1 if `address` is memory-mapped I/O or nothing is mapped there.
+int memory_poke(Memory *memory, uint16_t address, uint8_t data);
 
 #endif
@@ -0,0 +1,261 @@
+#include "movie.h"
+#include "controller.h"
+#include "emulator.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAGIC "NESMOVIE"
+#define MAGIC_SIZE 8
+
+void movie_init(Movie *movie, uint64_t rom_hash,
+                const EmulatorState *start_state) {
+    memset(movie, 0, sizeof(Movie));
+    movie->rom_hash = rom_hash;
+
+    if (start_state) {
+        movie->start_state = malloc(sizeof(EmulatorState));
+        *movie->start_state = *start_state;
+    }
+}
+
+void movie_free(Movie *movie) {
+    free(movie->start_state);
+    free(movie->runs);
+    free(movie->checkpoints);
+    memset(movie, 0, sizeof(Movie));
+}
+
+// Makes room for one more element in a growing array.
+static void *reserve(void *array, int count, int *capacity, size_t size) {
+    if (count < *capacity)
+        return array;
+
+    *capacity = *capacity ? *capacity * 2 : 64;
+    return realloc(array, *capacity * size);
+}
+
+void movie_record_frame(Movie *movie,
+                        const uint8_t buttons[CONTROLLER_PORT_COUNT]) {
+    movie->frame_count++;
+
+    MovieRun *last = movie->run_count ? &movie->runs[movie->run_count - 1] : 0;
+    if (last && !memcmp(last->buttons, buttons, CONTROLLER_PORT_COUNT)) {
+        last->length++;
+        return;
+    }
+
+    movie->runs = reserve(movie->runs, movie->run_count, &movie->run_capacity,
+                          sizeof(MovieRun));
+    MovieRun *run = &movie->runs[movie->run_count++];
+    run->length = 1;
+    memcpy(run->buttons, buttons, CONTROLLER_PORT_COUNT);
+}
+
+void movie_add_checkpoint(Movie *movie, uint32_t frame, uint64_t hash) {
+    movie->checkpoints =
+        reserve(movie->checkpoints, movie->checkpoint_count,
+                &movie->checkpoint_capacity, sizeof(MovieCheckpoint));
+    movie->checkpoints[movie->checkpoint_count++] =
+        (MovieCheckpoint){.frame = frame, .framebuffer_hash = hash};
+}
+
+int movie_next_frame(Movie *movie, uint8_t buttons[CONTROLLER_PORT_COUNT]) {
+    if (movie->frame >= movie->frame_count)
+        return 1;
+
+    MovieRun *run = &movie->runs[movie->run_index];
+    memcpy(buttons, run->buttons, CONTROLLER_PORT_COUNT);
+
+    movie->frame++;
+    if (++movie->run_frame == run->length) {
+        movie->run_index++;
+        movie->run_frame = 0;
+    }
+    return 0;
+}
+
+// Skips checkpoints before `frame` and returns the one at it, if any.
+static MovieCheckpoint *checkpoint_at(Movie *movie, uint32_t frame) {
+    while (movie->checkpoint_index < movie->checkpoint_count &&
+           movie->checkpoints[movie->checkpoint_index].frame < frame)
+        movie->checkpoint_index++;
+
+    if (movie->checkpoint_index < movie->checkpoint_count &&
+        movie->checkpoints[movie->checkpoint_index].frame == frame)
+        return &movie->checkpoints[movie->checkpoint_index];
+    return 0;
+}
+
+int movie_has_checkpoint(Movie *movie, uint32_t frame) {
+    return checkpoint_at(movie, frame) != 0;
+}
+
+int movie_verify_checkpoint(Movie *movie, uint32_t frame, uint64_t hash) {
+    MovieCheckpoint *checkpoint = checkpoint_at(movie, frame);
+    if (!checkpoint || checkpoint->framebuffer_hash == hash)
+        return 0;
+
+    fprintf(stderr,
+            "ERROR: movie desynced on frame %u, framebuffer hash 0x%016llx "
+            "instead of 0x%016llx\n",
+            frame, (unsigned long long)hash,
+            (unsigned long long)checkpoint->framebuffer_hash);
+    movie->checkpoints_failed++;
+    return 1;
+}
+
+int movie_start_playback(Movie *movie, Emulator *emulator) {
+    if (movie->rom_hash != emulator->memory.rom_hash) {
+        fprintf(stderr, "ERROR: movie was recorded with a different ROM\n");
+        return 1;
+    }
+
+    if (movie->start_state)
+        emulator_load_state(emulator, movie->start_state);
+
+    movie->frame = 0;
+    movie->run_index = 0;
+    movie->run_frame = 0;
+    movie->checkpoint_index = 0;
+    movie->checkpoints_failed = 0;
+    return 0;
+}
+
+// ----- Files -----
+
+static void write_u32(FILE *fp, uint32_t value) {
+    uint8_t bytes[4];
+    for (int i = 0; i < 4; i++)
+        bytes[i] = value >> (i * 8);
+    fwrite(bytes, sizeof(bytes), 1, fp);
+}
+
+static void write_u64(FILE *fp, uint64_t value) {
+    write_u32(fp, value);
+    write_u32(fp, value >> 32);
+}
+
+static int read_u32(FILE *fp, uint32_t *value) {
+    uint8_t bytes[4];
+    if (fread(bytes, sizeof(bytes), 1, fp) != 1)
+        return 1;
+
+    *value = 0;
+    for (int i = 0; i < 4; i++)
+        *value |= (uint32_t)bytes[i] << (i * 8);
+    return 0;
+}
+
+static int read_u64(FILE *fp, uint64_t *value) {
+    uint32_t low, high;
+    if (read_u32(fp, &low) || read_u32(fp, &high))
+        return 1;
+
+    *value = (uint64_t)high << 32 | low;
+    return 0;
+}
+
+int movie_save(Movie *movie, const char *filepath) {
+    FILE *fp = fopen(filepath, "wb");
+    if (!fp) {
+        perror("Could not open movie file");
+        return 1;
+    }
+
+    fwrite(MAGIC, MAGIC_SIZE, 1, fp);
+    write_u32(fp, MOVIE_VERSION);
+    write_u64(fp, movie->rom_hash);
+    write_u32(fp, movie->frame_count);
+    write_u32(fp, movie->start_state ? sizeof(EmulatorState) : 0);
+    write_u32(fp, movie->run_count);
+    write_u32(fp, movie->checkpoint_count);
+
+    if (movie->start_state)
+        fwrite(movie->start_state, sizeof(EmulatorState), 1, fp);
+
+    for (int i = 0; i < movie->run_count; i++) {
+        write_u32(fp, movie->runs[i].length);
+        fwrite(movie->runs[i].buttons, CONTROLLER_PORT_COUNT, 1, fp);
+    }
+
+    for (int i = 0; i < movie->checkpoint_count; i++) {
+        write_u32(fp, movie->checkpoints[i].frame);
+        write_u64(fp, movie->checkpoints[i].framebuffer_hash);
+    }
+
+    if (fclose(fp)) {
+        perror("Could not write movie file");
+        return 1;
+    }
+    return 0;
+}
+
+int movie_load(Movie *movie, const char *filepath) {
+    FILE *fp = fopen(filepath, "rb");
+    if (!fp) {
+        perror("Could not open movie file");
+        return 1;
+    }
+
+    char magic[MAGIC_SIZE];
+    uint32_t version, state_size, run_count, checkpoint_count;
+    uint64_t rom_hash;
+    uint32_t frame_count;
+
+    if (fread(magic, MAGIC_SIZE, 1, fp) != 1 ||
+        memcmp(magic, MAGIC, MAGIC_SIZE) || read_u32(fp, &version) ||
+        version != MOVIE_VERSION || read_u64(fp, &rom_hash) ||
+        read_u32(fp, &frame_count) || read_u32(fp, &state_size) ||
+        read_u32(fp, &run_count) || read_u32(fp, &checkpoint_count)) {
+        fprintf(stderr, "Invalid movie file\n");
+        fclose(fp);
+        return 1;
+    }
+
+    if (state_size && state_size != sizeof(EmulatorState)) {
+        fprintf(stderr, "Movie starts from a save state made by a different "
+                        "build of the emulator\n");
+        fclose(fp);
+        return 1;
+    }
+
+    movie_init(movie, rom_hash, 0);
+
+    int failed = 0;
+    if (state_size) {
+        movie->start_state = malloc(sizeof(EmulatorState));
+        failed |= fread(movie->start_state, sizeof(EmulatorState), 1, fp) != 1;
+    }
+
+    uint32_t frames_in_runs = 0;
+    for (uint32_t i = 0; i < run_count && !failed; i++) {
+        uint32_t length;
+        uint8_t buttons[CONTROLLER_PORT_COUNT];
+        // A run can't go past the frames the movie has
+        failed |= read_u32(fp, &length) ||
+                  fread(buttons, CONTROLLER_PORT_COUNT, 1, fp) != 1 ||
+                  length == 0 || length > frame_count - frames_in_runs;
+        for (uint32_t frame = 0; frame < length && !failed; frame++)
+            movie_record_frame(movie, buttons);
+        frames_in_runs += length;
+    }
+
+    for (uint32_t i = 0; i < checkpoint_count && !failed; i++) {
+        uint32_t frame;
+        uint64_t hash;
+        failed |= read_u32(fp, &frame) || read_u64(fp, &hash);
+        if (!failed)
+            movie_add_checkpoint(movie, frame, hash);
+    }
+
+    fclose(fp);
+
+    if (failed || frames_in_runs != frame_count) {
+        fprintf(stderr, "Invalid movie file\n");
+        movie_free(movie);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,97 @@
+// Input movies: the controller state of every frame, for replaying a run of
+// the emulator exactly.
+//
+// A movie is tied to a ROM by its hash and starts either from power-on or
+// from a save state. Frames with the same input are stored as one run, and
+// framebuffer hashes at checkpoints make it possible to verify that a
+// playback went the same way as the recording.
+//
+// File layout (little-endian):
+//   "NESMOVIE", version (u32), ROM hash (u64), frame count (u32),
+//   save state size (u32, 0 for power-on), run count (u32),
+//   checkpoint count (u32),
+//   save state,
+//   runs: length (u32), buttons of every port (u8 each),
+//   checkpoints: frame (u32), framebuffer hash (u64)
+
+#ifndef _MOVIE
+#define _MOVIE
+
+#include "controller.h"
+#include "emulator.h"
+#include <stdint.h>
+
+#define MOVIE_VERSION 1
+// Frames between the checkpoints taken while recording
+#define MOVIE_CHECKPOINT_INTERVAL 60
+
+typedef struct {
+    uint32_t length;
+    uint8_t buttons[CONTROLLER_PORT_COUNT];
+} MovieRun;
+
+typedef struct {
+    uint32_t frame;
+    uint64_t framebuffer_hash;
+} MovieCheckpoint;
+
+typedef struct {
+    uint64_t rom_hash;
+    // Null when starting from power-on
+    EmulatorState *start_state;
+    uint32_t frame_count;
+
+    MovieRun *runs;
+    int run_count;
+    int run_capacity;
+
+    MovieCheckpoint *checkpoints;
+    int checkpoint_count;
+    int checkpoint_capacity;
+
+    // Playback position
+    uint32_t frame;
+    int run_index;
+    uint32_t run_frame;
+    int checkpoint_index;
+    int checkpoints_failed;
+} Movie;
+
+// Starts an empty movie for the ROM with `rom_hash`. If `start_state` isn't
+// null, the movie starts from a copy of it.
+void movie_init(Movie *movie, uint64_t rom_hash,
+                const EmulatorState *start_state);
+void movie_free(Movie *movie);
+
+// Appends a frame with `buttons` held on the controllers.
+void movie_record_frame(Movie *movie,
+                        const uint8_t buttons[CONTROLLER_PORT_COUNT]);
+
+// Records the hash of the framebuffer at the end of `frame`.
+void movie_add_checkpoint(Movie *movie, uint32_t frame, uint64_t hash);
+
+// Gets the buttons of the next frame during playback.
+//
+// Returns 1 if the movie has ended.
+int movie_next_frame(Movie *movie, uint8_t buttons[CONTROLLER_PORT_COUNT]);
+
+// Whether there's a checkpoint at the end of `frame`, i.e. whether that frame
+// needs to be rendered.
+int movie_has_checkpoint(Movie *movie, uint32_t frame);
+
+// Compares the framebuffer hash at the end of `frame` against the checkpoint
+// there, if there is one.
+//
+// Returns 1 on a mismatch, will also print an error message to stderr.
+int movie_verify_checkpoint(Movie *movie, uint32_t frame, uint64_t hash);
+
+// Returns 1 on failure, will also print error messages to stderr.
+int movie_save(Movie *movie, const char *filepath);
+int movie_load(Movie *movie, const char *filepath);
+
+// Sets `emulator` up to play the movie from the start.
+//
+// Returns 1 if the movie is for a different ROM.
+int movie_start_playback(Movie *movie, Emulator *emulator);
+
+#endif
@@ -0,0 +1,130 @@
+#include "pacing.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+#define NS_PER_SECOND 1000000000.0
+// Most sleeps overshoot by less than this
+#define DEFAULT_SPIN_NS 2000000
+
+void pacing_init(Pacing *pacing, double frame_rate,
+                 uint64_t (*now_ns)(void *context),
+                 void (*sleep_ns)(void *context, uint64_t duration),
+                 void *clock_context) {
+    pacing->now_ns = now_ns;
+    pacing->sleep_ns = sleep_ns;
+    pacing->clock_context = clock_context;
+
+    pacing->frame_duration_ns = NS_PER_SECOND / frame_rate;
+    pacing->spin_ns = DEFAULT_SPIN_NS;
+
+    pacing->fast_forward = 0;
+    pacing->render_count = 1;
+    pacing->cycle_length = 1;
+    pacing->frame_index = 0;
+
+    pacing->frame_time_count = 0;
+    pacing->frame_time_next = 0;
+
+    uint64_t now = now_ns(clock_context);
+    pacing->last_frame_ns = now;
+    pacing->deadline_ns = now + pacing->frame_duration_ns;
+}
+
+void pacing_set_fast_forward(Pacing *pacing, int enabled, int render_count,
+                             int cycle_length) {
+    if (cycle_length < 1)
+        cycle_length = 1;
+    if (render_count < 1)
+        render_count = 1;
+    if (render_count > cycle_length)
+        render_count = cycle_length;
+
+    // Pick up from the current time again when slowing back down
+    if (pacing->fast_forward && !enabled)
+        pacing->deadline_ns = pacing->now_ns(pacing->clock_context) +
+                              pacing->frame_duration_ns;
+
+    pacing->fast_forward = enabled;
+    pacing->render_count = render_count;
+    pacing->cycle_length = cycle_length;
+}
+
+int pacing_should_render(Pacing *pacing) {
+    if (!pacing->fast_forward)
+        return 1;
+    return pacing->frame_index % pacing->cycle_length <
+           (uint64_t)pacing->render_count;
+}
+
+static void record_frame_time(Pacing *pacing, uint64_t now) {
+    pacing->frame_times[pacing->frame_time_next] = now - pacing->last_frame_ns;
+    pacing->frame_time_next = (pacing->frame_time_next + 1) % PACING_HISTORY;
+    if (pacing->frame_time_count < PACING_HISTORY)
+        pacing->frame_time_count++;
+    pacing->last_frame_ns = now;
+}
+
+// Waits until `deadline`, sleeping for all but the last `spin_ns`.
+static uint64_t wait_until(Pacing *pacing, uint64_t deadline) {
+    uint64_t now = pacing->now_ns(pacing->clock_context);
+
+    if (deadline > now + pacing->spin_ns) {
+        pacing->sleep_ns(pacing->clock_context,
+                         deadline - now - pacing->spin_ns);
+        now = pacing->now_ns(pacing->clock_context);
+    }
+
+    while (now < deadline)
+        now = pacing->now_ns(pacing->clock_context);
+
+    return now;
+}
+
+void pacing_end_frame(Pacing *pacing) {
+    pacing->frame_index++;
+
+    if (pacing->fast_forward) {
+        record_frame_time(pacing, pacing->now_ns(pacing->clock_context));
+        return;
+    }
+
+    uint64_t now = wait_until(pacing, pacing->deadline_ns);
+    record_frame_time(pacing, now);
+
+    // Deadlines are kept on a fixed grid so that small delays don't add up.
+    // If even the next one has passed already the grid is started over,
+    // rather than running frames back to back to catch up.
+    pacing->deadline_ns += pacing->frame_duration_ns;
+    if (pacing->deadline_ns <= now)
+        pacing->deadline_ns = now + pacing->frame_duration_ns;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+void pacing_get_stats(Pacing *pacing, PacingStats *stats) {
+    int count = pacing->frame_time_count;
+    *stats = (PacingStats){0};
+    if (!count)
+        return;
+
+    uint64_t total = 0;
+    uint64_t jitter[PACING_HISTORY];
+    for (int i = 0; i < count; i++) {
+        uint64_t frame_time = pacing->frame_times[i];
+        total += frame_time;
+        jitter[i] = frame_time > pacing->frame_duration_ns
+                        ? frame_time - pacing->frame_duration_ns
+                        : pacing->frame_duration_ns - frame_time;
+    }
+
+    if (total)
+        stats->fps = count * NS_PER_SECOND / total;
+
+    qsort(jitter, count, sizeof(uint64_t), compare_u64);
+    stats->jitter_p50_ns = jitter[(count - 1) * 50 / 100];
+    stats->jitter_p95_ns = jitter[(count - 1) * 95 / 100];
+    stats->jitter_p99_ns = jitter[(count - 1) * 99 / 100];
+}
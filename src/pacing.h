@@ -0,0 +1,71 @@
+// Frame pacing: keeps emulation at the console's frame rate, or runs it as
+// fast as possible with most frames left unrendered.
+//
+// Waiting sleeps for the bulk of the time and spins on the clock for the last
+// stretch, since sleeps tend to overshoot by up to a millisecond or two. The
+// clock is passed in so that pacing can be tested without real time passing.
+
+#ifndef _PACING
+#define _PACING
+
+#include <stdint.h>
+
+#define PACING_NTSC_RATE 60.0988
+#define PACING_PAL_RATE 50.007
+
+// Frame times kept for the statistics
+#define PACING_HISTORY 256
+
+typedef struct {
+    uint64_t (*now_ns)(void *context);
+    void (*sleep_ns)(void *context, uint64_t duration);
+    void *clock_context;
+
+    uint64_t frame_duration_ns;
+    // When the next frame is due
+    uint64_t deadline_ns;
+    // Sleep until this much is left, spin for the rest
+    uint64_t spin_ns;
+
+    // Uncapped, rendering only `render_count` out of every `cycle_length`
+    // frames
+    int fast_forward;
+    int render_count;
+    int cycle_length;
+    uint64_t frame_index;
+
+    // Time between the ends of the latest frames, oldest overwritten first
+    uint64_t frame_times[PACING_HISTORY];
+    int frame_time_count;
+    int frame_time_next;
+    uint64_t last_frame_ns;
+} Pacing;
+
+typedef struct {
+    // Emulated frames per second over the history
+    double fps;
+    // Deviation of frame times from the target
+    uint64_t jitter_p50_ns;
+    uint64_t jitter_p95_ns;
+    uint64_t jitter_p99_ns;
+} PacingStats;
+
+void pacing_init(Pacing *pacing, double frame_rate,
+                 uint64_t (*now_ns)(void *context),
+                 void (*sleep_ns)(void *context, uint64_t duration),
+                 void *clock_context);
+
+// Turns fast-forward on or off. When on, frames aren't waited for and only
+// `render_count` out of every `cycle_length` frames are rendered.
+void pacing_set_fast_forward(Pacing *pacing, int enabled, int render_count,
+                             int cycle_length);
+
+// Whether the upcoming frame should be rendered.
+int pacing_should_render(Pacing *pacing);
+
+// Ends a frame and waits until the next one is due.
+void pacing_end_frame(Pacing *pacing);
+
+void pacing_get_stats(Pacing *pacing, PacingStats *stats);
+
+#endif
@@ -2,6 +2,7 @@
 #define _PALETTE
 
 #include <stdint.h>
-uint32_t default_palette[512];
+// 64 colors for each of the 8 color emphasis combinations, 0x00RRGGBB
+extern uint32_t default_palette[512];
 
 #endif
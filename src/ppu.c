@@ -1,123 +1,677 @@
 #include "ppu.h"
+#include "host_stats.h"
+#include "palette.h"
 #include <stdint.h>
+#include <string.h>
+
+// Sprite pixels in `PPUContext.sprite_line`: the lower 5 bits are the index
+// into palette memory (0 when transparent), the rest are flags.
+#define SPRITE_PIXEL_PALETTE_INDEX 0x1f
+#define SPRITE_PIXEL_BEHIND_BACKGROUND 0x20
+#define SPRITE_PIXEL_SPRITE_0 0x40
+
+#define BYTES_ONES 0x0101010101010101ULL
+
+// Maps a nametable address (0x2000-0x3eff) to an offset in
+// `PPUMemory.cartridge_mapped_memory` depending on the mirroring used.
+static uint16_t nametable_address(uint16_t address, PPUMirroring mirroring) {
+    uint16_t nametable = (address >> 10) & 0x3;
+
+    switch (mirroring) {
+    case PPU_MIRRORING_HORIZONTAL:
+        nametable >>= 1;
+        break;
+    case PPU_MIRRORING_VERTICAL:
+        nametable &= 1;
+        break;
+    case PPU_MIRRORING_FOUR_SCREEN:
+        break;
+    }
 
-static uint8_t ppu_memory_read(uint16_t address, PPUMemory *ppu_memory) {
-    if (address < PPU_MEMORY_CARTRIDGE_MAPPED_TOTAL_SIZE)
-        return ppu_memory->cartridge_mapped_memory[address];
+    return 0x2000 + nametable * PPU_MEMORY_NAMETABLE_SIZE +
+           (address % PPU_MEMORY_NAMETABLE_SIZE);
+}
 
-    // Palettes
-    if (address >= 0x3f00 && address <= 0x3f1f)
-        return ppu_memory->palette[address % PPU_MEMORY_PALETTE_SIZE];
+// Palette entries 0x10, 0x14, 0x18 and 0x1c are mirrors of 0x00, 0x04, 0x08
+// and 0x0c.
+static inline uint8_t palette_index(uint16_t address) {
+    uint8_t index = address % PPU_MEMORY_PALETTE_SIZE;
+    if ((index & 0x13) == 0x10)
+        index &= ~0x10;
+    return index;
+}
 
-    return 0;
+// Reads a nametable byte, `address` being in 0x2000-0x3eff.
+static inline uint8_t nametable_read(uint16_t address, PPUContext *ppu_ctx) {
+    return ppu_ctx->memory.cartridge_mapped_memory[nametable_address(
+        address, ppu_ctx->mirroring)];
+}
+
+static uint8_t ppu_memory_read(uint16_t address, PPUContext *ppu_ctx) {
+    address &= 0x3fff;
+
+    if (address < 0x2000)
+        return ppu_ctx->memory.cartridge_mapped_memory[address];
+
+    if (address < 0x3f00)
+        return nametable_read(address, ppu_ctx);
+
+    // Palettes
+    return ppu_ctx->memory.palette[palette_index(address)];
 }
 
 static void ppu_memory_write(uint16_t address, uint8_t value,
-                             PPUMemory *ppu_memory) {
-    if (address < PPU_MEMORY_CARTRIDGE_MAPPED_TOTAL_SIZE)
-        ppu_memory->palette[address] = value;
+                             PPUContext *ppu_ctx) {
+    address &= 0x3fff;
+
+    if (address < 0x2000) {
+        ppu_ctx->memory.cartridge_mapped_memory[address] = value;
+        ppu_ctx->tile_decoded[address / 16] = 0;
+        return;
+    }
+
+    if (address < 0x3f00) {
+        ppu_ctx->memory.cartridge_mapped_memory[nametable_address(
+            address, ppu_ctx->mirroring)] = value;
+        return;
+    }
 
     // Palettes
-    if (address >= 0x3f00 && address <= 0x3f1f)
-        ppu_memory->palette[address % PPU_MEMORY_PALETTE_SIZE] = value;
+    ppu_ctx->memory.palette[palette_index(address)] = value;
 }
 
 // Increment PPU address by 1 or 32 depending on
 // `PPUCtrl.increment_mode_vertical`
 static inline void increment_ppu_address(PPUContext *ppu_ctx) {
-    ppu_ctx->address += (ppu_ctx->ppuctrl.increment_mode_vertical * 0x20) +
-                        (!ppu_ctx->ppuctrl.increment_mode_vertical * 1);
+    ppu_ctx->vram_address += (ppu_ctx->ppuctrl.increment_mode_vertical * 0x20) +
+                             (!ppu_ctx->ppuctrl.increment_mode_vertical * 1);
+}
+
+static inline int rendering_enabled(PPUContext *ppu_ctx) {
+    return ppu_ctx->ppumask.background_enable ||
+           ppu_ctx->ppumask.sprites_enable;
+}
+
+// ----- Decoded tile cache -----
+
+void ppu_invalidate_tile_cache(PPUContext *ppu_ctx) {
+    memset(ppu_ctx->tile_decoded, 0, sizeof(ppu_ctx->tile_decoded));
+}
+
+// Turns the two bitplanes of a tile row into 8 2-bit pixels, one per byte,
+// leftmost pixel in the lowest byte.
+static uint64_t decode_tile_row(uint8_t plane0_byte, uint8_t plane1_byte) {
+    uint64_t row = 0;
+    for (int i = 0; i < 8; i++) {
+        uint64_t plane0_dot = (plane0_byte >> (7 - i)) & 1;
+        uint64_t plane1_dot = (plane1_byte >> (7 - i)) & 1;
+        row |= (plane1_dot << 1 | plane0_dot) << (i * 8);
+    }
+    return row;
 }
 
-// Returns 4-bit pixel retrieved from `pattern_table`.
-static uint8_t get_pattern_table_pixel(uint8_t *pattern_table,
-                                       uint8_t tile_number, uint8_t x_offset,
-                                       uint8_t y_offset) {
-    uint16_t index = tile_number * 16;
-    assert(index < PPU_MEMORY_PATTERN_TABLE_SIZE / 16);
+// Returns row `y_offset` of tile `tile` (0-511, counting through both pattern
+// tables) from the decoded tile cache.
+static inline uint64_t get_tile_row(PPUContext *ppu_ctx, uint16_t tile,
+                                    uint8_t y_offset) {
+    if (!ppu_ctx->tile_decoded[tile]) {
+        uint8_t *tile_data = ppu_ctx->memory.cartridge_mapped_memory + tile * 16;
+        for (int y = 0; y < 8; y++)
+            ppu_ctx->tile_rows[tile][y] =
+                decode_tile_row(tile_data[y], tile_data[y + 8]);
+        ppu_ctx->tile_decoded[tile] = 1;
+    }
 
-    uint8_t plane0_byte = pattern_table[index + y_offset];
-    uint8_t plane1_byte = pattern_table[index + y_offset + 8];
+    return ppu_ctx->tile_rows[tile][y_offset];
+}
 
-    uint8_t plane0_dot = (plane0_byte & (1 << (7 - x_offset))) > 0;
-    uint8_t plane1_dot = (plane1_byte & (1 << (7 - x_offset))) > 0;
+// Gives opaque pixels of a decoded tile row the palette `palette`, so each
+// byte becomes an index into palette memory (0 when transparent).
+static inline uint64_t apply_palette(uint64_t row, uint8_t palette) {
+    uint64_t opaque = (row | row >> 1) & BYTES_ONES;
+    return row | opaque * (palette << 2);
+}
 
-    // if (y_offset == 3)
-    //     asm("int $3");
+// Returns one bit per opaque pixel of a decoded tile row, leftmost pixel in
+// the lowest bit.
+static inline uint8_t opaque_bits(uint64_t row) {
+    uint64_t opaque = (row | row >> 1) & BYTES_ONES;
+    return (opaque * 0x0102040810204080ULL) >> 56;
+}
 
-    return (plane1_dot * 0b10) | (plane0_dot * 0b01);
+static inline uint8_t reverse_bits(uint8_t byte) {
+    return ((byte * 0x0202020202ULL) & 0x010884422010ULL) % 1023;
 }
 
-// Returns a 4-bit sprite pixel if there is one at the current dot
-static uint8_t evaluate_sprites(PPUContext *ppu_ctx) {
-    //  TODO: 8x16 mode
-    assert(!ppu_ctx->ppuctrl.sprite_mode_8x16);
+// ----- Sprites -----
+
+static void predict_sprite_0_hit(PPUContext *ppu_ctx, uint8_t sprite_0_opaque,
+                                 uint8_t sprite_0_x);
+
+// Finds the (at most 8) sprites on the current scanline and draws them into
+// `PPUContext.sprite_line`. Sprites with a lower index in OAM take priority.
+//
+// If not `rendering`, only sprite 0 is drawn (for checking sprite 0 hit) and
+// the rest are only counted for the overflow flag.
+static void evaluate_sprites(PPUContext *ppu_ctx, int rendering) {
+    memset(ppu_ctx->sprite_line, 0, sizeof(ppu_ctx->sprite_line));
+    ppu_ctx->sprite_0_hit_dot = 0;
+    ppu_ctx->sprite_0_hit_per_dot = 0;
+
+    if (!rendering_enabled(ppu_ctx))
+        return;
 
     OAMEntry *oam_entries = (OAMEntry *)ppu_ctx->oam;
     uint8_t sprite_height = 8 + (ppu_ctx->ppuctrl.sprite_mode_8x16 * 8);
+    int sprites_found = 0;
 
     for (int i = 0; i < PPU_OAM_ENTRY_COUNT; i++) {
         OAMEntry *sprite_entry = oam_entries + i;
 
-        // Sprites on the first scanline are invisible
-        if (sprite_entry->pos_y == 0)
-            continue;
-
         // Sprites are delayed by one scanline, hence the '-1'
         int32_t y_pos_inside_sprite =
             ppu_ctx->current_scanline - 1 - sprite_entry->pos_y;
-        int32_t x_pos_inside_sprite =
-            ppu_ctx->current_dot - sprite_entry->pos_x;
 
         if (y_pos_inside_sprite < 0 || y_pos_inside_sprite >= sprite_height)
             continue;
 
-        if (x_pos_inside_sprite < 0 || x_pos_inside_sprite >= 8)
+        // NOTE: The hardware bug that makes the flag unreliable (see
+        // `PPUStatus.sprite_overflow`) is not emulated.
+        if (sprites_found++ == PPU_SPRITES_PER_SCANLINE) {
+            ppu_ctx->ppustatus.sprite_overflow = 1;
+            break;
+        }
+
+        if (i != 0 && !rendering)
             continue;
 
-        uint8_t *pattern_table = 0;
-        if (ppu_ctx->ppuctrl.sprite_pattern_table_select)
-            pattern_table = ppu_ctx->memory.pattern_table_1;
-        else
-            pattern_table = ppu_ctx->memory.pattern_table_0;
+        if (sprite_entry->attributes.flip_vertically)
+            y_pos_inside_sprite = sprite_height - 1 - y_pos_inside_sprite;
+
+        uint16_t tile = sprite_entry->tile_index;
+        if (ppu_ctx->ppuctrl.sprite_mode_8x16) {
+            // Bit 0 selects the pattern table, the bottom half is the next
+            // tile
+            tile = (tile & 1) * 0x100 + (tile & 0xfe) +
+                   (y_pos_inside_sprite >= 8);
+        } else {
+            tile += ppu_ctx->ppuctrl.sprite_pattern_table_select * 0x100;
+        }
+
+        uint64_t row = get_tile_row(ppu_ctx, tile, y_pos_inside_sprite % 8);
+        if (sprite_entry->attributes.flip_horizontally)
+            row = __builtin_bswap64(row);
+
+        uint8_t flags = 0x10 | (sprite_entry->attributes.palette << 2);
+        if (sprite_entry->attributes.behind_background)
+            flags |= SPRITE_PIXEL_BEHIND_BACKGROUND;
+        if (i == 0) {
+            flags |= SPRITE_PIXEL_SPRITE_0;
+            predict_sprite_0_hit(ppu_ctx, opaque_bits(row),
+                                 sprite_entry->pos_x);
+        }
+
+        for (int x = 0; x < 8; x++) {
+            int screen_x = sprite_entry->pos_x + x;
+            uint8_t pixel = (row >> (x * 8)) & 0x3;
+
+            if (screen_x >= PPU_VISIBLE_AREA_WIDTH)
+                break;
+            // Lower index sprites have been drawn already
+            if (!pixel || ppu_ctx->sprite_line[screen_x])
+                continue;
+
+            ppu_ctx->sprite_line[screen_x] = flags | pixel;
+        }
+    }
+}
 
-        uint8_t pixel =
-            get_pattern_table_pixel(pattern_table, sprite_entry->tile_index,
-                                    x_pos_inside_sprite, y_pos_inside_sprite);
+// ----- Compositing -----
 
-        return sprite_entry->attributes.palette << 2 | pixel;
-    }
+// Returns the background pixel at `x` if background rendering is enabled
+// there, otherwise 0 (transparent).
+static inline uint8_t visible_background_pixel(PPUContext *ppu_ctx, int x,
+                                               uint8_t background_pixel) {
+    if (!ppu_ctx->ppumask.background_enable ||
+        (x < 8 && !ppu_ctx->ppumask.show_background_left_column))
+        return 0;
+    return background_pixel;
+}
 
+// Returns the sprite pixel at `x` if sprite rendering is enabled there,
+// otherwise 0 (transparent).
+static inline uint8_t visible_sprite_pixel(PPUContext *ppu_ctx, int x) {
+    if (!ppu_ctx->ppumask.sprites_enable ||
+        (x < 8 && !ppu_ctx->ppumask.show_sprites_left_column))
+        return 0;
+    return ppu_ctx->sprite_line[x];
+}
+
+int ppu_output_init(PPUOutput *output, PPUOutputFormat format, int downsample) {
+    *output = (PPUOutput){.format = format};
+    if (format == PPU_OUTPUT_RGB || downsample == 0 || downsample == 1)
+        return 0;
+    if (downsample != 2 && downsample != 4)
+        return 1;
+    output->downsample_shift = downsample >> 1;
     return 0;
 }
 
-void ppu_tick(PPUContext *ppu_ctx, uint32_t *framebuffer, int *out_nmi_needed) {
-    // Vertical blank triggers on certain dots, also we interrupt the CPU at the
-    // start of it
-    if (ppu_ctx->current_dot == 1 && ppu_ctx->current_scanline == 241 &&
-        out_nmi_needed) {
-        *out_nmi_needed = 1;
-        ppu_ctx->ppustatus.vblank = 1;
+// Writes the color of the pixel at `x` into a byte framebuffer, if it is the
+// top left one of its square when downsampling.
+static inline void output_palette_index(PPUContext *ppu_ctx,
+                                        uint8_t *framebuffer, int x,
+                                        uint8_t color) {
+    int shift = ppu_ctx->output.downsample_shift;
+    int y = ppu_ctx->current_scanline;
+    if ((x | y) & ((1 << shift) - 1))
+        return;
+    framebuffer[(y >> shift) * (PPU_VISIBLE_AREA_WIDTH >> shift) +
+                (x >> shift)] = color;
+}
+
+// Adds the luma of the pixel at `x` to its square, writing out the averages
+// of the row of squares after the last pixel of it.
+static inline void output_gray(PPUContext *ppu_ctx, uint8_t *framebuffer,
+                               int x, uint32_t rgb) {
+    // BT.601 weights out of 256
+    uint8_t luma = ((rgb >> 16 & 0xff) * 77 + (rgb >> 8 & 0xff) * 150 +
+                    (rgb & 0xff) * 29) >>
+                   8;
+    int shift = ppu_ctx->output.downsample_shift;
+    int y = ppu_ctx->current_scanline;
+    if (!shift) {
+        framebuffer[y * PPU_VISIBLE_AREA_WIDTH + x] = luma;
+        return;
     }
 
-    if (ppu_ctx->current_dot == 1 && ppu_ctx->current_scanline == 261) {
-        ppu_ctx->ppustatus.vblank = 0;
+    uint16_t *sums = ppu_ctx->gray_sums;
+    sums[x >> shift] += luma;
+    int last = (1 << shift) - 1;
+    if (x != PPU_VISIBLE_AREA_WIDTH - 1 || (y & last) != last)
+        return;
+
+    int width = PPU_VISIBLE_AREA_WIDTH >> shift;
+    uint8_t *row = framebuffer + (y >> shift) * width;
+    for (int i = 0; i < width; i++) {
+        row[i] = sums[i] >> 2 * shift;
+        sums[i] = 0;
     }
+}
 
-    // Sprite evaluation
-    if (ppu_ctx->current_dot < PPU_VISIBLE_AREA_WIDTH &&
-        ppu_ctx->current_scanline < PPU_VISIBLE_AREA_HEIGTH) {
-        uint32_t temp_palette[16] = {0x00000000, 0x00ff0000, 0x0000ff00,
-                                     0x000000ff};
-        uint8_t sprite_pixel = evaluate_sprites(ppu_ctx);
+// Combines a background and a sprite pixel at `x` on the current scanline and
+// writes the resulting color into `framebuffer` (see `PPUContext.output`).
+//
+// `background_pixel` is an index into palette memory (0 when transparent).
+static inline void output_pixel(PPUContext *ppu_ctx, uint32_t *framebuffer,
+                                int x, uint8_t background_pixel) {
+    background_pixel = visible_background_pixel(ppu_ctx, x, background_pixel);
+    uint8_t sprite_pixel = visible_sprite_pixel(ppu_ctx, x);
+
+    uint8_t index = background_pixel;
+    if ((sprite_pixel & 0x3) &&
+        (!(background_pixel & 0x3) ||
+         !(sprite_pixel & SPRITE_PIXEL_BEHIND_BACKGROUND)))
+        index = sprite_pixel & SPRITE_PIXEL_PALETTE_INDEX;
+
+    uint8_t color = ppu_ctx->memory.palette[index] & 0x3f;
+    if (ppu_ctx->ppumask.grayscale_mode)
+        color &= 0x30;
+
+    uint32_t rgb = default_palette[(ppu_ctx->ppumask.value >> 5) << 6 | color];
+    switch (ppu_ctx->output.format) {
+    case PPU_OUTPUT_RGB:
+        framebuffer[ppu_ctx->current_scanline * PPU_VISIBLE_AREA_WIDTH + x] =
+            rgb;
+        break;
+    case PPU_OUTPUT_PALETTE_INDEX:
+        output_palette_index(ppu_ctx, (uint8_t *)framebuffer, x, color);
+        break;
+    case PPU_OUTPUT_GRAY:
+        output_gray(ppu_ctx, (uint8_t *)framebuffer, x, rgb);
+        break;
+    }
+}
 
-        if (framebuffer)
-            framebuffer[ppu_ctx->current_scanline * PPU_VISIBLE_AREA_WIDTH +
-                        ppu_ctx->current_dot] = temp_palette[sprite_pixel];
+// ----- Background -----
+
+// Increments coarse x in `PPUContext.vram_address`, wrapping around to the
+// next horizontal nametable.
+static inline void increment_coarse_x(PPUContext *ppu_ctx) {
+    if ((ppu_ctx->vram_address & 0x001f) == 31) {
+        ppu_ctx->vram_address &= ~0x001f;
+        ppu_ctx->vram_address ^= 0x0400;
+    } else {
+        ppu_ctx->vram_address++;
+    }
+}
+
+// Increments fine y in `PPUContext.vram_address`, overflowing into coarse y
+// and wrapping around to the next vertical nametable.
+static inline void increment_y(PPUContext *ppu_ctx) {
+    if ((ppu_ctx->vram_address & 0x7000) != 0x7000) {
+        ppu_ctx->vram_address += 0x1000;
+        return;
+    }
+
+    ppu_ctx->vram_address &= ~0x7000;
+    uint16_t coarse_y = (ppu_ctx->vram_address & 0x03e0) >> 5;
+    if (coarse_y == 29) {
+        coarse_y = 0;
+        ppu_ctx->vram_address ^= 0x0800;
+    } else if (coarse_y == 31) {
+        // Out of bounds coarse y (attribute memory) wraps without switching
+        // nametables
+        coarse_y = 0;
+    } else {
+        coarse_y++;
+    }
+
+    ppu_ctx->vram_address = (ppu_ctx->vram_address & ~0x03e0) | coarse_y << 5;
+}
+
+static inline void copy_horizontal_position(PPUContext *ppu_ctx) {
+    ppu_ctx->vram_address = (ppu_ctx->vram_address & ~0x041f) |
+                            (ppu_ctx->temp_vram_address & 0x041f);
+}
+
+static inline void copy_vertical_position(PPUContext *ppu_ctx) {
+    ppu_ctx->vram_address = (ppu_ctx->vram_address & ~0x7be0) |
+                            (ppu_ctx->temp_vram_address & 0x7be0);
+}
+
+static inline uint8_t fetch_nametable_byte(PPUContext *ppu_ctx) {
+    return ppu_memory_read(0x2000 | (ppu_ctx->vram_address & 0x0fff), ppu_ctx);
+}
+
+// Returns the 2-bit palette of the tile at `PPUContext.vram_address`.
+static inline uint8_t fetch_attribute(PPUContext *ppu_ctx) {
+    uint16_t v = ppu_ctx->vram_address;
+    uint8_t attribute = ppu_memory_read(
+        0x23c0 | (v & 0x0c00) | ((v >> 4) & 0x38) | ((v >> 2) & 0x07), ppu_ctx);
+
+    // Each attribute byte covers 4x4 tiles, 2 bits per 2x2 tile quadrant
+    uint8_t shift = ((v >> 4) & 0x4) | (v & 0x2);
+    return (attribute >> shift) & 0x3;
+}
+
+// Returns the address of the current background tile row in pattern memory.
+static inline uint16_t background_pattern_address(PPUContext *ppu_ctx) {
+    return ppu_ctx->ppuctrl.background_pattern_table_select * 0x1000 +
+           ppu_ctx->nametable_latch * 16 + (ppu_ctx->vram_address >> 12);
+}
+
+// Puts the fetched tile into the low byte of the shift registers.
+static inline void load_background_shifters(PPUContext *ppu_ctx) {
+    ppu_ctx->pattern_low_shifter =
+        (ppu_ctx->pattern_low_shifter & 0xff00) | ppu_ctx->pattern_low_latch;
+    ppu_ctx->pattern_high_shifter =
+        (ppu_ctx->pattern_high_shifter & 0xff00) | ppu_ctx->pattern_high_latch;
+    ppu_ctx->attribute_low_shifter =
+        (ppu_ctx->attribute_low_shifter & 0xff00) |
+        ((ppu_ctx->attribute_latch & 0x1) ? 0xff : 0x00);
+    ppu_ctx->attribute_high_shifter =
+        (ppu_ctx->attribute_high_shifter & 0xff00) |
+        ((ppu_ctx->attribute_latch & 0x2) ? 0xff : 0x00);
+}
+
+static inline void shift_background_shifters(PPUContext *ppu_ctx) {
+    ppu_ctx->pattern_low_shifter <<= 1;
+    ppu_ctx->pattern_high_shifter <<= 1;
+    ppu_ctx->attribute_low_shifter <<= 1;
+    ppu_ctx->attribute_high_shifter <<= 1;
+}
+
+// Does the background fetches, shifts and scroll updates of one dot on a
+// rendering scanline, following the real 8-dot fetch cadence.
+static void background_tick(PPUContext *ppu_ctx, int pre_render_line) {
+    uint16_t dot = ppu_ctx->current_dot;
+
+    if ((dot >= 2 && dot <= 257) || (dot >= 321 && dot <= 337)) {
+        shift_background_shifters(ppu_ctx);
+
+        switch ((dot - 1) % 8) {
+        case 0:
+            load_background_shifters(ppu_ctx);
+            ppu_ctx->nametable_latch = fetch_nametable_byte(ppu_ctx);
+            break;
+        case 2:
+            ppu_ctx->attribute_latch = fetch_attribute(ppu_ctx);
+            break;
+        case 4:
+            ppu_ctx->pattern_low_latch = ppu_memory_read(
+                background_pattern_address(ppu_ctx), ppu_ctx);
+            break;
+        case 6:
+            ppu_ctx->pattern_high_latch = ppu_memory_read(
+                background_pattern_address(ppu_ctx) + 8, ppu_ctx);
+            break;
+        case 7:
+            increment_coarse_x(ppu_ctx);
+            break;
+        }
     }
 
-    // Increment current dot and scanline
+    if (dot == 256)
+        increment_y(ppu_ctx);
 
+    if (dot == 257) {
+        load_background_shifters(ppu_ctx);
+        copy_horizontal_position(ppu_ctx);
+    }
+
+    // Unused nametable fetches at the end of the scanline
+    if (dot == 338 || dot == 340)
+        ppu_ctx->nametable_latch = fetch_nametable_byte(ppu_ctx);
+
+    if (pre_render_line && dot >= 280 && dot <= 304)
+        copy_vertical_position(ppu_ctx);
+}
+
+// Returns the background pixel currently at the output of the shift
+// registers as an index into palette memory (0 when transparent).
+static inline uint8_t background_pixel(PPUContext *ppu_ctx) {
+    uint16_t bit = 0x8000 >> ppu_ctx->fine_x;
+
+    uint8_t pixel = ((ppu_ctx->pattern_high_shifter & bit) > 0) << 1 |
+                    ((ppu_ctx->pattern_low_shifter & bit) > 0);
+    if (!pixel)
+        return 0;
+
+    uint8_t palette = ((ppu_ctx->attribute_high_shifter & bit) > 0) << 1 |
+                      ((ppu_ctx->attribute_low_shifter & bit) > 0);
+    return palette << 2 | pixel;
+}
+
+// Fetches the tile at `PPUContext.vram_address` into the latches, like the
+// 8 dots of a fetch group do.
+static inline void fetch_tile(PPUContext *ppu_ctx) {
+    ppu_ctx->nametable_latch = fetch_nametable_byte(ppu_ctx);
+    ppu_ctx->attribute_latch = fetch_attribute(ppu_ctx);
+    uint16_t pattern_address = background_pattern_address(ppu_ctx);
+    ppu_ctx->pattern_low_latch = ppu_memory_read(pattern_address, ppu_ctx);
+    ppu_ctx->pattern_high_latch = ppu_memory_read(pattern_address + 8, ppu_ctx);
+    increment_coarse_x(ppu_ctx);
+}
+
+// Computes which pixels of the background are opaque on the current scanline
+// (one bit per pixel, leftmost pixel in the lowest bit of `mask[0]`) without
+// affecting the state of the PPU. Needs to be called at the start of the
+// scanline.
+static void background_opaque_mask(PPUContext *ppu_ctx, uint64_t mask[4]) {
+    // Opaque pixels of the 33 tiles partially visible on the scanline plus
+    // padding, first two come from the shift registers
+    uint8_t tiles[34];
+    tiles[0] = reverse_bits(
+        (ppu_ctx->pattern_low_shifter | ppu_ctx->pattern_high_shifter) >> 8);
+    tiles[1] = reverse_bits(ppu_ctx->pattern_low_shifter |
+                            ppu_ctx->pattern_high_shifter);
+
+    uint16_t saved_vram_address = ppu_ctx->vram_address;
+    uint16_t pattern_table =
+        ppu_ctx->ppuctrl.background_pattern_table_select * 0x1000;
+    uint8_t fine_y = ppu_ctx->vram_address >> 12;
+
+    for (int i = 2; i < 34; i++) {
+        uint16_t address =
+            pattern_table + fetch_nametable_byte(ppu_ctx) * 16 + fine_y;
+        tiles[i] = reverse_bits(ppu_memory_read(address, ppu_ctx) |
+                                ppu_memory_read(address + 8, ppu_ctx));
+        increment_coarse_x(ppu_ctx);
+    }
+
+    ppu_ctx->vram_address = saved_vram_address;
+
+    uint8_t line[PPU_VISIBLE_AREA_WIDTH / 8];
+    for (int i = 0; i < PPU_VISIBLE_AREA_WIDTH / 8; i++)
+        line[i] = tiles[i] >> ppu_ctx->fine_x |
+                  tiles[i + 1] << (8 - ppu_ctx->fine_x);
+
+    memcpy(mask, line, sizeof(line));
+}
+
+// Predicts on which dot of the current scanline (if any) sprite 0 hit
+// happens by intersecting the opaque pixels of sprite 0 with the opaque pixels
+// of the background. Needs to be called at the start of the scanline.
+static void predict_sprite_0_hit(PPUContext *ppu_ctx, uint8_t sprite_0_opaque,
+                                 uint8_t sprite_0_x) {
+    if (ppu_ctx->ppustatus.sprite_0_hit || !sprite_0_opaque ||
+        !ppu_ctx->ppumask.background_enable ||
+        !ppu_ctx->ppumask.sprites_enable)
+        return;
+
+    uint64_t sprite_mask[5] = {0};
+    sprite_mask[sprite_0_x / 64] = (uint64_t)sprite_0_opaque
+                                   << (sprite_0_x % 64);
+    if (sprite_0_x % 64 > 56)
+        sprite_mask[sprite_0_x / 64 + 1] =
+            sprite_0_opaque >> (64 - sprite_0_x % 64);
+
+    uint64_t background_mask[4];
+    background_opaque_mask(ppu_ctx, background_mask);
+
+    // No hits in the clipped left column or on the rightmost pixel
+    if (!ppu_ctx->ppumask.show_background_left_column ||
+        !ppu_ctx->ppumask.show_sprites_left_column)
+        background_mask[0] &= ~0xffULL;
+    background_mask[3] &= ~(1ULL << 63);
+
+    for (int i = 0; i < 4; i++) {
+        uint64_t hits = sprite_mask[i] & background_mask[i];
+        if (!hits)
+            continue;
+
+        // Pixel x is output on dot x + 1
+        int x = i * 64 + __builtin_ctzll(hits);
+        ppu_ctx->sprite_0_hit_dot = ppu_ctx->dots_elapsed + x + 1;
+        return;
+    }
+}
+
+// Checks for a sprite 0 hit at pixel `x`, used when the prediction made at the
+// start of the scanline is unreliable.
+static inline void check_sprite_0_hit(PPUContext *ppu_ctx, int x,
+                                      uint8_t background_pixel) {
+    uint8_t sprite_pixel = visible_sprite_pixel(ppu_ctx, x);
+
+    if ((sprite_pixel & SPRITE_PIXEL_SPRITE_0) && (sprite_pixel & 0x3) &&
+        (visible_background_pixel(ppu_ctx, x, background_pixel) & 0x3) &&
+        x != PPU_VISIBLE_AREA_WIDTH - 1)
+        ppu_ctx->ppustatus.sprite_0_hit = 1;
+}
+
+// Rendering registers written in the middle of a visible scanline can change
+// the outcome of the sprite 0 hit prediction, so the rest of the scanline
+// falls back to checking every dot.
+static void invalidate_sprite_0_prediction(PPUContext *ppu_ctx) {
+    if (ppu_ctx->current_scanline >= PPU_VISIBLE_AREA_HEIGTH ||
+        ppu_ctx->current_dot == 0 || ppu_ctx->ppustatus.sprite_0_hit)
+        return;
+
+    ppu_ctx->sprite_0_hit_dot = 0;
+    ppu_ctx->sprite_0_hit_per_dot = 1;
+}
+
+// Fetches the first two tiles of the next scanline into the shift registers
+// and latches, as the fetches at the end of a scanline do.
+static void prefetch_next_scanline(PPUContext *ppu_ctx) {
+    fetch_tile(ppu_ctx);
+    uint8_t first_pattern_low = ppu_ctx->pattern_low_latch;
+    uint8_t first_pattern_high = ppu_ctx->pattern_high_latch;
+    uint8_t first_attribute = ppu_ctx->attribute_latch;
+    fetch_tile(ppu_ctx);
+
+    ppu_ctx->pattern_low_shifter = first_pattern_low << 8;
+    ppu_ctx->pattern_high_shifter = first_pattern_high << 8;
+    ppu_ctx->attribute_low_shifter = (first_attribute & 0x1) ? 0xff00 : 0;
+    ppu_ctx->attribute_high_shifter = (first_attribute & 0x2) ? 0xff00 : 0;
+    load_background_shifters(ppu_ctx);
+    ppu_ctx->nametable_latch = fetch_nametable_byte(ppu_ctx);
+}
+
+// Renders a whole rendering scanline in one go, one fetch group (eight
+// pixels) at a time. Leaves the PPU in the same state as ticking through the
+// scanline dot by dot would, as long as no registers are written in between
+// (which the catch-up model guarantees).
+//
+// On the pre-render scanline or without a `framebuffer` none of the tiles are
+// looked at. Their fetches only move coarse X along, which gets reset at the
+// end of the scanline anyway.
+static void render_scanline_fast(PPUContext *ppu_ctx, uint32_t *framebuffer,
+                                 int pre_render_line) {
+    if (!framebuffer || pre_render_line) {
+        increment_y(ppu_ctx);
+        copy_horizontal_position(ppu_ctx);
+        if (pre_render_line)
+            copy_vertical_position(ppu_ctx);
+        prefetch_next_scanline(ppu_ctx);
+        return;
+    }
+
+    // Palette indices of the 33 tiles partially visible on the scanline plus
+    // the one fetched but scrolled out of view
+    uint64_t tiles[34];
+
+    // The first two tiles were prefetched at the end of the previous
+    // scanline and sit in the shift registers
+    tiles[0] = apply_palette(
+        decode_tile_row(ppu_ctx->pattern_low_shifter >> 8,
+                        ppu_ctx->pattern_high_shifter >> 8),
+        ((ppu_ctx->attribute_high_shifter >> 15) & 1) << 1 |
+            ((ppu_ctx->attribute_low_shifter >> 15) & 1));
+    tiles[1] = apply_palette(
+        decode_tile_row(ppu_ctx->pattern_low_shifter & 0xff,
+                        ppu_ctx->pattern_high_shifter & 0xff),
+        ((ppu_ctx->attribute_high_shifter >> 7) & 1) << 1 |
+            ((ppu_ctx->attribute_low_shifter >> 7) & 1));
+
+    uint16_t pattern_table =
+        ppu_ctx->ppuctrl.background_pattern_table_select * 0x100;
+    uint8_t fine_y = ppu_ctx->vram_address >> 12;
+
+    for (int i = 2; i < 34; i++) {
+        uint8_t tile = fetch_nametable_byte(ppu_ctx);
+        uint8_t palette = fetch_attribute(ppu_ctx);
+        tiles[i] = apply_palette(
+            get_tile_row(ppu_ctx, pattern_table + tile, fine_y), palette);
+        increment_coarse_x(ppu_ctx);
+    }
+
+    increment_y(ppu_ctx);
+    copy_horizontal_position(ppu_ctx);
+    prefetch_next_scanline(ppu_ctx);
+
+    uint8_t line[sizeof(tiles)];
+    memcpy(line, tiles, sizeof(tiles));
+
+    for (int x = 0; x < PPU_VISIBLE_AREA_WIDTH; x++)
+        output_pixel(ppu_ctx, framebuffer, x, line[x + ppu_ctx->fine_x]);
+}
+
+// ----- Timing -----
+
+static inline void advance_dot(PPUContext *ppu_ctx) {
+    ppu_ctx->dots_elapsed++;
     ppu_ctx->current_dot++;
 
     if (ppu_ctx->current_dot == DOTS_PER_SCANLINE) {
@@ -125,21 +679,192 @@ void ppu_tick(PPUContext *ppu_ctx, uint32_t *framebuffer, int *out_nmi_needed) {
         ppu_ctx->current_scanline++;
     }
 
-    if (ppu_ctx->current_scanline == SCANLINES_PER_FRAME)
+    if (ppu_ctx->current_scanline == SCANLINES_PER_FRAME) {
         ppu_ctx->current_scanline = 0;
+        ppu_ctx->frame_count++;
+    }
+}
 
-    return;
+// Clears vblank, sprite 0 hit and sprite overflow at the end of vblank.
+static inline void clear_status_flags(PPUContext *ppu_ctx) {
+    ppu_ctx->ppustatus.vblank = 0;
+    ppu_ctx->ppustatus.sprite_0_hit = 0;
+    ppu_ctx->ppustatus.sprite_overflow = 0;
 }
 
+void ppu_tick(PPUContext *ppu_ctx, uint32_t *framebuffer, int *out_nmi_needed) {
+    uint16_t dot = ppu_ctx->current_dot;
+    uint16_t scanline = ppu_ctx->current_scanline;
+    int visible_line = scanline < PPU_VISIBLE_AREA_HEIGTH;
+    int pre_render_line = scanline == PPU_PRE_RENDER_SCANLINE;
+
+    // Vertical blank triggers on certain dots, also we interrupt the CPU at the
+    // start of it
+    if (dot == 1 && scanline == PPU_VBLANK_SCANLINE) {
+        ppu_ctx->ppustatus.vblank = 1;
+        if (out_nmi_needed && ppu_ctx->ppuctrl.vblank_nmi_enable)
+            *out_nmi_needed = 1;
+    }
+
+    if (dot == 1 && pre_render_line)
+        clear_status_flags(ppu_ctx);
+
+    if (visible_line && dot == 0)
+        evaluate_sprites(ppu_ctx, framebuffer != 0);
+
+    if ((visible_line || pre_render_line) && rendering_enabled(ppu_ctx))
+        background_tick(ppu_ctx, pre_render_line);
+
+    if (visible_line && dot >= 1 && dot <= PPU_VISIBLE_AREA_WIDTH &&
+        (framebuffer || ppu_ctx->sprite_0_hit_per_dot)) {
+        uint8_t background = background_pixel(ppu_ctx);
+
+        if (ppu_ctx->sprite_0_hit_per_dot)
+            check_sprite_0_hit(ppu_ctx, dot - 1, background);
+        if (framebuffer)
+            output_pixel(ppu_ctx, framebuffer, dot - 1, background);
+    }
+
+    if (ppu_ctx->sprite_0_hit_dot &&
+        ppu_ctx->dots_elapsed == ppu_ctx->sprite_0_hit_dot)
+        ppu_ctx->ppustatus.sprite_0_hit = 1;
+
+    advance_dot(ppu_ctx);
+}
+
+// Runs a whole scanline starting from dot 0 of a visible or the pre-render
+// scanline.
+static void run_scanline(PPUContext *ppu_ctx) {
+    int pre_render_line =
+        ppu_ctx->current_scanline == PPU_PRE_RENDER_SCANLINE;
+
+    uint64_t scanline_start = ppu_ctx->dots_elapsed;
+
+    if (pre_render_line)
+        clear_status_flags(ppu_ctx);
+    else
+        evaluate_sprites(ppu_ctx, ppu_ctx->framebuffer != 0);
+
+    if (rendering_enabled(ppu_ctx)) {
+        render_scanline_fast(ppu_ctx, ppu_ctx->framebuffer, pre_render_line);
+    } else if (!pre_render_line && ppu_ctx->framebuffer) {
+        for (int x = 0; x < PPU_VISIBLE_AREA_WIDTH; x++)
+            output_pixel(ppu_ctx, ppu_ctx->framebuffer, x, 0);
+    }
+
+    if (ppu_ctx->sprite_0_hit_dot &&
+        ppu_ctx->sprite_0_hit_dot >= scanline_start)
+        ppu_ctx->ppustatus.sprite_0_hit = 1;
+
+    ppu_ctx->dots_elapsed += DOTS_PER_SCANLINE - 1;
+    ppu_ctx->current_dot = DOTS_PER_SCANLINE - 1;
+    advance_dot(ppu_ctx);
+}
+
+// Position of the current dot counted from the start of the frame.
+static inline uint32_t frame_position(PPUContext *ppu_ctx) {
+    return ppu_ctx->current_scanline * DOTS_PER_SCANLINE +
+           ppu_ctx->current_dot;
+}
+
+// Returns how many dots can be skipped from the current position without
+// missing anything observable, 0 if the current dot needs to be ticked.
+//
+// Post-render and vblank scanlines do nothing except for setting the vblank
+// flag, so the whole stretch up to the pre-render scanline can be jumped over.
+static uint32_t idle_dots_ahead(PPUContext *ppu_ctx) {
+    if (ppu_ctx->current_scanline < PPU_VISIBLE_AREA_HEIGTH ||
+        ppu_ctx->current_scanline >= PPU_PRE_RENDER_SCANLINE)
+        return 0;
+
+    uint32_t position = frame_position(ppu_ctx);
+    uint32_t vblank_start = PPU_VBLANK_SCANLINE * DOTS_PER_SCANLINE + 1;
+
+    if (position < vblank_start)
+        return vblank_start - position;
+    if (position == vblank_start)
+        return 0;
+
+    return PPU_PRE_RENDER_SCANLINE * DOTS_PER_SCANLINE - position;
+}
+
+void ppu_run_until(PPUContext *ppu_ctx, uint64_t target_dot) {
+    if (ppu_ctx->dots_elapsed >= target_dot)
+        return;
+
+    HOST_STATS_ENTER(HOST_STATS_PPU);
+    while (ppu_ctx->dots_elapsed < target_dot) {
+        // Whole scanlines are rendered a tile at a time
+        if (ppu_ctx->current_dot == 0 &&
+            (ppu_ctx->current_scanline < PPU_VISIBLE_AREA_HEIGTH ||
+             ppu_ctx->current_scanline == PPU_PRE_RENDER_SCANLINE) &&
+            target_dot - ppu_ctx->dots_elapsed >= DOTS_PER_SCANLINE) {
+            run_scanline(ppu_ctx);
+            continue;
+        }
+
+        uint64_t skip = idle_dots_ahead(ppu_ctx);
+        if (!skip) {
+            ppu_tick(ppu_ctx, ppu_ctx->framebuffer, &ppu_ctx->nmi_pending);
+            continue;
+        }
+
+        if (skip > target_dot - ppu_ctx->dots_elapsed)
+            skip = target_dot - ppu_ctx->dots_elapsed;
+
+        // Skipping never crosses a frame boundary, see `idle_dots_ahead`
+        uint32_t position = frame_position(ppu_ctx) + skip;
+        ppu_ctx->current_scanline = position / DOTS_PER_SCANLINE;
+        ppu_ctx->current_dot = position % DOTS_PER_SCANLINE;
+        ppu_ctx->dots_elapsed += skip;
+    }
+    HOST_STATS_LEAVE();
+}
+
+uint64_t ppu_next_event_dot(PPUContext *ppu_ctx) {
+    uint32_t position = frame_position(ppu_ctx);
+    uint32_t vblank_start = PPU_VBLANK_SCANLINE * DOTS_PER_SCANLINE + 1;
+
+    // The dot after vblank start, by then the flag and NMI have been raised
+    uint64_t event_dot;
+    if (position <= vblank_start)
+        event_dot = ppu_ctx->dots_elapsed + (vblank_start - position) + 1;
+    else
+        event_dot = ppu_ctx->dots_elapsed + (DOTS_PER_FRAME - position) +
+                    vblank_start + 1;
+
+    if (ppu_ctx->sprite_0_hit_dot &&
+        ppu_ctx->sprite_0_hit_dot >= ppu_ctx->dots_elapsed &&
+        ppu_ctx->sprite_0_hit_dot + 1 < event_dot)
+        event_dot = ppu_ctx->sprite_0_hit_dot + 1;
+
+    return event_dot;
+}
+
+// ----- Registers -----
+
 uint8_t ppu_read_ppustatus(PPUContext *ppu_ctx) {
+    uint8_t value = ppu_ctx->ppustatus.value;
+
+    // Reading clears vblank
+    ppu_ctx->ppustatus.vblank = 0;
     ppu_ctx->write_latch = 0;
-    return ppu_ctx->ppustatus.value;
+    return value;
 }
 
 uint8_t ppu_read_ppudata(PPUContext *ppu_ctx) {
-    // Reading data from the PPU is delayed by one read
+    uint16_t address = ppu_ctx->vram_address & 0x3fff;
+
+    // Reading data from the PPU is delayed by one read, except for palettes
+    // which are returned right away (the buffer gets the nametable byte
+    // "underneath" instead)
     uint8_t return_value = ppu_ctx->read_buffer;
-    ppu_ctx->read_buffer = ppu_memory_read(ppu_ctx->address, &ppu_ctx->memory);
+    if (address >= 0x3f00) {
+        return_value = ppu_ctx->memory.palette[palette_index(address)];
+        ppu_ctx->read_buffer = nametable_read(address - 0x1000, ppu_ctx);
+    } else {
+        ppu_ctx->read_buffer = ppu_memory_read(address, ppu_ctx);
+    }
 
     increment_ppu_address(ppu_ctx);
 
@@ -151,33 +876,51 @@ uint8_t ppu_read_oamdata(PPUContext *ppu_ctx) {
 }
 
 void ppu_write_ppuctrl(uint8_t value, PPUContext *ppu_ctx) {
+    invalidate_sprite_0_prediction(ppu_ctx);
     ppu_ctx->ppuctrl.value = value;
+    ppu_ctx->temp_vram_address =
+        (ppu_ctx->temp_vram_address & ~0x0c00) | (value & 0x3) << 10;
 }
 
 void ppu_write_ppumask(uint8_t value, PPUContext *ppu_ctx) {
+    invalidate_sprite_0_prediction(ppu_ctx);
     ppu_ctx->ppumask.value = value;
 }
 
 void ppu_write_ppuscroll(uint8_t value, PPUContext *ppu_ctx) {
-    if (!ppu_ctx->write_latch)
-        ppu_ctx->scroll_x = value;
-    else
-        ppu_ctx->scroll_y = value;
+    invalidate_sprite_0_prediction(ppu_ctx);
+    if (!ppu_ctx->write_latch) {
+        // Coarse and fine x
+        ppu_ctx->temp_vram_address =
+            (ppu_ctx->temp_vram_address & ~0x001f) | value >> 3;
+        ppu_ctx->fine_x = value & 0x7;
+    } else {
+        // Coarse and fine y
+        ppu_ctx->temp_vram_address = (ppu_ctx->temp_vram_address & ~0x73e0) |
+                                     (value & 0x07) << 12 |
+                                     (value & 0xf8) << 2;
+    }
 
     ppu_ctx->write_latch = !ppu_ctx->write_latch;
 }
 
 void ppu_write_ppuaddr(uint8_t value, PPUContext *ppu_ctx) {
-    if (!ppu_ctx->write_latch)
-        ppu_ctx->address = (ppu_ctx->address & 0x00ff) | value << 8;
-    else
-        ppu_ctx->address = (ppu_ctx->address & 0xff00) | value;
+    invalidate_sprite_0_prediction(ppu_ctx);
+    if (!ppu_ctx->write_latch) {
+        ppu_ctx->temp_vram_address =
+            (ppu_ctx->temp_vram_address & 0x00ff) | (value & 0x3f) << 8;
+    } else {
+        ppu_ctx->temp_vram_address =
+            (ppu_ctx->temp_vram_address & 0xff00) | value;
+        ppu_ctx->vram_address = ppu_ctx->temp_vram_address;
+    }
 
     ppu_ctx->write_latch = !ppu_ctx->write_latch;
 }
 
 void ppu_write_ppudata(uint8_t value, PPUContext *ppu_ctx) {
-    ppu_memory_write(ppu_ctx->address, value, &ppu_ctx->memory);
+    invalidate_sprite_0_prediction(ppu_ctx);
+    ppu_memory_write(ppu_ctx->vram_address, value, ppu_ctx);
     increment_ppu_address(ppu_ctx);
 }
 
@@ -186,6 +929,7 @@ void ppu_write_oamaddr(uint8_t value, PPUContext *ppu_ctx) {
 }
 
 void ppu_write_oamdata(uint8_t value, PPUContext *ppu_ctx) {
+    invalidate_sprite_0_prediction(ppu_ctx);
     // Won't need safety checks since oam_address is one byte and the size of
     // oam is 0x100
     ppu_ctx->oam[ppu_ctx->oam_address++] = value;
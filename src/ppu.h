@@ -8,6 +8,12 @@
 
 #define DOTS_PER_SCANLINE 341
 #define SCANLINES_PER_FRAME 262
+#define DOTS_PER_FRAME (DOTS_PER_SCANLINE * SCANLINES_PER_FRAME)
+#define PPU_DOTS_PER_CPU_CYCLE 3
+
+// Scanline on which vertical blank (and the NMI) starts
+#define PPU_VBLANK_SCANLINE 241
+#define PPU_PRE_RENDER_SCANLINE 261
 
 #define PPU_MEMORY_PATTERN_TABLE_SIZE 0x1000
 #define PPU_MEMORY_NAMETABLE_SIZE 0x400
@@ -17,6 +23,10 @@
 
 #define PPU_OAM_ENTRY_COUNT 64
 #define PPU_OAM_SIZE (PPU_OAM_ENTRY_COUNT * 4)
+// Amount of sprites that can be drawn on one scanline
+#define PPU_SPRITES_PER_SCANLINE 8
+
+#define PPU_TILE_COUNT (PPU_MEMORY_PATTERN_TABLE_SIZE * 2 / 16)
 
 #include <assert.h>
 #include <stdint.h>
@@ -108,6 +118,36 @@ typedef struct {
 
 } PPUMemory;
 
+typedef enum {
+    // Nametables 0x2000 and 0x2400 are the same, as are 0x2800 and 0x2C00
+    PPU_MIRRORING_HORIZONTAL,
+    // Nametables 0x2000 and 0x2800 are the same, as are 0x2400 and 0x2C00
+    PPU_MIRRORING_VERTICAL,
+    // All four nametables are separate
+    PPU_MIRRORING_FOUR_SCREEN,
+} PPUMirroring;
+
+// What the PPU writes into the framebuffer, made while compositing each pixel
+// so that nothing has to go over the frame again afterwards.
+typedef enum {
+    // A `uint32_t` 0x00RRGGBB color per pixel
+    PPU_OUTPUT_RGB,
+    // A byte per pixel, which of the 64 colors of the palette it is. Color
+    // emphasis is left out. Downsampled by keeping one pixel of each square.
+    PPU_OUTPUT_PALETTE_INDEX,
+    // A byte per pixel, the luma of its color. Downsampled by averaging each
+    // square.
+    PPU_OUTPUT_GRAY,
+} PPUOutputFormat;
+
+// Made with `ppu_output_init`, zero being full color at full size.
+typedef struct {
+    PPUOutputFormat format;
+    // The byte formats are `1 << downsample_shift` times smaller in both
+    // directions
+    uint8_t downsample_shift;
+} PPUOutput;
+
 typedef union {
     struct {
         uint8_t palette : 2;
@@ -128,37 +168,141 @@ typedef struct __attribute__((packed)) {
 
 typedef struct {
     PPUMemory memory;
+    PPUMirroring mirroring;
     uint8_t oam[PPU_OAM_SIZE];
     uint8_t oam_address;
     PPUStatus ppustatus;
     PPUCtrl ppuctrl;
     PPUMask ppumask;
+
+    // Internal scrolling registers, see
+    // https://www.nesdev.org/wiki/PPU_scrolling
+
+    // (v) Current VRAM address, also used as the scroll position while
+    // rendering: 0yyyNNYYYYYXXXXX (fine y, nametable, coarse y, coarse x).
+    uint16_t vram_address;
+    // (t) Temporary VRAM address, copied into `vram_address` at certain points
+    // of the frame.
+    uint16_t temp_vram_address;
+    // (x) Fine x scroll, 3 bits.
+    uint8_t fine_x;
+    // (w) First or second write toggle for PPUSCROLL and PPUADDR.
     uint8_t write_latch;
-    uint8_t scroll_x;
-    uint8_t scroll_y;
-    uint16_t address;
+
+    // Background tile data fetched for the next tile.
+    uint8_t nametable_latch;
+    uint8_t attribute_latch;
+    uint8_t pattern_low_latch;
+    uint8_t pattern_high_latch;
+
+    // Background shift registers, the high byte holds the tile currently
+    // being drawn and the low byte the next one.
+    uint16_t pattern_low_shifter;
+    uint16_t pattern_high_shifter;
+    uint16_t attribute_low_shifter;
+    uint16_t attribute_high_shifter;
+
+    // Sprite pixels of the current scanline, see `SPRITE_PIXEL_*` in ppu.c.
+    uint8_t sprite_line[PPU_VISIBLE_AREA_WIDTH];
+
+    // Decoded tile cache: every row of every tile in the pattern tables with
+    // one 2-bit pixel per byte, leftmost pixel in the lowest byte. A tile is
+    // decoded on first use after its pattern data has been written.
+    uint64_t tile_rows[PPU_TILE_COUNT][8];
+    uint8_t tile_decoded[PPU_TILE_COUNT];
+
+    // Sprite 0 hit is predicted once per scanline when sprites are evaluated,
+    // by intersecting the opaque pixels of sprite 0 and the background.
+
+    // Dot (in total dots since power-on) on which sprite 0 hit gets set on the
+    // current scanline, 0 if it doesn't.
+    uint64_t sprite_0_hit_dot;
+    // Set if rendering registers were written in the middle of the scanline,
+    // which makes `sprite_0_hit_dot` unreliable, so the rest of the scanline
+    // is checked dot by dot instead.
+    uint8_t sprite_0_hit_per_dot;
 
     // Used to delay reads from PPUDATA by one.
     uint8_t read_buffer;
 
     uint16_t current_dot;
     uint16_t current_scanline;
+
+    // Catch-up state: the PPU is not stepped along with the CPU but is run in
+    // bulk up to the current CPU time whenever the CPU could observe it (see
+    // `ppu_run_until`).
+
+    // Total number of dots run since power-on.
+    uint64_t dots_elapsed;
+    // Number of frames completed since power-on.
+    uint64_t frame_count;
+    // Set when a vblank NMI has been raised and not yet relayed to the CPU.
+    int nmi_pending;
+    // Where rendered pixels are written to during catch-up, can be null to
+    // skip rendering (see `ppu_tick`).
+    uint32_t *framebuffer;
+    PPUOutput output;
+    // Luma of the squares of the current row of a downsampled gray output
+    uint16_t gray_sums[PPU_VISIBLE_AREA_WIDTH / 2];
 } PPUContext;
 
+// Makes an output of `format`, the byte formats `downsample` times smaller in
+// both directions: 1 (or 0), 2 or 4. Full color is always full size.
+//
+// Returns 1 if `downsample` is something else, the output is full size then.
+int ppu_output_init(PPUOutput *output, PPUOutputFormat format, int downsample);
+
+// Of what `PPUContext.framebuffer` is filled with.
+static inline int ppu_output_width(const PPUOutput *output) {
+    if (output->format == PPU_OUTPUT_RGB)
+        return PPU_VISIBLE_AREA_WIDTH;
+    return PPU_VISIBLE_AREA_WIDTH >> output->downsample_shift;
+}
+
+static inline int ppu_output_height(const PPUOutput *output) {
+    if (output->format == PPU_OUTPUT_RGB)
+        return PPU_VISIBLE_AREA_HEIGTH;
+    return PPU_VISIBLE_AREA_HEIGTH >> output->downsample_shift;
+}
+
+// In bytes
+static inline int ppu_output_size(const PPUOutput *output) {
+    int pixel_size = output->format == PPU_OUTPUT_RGB ? sizeof(uint32_t) : 1;
+    return ppu_output_width(output) * ppu_output_height(output) * pixel_size;
+}
+
 // Does one tick of the PPU.
 //
 // `out_nmi_needed` is set to one if an vblank NMI (Non-Maskable Interrupt) is
 // needed to be relayed to the CPU.
 //
-// Outputted pixel data is written to `framebuffer` in BGRA8888 format. The
-// framebuffer needs to be (`PPU_VISIBLE_AREA_WIDTH` *
-// `PPU_VISIBLE_AREA_HEIGTH`) * 4 bytes long. If the pointer is null no data
-// will be written.
+// Outputted pixel data is written to `framebuffer` in BGRA8888 format, or as
+// set in `PPUContext.output`. The framebuffer needs to be
+// `ppu_output_size` bytes long, for the byte formats it is written to a byte
+// at a time regardless of its type. If the pointer is null no data
+// will be written and no pixel work is done, only the things the CPU can
+// observe (vblank, NMI, sprite 0 hit and sprite overflow) are kept up.
 void ppu_tick(PPUContext *ppu_ctx, uint32_t *framebuffer, int *out_nmi_needed);
 
+// Marks all tiles in the decoded tile cache as stale. Needs to be called after
+// writing into pattern tables directly instead of through PPUDATA.
+void ppu_invalidate_tile_cache(PPUContext *ppu_ctx);
+
+// Catches the PPU up to `target_dot` (in total dots since power-on), writing
+// pixels to `PPUContext.framebuffer` and setting `PPUContext.nmi_pending` if
+// vblank started along the way. Stretches of the frame where nothing
+// observable happens are skipped over in one step instead of dot by dot, and
+// whole scanlines are rendered a tile (eight pixels) at a time.
+void ppu_run_until(PPUContext *ppu_ctx, uint64_t target_dot);
+
+// Returns the dot count (in total dots since power-on) by which the next event
+// the CPU needs to be woken up for has happened, i.e. the start of the next
+// vblank or a sprite 0 hit predicted on the current scanline.
+uint64_t ppu_next_event_dot(PPUContext *ppu_ctx);
+
 // Rendering events
 uint8_t ppu_read_ppustatus(PPUContext *ppu_ctx);
-// Read data from PPU memory at address `PPUContext.address` (delayed by one).
+// Read data from PPU memory at address `PPUContext.vram_address` (delayed by one).
 uint8_t ppu_read_ppudata(PPUContext *ppu_ctx);
 // Read data from OAM at `PPUContext.oam_address`.
 uint8_t ppu_read_oamdata(PPUContext *ppu_ctx);
@@ -171,7 +315,7 @@ void ppu_write_ppumask(uint8_t value, PPUContext *ppu_ctx);
 void ppu_write_ppuscroll(uint8_t value, PPUContext *ppu_ctx);
 // PPU memory read/write address (takes 2 writes, high and low byte).
 void ppu_write_ppuaddr(uint8_t value, PPUContext *ppu_ctx);
-// Write data into PPU memory at address `PPUContext.address`.
+// Write data into PPU memory at address `PPUContext.vram_address`.
 void ppu_write_ppudata(uint8_t value, PPUContext *ppu_ctx);
 // OAM read/write address register
 void ppu_write_oamaddr(uint8_t value, PPUContext *ppu_ctx);
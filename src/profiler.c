@@ -0,0 +1,251 @@
+#include "profiler.h"
+#include "memory.h"
+#include "trace.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void profiler_init(Profiler *profiler, uint64_t cpu_cycle) {
+    memset(profiler, 0, sizeof(Profiler));
+    profiler->node_count = 1;
+    profiler->nodes[PROFILER_ROOT].parent = -1;
+    profiler->stack[0] = PROFILER_ROOT;
+    profiler->depth = 1;
+    profiler->charged_cycle = cpu_cycle;
+}
+
+void profiler_charge(Profiler *profiler, uint64_t cpu_cycle) {
+    int node = profiler->stack[profiler->depth - 1];
+    profiler->nodes[node].cycles += cpu_cycle - profiler->charged_cycle;
+    profiler->charged_cycle = cpu_cycle;
+}
+
+// Finds or adds the node for calling `address` from `parent`. Gives `parent`
+// back if there's no room for more nodes.
+static int child_node(Profiler *profiler, int parent, uint16_t address,
+                      ProfilerInterrupt interrupt) {
+    uint32_t key = (uint32_t)parent << 18 | address << 2 | interrupt;
+    uint32_t slot = (key * 2654435761u) % PROFILER_NODE_TABLE_SIZE;
+
+    while (profiler->node_table[slot]) {
+        int node = profiler->node_table[slot] - 1;
+        ProfilerNode *candidate = &profiler->nodes[node];
+        if (candidate->parent == parent && candidate->address == address &&
+            candidate->interrupt == interrupt)
+            return node;
+        slot = (slot + 1) % PROFILER_NODE_TABLE_SIZE;
+    }
+
+    if (profiler->node_count == PROFILER_MAX_NODES)
+        return parent;
+
+    int node = profiler->node_count++;
+    profiler->nodes[node] = (ProfilerNode){
+        .address = address, .interrupt = interrupt, .parent = parent};
+    profiler->node_table[slot] = node + 1;
+    return node;
+}
+
+void profiler_enter(Profiler *profiler, uint16_t address,
+                    ProfilerInterrupt interrupt, uint64_t cpu_cycle) {
+    profiler_charge(profiler, cpu_cycle);
+
+    if (profiler->depth == PROFILER_MAX_DEPTH) {
+        profiler->overflow++;
+        return;
+    }
+
+    int parent = profiler->stack[profiler->depth - 1];
+    int node = child_node(profiler, parent, address, interrupt);
+    profiler->stack[profiler->depth++] = node;
+    profiler->nodes[node].calls++;
+}
+
+void profiler_leave(Profiler *profiler, int interrupt, uint64_t cpu_cycle) {
+    profiler_charge(profiler, cpu_cycle);
+
+    if (profiler->overflow) {
+        profiler->overflow--;
+        return;
+    }
+
+    if (!interrupt) {
+        if (profiler->depth > 1)
+            profiler->depth--;
+        return;
+    }
+
+    // Unwind to the interrupt, if it's on the stack at all
+    for (int depth = profiler->depth - 1; depth > 0; depth--) {
+        if (profiler->nodes[profiler->stack[depth]].interrupt) {
+            profiler->depth = depth;
+            return;
+        }
+    }
+}
+
+static void node_name(ProfilerNode *node, int index, char *name, size_t size) {
+    static const char *prefixes[] = {
+        [PROFILER_NO_INTERRUPT] = "sub",
+        [PROFILER_NMI] = "nmi",
+        [PROFILER_IRQ] = "irq",
+        [PROFILER_BRK] = "brk",
+    };
+    if (index == PROFILER_ROOT)
+        snprintf(name, size, "reset");
+    else
+        snprintf(name, size, "%s_%04X", prefixes[node->interrupt],
+                 node->address);
+}
+
+void profiler_write_folded(Profiler *profiler, FILE *fp) {
+    for (int i = 0; i < profiler->node_count; i++) {
+        if (!profiler->nodes[i].cycles)
+            continue;
+
+        // Path from the root
+        int path[PROFILER_MAX_DEPTH];
+        int length = 0;
+        for (int node = i; node >= 0 && length < PROFILER_MAX_DEPTH;
+             node = profiler->nodes[node].parent)
+            path[length++] = node;
+
+        for (int j = length - 1; j >= 0; j--) {
+            char name[16];
+            node_name(&profiler->nodes[path[j]], path[j], name, sizeof(name));
+            fprintf(fp, "%s%c", name, j ? ';' : ' ');
+        }
+        fprintf(fp, "%llu\n", (unsigned long long)profiler->nodes[i].cycles);
+    }
+}
+
+// Picks the `count` largest of `values`, in descending order, into `indices`.
+//
+// Returns how many were picked, zeros are left out.
+static int top_indices(uint64_t *values, int length, int *indices, int count) {
+    int picked = 0;
+    for (int i = 0; i < length; i++) {
+        if (!values[i] ||
+            (picked == count && values[i] <= values[indices[count - 1]]))
+            continue;
+
+        // Insertion into the sorted picks
+        int j = picked < count ? picked++ : count - 1;
+        for (; j > 0 && values[indices[j - 1]] < values[i]; j--)
+            indices[j] = indices[j - 1];
+        indices[j] = i;
+    }
+    return picked;
+}
+
+static double percentage(uint64_t part, uint64_t total) {
+    return total ? 100.0 * part / total : 0;
+}
+
+// PRG ROM bank at `address`, given that a 16 KB PRG ROM is mirrored
+static int prg_bank(Memory *memory, uint16_t address) {
+    int offset = address - 0x8000;
+    if (memory->prg_rom_size == PROFILER_BANK_SIZE)
+        offset %= PROFILER_BANK_SIZE;
+    return offset / PROFILER_BANK_SIZE;
+}
+
+static void write_regions(Profiler *profiler, Memory *memory, uint64_t total,
+                          FILE *fp) {
+    uint64_t ram = 0, prg_ram = 0, other = 0;
+    uint64_t banks[0x8000 / PROFILER_BANK_SIZE] = {0};
+
+    for (int address = 0; address < 0x10000; address++) {
+        uint64_t cycles = profiler->cycles[address];
+        if (address < 0x2000)
+            ram += cycles;
+        else if (address >= 0x6000 && address < 0x8000)
+            prg_ram += cycles;
+        else if (address >= 0x8000)
+            banks[prg_bank(memory, address)] += cycles;
+        else
+            other += cycles;
+    }
+
+    fprintf(fp, "%14s %6s  region\n", "cycles", "%");
+    fprintf(fp, "%14llu %6.2f  RAM\n", (unsigned long long)ram,
+            percentage(ram, total));
+    fprintf(fp, "%14llu %6.2f  PRG RAM\n", (unsigned long long)prg_ram,
+            percentage(prg_ram, total));
+    for (int i = 0; i < 0x8000 / PROFILER_BANK_SIZE; i++)
+        if (banks[i])
+            fprintf(fp, "%14llu %6.2f  PRG ROM bank %d\n",
+                    (unsigned long long)banks[i], percentage(banks[i], total),
+                    i);
+    if (other)
+        fprintf(fp, "%14llu %6.2f  other\n", (unsigned long long)other,
+                percentage(other, total));
+}
+
+// Subroutines by address with the handlers of each interrupt after them, then
+// the root
+#define SUBROUTINE_KEYS 0x40001
+#define ROOT_KEY 0x40000
+
+static void write_subroutines(Profiler *profiler, uint64_t total, FILE *fp) {
+    // Every path into a subroutine counts for it
+    uint64_t *cycles = calloc(SUBROUTINE_KEYS, sizeof(uint64_t));
+    uint64_t *calls = calloc(SUBROUTINE_KEYS, sizeof(uint64_t));
+    for (int i = 0; i < profiler->node_count; i++) {
+        ProfilerNode *node = &profiler->nodes[i];
+        int key = i == PROFILER_ROOT ? ROOT_KEY
+                                     : node->interrupt << 16 | node->address;
+        cycles[key] += node->cycles;
+        calls[key] += node->calls;
+    }
+
+    int top[PROFILER_REPORT_ROWS];
+    int count = top_indices(cycles, SUBROUTINE_KEYS, top, PROFILER_REPORT_ROWS);
+
+    fprintf(fp, "%14s %6s %10s  subroutine (self)\n", "cycles", "%", "calls");
+    for (int i = 0; i < count; i++) {
+        ProfilerNode node = {.address = top[i] & 0xffff,
+                             .interrupt = (top[i] >> 16) & 3};
+        char name[16];
+        node_name(&node, top[i] == ROOT_KEY ? PROFILER_ROOT : -1, name,
+                  sizeof(name));
+        fprintf(fp, "%14llu %6.2f %10llu  %s\n",
+                (unsigned long long)cycles[top[i]],
+                percentage(cycles[top[i]], total),
+                (unsigned long long)calls[top[i]], name);
+    }
+
+    free(cycles);
+    free(calls);
+}
+
+static void write_hot_addresses(Profiler *profiler, Memory *memory,
+                                uint64_t total, FILE *fp) {
+    int top[PROFILER_REPORT_ROWS];
+    int count =
+        top_indices(profiler->cycles, 0x10000, top, PROFILER_REPORT_ROWS);
+
+    fprintf(fp, "%14s %6s  address\n", "cycles", "%");
+    for (int i = 0; i < count; i++) {
+        char disassembly[TRACE_DISASSEMBLY_SIZE];
+        trace_disassemble(memory, top[i], disassembly);
+        fprintf(fp, "%14llu %6.2f  %04X  %s\n",
+                (unsigned long long)profiler->cycles[top[i]],
+                percentage(profiler->cycles[top[i]], total), top[i],
+                disassembly);
+    }
+}
+
+void profiler_write_report(Profiler *profiler, Memory *memory, FILE *fp) {
+    uint64_t total = 0;
+    for (int address = 0; address < 0x10000; address++)
+        total += profiler->cycles[address];
+
+    fprintf(fp, "Profile of %llu CPU cycles\n\n", (unsigned long long)total);
+    write_regions(profiler, memory, total, fp);
+    fprintf(fp, "\n");
+    write_subroutines(profiler, total, fp);
+    fprintf(fp, "\n");
+    write_hot_addresses(profiler, memory, total, fp);
+}
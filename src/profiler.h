@@ -0,0 +1,96 @@
+// Guest profiler: where the emulated program spends its CPU cycles.
+//
+// Cycles are counted per instruction address, a single increment per
+// instruction. Subroutines are followed through JSR/RTS (and interrupts/RTI)
+// with a shadow call stack, and the call tree is only charged when the
+// position in it changes, so instructions in between cost nothing more. Code
+// that returns through a manipulated stack (like RTS jump tables) confuses the
+// call tree, but not the per-address counts.
+
+#ifndef _PROFILER
+#define _PROFILER
+
+#include "memory.h"
+#include <stdint.h>
+#include <stdio.h>
+
+#define PROFILER_MAX_DEPTH 64
+// Distinct call paths tracked, deeper paths are charged to their parent
+#define PROFILER_MAX_NODES 8192
+#define PROFILER_NODE_TABLE_SIZE (PROFILER_MAX_NODES * 2)
+// The part of the call tree outside of any subroutine, i.e. the reset handler
+#define PROFILER_ROOT 0
+// Size of the PRG ROM banks in the report
+#define PROFILER_BANK_SIZE 0x4000
+// Rows in each table of the report
+#define PROFILER_REPORT_ROWS 20
+
+// What a node of the call tree was entered by, besides JSR
+typedef enum {
+    PROFILER_NO_INTERRUPT,
+    PROFILER_NMI,
+    PROFILER_IRQ,
+    PROFILER_BRK,
+} ProfilerInterrupt;
+
+typedef struct {
+    // Entry address of the subroutine or interrupt handler
+    uint16_t address;
+    // `ProfilerInterrupt`
+    uint8_t interrupt;
+    int parent;
+    uint64_t calls;
+    // Cycles spent in the subroutine itself, not in what it calls
+    uint64_t cycles;
+} ProfilerNode;
+
+typedef struct {
+    // Cycles spent on the instruction at every address
+    uint64_t cycles[0x10000];
+
+    // Call tree, every node is a distinct path of calls from the root
+    ProfilerNode nodes[PROFILER_MAX_NODES];
+    int node_count;
+    // Index + 1 of the node for a (parent, address, interrupt) triple, 0 for
+    // none
+    int node_table[PROFILER_NODE_TABLE_SIZE];
+
+    // Nodes of the current call path
+    int stack[PROFILER_MAX_DEPTH];
+    int depth;
+    // Calls that didn't fit on `stack`
+    int overflow;
+    // CPU cycle the current node has been charged up to
+    uint64_t charged_cycle;
+} Profiler;
+
+// Starts an empty profile at `cpu_cycle`.
+void profiler_init(Profiler *profiler, uint64_t cpu_cycle);
+
+static inline void profiler_count(Profiler *profiler, uint16_t address,
+                                  uint8_t cycles) {
+    profiler->cycles[address] += cycles;
+}
+
+// Called when a subroutine or interrupt handler at `address` is entered or
+// left at `cpu_cycle`. Leaving an interrupt also leaves whatever subroutines
+// were entered in it and not returned from.
+void profiler_enter(Profiler *profiler, uint16_t address,
+                    ProfilerInterrupt interrupt, uint64_t cpu_cycle);
+void profiler_leave(Profiler *profiler, int interrupt, uint64_t cpu_cycle);
+
+// Charges the cycles up to `cpu_cycle` to the current subroutine, call before
+// writing out the profile.
+void profiler_charge(Profiler *profiler, uint64_t cpu_cycle);
+
+// Writes the call tree as folded stacks ("reset;sub_C123;sub_C456 1234" per
+// line), the input format of flame graph tools. Interrupt handlers are named
+// after the interrupt, like "nmi_C000", "irq_C100" or "brk_C100".
+void profiler_write_folded(Profiler *profiler, FILE *fp);
+
+// Writes the cycles spent per memory region and PRG ROM bank, the subroutines
+// taking the most cycles and the hottest instructions, disassembled from
+// `memory`.
+void profiler_write_report(Profiler *profiler, Memory *memory, FILE *fp);
+
+#endif
@@ -0,0 +1,95 @@
+#include "ring_buffer.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+int ring_buffer_init(RingBuffer *ring, void *storage, size_t element_size,
+                     size_t capacity) {
+    if (capacity == 0 || (capacity & (capacity - 1))) {
+        fprintf(stderr,
+                "ERROR: ring buffer capacity %zu is not a power of two\n",
+                capacity);
+        return 1;
+    }
+
+    ring->data = storage;
+    ring->element_size = element_size;
+    ring->capacity = capacity;
+    atomic_init(&ring->read_index, 0);
+    atomic_init(&ring->write_index, 0);
+    return 0;
+}
+
+// Copies `count` elements between the buffer at `index` and `elements`,
+// wrapping around the end of the buffer.
+static void copy_elements(RingBuffer *ring, size_t index, uint8_t *elements,
+                          size_t count, int to_buffer) {
+    size_t start = index & (ring->capacity - 1);
+    size_t first = ring->capacity - start;
+    if (first > count)
+        first = count;
+
+    uint8_t *slot = ring->data + start * ring->element_size;
+    size_t first_bytes = first * ring->element_size;
+    size_t rest_bytes = (count - first) * ring->element_size;
+
+    if (to_buffer) {
+        memcpy(slot, elements, first_bytes);
+        memcpy(ring->data, elements + first_bytes, rest_bytes);
+    } else {
+        memcpy(elements, slot, first_bytes);
+        memcpy(elements + first_bytes, ring->data, rest_bytes);
+    }
+}
+
+size_t ring_buffer_write(RingBuffer *ring, const void *elements,
+                         size_t count) {
+    size_t write_index =
+        atomic_load_explicit(&ring->write_index, memory_order_relaxed);
+    // Acquire so the consumer is done with the slots before they're reused
+    size_t read_index =
+        atomic_load_explicit(&ring->read_index, memory_order_acquire);
+
+    size_t space = ring->capacity - (write_index - read_index);
+    if (count > space)
+        count = space;
+
+    copy_elements(ring, write_index, (uint8_t *)elements, count, 1);
+    // Release so the elements are visible before the new index is
+    atomic_store_explicit(&ring->write_index, write_index + count,
+                          memory_order_release);
+    return count;
+}
+
+size_t ring_buffer_peek(RingBuffer *ring, void *out, size_t count) {
+    size_t read_index =
+        atomic_load_explicit(&ring->read_index, memory_order_relaxed);
+    size_t write_index =
+        atomic_load_explicit(&ring->write_index, memory_order_acquire);
+
+    size_t available = write_index - read_index;
+    if (count > available)
+        count = available;
+
+    copy_elements(ring, read_index, out, count, 0);
+    return count;
+}
+
+size_t ring_buffer_read(RingBuffer *ring, void *out, size_t count) {
+    count = ring_buffer_peek(ring, out, count);
+
+    size_t read_index =
+        atomic_load_explicit(&ring->read_index, memory_order_relaxed);
+    // Release so the producer only reuses the slots once they've been copied
+    atomic_store_explicit(&ring->read_index, read_index + count,
+                          memory_order_release);
+    return count;
+}
+
+size_t ring_buffer_count(RingBuffer *ring) {
+    size_t read_index =
+        atomic_load_explicit(&ring->read_index, memory_order_acquire);
+    size_t write_index =
+        atomic_load_explicit(&ring->write_index, memory_order_acquire);
+    return write_index - read_index;
+}
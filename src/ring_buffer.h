@@ -0,0 +1,49 @@
+// Lock-free single-producer/single-consumer ring buffer.
+//
+// One thread may write while another one reads without any locking. The
+// buffer doesn't own its storage, it's handed a block of `capacity` elements
+// of `element_size` bytes each.
+
+#ifndef _RING_BUFFER
+#define _RING_BUFFER
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    uint8_t *data;
+    size_t element_size;
+    // Always a power of two
+    size_t capacity;
+    // Free-running element counts, wrapped into the buffer when used. Only
+    // the consumer stores `read_index` and only the producer `write_index`.
+    _Atomic size_t read_index;
+    _Atomic size_t write_index;
+} RingBuffer;
+
+// Sets up the buffer to use `storage`. `capacity` must be a power of two.
+//
+// Returns 1 on failure.
+int ring_buffer_init(RingBuffer *ring, void *storage, size_t element_size,
+                     size_t capacity);
+
+// Writes at most `count` elements, as many as fit. Producer only.
+//
+// Returns the number of elements written.
+size_t ring_buffer_write(RingBuffer *ring, const void *elements, size_t count);
+
+// Reads at most `count` elements into `out`. Consumer only.
+//
+// Returns the number of elements read.
+size_t ring_buffer_read(RingBuffer *ring, void *out, size_t count);
+
+// Like `ring_buffer_read` but leaves the elements in the buffer. Consumer
+// only.
+size_t ring_buffer_peek(RingBuffer *ring, void *out, size_t count);
+
+// Elements waiting to be read. Safe to call from either side, although the
+// value may already be out of date when it returns.
+size_t ring_buffer_count(RingBuffer *ring);
+
+#endif
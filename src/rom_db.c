@@ -0,0 +1,141 @@
+#include "rom_db.h"
+#include "ppu.h"
+#include "rom_file.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LINE_SIZE 256
+
+static const char *mirroring_names[] = {
+    [PPU_MIRRORING_HORIZONTAL] = "h",
+    [PPU_MIRRORING_VERTICAL] = "v",
+    [PPU_MIRRORING_FOUR_SCREEN] = "4",
+};
+static const char *timing_names[] = {
+    [ROM_TIMING_NTSC] = "ntsc",
+    [ROM_TIMING_PAL] = "pal",
+    [ROM_TIMING_MULTIPLE] = "multi",
+    [ROM_TIMING_DENDY] = "dendy",
+};
+
+// Index of `name` in `names`, or -1 for "-".
+//
+// Returns 1 if it's neither.
+static int parse_name(const char *name, const char **names, int count,
+                      int *out) {
+    if (!strcmp(name, "-")) {
+        *out = -1;
+        return 0;
+    }
+    for (int i = 0; i < count; i++) {
+        if (names[i] && !strcmp(name, names[i])) {
+            *out = i;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int parse_line(const char *line, RomDatabaseEntry *entry) {
+    char mapper[8], mirroring[8], timing[8];
+    int title_start = 0;
+    if (sscanf(line, "%x %7s %7s %7s %n", &entry->crc32, mapper, mirroring,
+               timing, &title_start) < 4)
+        return 1;
+
+    char *end;
+    entry->mapper = strtol(mapper, &end, 10);
+    if (!strcmp(mapper, "-"))
+        entry->mapper = -1;
+    else if (*end || entry->mapper < 0 || entry->mapper > 4095)
+        return 1;
+
+    if (parse_name(mirroring, mirroring_names, 3, &entry->mirroring) ||
+        parse_name(timing, timing_names, 4, &entry->timing))
+        return 1;
+
+    snprintf(entry->title, sizeof(entry->title), "%s",
+             title_start ? line + title_start : "");
+    return 0;
+}
+
+static int compare_entries(const void *a, const void *b) {
+    uint32_t crc_a = ((const RomDatabaseEntry *)a)->crc32;
+    uint32_t crc_b = ((const RomDatabaseEntry *)b)->crc32;
+    return (crc_a > crc_b) - (crc_a < crc_b);
+}
+
+int rom_db_load(RomDatabase *database, const char *filepath) {
+    *database = (RomDatabase){0};
+
+    FILE *fp = fopen(filepath, "r");
+    if (!fp) {
+        perror("Could not open ROM database");
+        return 1;
+    }
+
+    int capacity = 0;
+    char line[LINE_SIZE];
+    for (int line_number = 1; fgets(line, sizeof(line), fp); line_number++) {
+        line[strcspn(line, "\r\n")] = 0;
+        if (*line == '#' || !line[strspn(line, " \t")])
+            continue;
+
+        if (database->count == capacity) {
+            capacity = capacity ? capacity * 2 : 256;
+            RomDatabaseEntry *entries = realloc(
+                database->entries, capacity * sizeof(RomDatabaseEntry));
+            if (!entries) {
+                fclose(fp);
+                rom_db_free(database);
+                return 1;
+            }
+            database->entries = entries;
+        }
+
+        if (parse_line(line, &database->entries[database->count]))
+            fprintf(stderr, "%s:%d: invalid ROM database entry\n", filepath,
+                    line_number);
+        else
+            database->count++;
+    }
+    fclose(fp);
+
+    qsort(database->entries, database->count, sizeof(RomDatabaseEntry),
+          compare_entries);
+    return 0;
+}
+
+void rom_db_free(RomDatabase *database) {
+    free(database->entries);
+    *database = (RomDatabase){0};
+}
+
+const RomDatabaseEntry *rom_db_find(RomDatabase *database, uint32_t crc32) {
+    RomDatabaseEntry key = {.crc32 = crc32};
+    return bsearch(&key, database->entries, database->count,
+                   sizeof(RomDatabaseEntry), compare_entries);
+}
+
+int rom_db_apply(const RomDatabaseEntry *entry, RomInfo *info) {
+    int corrected = 0;
+    if (entry->mapper >= 0 && entry->mapper != info->mapper) {
+        info->mapper = entry->mapper;
+        info->submapper = 0;
+        corrected = 1;
+    }
+    if (entry->mirroring >= 0 && entry->mirroring != info->mirroring) {
+        info->mirroring = entry->mirroring;
+        corrected = 1;
+    }
+    if (entry->timing >= 0 && entry->timing != (int)info->timing) {
+        info->timing = entry->timing;
+        corrected = 1;
+    }
+
+    snprintf(info->title, sizeof(info->title), "%s", entry->title);
+    info->corrected |= corrected;
+    return corrected;
+}
@@ -0,0 +1,45 @@
+// Game database, for ROMs whose headers are wrong. Games are identified by
+// the CRC-32 of their PRG and CHR ROM, which doesn't depend on the header.
+//
+// Loaded from a text file with a line per game:
+//
+//   <CRC-32> <mapper> <mirroring> <timing> [title]
+//
+// like "1a2b3c4d 0 v ntsc Some Game". Mirroring is h, v or 4 (four-screen)
+// and timing ntsc, pal, multi or dendy. Any of the three can be "-" to keep
+// what the header says. Lines starting with # are comments.
+
+#ifndef _ROM_DB
+#define _ROM_DB
+
+#include "rom_file.h"
+#include <stdint.h>
+
+typedef struct {
+    uint32_t crc32;
+    // -1 to keep what the header says
+    int mapper;
+    int mirroring;
+    int timing;
+    char title[ROM_FILE_TITLE_SIZE];
+} RomDatabaseEntry;
+
+typedef struct RomDatabase {
+    // Sorted by CRC-32
+    RomDatabaseEntry *entries;
+    int count;
+} RomDatabase;
+
+// Returns 1 on failure.
+int rom_db_load(RomDatabase *database, const char *filepath);
+void rom_db_free(RomDatabase *database);
+
+// Returns null if there is no game with `crc32`.
+const RomDatabaseEntry *rom_db_find(RomDatabase *database, uint32_t crc32);
+
+// Corrects `info` with what the database knows about the game.
+//
+// Returns 1 if the header was wrong about something.
+int rom_db_apply(const RomDatabaseEntry *entry, RomInfo *info);
+
+#endif
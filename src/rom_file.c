@@ -1,79 +1,422 @@
 #include "rom_file.h"
+#include "hash.h"
+#include "hash_cache.h"
 #include "memory.h"
 #include "ppu.h"
+#include "rom_db.h"
+#include "zip.h"
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
 
-// Copies data from the `file_buffer` into the appropriate locations in the
-// `Memory` struct
-static int populate_cpu_memory_with_file_data(uint8_t *file_buffer,
-                                              Memory *memory, int limit) {
-    INESHeader *header = (INESHeader *)file_buffer;
-    memory->prg_rom_size = header->prg_rom_size_16k * 16 * 1024;
-    memory->chr_rom_size = header->chr_rom_size_8k * 8 * 1024;
-
-    // Safety check
-    int usage = INES_HEADER_SIZE +
-                (header->using_trainer * MEMORY_TRAINER_SIZE) +
-                memory->prg_rom_size + memory->chr_rom_size;
-    if (usage > limit)
+// Size of the CHR ROM the PPU sees without a mapper
+#define CHR_BANK_SIZE (PPU_MEMORY_PATTERN_TABLE_SIZE * 2)
+#define READ_CHUNK_SIZE 0x4000
+
+// Size of a NES 2.0 ROM area from the least significant byte and the most
+// significant nibble. A nibble of 0xf means the byte is an exponent and a
+// multiplier instead.
+static uint64_t nes_2_0_rom_size(uint8_t lsb, uint8_t msb, int unit) {
+    if (msb != 0xf)
+        return (uint64_t)(msb << 8 | lsb) * unit;
+
+    int exponent = lsb >> 2;
+    int multiplier = (lsb & 3) * 2 + 1;
+    if (exponent > 32)
+        return UINT64_MAX;
+    return ((uint64_t)1 << exponent) * multiplier;
+}
+
+// Size of NES 2.0 cartridge RAM from a shift count, 0 for none.
+static inline uint32_t nes_2_0_ram_size(uint8_t shift) {
+    return shift ? 64 << shift : 0;
+}
+
+int rom_file_parse_header(const uint8_t *bytes, long file_size,
+                          RomInfo *info) {
+    const INESHeader *header = (const INESHeader *)bytes;
+    if (file_size < INES_HEADER_SIZE || strncmp(header->magic, "NES\032", 4)) {
+        fprintf(stderr, "Invalid ROM file: not an INES file\n");
         return 1;
+    }
 
-    int cursor = INES_HEADER_SIZE;
+    *info = (RomInfo){0};
+    info->nes_2_0 = header->ines_2_identifier == 2;
+    info->battery = header->using_non_volatile_memory;
+    info->trainer = header->using_trainer;
+    info->console_type = header->console_type;
+    info->mapper = header->mapper_number_higher << 4 |
+                   header->mapper_number_lower;
 
-    // Trainer is a 512 byte chunk of extra stuff usable to the CPU at 0x7000.
-    // Unused by most cartridges.
-    if (header->using_trainer) {
-        memcpy(memory->trainer, file_buffer + cursor, MEMORY_TRAINER_SIZE);
-        cursor += MEMORY_TRAINER_SIZE;
+    if (header->using_alternative_nametables)
+        info->mirroring = PPU_MIRRORING_FOUR_SCREEN;
+    else if (header->mirrored_vertically)
+        info->mirroring = PPU_MIRRORING_VERTICAL;
+    else
+        info->mirroring = PPU_MIRRORING_HORIZONTAL;
+
+    uint64_t prg_rom_size, chr_rom_size;
+    if (info->nes_2_0) {
+        info->mapper |= (header->flags8 & 0xf) << 8;
+        info->submapper = header->flags8 >> 4;
+        prg_rom_size = nes_2_0_rom_size(header->prg_rom_size_16k,
+                                        header->flags9 & 0xf, 0x4000);
+        chr_rom_size = nes_2_0_rom_size(header->chr_rom_size_8k,
+                                        header->flags9 >> 4, 0x2000);
+        info->prg_ram_size = nes_2_0_ram_size(header->flags10 & 0xf);
+        info->prg_nvram_size = nes_2_0_ram_size(header->flags10 >> 4);
+        info->chr_ram_size = nes_2_0_ram_size(header->flags11 & 0xf);
+        info->chr_nvram_size = nes_2_0_ram_size(header->flags11 >> 4);
+        info->timing = header->flags12 & 3;
+    } else {
+        // Old dumping tools wrote their name (like "DiskDude!") over bytes
+        // 7-15, only trust byte 7 if the padding after the flags is zero
+        if (header->flags12 || header->flags13 || header->flags14 ||
+            header->flags15) {
+            info->mapper = header->mapper_number_lower;
+            info->console_type = 0;
+        }
+        prg_rom_size = header->prg_rom_size_16k * 0x4000;
+        chr_rom_size = header->chr_rom_size_8k * 0x2000;
+        // 0 means 8 KB, for compatibility
+        info->prg_ram_size = (header->flags8 ? header->flags8 : 1) * 0x2000;
+        info->timing = header->flags9 & 1 ? ROM_TIMING_PAL : ROM_TIMING_NTSC;
     }
+    if (!chr_rom_size && !info->chr_ram_size)
+        info->chr_ram_size = CHR_BANK_SIZE;
+
+    uint64_t usage = INES_HEADER_SIZE + info->trainer * MEMORY_TRAINER_SIZE +
+                     prg_rom_size + chr_rom_size;
+    if (!prg_rom_size || prg_rom_size > INT_MAX || chr_rom_size > INT_MAX ||
+        usage > (uint64_t)file_size) {
+        fprintf(stderr, "Invalid ROM file: the header says it has more data "
+                        "than there is\n");
+        return 1;
+    }
+    info->prg_rom_size = prg_rom_size;
+    info->chr_rom_size = chr_rom_size;
+
+    if (usage < (uint64_t)file_size)
+        fprintf(stderr, "Note: %ld bytes after the end of the ROM data are "
+                        "ignored\n",
+                file_size - (long)usage);
+    return 0;
+}
+
+// Key of a ROM in the hash cache, the real path of the file and the name of
+// the ROM in it for archives. Has to be freed.
+static char *hash_cache_key(const char *filepath, const char *entry_name) {
+    char *path = realpath(filepath, 0);
+    if (!path || !entry_name)
+        return path;
+
+    char *key = malloc(strlen(path) + strlen(entry_name) + 2);
+    if (key)
+        sprintf(key, "%s#%s", path, entry_name);
+    free(path);
+    return key;
+}
 
-    // Program ROM
+// Where the file data streamed in is copied, parsing the header as soon as it
+// is in and hashing the PRG and CHR ROM on the way
+typedef struct {
+    Memory *memory;
+    RomInfo *info;
+    long file_size;
+    long position;
+    uint8_t header[INES_HEADER_SIZE];
+
+    // Whether the digests still need computing, they weren't in the cache
+    int hashing;
+    HashDigests digests;
+    HashSHA1 sha1;
+    uint64_t file_hash;
+} RomLoader;
+
+// Sets up the memory for the ROM once the header is in.
+//
+// Returns 1 on failure.
+static int start_rom(RomLoader *loader) {
+    RomInfo *info = loader->info;
+    if (rom_file_parse_header(loader->header, loader->file_size, info))
+        return 1;
+
+    Memory *memory = loader->memory;
+    memory->prg_rom_size = info->prg_rom_size;
+    memory->chr_rom_size = info->chr_rom_size;
     memory->prg_rom = (uint8_t *)malloc(memory->prg_rom_size);
-    memcpy(memory->prg_rom, file_buffer + cursor, memory->prg_rom_size);
-    cursor += memory->prg_rom_size;
+    if (memory->chr_rom_size)
+        memory->chr_rom = (uint8_t *)malloc(memory->chr_rom_size);
+    if (!memory->prg_rom || (memory->chr_rom_size && !memory->chr_rom)) {
+        fprintf(stderr, "Could not load ROM file\n");
+        return 1;
+    }
+    return 0;
+}
+
+// Copies the next `size` bytes of the file into place.
+//
+// Returns 1 on failure.
+static int load_rom_data(void *context, const uint8_t *data, size_t size) {
+    RomLoader *loader = context;
+    RomInfo *info = loader->info;
+    Memory *memory = loader->memory;
+    loader->file_hash = hash_fnv1a(loader->file_hash, data, size);
+
+    while (size) {
+        long position = loader->position;
+        long trainer_end =
+            INES_HEADER_SIZE + info->trainer * MEMORY_TRAINER_SIZE;
+        long prg_rom_end = trainer_end + info->prg_rom_size;
+        long chr_rom_end = prg_rom_end + info->chr_rom_size;
+
+        // Anything after the ROM data is skipped
+        uint8_t *destination = 0;
+        long end = position + size;
+        if (position < INES_HEADER_SIZE) {
+            destination = loader->header + position;
+            end = INES_HEADER_SIZE;
+        } else if (position < trainer_end) {
+            // Trainer is a 512 byte chunk of extra stuff usable to the CPU at
+            // 0x7000. Unused by most cartridges.
+            destination = memory->trainer + position - INES_HEADER_SIZE;
+            end = trainer_end;
+        } else if (position < prg_rom_end) {
+            destination = memory->prg_rom + position - trainer_end;
+            end = prg_rom_end;
+        } else if (position < chr_rom_end) {
+            // Character / Sprite ROM, kept whole for mappers to switch banks
+            // of
+            destination = memory->chr_rom + position - prg_rom_end;
+            end = chr_rom_end;
+        }
+
+        size_t count = end - position < (long)size ? end - position : size;
+        if (destination)
+            memcpy(destination, data, count);
+        // Identified by the ROM data alone, the header might be what's wrong
+        if (loader->hashing && position >= trainer_end &&
+            position < chr_rom_end) {
+            loader->digests.crc32 =
+                hash_crc32(loader->digests.crc32, data, count);
+            hash_sha1_update(&loader->sha1, data, count);
+        }
+
+        loader->position += count;
+        data += count;
+        size -= count;
+        if (loader->position == INES_HEADER_SIZE && start_rom(loader))
+            return 1;
+    }
+    return 0;
+}
 
-    // Character / Sprite ROM
-    if (memory->chr_rom_size &&
-        memory->chr_rom_size < PPU_MEMORY_CARTRIDGE_MAPPED_TOTAL_SIZE) {
+// Warns about what the ROM needs that isn't emulated.
+static void check_support(RomInfo *info) {
+    if (info->mapper)
+        fprintf(stderr,
+                "Warning: mapper %d isn't supported, the ROM will likely not "
+                "run right\n",
+                info->mapper);
+    else if (info->chr_rom_size > CHR_BANK_SIZE ||
+             info->prg_rom_size > 0x8000)
+        fprintf(stderr, "Warning: the ROM is too big for mapper 0, only the "
+                        "first banks are used\n");
+
+    if (info->timing == ROM_TIMING_PAL || info->timing == ROM_TIMING_DENDY)
+        fprintf(stderr, "Warning: the ROM is for PAL consoles, but only NTSC "
+                        "timing is emulated\n");
+}
+
+// Looks the ROM up in the game database and makes what was loaded usable.
+static void finish_rom(RomLoader *loader, RomFileOptions *options,
+                       const char *name) {
+    RomInfo *info = loader->info;
+    Memory *memory = loader->memory;
+
+    if (loader->hashing)
+        hash_sha1_final(&loader->sha1, loader->digests.sha1);
+    info->digests = loader->digests;
+
+    const RomDatabaseEntry *entry = 0;
+    if (options && options->database)
+        entry = rom_db_find(options->database, info->digests.crc32);
+    if (entry && rom_db_apply(entry, info))
+        fprintf(stderr, "Note: the header of %s is wrong, using the ROM "
+                        "database instead\n",
+                name);
+    check_support(info);
+
+    // The first CHR bank is what the PPU sees at power-on
+    if (memory->chr_rom_size) {
+        int bank_size = memory->chr_rom_size < CHR_BANK_SIZE
+                            ? memory->chr_rom_size
+                            : CHR_BANK_SIZE;
         memcpy(memory->ppu_ctx.memory.cartridge_mapped_memory,
-               file_buffer + cursor, memory->chr_rom_size);
-        cursor += memory->chr_rom_size;
+               memory->chr_rom, bank_size);
+        ppu_invalidate_tile_cache(&memory->ppu_ctx);
     }
+    memory->ppu_ctx.mirroring = info->mirroring;
+    memory->rom_hash = loader->file_hash;
 
-    return 0;
+    // Used to be loaded to 0x7000 by copier devices, before the game started
+    if (info->trainer)
+        memory_map_trainer(memory);
 }
 
-int rom_file_read(char *filepath, Memory *memory) {
-    FILE *fp = fopen(filepath, "r");
-    if (!fp) {
-        perror("Could not open ROM file");
+// Starts loading a file of `file_size`, with the digests from the cache if
+// they are in it under `key`.
+static void init_loader(RomLoader *loader, Memory *memory, RomInfo *info,
+                        long file_size, HashCache *cache, const char *key,
+                        const struct stat *file_stat) {
+    *loader = (RomLoader){.memory = memory,
+                          .info = info,
+                          .file_size = file_size,
+                          .hashing = 1,
+                          .file_hash = HASH_FNV1A_INITIAL};
+    *info = (RomInfo){0};
+    memory->prg_rom = 0;
+    memory->chr_rom = 0;
+    if (cache && key &&
+        !hash_cache_find(cache, key, file_stat, &loader->digests))
+        loader->hashing = 0;
+    hash_sha1_init(&loader->sha1);
+}
+
+// Caches the digests if they were computed, and frees the key.
+static void store_digests(RomLoader *loader, HashCache *cache, char *key,
+                          const struct stat *file_stat) {
+    if (cache && key && loader->hashing)
+        hash_cache_store(cache, key, file_stat, &loader->digests);
+    free(key);
+}
+
+// Undoes a load that failed part way.
+static void abort_rom(RomLoader *loader) {
+    free(loader->memory->prg_rom);
+    free(loader->memory->chr_rom);
+    loader->memory->prg_rom = 0;
+    loader->memory->chr_rom = 0;
+}
+
+int rom_file_read_zip(ZipArchive *archive, const char *archive_filepath,
+                      const char *entry_name, Memory *memory, RomInfo *info,
+                      RomFileOptions *options) {
+    const ZipEntry *entry =
+        entry_name ? zip_find(archive, entry_name)
+                   : zip_find_extension(archive, ROM_FILE_EXTENSION);
+    if (!entry) {
+        fprintf(stderr, "No ROM %s in %s\n", entry_name ? entry_name : "file",
+                archive_filepath);
         return 1;
     }
 
-    // Get file size
-    fseek(fp, 0, SEEK_END);
-    int filesize = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
+    RomInfo rom_info;
+    if (!info)
+        info = &rom_info;
+    HashCache *cache = options ? options->hash_cache : 0;
+    struct stat file_stat = {0};
+    char *key = 0;
+    if (cache && !stat(archive_filepath, &file_stat))
+        key = hash_cache_key(archive_filepath, entry->name);
 
-    // Read into memory
-    uint8_t *file_buffer = (uint8_t *)malloc(filesize + 1);
-    fread(file_buffer, filesize, 1, fp);
-    fclose(fp);
+    RomLoader loader;
+    init_loader(&loader, memory, info, entry->uncompressed_size, cache, key,
+                &file_stat);
+    if (zip_extract(archive, entry, load_rom_data, &loader) ||
+        loader.position < INES_HEADER_SIZE) {
+        if (loader.position < INES_HEADER_SIZE)
+            rom_file_parse_header(loader.header, loader.position, info);
+        abort_rom(&loader);
+        free(key);
+        return 1;
+    }
 
-    INESHeader *header = (INESHeader *)file_buffer;
-    if (filesize < 16 || strncmp(header->magic, "NES\032", 4)) {
-        fprintf(stderr, "Invalid ROM file\n");
+    finish_rom(&loader, options, entry->name);
+    store_digests(&loader, cache, key, &file_stat);
+    return 0;
+}
+
+// Whether `filepath` is of a zip archive, going by the extension.
+static int is_zip(const char *filepath) {
+    size_t size = strlen(filepath);
+    return size >= 4 && !strcasecmp(filepath + size - 4, ".zip");
+}
+
+// Reads a ROM from a zip archive, the first ".nes" file in it or the one after
+// a '#' in `filepath`.
+static int read_zip(const char *filepath, Memory *memory, RomInfo *info,
+                    RomFileOptions *options) {
+    char *archive_filepath = strdup(filepath);
+    if (!archive_filepath)
         return 1;
+    char *entry_name = strstr(archive_filepath, ".zip#");
+    if (!entry_name)
+        entry_name = strstr(archive_filepath, ".ZIP#");
+    if (entry_name) {
+        entry_name += 4;
+        *entry_name++ = 0;
     }
 
-    if (populate_cpu_memory_with_file_data(file_buffer, memory, filesize)) {
-        fprintf(stderr, "Invalid ROM file\n");
+    ZipArchive archive;
+    int result = zip_open(&archive, archive_filepath) ||
+                 rom_file_read_zip(&archive, archive_filepath, entry_name,
+                                   memory, info, options);
+    zip_close(&archive);
+    free(archive_filepath);
+    return result;
+}
+
+int rom_file_read(char *filepath, Memory *memory, RomInfo *info,
+                  RomFileOptions *options) {
+    if (is_zip(filepath) || strstr(filepath, ".zip#") ||
+        strstr(filepath, ".ZIP#"))
+        return read_zip(filepath, memory, info, options);
+
+    FILE *fp = fopen(filepath, "rb");
+    struct stat file_stat;
+    if (!fp || fstat(fileno(fp), &file_stat)) {
+        perror("Could not open ROM file");
+        if (fp)
+            fclose(fp);
         return 1;
     }
 
-    free(file_buffer);
+    RomInfo rom_info;
+    if (!info)
+        info = &rom_info;
+    HashCache *cache = options ? options->hash_cache : 0;
+    char *key = cache ? hash_cache_key(filepath, 0) : 0;
+
+    // Read straight into place a chunk at a time
+    RomLoader loader;
+    init_loader(&loader, memory, info, file_stat.st_size, cache, key,
+                &file_stat);
+    uint8_t chunk[READ_CHUNK_SIZE];
+    size_t size;
+    int failed = 0;
+    while (!failed && (size = fread(chunk, 1, sizeof(chunk), fp)))
+        failed = load_rom_data(&loader, chunk, size);
+    if (!failed && ferror(fp)) {
+        fprintf(stderr, "Could not read ROM file\n");
+        failed = 1;
+    }
+    fclose(fp);
+
+    if (!failed && loader.position < INES_HEADER_SIZE) {
+        rom_file_parse_header(loader.header, loader.position, info);
+        failed = 1;
+    }
+    if (failed) {
+        abort_rom(&loader);
+        free(key);
+        return 1;
+    }
 
+    finish_rom(&loader, options, filepath);
+    store_digests(&loader, cache, key, &file_stat);
     return 0;
 }
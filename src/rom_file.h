@@ -1,10 +1,19 @@
 #ifndef _ROM_FILE
 #define _ROM_FILE
 
+#include "hash.h"
 #include "memory.h"
+#include "ppu.h"
 #include <stdint.h>
 
 #define INES_HEADER_SIZE 16
+#define ROM_FILE_TITLE_SIZE 64
+// Of ROM files in zip archives
+#define ROM_FILE_EXTENSION ".nes"
+
+struct RomDatabase;
+struct HashCache;
+struct ZipArchive;
 
 // A header record at the beginning of a ROM file that will tell us some
 // information about the cardridge.
@@ -15,33 +24,100 @@ typedef struct {
     uint8_t prg_rom_size_16k;
     uint8_t chr_rom_size_8k;
 
-    // Flags 6
-    uint8_t mapper_number_lower : 4;
-    uint8_t using_alternative_nametables : 1;
-    uint8_t using_trainer : 1;
-    uint8_t using_non_volatile_memory : 1;
+    // Flags 6 (bit-fields are laid out starting from the least significant
+    // bit)
     uint8_t mirrored_vertically : 1;
+    uint8_t using_non_volatile_memory : 1;
+    uint8_t using_trainer : 1;
+    uint8_t using_alternative_nametables : 1;
+    uint8_t mapper_number_lower : 4;
 
     // Flags 7
-    uint8_t mapper_number_higher : 4;
+    uint8_t console_type : 2;
     // If it's 2 then this is an INES 2.0 ROM
     uint8_t ines_2_identifier : 2;
-    uint8_t console_type : 2;
+    uint8_t mapper_number_higher : 4;
 
     // Rest of the flags (format depends on whether or not this is an INES 2.0
-    // ROM)
+    // ROM). INES 1.0 only uses 8 and 9, and expects the rest to be zero.
     uint8_t flags8;
     uint8_t flags9;
     uint8_t flags10;
-
-    // Empty
-    uint64_t : 40;
+    uint8_t flags11;
+    uint8_t flags12;
+    uint8_t flags13;
+    uint8_t flags14;
+    uint8_t flags15;
 } INESHeader;
 
+typedef enum {
+    ROM_TIMING_NTSC,
+    ROM_TIMING_PAL,
+    // Runs on either
+    ROM_TIMING_MULTIPLE,
+    ROM_TIMING_DENDY,
+} RomTiming;
+
+// What a ROM file says about its cartridge, after any corrections from the
+// game database.
+typedef struct {
+    int nes_2_0;
+    uint16_t mapper;
+    uint8_t submapper;
+    PPUMirroring mirroring;
+    RomTiming timing;
+    uint8_t console_type;
+    int battery;
+    int trainer;
+
+    uint32_t prg_rom_size;
+    uint32_t chr_rom_size;
+    // RAM on the cartridge, 0 for none or unknown
+    uint32_t prg_ram_size;
+    uint32_t prg_nvram_size;
+    uint32_t chr_ram_size;
+    uint32_t chr_nvram_size;
+
+    // Of the PRG and CHR ROM together, without the header and trainer
+    HashDigests digests;
+    // From the database, empty if the ROM isn't in it
+    char title[ROM_FILE_TITLE_SIZE];
+    // Set if the database corrected what the header says
+    int corrected;
+} RomInfo;
+
+// Where `rom_file_read` can look ROMs up, both optional.
+typedef struct {
+    struct RomDatabase *database;
+    struct HashCache *hash_cache;
+} RomFileOptions;
+
+// Parses an INES 1.0 or NES 2.0 header of a file of `file_size`.
+//
+// Returns 1 if the header is invalid or the file too small for it, after
+// printing why to stderr.
+int rom_file_parse_header(const uint8_t *header, long file_size,
+                          RomInfo *info);
+
 // Reads ROM file at `filepath` and populates `memory` with appropriate
-// cartridge data from the ROM.
+// cartridge data from the ROM. The ROM is described in `info` if it isn't
+// null, and `options` can be null.
+//
+// The file is read a chunk at a time straight into the PRG and CHR ROM. It
+// can also be a zip archive, "FILE.zip" for the first ".nes" file in it or
+// "FILE.zip#NAME" for another one, which is decompressed the same way.
+//
+// Returns 1 on failure, will also print error messages to stderr.
+int rom_file_read(char *filepath, Memory *memory, RomInfo *info,
+                  RomFileOptions *options);
+
+// Reads the ROM called `entry_name` from an archive opened from
+// `archive_filepath`, or the first ".nes" file if it is null. For loading
+// many ROMs or instances from one archive without reading its index again.
 //
 // Returns 1 on failure, will also print error messages to stderr.
-int rom_file_read(char *filepath, Memory *memory);
+int rom_file_read_zip(struct ZipArchive *archive, const char *archive_filepath,
+                      const char *entry_name, Memory *memory, RomInfo *info,
+                      RomFileOptions *options);
 
 #endif
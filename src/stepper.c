@@ -0,0 +1,134 @@
+#include "stepper.h"
+#include "cpu.h"
+#include "debugger.h"
+#include "emulator.h"
+#include "ppu.h"
+#include "ring_buffer.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+int stepper_init(Stepper *stepper) {
+    return ring_buffer_init(&stepper->ring, stepper->storage,
+                            sizeof(StepperCommand), STEPPER_QUEUE_CAPACITY);
+}
+
+int stepper_parse(const char *line, StepperCommand *out) {
+    char name[4] = "";
+    // Leaves room for the name in `text`
+    char argument[40] = "";
+    int fields = sscanf(line, " %3s %39s", name, argument);
+
+    *out = (StepperCommand){.count = 1};
+    if (fields < 1 || !strcmp(name, "s"))
+        out->type = STEPPER_INSTRUCTIONS;
+    else if (!strcmp(name, "cy"))
+        out->type = STEPPER_CYCLES;
+    else if (!strcmp(name, "l"))
+        out->type = STEPPER_SCANLINES;
+    else if (!strcmp(name, "f"))
+        out->type = STEPPER_FRAMES;
+    else if (!strcmp(name, "n"))
+        out->type = STEPPER_NMI;
+    else if (!strcmp(name, "c"))
+        out->type = STEPPER_CONTINUE;
+    else if (!strcmp(name, "p"))
+        out->type = STEPPER_PAUSE;
+    else if (!strcmp(name, "q"))
+        out->type = STEPPER_QUIT;
+    else if (!strcmp(name, "b") || !strcmp(name, "db") ||
+             !strcmp(name, "w") || !strcmp(name, "dw")) {
+        if (fields < 2)
+            return 1;
+        out->type = STEPPER_DEBUGGER;
+        snprintf(out->text, sizeof(out->text), "%s %s", name, argument);
+        return 0;
+    } else
+        return 1;
+
+    if (fields < 2)
+        return out->type == STEPPER_CYCLES;
+
+    // Counts only go with the stepping commands
+    unsigned long long count;
+    if (out->type > STEPPER_FRAMES || sscanf(argument, "%llu", &count) != 1 ||
+        !count)
+        return 1;
+    out->count = count;
+    return 0;
+}
+
+int stepper_push(Stepper *stepper, const StepperCommand *command) {
+    return ring_buffer_write(&stepper->ring, command, 1) != 1;
+}
+
+int stepper_pop(Stepper *stepper, StepperCommand *out) {
+    return ring_buffer_read(&stepper->ring, out, 1) != 1;
+}
+
+int stepper_peek(Stepper *stepper, StepperCommand *out) {
+    return ring_buffer_peek(&stepper->ring, out, 1) != 1;
+}
+
+int stepper_runs(const StepperCommand *command) {
+    return command->type <= STEPPER_NMI;
+}
+
+// Scanlines since power-on
+static inline uint64_t scanline_index(PPUContext *ppu_ctx) {
+    return ppu_ctx->frame_count * SCANLINES_PER_FRAME +
+           ppu_ctx->current_scanline;
+}
+
+int stepper_run(const StepperCommand *command, Emulator *emulator,
+                uint32_t *framebuffer) {
+    Memory *memory = &emulator->memory;
+    PPUContext *ppu_ctx = &memory->ppu_ctx;
+
+    uint64_t start_cycle = memory->cpu_cycle;
+    uint64_t start_scanline = scanline_index(ppu_ctx);
+    uint64_t start_frame = ppu_ctx->frame_count;
+
+    for (uint64_t instructions = 0;; instructions++) {
+        switch (command->type) {
+        case STEPPER_INSTRUCTIONS:
+            if (instructions >= command->count)
+                return 0;
+            break;
+        case STEPPER_CYCLES:
+            if (memory->cpu_cycle - start_cycle >= command->count)
+                return 0;
+            break;
+        case STEPPER_SCANLINES:
+            if (scanline_index(ppu_ctx) - start_scanline >= command->count)
+                return 0;
+            break;
+        case STEPPER_FRAMES:
+            if (ppu_ctx->frame_count - start_frame >= command->count)
+                return 0;
+            break;
+        case STEPPER_NMI:
+            // Taken here rather than along with the next instruction, to stop
+            // on the handler's first one
+            if (ppu_ctx->nmi_pending) {
+                ppu_ctx->nmi_pending = 0;
+                cpu_enter_nmi(&emulator->cpu_ctx, memory);
+                return 0;
+            }
+            if (ppu_ctx->frame_count - start_frame >= STEPPER_NMI_MAX_FRAMES)
+                return 0;
+            break;
+        default:
+            return 0;
+        }
+
+        Debugger *debugger = memory->debugger;
+        if (instructions && debugger &&
+            debugger_check_execute(debugger, emulator->cpu_ctx.program_counter))
+            return EMULATOR_STOPPED;
+
+        int result = emulator_step(emulator, framebuffer);
+        if (result)
+            return result;
+    }
+}
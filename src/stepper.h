@@ -0,0 +1,89 @@
+// Interactive stepping: runs a paused emulator by instructions, CPU cycles,
+// scanlines or frames, or up to the next NMI.
+//
+// Commands are parsed from lines of text on whichever thread reads them and
+// queued to the emulation thread, lock-free with one producer and one
+// consumer (see ring_buffer.h). The emulation thread never waits for input,
+// and only looks at the queue while running if stepping is enabled at all.
+
+#ifndef _STEPPER
+#define _STEPPER
+
+#include "emulator.h"
+#include "ring_buffer.h"
+#include <stdint.h>
+
+#define STEPPER_QUEUE_CAPACITY 64
+#define STEPPER_TEXT_SIZE 48
+// Frames to wait for an NMI before giving up, NMIs may well be disabled
+#define STEPPER_NMI_MAX_FRAMES 60
+
+typedef enum {
+    STEPPER_INSTRUCTIONS,
+    STEPPER_CYCLES,
+    STEPPER_SCANLINES,
+    STEPPER_FRAMES,
+    // Up to the first instruction of the next NMI handler
+    STEPPER_NMI,
+    STEPPER_CONTINUE,
+    STEPPER_PAUSE,
+    STEPPER_QUIT,
+    // A breakpoint or watchpoint command for the front end, in `text`
+    STEPPER_DEBUGGER,
+} StepperCommandType;
+
+typedef struct {
+    StepperCommandType type;
+    // How many instructions, cycles, scanlines or frames to step
+    uint64_t count;
+    char text[STEPPER_TEXT_SIZE];
+} StepperCommand;
+
+typedef struct {
+    RingBuffer ring;
+    StepperCommand storage[STEPPER_QUEUE_CAPACITY];
+} Stepper;
+
+// Returns 1 on failure.
+int stepper_init(Stepper *stepper);
+
+// Parses a command line:
+//
+//   (empty) or "s [N]"  N instructions
+//   "cy N"              N CPU cycles
+//   "l [N]"             N scanlines
+//   "f [N]"             N frames
+//   "n"                 to the next NMI
+//   "c", "p", "q"       continue, pause, quit
+//   "b", "db", "w", "dw" followed by an argument, for the debugger
+//
+// Returns 1 if the line isn't a command.
+int stepper_parse(const char *line, StepperCommand *out);
+
+// Queues `command`. Producer only.
+//
+// Returns 1 if the queue is full.
+int stepper_push(Stepper *stepper, const StepperCommand *command);
+
+// Takes the next command, or only looks at it. Consumer only.
+//
+// Returns 1 if there is none.
+int stepper_pop(Stepper *stepper, StepperCommand *out);
+int stepper_peek(Stepper *stepper, StepperCommand *out);
+
+// Whether commands are waiting, cheap enough to check every frame.
+static inline int stepper_pending(Stepper *stepper) {
+    return ring_buffer_count(&stepper->ring) > 0;
+}
+
+// Whether `command` runs the emulator, i.e. is for `stepper_run`.
+int stepper_runs(const StepperCommand *command);
+
+// Runs the emulator as far as `command` says. Breakpoints are honored after
+// the first instruction.
+//
+// Returns 0, or what `emulator_step` returned when it stopped early.
+int stepper_run(const StepperCommand *command, Emulator *emulator,
+                uint32_t *framebuffer);
+
+#endif
@@ -0,0 +1,240 @@
+#include "trace.h"
+#include "cpu.h"
+#include "decode_instruction.h"
+#include "emulator.h"
+#include "memory.h"
+#include "ppu.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define DISASSEMBLY_SIZE TRACE_DISASSEMBLY_SIZE
+
+static inline uint16_t peek_two_bytes(Memory *memory, uint16_t address) {
+    return memory_peek(memory, address + 1) << 8 | memory_peek(memory, address);
+}
+
+// Pointers in the zero page wrap around within it
+static inline uint16_t peek_zero_page_pointer(Memory *memory, uint8_t address) {
+    return memory_peek(memory, (uint8_t)(address + 1)) << 8 |
+           memory_peek(memory, address);
+}
+
+// Writes the instruction and its operand the way Nintendulator does, along
+// with the memory it accesses if `ctx` isn't null.
+static void format_disassembly(Instruction instruction, uint16_t address,
+                               CPUContext *ctx, Memory *memory, char *out) {
+    const char *name = instruction.mneumonic_str;
+    uint8_t operand = memory_peek(memory, address + 1);
+    uint16_t absolute = peek_two_bytes(memory, address + 1);
+    uint8_t x = ctx ? ctx->x : 0;
+    uint8_t y = ctx ? ctx->y : 0;
+
+    // Instruction and operand, and what it accesses
+    char text[DISASSEMBLY_SIZE / 2];
+    char accessed[DISASSEMBLY_SIZE / 2] = "";
+    uint16_t target;
+
+    switch (instruction.addressing_mode) {
+    case IMPLIED:
+        snprintf(out, DISASSEMBLY_SIZE, "%s", name);
+        return;
+    case ACCUMULATOR:
+        snprintf(out, DISASSEMBLY_SIZE, "%s A", name);
+        return;
+    case IMMEDIATE:
+        snprintf(out, DISASSEMBLY_SIZE, "%s #$%02X", name, operand);
+        return;
+    case RELATIVE:
+        target = address + instruction.bytes + (int8_t)operand;
+        snprintf(out, DISASSEMBLY_SIZE, "%s $%04X", name, target);
+        return;
+
+    case ZERO_PAGE:
+        snprintf(text, sizeof(text), "%s $%02X", name, operand);
+        snprintf(accessed, sizeof(accessed), " = %02X",
+                 memory_peek(memory, operand));
+        break;
+    case ZERO_PAGE_INDEXED_X:
+    case ZERO_PAGE_INDEXED_Y: {
+        int indexed_x = instruction.addressing_mode == ZERO_PAGE_INDEXED_X;
+        target = (uint8_t)(operand + (indexed_x ? x : y));
+        snprintf(text, sizeof(text), "%s $%02X,%c", name, operand,
+                 indexed_x ? 'X' : 'Y');
+        snprintf(accessed, sizeof(accessed), " @ %02X = %02X", target,
+                 memory_peek(memory, target));
+        break;
+    }
+
+    case ABSOLUTE:
+        snprintf(text, sizeof(text), "%s $%04X", name, absolute);
+        // Jumps don't access the address
+        if (instruction.mneumonic != JMP && instruction.mneumonic != JSR)
+            snprintf(accessed, sizeof(accessed), " = %02X",
+                     memory_peek(memory, absolute));
+        break;
+    case ABSOLUTE_INDEXED_X:
+    case ABSOLUTE_INDEXED_Y: {
+        int indexed_x = instruction.addressing_mode == ABSOLUTE_INDEXED_X;
+        target = absolute + (indexed_x ? x : y);
+        snprintf(text, sizeof(text), "%s $%04X,%c", name, absolute,
+                 indexed_x ? 'X' : 'Y');
+        snprintf(accessed, sizeof(accessed), " @ %04X = %02X", target,
+                 memory_peek(memory, target));
+        break;
+    }
+
+    case INDIRECT_ABSOLUTE:
+        // The high byte of the pointer is read without carrying into the
+        // page
+        target = memory_peek(memory, (absolute & 0xff00) |
+                                         (uint8_t)(absolute + 1))
+                     << 8 |
+                 memory_peek(memory, absolute);
+        snprintf(text, sizeof(text), "%s ($%04X)", name, absolute);
+        snprintf(accessed, sizeof(accessed), " = %04X", target);
+        break;
+    case INDEXED_INDIRECT: {
+        uint8_t pointer = operand + x;
+        target = peek_zero_page_pointer(memory, pointer);
+        snprintf(text, sizeof(text), "%s ($%02X,X)", name, operand);
+        snprintf(accessed, sizeof(accessed), " @ %02X = %04X = %02X", pointer,
+                 target, memory_peek(memory, target));
+        break;
+    }
+    case INDIRECT_INDEXED: {
+        uint16_t base = peek_zero_page_pointer(memory, operand);
+        target = base + y;
+        snprintf(text, sizeof(text), "%s ($%02X),Y", name, operand);
+        snprintf(accessed, sizeof(accessed), " = %04X @ %04X = %02X", base,
+                 target, memory_peek(memory, target));
+        break;
+    }
+    }
+
+    snprintf(out, DISASSEMBLY_SIZE, "%s%s", text, ctx ? accessed : "");
+}
+
+int trace_disassemble(Memory *memory, uint16_t address, char *out) {
+    Instruction instruction = decode_instruction(memory_peek(memory, address));
+    if (!instruction.mneumonic_str) {
+        snprintf(out, TRACE_DISASSEMBLY_SIZE, "???");
+        return 1;
+    }
+
+    format_disassembly(instruction, address, 0, memory, out);
+    return instruction.bytes;
+}
+
+void trace_format(CPUContext *ctx, Memory *memory, char *line) {
+    uint16_t address = ctx->program_counter;
+    Instruction instruction = decode_instruction(memory_peek(memory, address));
+
+    char disassembly[DISASSEMBLY_SIZE];
+    if (instruction.mneumonic_str) {
+        format_disassembly(instruction, address, ctx, memory, disassembly);
+    } else {
+        // Unofficial opcodes aren't emulated
+        instruction.bytes = 1;
+        snprintf(disassembly, DISASSEMBLY_SIZE, "???");
+    }
+
+    char bytes[10] = "";
+    for (int i = 0; i < instruction.bytes; i++)
+        snprintf(bytes + i * 3, sizeof(bytes) - i * 3, "%02X ",
+                 memory_peek(memory, address + i));
+
+    // The B flag only exists on the stack and bit 5 always reads as set
+    uint8_t status = (ctx->status_register.value & ~0x10) | 0x20;
+
+    snprintf(line, TRACE_LINE_SIZE,
+             "%04X  %-9s %-32sA:%02X X:%02X Y:%02X P:%02X SP:%02X "
+             "PPU:%3d,%3d CYC:%llu",
+             address, bytes, disassembly, ctx->a, ctx->x, ctx->y, status,
+             ctx->stack_pointer, memory->ppu_ctx.current_scanline,
+             memory->ppu_ctx.current_dot,
+             (unsigned long long)memory->cpu_cycle);
+}
+
+void trace_start_nestest(Emulator *emulator) {
+    emulator->cpu_ctx.program_counter = 0xc000;
+    emulator->cpu_ctx.stack_pointer = 0xfd;
+    emulator->cpu_ctx.status_register.value = 0x24;
+
+    // As if coming out of the reset sequence
+    emulator->memory.cpu_cycle = CPU_INTERRUPT_CYCLES;
+    ppu_run_until(&emulator->memory.ppu_ctx,
+                  emulator->memory.cpu_cycle * PPU_DOTS_PER_CPU_CYCLE);
+}
+
+// Prints the lines before `line_number` kept in `context`.
+static void print_context(char context[][TRACE_LINE_SIZE],
+                          uint64_t line_number) {
+    uint64_t first = line_number > TRACE_CONTEXT_LINES
+                         ? line_number - TRACE_CONTEXT_LINES
+                         : 1;
+    for (uint64_t i = first; i < line_number; i++)
+        fprintf(stderr, "  %s\n", context[i % TRACE_CONTEXT_LINES]);
+}
+
+static void print_difference(char context[][TRACE_LINE_SIZE],
+                             uint64_t line_number, const char *expected,
+                             const char *line) {
+    fprintf(stderr, "Trace differs from the golden log on line %llu:\n",
+            (unsigned long long)line_number);
+    print_context(context, line_number);
+    fprintf(stderr, "- %s\n+ %s\n", expected, line);
+
+    int column = 0;
+    while (expected[column] && expected[column] == line[column])
+        column++;
+    fprintf(stderr, "  %*s^\n", column, "");
+}
+
+int trace_compare(Emulator *emulator, FILE *golden, FILE *out) {
+    char context[TRACE_CONTEXT_LINES][TRACE_LINE_SIZE];
+    char line[TRACE_LINE_SIZE];
+    char expected[TRACE_LINE_SIZE * 2];
+
+    for (uint64_t line_number = 1;; line_number++) {
+        if (golden && !fgets(expected, sizeof(expected), golden))
+            return 0;
+
+        // The PPU position is part of the line
+        ppu_run_until(&emulator->memory.ppu_ctx,
+                      emulator->memory.cpu_cycle * PPU_DOTS_PER_CPU_CYCLE);
+        trace_format(&emulator->cpu_ctx, &emulator->memory, line);
+
+        if (out)
+            fprintf(out, "%s\n", line);
+
+        if (golden) {
+            expected[strcspn(expected, "\r\n")] = 0;
+            if (strcmp(expected, line)) {
+                print_difference(context, line_number, expected, line);
+                return 1;
+            }
+        }
+        memcpy(context[line_number % TRACE_CONTEXT_LINES], line,
+               TRACE_LINE_SIZE);
+
+        if (emulator_step(emulator, 0)) {
+            // Where the CPU can't follow the golden log any further
+            if (emulator->exit_reason ==
+                EMULATOR_EXIT_UNSUPPORTED_INSTRUCTION) {
+                fprintf(stderr,
+                        "The CPU can't go on from line %llu, "
+                        "the instruction isn't supported:\n",
+                        (unsigned long long)line_number);
+                print_context(context, line_number + 1);
+                return 1;
+            }
+            if (!golden)
+                return 0;
+            fprintf(stderr,
+                    "CPU exited on line %llu before the golden log ended\n",
+                    (unsigned long long)line_number);
+            return 1;
+        }
+    }
+}
@@ -0,0 +1,50 @@
+// CPU execution traces in the format of nestest.log, for checking the CPU
+// against a known good log line by line:
+//
+// C000  4C F5 C5  JMP $C5F5                       A:00 X:00 Y:00 P:24 SP:FD
+//   PPU:  0, 21 CYC:7
+//
+// (on one line). That is the address and bytes of the instruction, its
+// disassembly with the memory it's about to access, and the registers, PPU
+// position (scanline, dot) and CPU cycle before it runs.
+
+#ifndef _TRACE
+#define _TRACE
+
+#include "cpu.h"
+#include "emulator.h"
+#include "memory.h"
+#include <stdio.h>
+
+// Big enough for any trace line
+#define TRACE_LINE_SIZE 128
+// Big enough for the disassembly of any instruction
+#define TRACE_DISASSEMBLY_SIZE 64
+// Lines shown before the line that differs from a golden log
+#define TRACE_CONTEXT_LINES 8
+
+// Formats the instruction at the program counter into `line` (of
+// `TRACE_LINE_SIZE`), without side effects.
+void trace_format(CPUContext *ctx, Memory *memory, char *line);
+
+// Disassembles the instruction at `address` into `out` (of
+// `TRACE_DISASSEMBLY_SIZE`), without side effects.
+//
+// Returns the size of the instruction in bytes.
+int trace_disassemble(Memory *memory, uint16_t address, char *out);
+
+// Sets up the state nestest.log starts from, running from 0xc000 (the
+// automated mode of nestest that needs no PPU).
+void trace_start_nestest(Emulator *emulator);
+
+// Runs `emulator` one instruction at a time, comparing the trace to the lines
+// of `golden` as they are read, until the golden log ends. Every line is also
+// written to `out` if it isn't null, and `golden` can be null to only do that
+// until the CPU exits.
+//
+// Returns 1 if the trace differs from the golden log or the CPU got to an
+// instruction it doesn't support, after printing the difference and the lines
+// leading up to it to stderr.
+int trace_compare(Emulator *emulator, FILE *golden, FILE *out);
+
+#endif
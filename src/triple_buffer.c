@@ -0,0 +1,43 @@
+#include "triple_buffer.h"
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define INDEX_MASK 0x3
+
+void triple_buffer_init(TripleBuffer *triple, void *buffers[3]) {
+    for (int i = 0; i < 3; i++)
+        triple->buffers[i] = buffers[i];
+
+    triple->back = 0;
+    atomic_init(&triple->middle, 1);
+    triple->front = 2;
+}
+
+void *triple_buffer_back(TripleBuffer *triple) {
+    return triple->buffers[triple->back];
+}
+
+void *triple_buffer_publish(TripleBuffer *triple) {
+    // Release so the writes to the buffer are visible to the consumer, and
+    // acquire so it's done with the one we get back
+    uint8_t previous = atomic_exchange_explicit(
+        &triple->middle, triple->back | TRIPLE_BUFFER_FRESH,
+        memory_order_acq_rel);
+    triple->back = previous & INDEX_MASK;
+    return triple->buffers[triple->back];
+}
+
+int triple_buffer_consume(TripleBuffer *triple) {
+    if (!(atomic_load_explicit(&triple->middle, memory_order_relaxed) &
+          TRIPLE_BUFFER_FRESH))
+        return 0;
+
+    uint8_t previous = atomic_exchange_explicit(
+        &triple->middle, triple->front, memory_order_acq_rel);
+    triple->front = previous & INDEX_MASK;
+    return 1;
+}
+
+void *triple_buffer_front(TripleBuffer *triple) {
+    return triple->buffers[triple->front];
+}
@@ -0,0 +1,47 @@
+// Lock-free triple buffering between one producer and one consumer thread.
+//
+// The producer always has a buffer of its own to write into and the consumer
+// one to read from, the third holds the newest finished buffer. Handing a
+// buffer over is a single atomic exchange, so neither side ever waits for
+// the other. Frames the consumer doesn't get to in time are skipped.
+
+#ifndef _TRIPLE_BUFFER
+#define _TRIPLE_BUFFER
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+typedef struct {
+    void *buffers[3];
+    // Index of the buffer in the middle, or'd with `TRIPLE_BUFFER_FRESH` if
+    // the consumer hasn't seen it yet
+    _Atomic uint8_t middle;
+    // Only touched by the producer
+    uint8_t back;
+    // Only touched by the consumer
+    uint8_t front;
+} TripleBuffer;
+
+#define TRIPLE_BUFFER_FRESH 0x4
+
+// Sets up the buffer to hand over the three `buffers`.
+void triple_buffer_init(TripleBuffer *triple, void *buffers[3]);
+
+// The buffer the producer should be writing into.
+void *triple_buffer_back(TripleBuffer *triple);
+
+// Hands the back buffer over to the consumer, replacing any finished buffer
+// it didn't take yet. Producer only.
+//
+// Returns the new back buffer.
+void *triple_buffer_publish(TripleBuffer *triple);
+
+// Takes the newest finished buffer if there is one. Consumer only.
+//
+// Returns 1 if a new buffer was taken.
+int triple_buffer_consume(TripleBuffer *triple);
+
+// The buffer the consumer should be reading from.
+void *triple_buffer_front(TripleBuffer *triple);
+
+#endif
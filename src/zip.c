@@ -0,0 +1,272 @@
+#include "zip.h"
+#include "hash.h"
+#include "inflate.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#define END_OF_DIRECTORY_SIGNATURE 0x06054b50
+#define END_OF_DIRECTORY_SIZE 22
+#define DIRECTORY_ENTRY_SIGNATURE 0x02014b50
+#define DIRECTORY_ENTRY_SIZE 46
+#define LOCAL_HEADER_SIGNATURE 0x04034b50
+#define LOCAL_HEADER_SIZE 30
+// The end of the central directory is followed by a comment of up to this
+#define MAX_COMMENT_SIZE 0xffff
+
+#define FLAG_ENCRYPTED 0x0001
+#define COPY_CHUNK_SIZE 0x4000
+
+static inline uint16_t get_u16(const uint8_t *bytes) {
+    return bytes[1] << 8 | bytes[0];
+}
+
+static inline uint32_t get_u32(const uint8_t *bytes) {
+    return (uint32_t)get_u16(bytes + 2) << 16 | get_u16(bytes);
+}
+
+// Reads `size` bytes at `offset`.
+//
+// Returns 1 on failure.
+static int read_at(FILE *fp, long offset, void *buffer, size_t size) {
+    return fseek(fp, offset, SEEK_SET) || fread(buffer, 1, size, fp) != size;
+}
+
+// Finds the end of central directory record, searching backwards from the end
+// as it may be followed by a comment.
+//
+// Returns 1 if there is none.
+static int read_end_of_directory(FILE *fp, uint8_t *out) {
+    fseek(fp, 0, SEEK_END);
+    long file_size = ftell(fp);
+    long size = END_OF_DIRECTORY_SIZE + MAX_COMMENT_SIZE;
+    if (size > file_size)
+        size = file_size;
+    if (size < END_OF_DIRECTORY_SIZE)
+        return 1;
+
+    uint8_t *tail = malloc(size);
+    if (!tail || read_at(fp, file_size - size, tail, size)) {
+        free(tail);
+        return 1;
+    }
+
+    int found = 0;
+    for (long i = size - END_OF_DIRECTORY_SIZE; i >= 0 && !found; i--) {
+        if (get_u32(tail + i) == END_OF_DIRECTORY_SIGNATURE) {
+            memcpy(out, tail + i, END_OF_DIRECTORY_SIZE);
+            found = 1;
+        }
+    }
+    free(tail);
+    return !found;
+}
+
+static int compare_entries(const void *a, const void *b) {
+    return strcmp(((const ZipEntry *)a)->name, ((const ZipEntry *)b)->name);
+}
+
+// Indexes the central directory of `size` bytes in `directory`.
+//
+// Returns 1 if it is invalid.
+static int read_directory(ZipArchive *archive, const uint8_t *directory,
+                          uint32_t size, int count) {
+    archive->entries = calloc(count ? count : 1, sizeof(ZipEntry));
+    if (!archive->entries)
+        return 1;
+
+    const uint8_t *entry = directory;
+    const uint8_t *end = directory + size;
+    for (int i = 0; i < count; i++) {
+        if (end - entry < DIRECTORY_ENTRY_SIZE ||
+            get_u32(entry) != DIRECTORY_ENTRY_SIGNATURE)
+            return 1;
+        int name_size = get_u16(entry + 28);
+        int extra_size = get_u16(entry + 30);
+        int comment_size = get_u16(entry + 32);
+        int entry_size =
+            DIRECTORY_ENTRY_SIZE + name_size + extra_size + comment_size;
+        if (end - entry < entry_size)
+            return 1;
+
+        const char *name = (const char *)entry + DIRECTORY_ENTRY_SIZE;
+        // Directories
+        if (name_size && name[name_size - 1] != '/') {
+            ZipEntry *out = &archive->entries[archive->count];
+            out->name = strndup(name, name_size);
+            if (!out->name)
+                return 1;
+            out->flags = get_u16(entry + 8);
+            out->method = get_u16(entry + 10);
+            out->crc32 = get_u32(entry + 16);
+            out->compressed_size = get_u32(entry + 20);
+            out->uncompressed_size = get_u32(entry + 24);
+            out->local_header_offset = get_u32(entry + 42);
+            archive->count++;
+        }
+        entry += entry_size;
+    }
+
+    qsort(archive->entries, archive->count, sizeof(ZipEntry),
+          compare_entries);
+    return 0;
+}
+
+int zip_open(ZipArchive *archive, const char *filepath) {
+    *archive = (ZipArchive){0};
+    archive->fp = fopen(filepath, "rb");
+    if (!archive->fp) {
+        perror("Could not open zip file");
+        return 1;
+    }
+
+    uint8_t end[END_OF_DIRECTORY_SIZE];
+    if (read_end_of_directory(archive->fp, end)) {
+        fprintf(stderr, "ERROR: %s is not a zip file\n", filepath);
+        zip_close(archive);
+        return 1;
+    }
+
+    int disk = get_u16(end + 4);
+    int count = get_u16(end + 10);
+    uint32_t size = get_u32(end + 12);
+    uint32_t offset = get_u32(end + 16);
+    if (disk || count == 0xffff || offset == 0xffffffff) {
+        fprintf(stderr, "ERROR: %s is a multi-disk or ZIP64 archive, which "
+                        "isn't supported\n",
+                filepath);
+        zip_close(archive);
+        return 1;
+    }
+
+    uint8_t *directory = malloc(size ? size : 1);
+    int failed = !directory || read_at(archive->fp, offset, directory, size) ||
+                 read_directory(archive, directory, size, count);
+    free(directory);
+    if (failed) {
+        fprintf(stderr, "ERROR: the zip file %s is corrupted\n", filepath);
+        zip_close(archive);
+        return 1;
+    }
+    return 0;
+}
+
+void zip_close(ZipArchive *archive) {
+    if (archive->fp)
+        fclose(archive->fp);
+    for (int i = 0; i < archive->count; i++)
+        free(archive->entries[i].name);
+    free(archive->entries);
+    *archive = (ZipArchive){0};
+}
+
+const ZipEntry *zip_find(ZipArchive *archive, const char *name) {
+    ZipEntry key = {.name = (char *)name};
+    return bsearch(&key, archive->entries, archive->count, sizeof(ZipEntry),
+                   compare_entries);
+}
+
+const ZipEntry *zip_find_extension(ZipArchive *archive,
+                                   const char *extension) {
+    size_t extension_size = strlen(extension);
+    for (int i = 0; i < archive->count; i++) {
+        const char *name = archive->entries[i].name;
+        size_t size = strlen(name);
+        if (size >= extension_size &&
+            !strcasecmp(name + size - extension_size, extension))
+            return &archive->entries[i];
+    }
+    return 0;
+}
+
+// ----- Extracting -----
+
+typedef struct {
+    FILE *fp;
+    // Compressed bytes left to read
+    uint32_t remaining;
+
+    InflateWrite write;
+    void *write_context;
+    // Of what was written so far
+    uint32_t crc32;
+    uint32_t size;
+    int stopped;
+} Extraction;
+
+static int read_compressed(void *context, uint8_t *buffer, int size) {
+    Extraction *extraction = context;
+    if ((uint32_t)size > extraction->remaining)
+        size = extraction->remaining;
+    if (!size)
+        return 0;
+
+    if (fread(buffer, 1, size, extraction->fp) != (size_t)size)
+        return -1;
+    extraction->remaining -= size;
+    return size;
+}
+
+static int write_checked(void *context, const uint8_t *data, size_t size) {
+    Extraction *extraction = context;
+    extraction->crc32 = hash_crc32(extraction->crc32, data, size);
+    extraction->size += size;
+    extraction->stopped =
+        extraction->write(extraction->write_context, data, size);
+    return extraction->stopped;
+}
+
+// Copies a stored file.
+//
+// Returns 1 on failure.
+static int copy_stored(Extraction *extraction) {
+    uint8_t chunk[COPY_CHUNK_SIZE];
+    int size;
+    while ((size = read_compressed(extraction, chunk, sizeof(chunk))) > 0)
+        if (write_checked(extraction, chunk, size))
+            return 1;
+    return size < 0;
+}
+
+int zip_extract(ZipArchive *archive, const ZipEntry *entry, InflateWrite write,
+                void *write_context) {
+    if (entry->flags & FLAG_ENCRYPTED ||
+        (entry->method != ZIP_METHOD_STORED &&
+         entry->method != ZIP_METHOD_DEFLATED)) {
+        fprintf(stderr, "ERROR: %s is encrypted or compressed in a way that "
+                        "isn't supported\n",
+                entry->name);
+        return 1;
+    }
+
+    // The sizes of the name and extra field can differ from the central
+    // directory's
+    uint8_t header[LOCAL_HEADER_SIZE];
+    if (read_at(archive->fp, entry->local_header_offset, header,
+                LOCAL_HEADER_SIZE) ||
+        get_u32(header) != LOCAL_HEADER_SIGNATURE ||
+        fseek(archive->fp, get_u16(header + 26) + get_u16(header + 28),
+              SEEK_CUR)) {
+        fprintf(stderr, "ERROR: %s is corrupted\n", entry->name);
+        return 1;
+    }
+
+    Extraction extraction = {.fp = archive->fp,
+                             .remaining = entry->compressed_size,
+                             .write = write,
+                             .write_context = write_context};
+    int result = entry->method == ZIP_METHOD_STORED
+                     ? copy_stored(&extraction)
+                     : inflate_stream(read_compressed, &extraction,
+                                      write_checked, &extraction);
+    if (extraction.stopped)
+        return 1;
+    if (result || extraction.size != entry->uncompressed_size ||
+        extraction.crc32 != entry->crc32) {
+        fprintf(stderr, "ERROR: %s is corrupted\n", entry->name);
+        return 1;
+    }
+    return 0;
+}
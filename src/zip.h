@@ -0,0 +1,57 @@
+// Reading files out of zip archives, stored or deflated.
+//
+// Opening an archive reads its central directory once into an index sorted
+// by name, so any number of files can then be looked up and extracted
+// without reading it again. Files are extracted as a stream (see inflate.h),
+// straight to wherever the caller wants them.
+//
+// ZIP64, encryption and multi-disk archives aren't supported.
+
+#ifndef _ZIP
+#define _ZIP
+
+#include "inflate.h"
+#include <stdint.h>
+#include <stdio.h>
+
+#define ZIP_METHOD_STORED 0
+#define ZIP_METHOD_DEFLATED 8
+
+typedef struct {
+    char *name;
+    uint16_t method;
+    uint16_t flags;
+    uint32_t crc32;
+    uint32_t compressed_size;
+    uint32_t uncompressed_size;
+    uint32_t local_header_offset;
+} ZipEntry;
+
+typedef struct ZipArchive {
+    FILE *fp;
+    // Files, not directories, sorted by name
+    ZipEntry *entries;
+    int count;
+} ZipArchive;
+
+// Returns 1 on failure.
+int zip_open(ZipArchive *archive, const char *filepath);
+void zip_close(ZipArchive *archive);
+
+// Returns null if there is no file called `name`.
+const ZipEntry *zip_find(ZipArchive *archive, const char *name);
+
+// The first file by name ending in `extension`, ignoring case.
+//
+// Returns null if there is none.
+const ZipEntry *zip_find_extension(ZipArchive *archive,
+                                   const char *extension);
+
+// Decompresses `entry` into `write`, checking its size and CRC-32. Only one
+// file of an archive can be extracted at a time.
+//
+// Returns 1 on failure, or if the writer stopped.
+int zip_extract(ZipArchive *archive, const ZipEntry *entry, InflateWrite write,
+                void *write_context);
+
+#endif
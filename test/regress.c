@@ -0,0 +1,377 @@
+// Regression suite: runs a corpus of test ROMs headless and compares a hash
+// of the final framebuffer and the result bytes at 0x6000 against golden
+// values.
+//
+// Every ROM runs in a process of its own (at most -j at a time) so that one
+// that crashes the emulator doesn't take the rest of the suite with it.
+//
+// The corpus is listed in a manifest, one ROM per line:
+//   [ROM path, relative to the manifest] [frames to run] [hash or -]
+// Lines starting with # are comments. A ROM that isn't there or has no hash
+// recorded fails the run, like one whose output changed.
+//
+// A ROM also fails, whatever its hash, if the emulator stops before the last
+// frame, or if it reports with blargg's result protocol and its status byte
+// at 0x6000 isn't 0 by then.
+//
+// Usage: regress [manifest] [-j=workers] [-update]
+// With -update the manifest is rewritten with the hashes of this run, except
+// for the ROMs that failed like that.
+
+#include "emulator.h"
+#include "hash.h"
+#include "ppu.h"
+#include "rom_file.h"
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_LINES 1024
+#define MAX_LINE_LENGTH 512
+// Status byte, signature and text of blargg's test ROMs
+#define RESULT_SIZE 0x100
+#define RESULT_RUNNING 0x80
+static const uint8_t result_signature[3] = {0xde, 0xb0, 0x61};
+
+typedef enum {
+    JOB_PASS,
+    JOB_FAIL,
+    // No golden hash recorded yet
+    JOB_NEW,
+    JOB_MISSING,
+    JOB_ERROR,
+    JOB_CRASH,
+} JobStatus;
+
+typedef struct {
+    char name[MAX_LINE_LENGTH];
+    // Relative to the working directory
+    char path[MAX_LINE_LENGTH * 2];
+    int frames;
+    int has_expected_hash;
+    uint64_t expected_hash;
+
+    // Filled in by the worker processes
+    JobStatus status;
+    uint64_t hash;
+    int frames_run;
+    // Why the emulator stopped before the last frame
+    EmulatorExitReason exit_reason;
+    double seconds;
+    // Text left at 0x6004 by ROMs using blargg's result protocol
+    char result_text[RESULT_SIZE];
+    int result_code;
+    int signal;
+} Job;
+
+// The manifest is kept around line by line for -update
+static char lines[MAX_LINES][MAX_LINE_LENGTH];
+static int line_jobs[MAX_LINES];
+static int line_count = 0;
+
+// Shared with the worker processes
+static Job *jobs;
+static int job_count = 0;
+
+static double now_seconds(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+// Returns 1 on failure, will also print error messages to stderr.
+static int read_manifest(const char *filepath) {
+    FILE *fp = fopen(filepath, "r");
+    if (!fp) {
+        perror("Could not open manifest");
+        return 1;
+    }
+
+    // ROM paths are relative to the directory of the manifest
+    char directory[MAX_LINE_LENGTH] = ".";
+    const char *slash = strrchr(filepath, '/');
+    if (slash)
+        snprintf(directory, sizeof(directory), "%.*s",
+                 (int)(slash - filepath), filepath);
+
+    while (line_count < MAX_LINES &&
+           fgets(lines[line_count], MAX_LINE_LENGTH, fp)) {
+        char *line = lines[line_count];
+        line[strcspn(line, "\n")] = 0;
+        line_jobs[line_count] = -1;
+
+        char name[MAX_LINE_LENGTH], hash[MAX_LINE_LENGTH];
+        int frames;
+        int fields = sscanf(line, "%511s %d %511s", name, &frames, hash);
+
+        if (fields <= 0 || name[0] == '#') {
+            line_count++;
+            continue;
+        }
+        if (fields != 3 || frames <= 0) {
+            fprintf(stderr, "%s:%d: expected [ROM] [frames] [hash or -]\n",
+                    filepath, line_count + 1);
+            fclose(fp);
+            return 1;
+        }
+
+        Job *job = &jobs[job_count];
+        snprintf(job->name, sizeof(job->name), "%s", name);
+        snprintf(job->path, sizeof(job->path), "%s/%s", directory, name);
+        job->frames = frames;
+        job->has_expected_hash = strcmp(hash, "-") != 0;
+        job->expected_hash = strtoull(hash, 0, 16);
+
+        line_jobs[line_count++] = job_count++;
+    }
+
+    fclose(fp);
+    return 0;
+}
+
+// Whether the ROM ran to the end without reporting a failure, so its hash can
+// be recorded.
+static int run_completed(const Job *job) {
+    return job->frames_run == job->frames && job->result_code <= 0;
+}
+
+static int write_manifest(const char *filepath) {
+    FILE *fp = fopen(filepath, "w");
+    if (!fp) {
+        perror("Could not write manifest");
+        return 1;
+    }
+
+    for (int i = 0; i < line_count; i++) {
+        Job *job = line_jobs[i] < 0 ? 0 : &jobs[line_jobs[i]];
+        if (job && run_completed(job) &&
+            (job->status == JOB_FAIL || job->status == JOB_NEW))
+            fprintf(fp, "%-48s %6d %016llx\n", job->name, job->frames,
+                    (unsigned long long)job->hash);
+        else
+            fprintf(fp, "%s\n", lines[i]);
+    }
+
+    fclose(fp);
+    return 0;
+}
+
+// Runs in a worker process.
+static void run_job(Job *job) {
+    static Emulator emulator_storage;
+    static uint32_t framebuffer[PPU_FRAMEBUFFER_LENGTH];
+    Emulator *emulator = &emulator_storage;
+
+    if (access(job->path, R_OK)) {
+        job->status = JOB_MISSING;
+        return;
+    }
+
+    emulator_init(emulator);
+
+    double start = now_seconds();
+
+    if (rom_file_read(job->path, &emulator->memory, 0, 0)) {
+        job->status = JOB_ERROR;
+        return;
+    }
+    emulator_power_on(emulator);
+
+    // Only the last frame is hashed, so only it needs to be rendered
+    for (job->frames_run = 0; job->frames_run < job->frames;
+         job->frames_run++) {
+        int last = job->frames_run == job->frames - 1;
+        if (emulator_run_frame(emulator, last ? framebuffer : 0))
+            break;
+    }
+    job->exit_reason = emulator->exit_reason;
+
+    uint8_t *result = emulator->memory.prg_ram;
+    job->hash = hash_fnv1a(HASH_FNV1A_INITIAL, framebuffer,
+                           PPU_FRAMEBUFFER_LENGTH * sizeof(uint32_t));
+    job->hash = hash_fnv1a(job->hash, result, RESULT_SIZE);
+
+    job->seconds = now_seconds() - start;
+
+    job->result_code = -1;
+    if (!memcmp(result + 1, result_signature, sizeof(result_signature))) {
+        job->result_code = result[0];
+        snprintf(job->result_text, sizeof(job->result_text), "%.*s",
+                 RESULT_SIZE - 4, (char *)result + 4);
+    }
+
+    if (!run_completed(job))
+        job->status = JOB_FAIL;
+    else if (!job->has_expected_hash)
+        job->status = JOB_NEW;
+    else if (job->hash == job->expected_hash)
+        job->status = JOB_PASS;
+    else
+        job->status = JOB_FAIL;
+}
+
+// Keeps up to `worker_count` worker processes running until every job is
+// done.
+static void run_jobs(int worker_count) {
+    pid_t workers[worker_count];
+    int worker_jobs[worker_count];
+    int running = 0;
+    int next_job = 0;
+
+    while (next_job < job_count || running) {
+        if (next_job < job_count && running < worker_count) {
+            Job *job = &jobs[next_job];
+            // Anything the worker doesn't get to counts as a crash
+            job->status = JOB_CRASH;
+
+            fflush(stdout);
+            pid_t pid = fork();
+            if (pid == 0) {
+                run_job(job);
+                _exit(0);
+            }
+            if (pid < 0) {
+                perror("Could not start worker");
+                job->signal = 0;
+                next_job++;
+                continue;
+            }
+
+            workers[running] = pid;
+            worker_jobs[running++] = next_job++;
+            continue;
+        }
+
+        int status;
+        pid_t pid = wait(&status);
+        for (int i = 0; i < running; i++) {
+            if (workers[i] != pid)
+                continue;
+
+            if (WIFSIGNALED(status))
+                jobs[worker_jobs[i]].signal = WTERMSIG(status);
+
+            running--;
+            workers[i] = workers[running];
+            worker_jobs[i] = worker_jobs[running];
+            break;
+        }
+    }
+}
+
+static void print_job(Job *job) {
+    static const char *status_names[] = {
+        [JOB_PASS] = "PASS",       [JOB_FAIL] = "FAIL",
+        [JOB_NEW] = "NEW",         [JOB_MISSING] = "MISS",
+        [JOB_ERROR] = "ERROR",     [JOB_CRASH] = "CRASH",
+    };
+
+    printf("%-5s %-48s", status_names[job->status], job->name);
+    if (job->status == JOB_MISSING) {
+        printf(" (not found)\n");
+        return;
+    }
+    if (job->status == JOB_ERROR) {
+        printf(" (could not be loaded)\n");
+        return;
+    }
+    if (job->status == JOB_CRASH) {
+        printf(" (%s)\n", job->signal ? strsignal(job->signal) : "no result");
+        return;
+    }
+
+    printf(" %5d frames %8.1f ms %7.0f fps  %016llx", job->frames_run,
+           job->seconds * 1000, job->frames_run / job->seconds,
+           (unsigned long long)job->hash);
+    if (job->frames_run < job->frames)
+        printf(" (stopped early, %s)",
+               emulator_exit_reason_name(job->exit_reason));
+    else if (job->status == JOB_FAIL && run_completed(job))
+        printf(" (expected %016llx)", (unsigned long long)job->expected_hash);
+    printf("\n");
+
+    if (job->result_code == RESULT_RUNNING) {
+        printf("      still running, more frames are needed\n");
+    } else if (job->result_code >= 0 &&
+               (job->result_code != 0 || job->status != JOB_PASS)) {
+        // Indent the ROM's own report
+        printf("      result code %d\n", job->result_code);
+        char *text = job->result_text;
+        for (char *line = strtok(text, "\n"); line; line = strtok(0, "\n"))
+            printf("      %s\n", line);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    const char *manifest = "test/regress/manifest.txt";
+    long worker_count = sysconf(_SC_NPROCESSORS_ONLN);
+    int update = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strncmp("-j=", argv[i], 3))
+            worker_count = atol(argv[i] + 3);
+        else if (!strcmp("-update", argv[i]))
+            update = 1;
+        else if (argv[i][0] != '-')
+            manifest = argv[i];
+        else {
+            printf("Usage:\n%s [manifest] [-j=workers] [-update]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    jobs = mmap(0, MAX_LINES * sizeof(Job), PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (jobs == MAP_FAILED) {
+        perror("Could not allocate jobs");
+        return 1;
+    }
+
+    if (read_manifest(manifest))
+        return 1;
+    if (!job_count) {
+        printf("No ROMs listed in %s\n", manifest);
+        return 0;
+    }
+
+    if (worker_count < 1)
+        worker_count = 1;
+    if (worker_count > job_count)
+        worker_count = job_count;
+
+    double start = now_seconds();
+
+    run_jobs(worker_count);
+
+    double seconds = now_seconds() - start;
+
+    int counts[JOB_CRASH + 1] = {0};
+    double cpu_seconds = 0;
+    for (int i = 0; i < job_count; i++) {
+        print_job(&jobs[i]);
+        counts[jobs[i].status]++;
+        cpu_seconds += jobs[i].seconds;
+    }
+
+    printf("\n%d passed, %d failed, %d new, %d missing, %d errors, "
+           "%d crashed in %.2f s (%.2f s of emulation on %ld workers)\n",
+           counts[JOB_PASS], counts[JOB_FAIL], counts[JOB_NEW],
+           counts[JOB_MISSING], counts[JOB_ERROR], counts[JOB_CRASH],
+           seconds, cpu_seconds, worker_count);
+
+    if (update) {
+        if (write_manifest(manifest))
+            return 1;
+        printf("Updated %s\n", manifest);
+        return 0;
+    }
+
+    return counts[JOB_FAIL] || counts[JOB_NEW] || counts[JOB_MISSING] ||
+           counts[JOB_ERROR] || counts[JOB_CRASH];
+}
@@ -0,0 +1,286 @@
+#!/usr/bin/env python3
+# Builds the test ROMs of the regression suite, run with "make regress-roms".
+#
+# The ROMs are written in a small 6502 assembler below rather than for an
+# outside one, so that nothing but Python is needed to rebuild them. Each
+# instruction is (mnemonic, addressing mode[, operand]), where the operand is
+# a number or a label, and a string on its own defines a label.
+#
+# Usage: make_roms.py [output directory, defaults to this one]
+
+import os
+import struct
+import sys
+
+OPCODES = {
+    ('ADC', '#'): 0x69, ('ADC', 'zp'): 0x65,
+    ('AND', '#'): 0x29, ('AND', 'zp'): 0x25,
+    ('ASL', 'a'): 0x0A, ('ASL', 'zp'): 0x06,
+    ('BCC', 'rel'): 0x90, ('BCS', 'rel'): 0xB0,
+    ('BEQ', 'rel'): 0xF0, ('BMI', 'rel'): 0x30,
+    ('BNE', 'rel'): 0xD0, ('BPL', 'rel'): 0x10,
+    ('BVC', 'rel'): 0x50, ('BVS', 'rel'): 0x70,
+    ('BIT', 'zp'): 0x24, ('BIT', 'abs'): 0x2C,
+    ('CLC', ''): 0x18, ('CLD', ''): 0xD8, ('CLV', ''): 0xB8,
+    ('CMP', '#'): 0xC9, ('CMP', 'zp'): 0xC5,
+    ('CPX', '#'): 0xE0, ('CPY', '#'): 0xC0,
+    ('DEC', 'zp,x'): 0xD6,
+    ('DEX', ''): 0xCA, ('DEY', ''): 0x88,
+    ('EOR', '#'): 0x49,
+    ('INC', 'zp'): 0xE6,
+    ('INX', ''): 0xE8, ('INY', ''): 0xC8,
+    ('JMP', 'abs'): 0x4C, ('JSR', 'abs'): 0x20,
+    ('LDA', '#'): 0xA9, ('LDA', 'zp'): 0xA5, ('LDA', 'zp,x'): 0xB5,
+    ('LDA', 'abs'): 0xAD, ('LDA', 'abs,x'): 0xBD,
+    ('LDA', '(zp,x)'): 0xA1, ('LDA', '(zp),y'): 0xB1,
+    ('LDX', '#'): 0xA2,
+    ('LDY', '#'): 0xA0, ('LDY', 'zp'): 0xA4,
+    ('LSR', 'a'): 0x4A,
+    ('ORA', 'zp'): 0x05,
+    ('PHA', ''): 0x48, ('PLA', ''): 0x68,
+    ('ROL', 'a'): 0x2A, ('ROR', 'zp'): 0x66,
+    ('RTI', ''): 0x40, ('RTS', ''): 0x60,
+    ('SBC', 'zp'): 0xE5,
+    ('SEC', ''): 0x38, ('SEI', ''): 0x78,
+    ('STA', 'zp'): 0x85, ('STA', 'zp,x'): 0x95,
+    ('STA', 'abs'): 0x8D, ('STA', 'abs,x'): 0x9D, ('STA', 'abs,y'): 0x99,
+    ('STX', 'abs'): 0x8E, ('STY', 'zp'): 0x84,
+    ('TAY', ''): 0xA8, ('TXA', ''): 0x8A, ('TYA', ''): 0x98,
+}
+SIZES = {
+    '': 1, 'a': 1, '#': 2, 'zp': 2, 'zp,x': 2, '(zp,x)': 2, '(zp),y': 2,
+    'rel': 2, 'abs': 3, 'abs,x': 3, 'abs,y': 3,
+}
+
+
+def assemble(program, origin=0x8000):
+    """Returns the machine code of `program` and the address of its labels."""
+    labels = {}
+    address = origin
+    for item in program:
+        if isinstance(item, str):
+            labels[item] = address
+        elif item[0] == '.bytes':
+            address += len(item[1])
+        else:
+            address += SIZES[item[1]]
+
+    code = bytearray()
+    address = origin
+    for item in program:
+        if isinstance(item, str):
+            continue
+        if item[0] == '.bytes':
+            code += bytes(item[1])
+            address += len(item[1])
+            continue
+
+        mnemonic, mode = item[0], item[1]
+        operand = item[2] if len(item) > 2 else None
+        if isinstance(operand, str):
+            operand = labels[operand]
+        code.append(OPCODES[(mnemonic, mode)])
+        size = SIZES[mode]
+        if mode == 'rel':
+            offset = operand - (address + 2)
+            assert -128 <= offset < 128, f'branch too far: {item}'
+            code.append(offset & 0xFF)
+        elif size == 2:
+            assert 0 <= operand < 0x100, f'operand too large: {item}'
+            code.append(operand)
+        elif size == 3:
+            code += struct.pack('<H', operand)
+        address += size
+    return bytes(code), labels
+
+
+def ines(code, labels, chr_rom=b''):
+    """An NROM-128 image with vertical mirroring, vectors taken from the
+    `nmi`, `reset` and `irq` labels."""
+    prg_rom = bytearray(code.ljust(0x4000 - 6, b'\xEA'))
+    prg_rom += struct.pack('<HHH', labels['nmi'], labels['reset'],
+                           labels['irq'])
+    header = b'NES\x1a' + bytes([1, 1, 1, 0]) + bytes(8)
+    return header + bytes(prg_rom) + chr_rom.ljust(0x2000, b'\0')
+
+
+# ----- ppu_render.nes -----
+#
+# Draws both nametables with a different tile pattern per 256 byte page, so
+# every attribute palette shows up, puts 16 sprites with every palette and
+# flip on screen and scrolls diagonally by a pixel a frame from its NMI
+# handler. After 120 frames the picture is the left half of the second
+# nametable joined to the right half of the first, scrolled down by 60
+# lines, with the sprites in a diagonal line from the top left.
+
+PALETTE = [
+    0x0F, 0x16, 0x27, 0x18, 0x0F, 0x1A, 0x2A, 0x3A,
+    0x0F, 0x11, 0x21, 0x31, 0x0F, 0x13, 0x23, 0x33,
+    0x0F, 0x06, 0x16, 0x26, 0x0F, 0x09, 0x19, 0x29,
+    0x0F, 0x02, 0x12, 0x22, 0x0F, 0x14, 0x24, 0x34,
+]
+# Y, tile, attributes (palette and both flips) and X of each sprite
+SPRITES = []
+for i in range(16):
+    SPRITES += [40 + i * 10, i, (i & 3) | (i & 4) << 4 | (i & 8) << 4,
+                16 + i * 14]
+
+PPU_RENDER = [
+    'reset',
+    ('SEI', ''), ('CLD', ''),
+    ('LDX', '#', 0), ('STX', 'abs', 0x2000), ('STX', 'abs', 0x2001),
+    # No APU frame IRQs
+    ('LDA', '#', 0x40), ('STA', 'abs', 0x4017),
+    # The PPU is ready after two vertical blanks
+    'wait_vblank_1', ('BIT', 'abs', 0x2002), ('BPL', 'rel', 'wait_vblank_1'),
+    'wait_vblank_2', ('BIT', 'abs', 0x2002), ('BPL', 'rel', 'wait_vblank_2'),
+
+    ('LDA', '#', 0x3F), ('STA', 'abs', 0x2006),
+    ('LDA', '#', 0x00), ('STA', 'abs', 0x2006),
+    ('LDX', '#', 0),
+    'palette_loop',
+    ('LDA', 'abs,x', 'palette'), ('STA', 'abs', 0x2007),
+    ('INX', ''), ('CPX', '#', len(PALETTE)), ('BNE', 'rel', 'palette_loop'),
+
+    # 8 pages from 0x2000, both nametables with their attributes
+    ('LDA', '#', 0x20), ('STA', 'abs', 0x2006),
+    ('LDA', '#', 0x00), ('STA', 'abs', 0x2006),
+    ('LDY', '#', 8), ('LDX', '#', 0),
+    'nametable_loop',
+    ('TXA', ''), ('CLC', ''), ('ADC', 'zp', 0x01), ('AND', '#', 0x0F),
+    ('STA', 'abs', 0x2007),
+    ('INX', ''), ('CPX', '#', 0), ('BNE', 'rel', 'nametable_loop'),
+    ('INC', 'zp', 0x01), ('DEY', ''), ('CPY', '#', 0),
+    ('BNE', 'rel', 'nametable_loop'),
+
+    # Sprites below the screen, then the ones drawn over the top
+    ('LDA', '#', 0xFF), ('LDX', '#', 0),
+    'hide_loop',
+    ('STA', 'abs,x', 0x0200),
+    ('INX', ''), ('CPX', '#', 0), ('BNE', 'rel', 'hide_loop'),
+    'sprite_loop',
+    ('LDA', 'abs,x', 'sprites'), ('STA', 'abs,x', 0x0200),
+    ('INX', ''), ('CPX', '#', len(SPRITES)), ('BNE', 'rel', 'sprite_loop'),
+    ('LDA', '#', 0x02), ('STA', 'abs', 0x4014),
+
+    ('LDA', '#', 0), ('STA', 'abs', 0x2005), ('STA', 'abs', 0x2005),
+    # NMI on, background and sprites on everywhere
+    ('LDA', '#', 0x80), ('STA', 'abs', 0x2000),
+    ('LDA', '#', 0x1E), ('STA', 'abs', 0x2001),
+    'idle', ('JMP', 'abs', 'idle'),
+
+    # Counts frames in 0x00, scrolls by it horizontally and half of it
+    # vertically
+    'nmi',
+    ('PHA', ''),
+    ('INC', 'zp', 0x00),
+    ('LDA', '#', 0x02), ('STA', 'abs', 0x4014),
+    ('LDA', 'zp', 0x00), ('STA', 'abs', 0x2005),
+    ('LSR', 'a'), ('STA', 'abs', 0x2005),
+    ('LDA', '#', 0x80), ('STA', 'abs', 0x2000),
+    ('PLA', ''),
+    'irq', ('RTI', ''),
+
+    'palette', ('.bytes', PALETTE),
+    'sprites', ('.bytes', SPRITES),
+]
+
+
+def ppu_render_chr_rom():
+    """16 tiles of stripes and diagonals that differ in every row."""
+    chr_rom = bytearray()
+    for tile in range(16):
+        plane_0 = [((0xFF >> row % 8) ^ tile * 0x11) & 0xFF
+                   for row in range(8)]
+        plane_1 = [((0x81 << (row + tile) % 8 | 1 << tile % 8) ^
+                    (0xF0 if row & 4 else 0)) & 0xFF for row in range(8)]
+        chr_rom += bytes(plane_0 + plane_1)
+    return bytes(chr_rom)
+
+
+# ----- cpu_checksum.nes -----
+#
+# Runs 256 rounds of additions, subtractions, logic, shifts, read-modify-write
+# instructions, branches on every flag, indexed, indirect and stack accesses
+# and subroutine calls, each feeding the next. It then copies the values it
+# computed to 0x6080 and reports with blargg's result protocol: 0 at 0x6000,
+# DE B0 61 at 0x6001 and text from 0x6004. The loops compare explicitly
+# rather than rely on INX and DEY setting flags, so that a wrong flag shows
+# up in the checksum and not as a hang.
+
+RESULT_TEXT = b'CPU checksum done\n\0'
+
+CPU_CHECKSUM = [
+    'reset',
+    ('SEI', ''), ('CLD', ''),
+    ('LDA', '#', 0x40), ('STA', 'abs', 0x4017),
+    # A pointer to 0x0300 in 0x20 for the indirect accesses
+    ('LDA', '#', 0x00), ('STA', 'zp', 0x20),
+    ('LDA', '#', 0x03), ('STA', 'zp', 0x21),
+
+    ('LDX', '#', 0),
+    'loop',
+    ('TXA', ''), ('CLC', ''), ('ADC', 'zp', 0x10), ('STA', 'zp', 0x10),
+    ('EOR', '#', 0x5A), ('ROL', 'a'), ('STA', 'zp', 0x11),
+    ('SEC', ''), ('SBC', 'zp', 0x12), ('STA', 'zp', 0x12),
+    ('AND', 'zp', 0x10), ('ORA', 'zp', 0x11), ('LSR', 'a'),
+    ('STA', 'abs,x', 0x0300),
+    ('ROR', 'zp', 0x13), ('ASL', 'zp', 0x14), ('INC', 'zp', 0x15),
+    ('DEC', 'zp,x', 0x16),
+    # Counts how often each branch is taken
+    ('CMP', 'zp', 0x11), ('BCC', 'rel', 'below'), ('INC', 'zp', 0x17),
+    'below', ('BIT', 'zp', 0x12), ('BVC', 'rel', 'clear'),
+    ('INC', 'zp', 0x18),
+    'clear', ('BMI', 'rel', 'minus'), ('INC', 'zp', 0x19),
+    'minus',
+    ('LDY', '#', 0x07), ('LDA', '(zp),y', 0x20),
+    ('ADC', 'zp', 0x1A), ('STA', 'zp', 0x1A),
+    ('LDA', '(zp,x)', 0x20), ('EOR', '#', 0xA5), ('STA', 'zp', 0x1B),
+    ('JSR', 'abs', 'subroutine'),
+    ('INX', ''), ('CPX', '#', 0), ('BNE', 'rel', 'loop'),
+
+    # 0x0300-0x036f to 0x6080, 0x10-0x1f to 0x60f0
+    'copy_loop',
+    ('LDA', 'abs,x', 0x0300), ('STA', 'abs,x', 0x6080),
+    ('INX', ''), ('CPX', '#', 0x70), ('BNE', 'rel', 'copy_loop'),
+    ('LDX', '#', 0),
+    'copy_zero_page_loop',
+    ('LDA', 'zp,x', 0x10), ('STA', 'abs,x', 0x60F0),
+    ('INX', ''), ('CPX', '#', 0x10), ('BNE', 'rel', 'copy_zero_page_loop'),
+    ('LDX', '#', 0),
+    'copy_text_loop',
+    ('LDA', 'abs,x', 'text'), ('STA', 'abs,x', 0x6004),
+    ('INX', ''), ('CPX', '#', len(RESULT_TEXT)),
+    ('BNE', 'rel', 'copy_text_loop'),
+    ('LDA', '#', 0xDE), ('STA', 'abs', 0x6001),
+    ('LDA', '#', 0xB0), ('STA', 'abs', 0x6002),
+    ('LDA', '#', 0x61), ('STA', 'abs', 0x6003),
+    ('LDA', '#', 0), ('STA', 'abs', 0x6000),
+    'idle', ('JMP', 'abs', 'idle'),
+
+    'subroutine',
+    ('LDY', 'zp', 0x10), ('INY', ''), ('STY', 'zp', 0x1C),
+    ('TYA', ''), ('PHA', ''), ('ADC', '#', 0x33), ('PLA', ''),
+    ('ADC', 'zp', 0x1D), ('STA', 'zp', 0x1D),
+    ('RTS', ''),
+
+    'nmi', 'irq', ('RTI', ''),
+    'text', ('.bytes', RESULT_TEXT),
+]
+
+
+def main():
+    directory = sys.argv[1] if len(sys.argv) > 1 else os.path.dirname(
+        os.path.abspath(__file__))
+
+    code, labels = assemble(PPU_RENDER)
+    with open(os.path.join(directory, 'ppu_render.nes'), 'wb') as f:
+        f.write(ines(code, labels, ppu_render_chr_rom()))
+
+    code, labels = assemble(CPU_CHECKSUM)
+    with open(os.path.join(directory, 'cpu_checksum.nes'), 'wb') as f:
+        f.write(ines(code, labels))
+
+
+if __name__ == '__main__':
+    main()
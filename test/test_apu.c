@@ -0,0 +1,149 @@
+#include "apu.h"
+#include "unity.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define CYCLES_PER_FRAME 29780
+#define MAX_SAMPLES 4096
+
+APU apu;
+int16_t samples[MAX_SAMPLES];
+
+void setUp() {
+    memset(&apu, 0, sizeof(APU));
+    apu_init(&apu, APU_DEFAULT_SAMPLE_RATE);
+}
+
+void tearDown() {}
+
+static int peak_to_peak(int16_t *samples, int count) {
+    int min = samples[0], max = samples[0];
+    for (int i = 1; i < count; i++) {
+        if (samples[i] < min)
+            min = samples[i];
+        if (samples[i] > max)
+            max = samples[i];
+    }
+    return max - min;
+}
+
+// Counts the times the waveform crosses its midpoint going up
+static int count_periods(int16_t *samples, int count) {
+    int min = samples[0];
+    for (int i = 1; i < count; i++)
+        if (samples[i] < min)
+            min = samples[i];
+    int mid = min + peak_to_peak(samples, count) / 2;
+
+    int periods = 0;
+    for (int i = 1; i < count; i++)
+        if (samples[i - 1] < mid && samples[i] >= mid)
+            periods++;
+    return periods;
+}
+
+void test_pulse_tone() {
+    apu_write_register(&apu, 0x4015, 0x01, 0);
+    apu_write_register(&apu, 0x4000, 0xbf, 0);
+    // Period 0xfd is about 440 Hz
+    apu_write_register(&apu, 0x4002, 0xfd, 0);
+    apu_write_register(&apu, 0x4003, 0x00, 0);
+
+    apu_end_frame(&apu, CYCLES_PER_FRAME * 4);
+    int count = apu_read_samples(&apu, samples, MAX_SAMPLES);
+
+    // Four frames at 48 kHz
+    TEST_ASSERT_INT_WITHIN(2, 3194, count);
+    TEST_ASSERT_GREATER_THAN(5000, peak_to_peak(samples, count));
+    TEST_ASSERT_INT_WITHIN(1, 29, count_periods(samples, count));
+}
+
+void test_silent_when_disabled() {
+    apu_write_register(&apu, 0x4000, 0xbf, 0);
+    apu_write_register(&apu, 0x4002, 0xfd, 0);
+    apu_write_register(&apu, 0x4003, 0x00, 0);
+
+    apu_end_frame(&apu, CYCLES_PER_FRAME);
+    int count = apu_read_samples(&apu, samples, MAX_SAMPLES);
+
+    TEST_ASSERT_GREATER_THAN(0, count);
+    TEST_ASSERT_EQUAL(0, peak_to_peak(samples, count));
+}
+
+void test_length_counter_status() {
+    apu_write_register(&apu, 0x4015, 0x0f, 0);
+    apu_write_register(&apu, 0x4003, 0x08, 0);
+    apu_write_register(&apu, 0x400f, 0x08, 0);
+    TEST_ASSERT_EQUAL_HEX8(0x09, apu_read_status(&apu, 10));
+
+    // Length counter value 254 runs out after 127 frames
+    TEST_ASSERT_EQUAL_HEX8(0x09, apu_read_status(&apu, 10) & 0x0f);
+    apu_write_register(&apu, 0x4015, 0x00, 20);
+    TEST_ASSERT_EQUAL_HEX8(0x00, apu_read_status(&apu, 30) & 0x0f);
+}
+
+void test_frame_irq() {
+    apu_run_until(&apu, 29828);
+    TEST_ASSERT_FALSE(apu_irq_pending(&apu));
+    apu_run_until(&apu, 29830);
+    TEST_ASSERT(apu_irq_pending(&apu));
+
+    TEST_ASSERT_EQUAL_HEX8(0x40, apu_read_status(&apu, 29830));
+    TEST_ASSERT_FALSE(apu_irq_pending(&apu));
+
+    // Inhibited
+    apu_write_register(&apu, 0x4017, 0x40, 29830);
+    apu_run_until(&apu, 29830 * 3);
+    TEST_ASSERT_FALSE(apu_irq_pending(&apu));
+}
+
+void test_runs_without_init() {
+    memset(&apu, 0, sizeof(APU));
+    apu_write_register(&apu, 0x4015, 0x1f, 0);
+    apu_write_register(&apu, 0x400c, 0x3f, 0);
+    apu_write_register(&apu, 0x400f, 0x08, 0);
+    apu_run_until(&apu, CYCLES_PER_FRAME);
+    TEST_ASSERT_EQUAL_HEX8(0x08, apu_read_status(&apu, CYCLES_PER_FRAME));
+}
+
+void test_output_is_deterministic() {
+    APU *other = malloc(sizeof(APU));
+    memset(other, 0, sizeof(APU));
+    apu_init(other, APU_DEFAULT_SAMPLE_RATE);
+
+    APU *apus[] = {&apu, other};
+    int16_t *outputs[] = {samples, malloc(MAX_SAMPLES * sizeof(int16_t))};
+    int counts[2];
+
+    for (int i = 0; i < 2; i++) {
+        apu_write_register(apus[i], 0x4015, 0x0f, 0);
+        apu_write_register(apus[i], 0x400c, 0x3a, 0);
+        apu_write_register(apus[i], 0x400e, 0x04, 0);
+        apu_write_register(apus[i], 0x400f, 0x00, 0);
+        apu_write_register(apus[i], 0x4008, 0xff, 0);
+        apu_write_register(apus[i], 0x400a, 0x80, 0);
+        apu_write_register(apus[i], 0x400b, 0x00, 1000);
+        apu_end_frame(apus[i], CYCLES_PER_FRAME);
+        counts[i] = apu_read_samples(apus[i], outputs[i], MAX_SAMPLES);
+    }
+
+    TEST_ASSERT_EQUAL(counts[0], counts[1]);
+    TEST_ASSERT_EQUAL_INT16_ARRAY(outputs[0], outputs[1], counts[0]);
+    TEST_ASSERT_GREATER_THAN(1000, peak_to_peak(samples, counts[0]));
+
+    free(outputs[1]);
+    free(other);
+}
+
+int main() {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_pulse_tone);
+    RUN_TEST(test_silent_when_disabled);
+    RUN_TEST(test_length_counter_status);
+    RUN_TEST(test_frame_irq);
+    RUN_TEST(test_runs_without_init);
+    RUN_TEST(test_output_is_deterministic);
+
+    return UNITY_END();
+}
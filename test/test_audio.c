@@ -0,0 +1,85 @@
+#include "apu.h"
+#include "audio.h"
+#include "unity.h"
+#include <string.h>
+
+#define CYCLES_PER_FRAME 29780
+// What a 60 Hz display would ask for at 48 kHz, a little more than a frame
+// of NES audio
+#define SAMPLES_PER_DISPLAY_FRAME 800
+
+APU apu;
+AudioOutput audio;
+int16_t samples[SAMPLES_PER_DISPLAY_FRAME];
+
+void setUp() {
+    memset(&apu, 0, sizeof(APU));
+    apu_init(&apu, APU_DEFAULT_SAMPLE_RATE);
+    audio_init(&audio, APU_DEFAULT_SAMPLE_RATE);
+}
+
+void tearDown() {}
+
+void test_rate_adjustment() {
+    TEST_ASSERT(audio_rate_adjustment(500, 500) == 1.0);
+    TEST_ASSERT(audio_rate_adjustment(400, 500) > 1.0);
+    TEST_ASSERT(audio_rate_adjustment(600, 500) < 1.0);
+
+    // Never more than the limit
+    TEST_ASSERT(audio_rate_adjustment(0, 500) ==
+                1.0 + AUDIO_MAX_RATE_ADJUSTMENT);
+    TEST_ASSERT(audio_rate_adjustment(5000, 500) ==
+                1.0 - AUDIO_MAX_RATE_ADJUSTMENT);
+}
+
+void test_underrun_repeats_last_sample() {
+    int16_t in[] = {10, 20, 30};
+    ring_buffer_write(&audio.ring, in, 3);
+
+    int16_t out[6];
+    TEST_ASSERT_EQUAL(3, audio_pull(&audio, out, 6));
+    int16_t expected[] = {10, 20, 30, 30, 30, 30};
+    TEST_ASSERT_EQUAL_INT16_ARRAY(expected, out, 6);
+    TEST_ASSERT_EQUAL(3, audio.samples_missed);
+}
+
+void test_latency_is_capped() {
+    for (int frame = 0; frame < 10; frame++) {
+        apu_end_frame(&apu, (uint64_t)CYCLES_PER_FRAME * (frame + 1));
+        audio_push_frame(&audio, &apu);
+    }
+
+    TEST_ASSERT_EQUAL(audio.max_fill, ring_buffer_count(&audio.ring));
+    TEST_ASSERT_GREATER_THAN(0, audio.samples_dropped);
+}
+
+// The device consumes slightly faster than the emulator produces at the
+// nominal rate, rate control has to make up for it without running dry
+void test_rate_control_keeps_fill() {
+    uint64_t missed_when_settled = 0;
+
+    for (int frame = 0; frame < 1200; frame++) {
+        apu_end_frame(&apu, (uint64_t)CYCLES_PER_FRAME * (frame + 1));
+        audio_push_frame(&audio, &apu);
+        audio_pull(&audio, samples, SAMPLES_PER_DISPLAY_FRAME);
+
+        if (frame == 600)
+            missed_when_settled = audio.samples_missed;
+    }
+
+    TEST_ASSERT(audio.rate_adjustment > 1.0);
+    TEST_ASSERT_EQUAL(missed_when_settled, audio.samples_missed);
+    TEST_ASSERT_INT_WITHIN(audio.target_fill / 2, audio.target_fill,
+                           audio.average_fill);
+}
+
+int main() {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_rate_adjustment);
+    RUN_TEST(test_underrun_repeats_last_sample);
+    RUN_TEST(test_latency_is_capped);
+    RUN_TEST(test_rate_control_keeps_fill);
+
+    return UNITY_END();
+}
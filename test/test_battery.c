@@ -0,0 +1,92 @@
+#include "battery.h"
+#include "memory.h"
+#include "unity.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+char filepath[] = "/tmp/test_battery_XXXXXX";
+Battery battery;
+Memory memory;
+
+void setUp() {
+    memset(&memory, 0, sizeof(Memory));
+    memory_init(&memory);
+    close(mkstemp(filepath));
+}
+
+void tearDown() {
+    remove(filepath);
+    strcpy(filepath, "/tmp/test_battery_XXXXXX");
+}
+
+void test_writes_are_tracked_by_page() {
+    memory_write(&memory, 0x6001, 0x12);
+    memory_write(&memory, 0x7fff, 0x34);
+    TEST_ASSERT_EQUAL_HEX8(0x81, memory.prg_ram_dirty);
+}
+
+void test_saved_across_runs() {
+    TEST_ASSERT_EQUAL_INT(0, battery_open(&battery, &memory, filepath));
+    memory_write(&memory, 0x6000, 0x12);
+    battery_update(&battery, &memory);
+    TEST_ASSERT_EQUAL_HEX8(0, memory.prg_ram_dirty);
+    TEST_ASSERT_EQUAL_HEX8(0x12, battery.mapping[0]);
+
+    // Copied when closing too
+    memory_write(&memory, 0x7abc, 0x34);
+    battery_close(&battery, &memory);
+
+    memset(&memory, 0, sizeof(Memory));
+    memory_init(&memory);
+    TEST_ASSERT_EQUAL_INT(0, battery_open(&battery, &memory, filepath));
+    TEST_ASSERT_EQUAL_HEX8(0x12, memory_read(&memory, 0x6000));
+    TEST_ASSERT_EQUAL_HEX8(0x34, memory_read(&memory, 0x7abc));
+    battery_close(&battery, &memory);
+
+    FILE *fp = fopen(filepath, "rb");
+    fseek(fp, 0, SEEK_END);
+    TEST_ASSERT_EQUAL_INT(MEMORY_PRG_RAM_SIZE, ftell(fp));
+    fclose(fp);
+}
+
+void test_trainer_is_mapped_at_0x7000() {
+    memory.trainer[0] = 0xab;
+    memory.trainer[MEMORY_TRAINER_SIZE - 1] = 0xcd;
+    memory_map_trainer(&memory);
+    TEST_ASSERT_EQUAL_HEX8(0xab, memory_read(&memory, 0x7000));
+    TEST_ASSERT_EQUAL_HEX8(0xcd, memory_read(&memory, 0x71ff));
+    TEST_ASSERT_EQUAL_HEX8(0, memory.prg_ram_dirty);
+}
+
+void test_trainer_does_not_overwrite_save() {
+    TEST_ASSERT_EQUAL_INT(0, battery_open(&battery, &memory, filepath));
+    memory_write(&memory, 0x7000, 0x12);
+    battery_close(&battery, &memory);
+
+    memset(&memory, 0, sizeof(Memory));
+    memory_init(&memory);
+    TEST_ASSERT_EQUAL_INT(0, battery_open(&battery, &memory, filepath));
+    memory.trainer[0] = 0xab;
+    memory_map_trainer(&memory);
+    TEST_ASSERT_EQUAL_HEX8(0xab, memory_read(&memory, 0x7000));
+
+    // Saving the rest of the page leaves the trainer out
+    memory_write(&memory, 0x7300, 0x34);
+    battery_update(&battery, &memory);
+    TEST_ASSERT_EQUAL_HEX8(0x12, battery.mapping[0x1000]);
+    TEST_ASSERT_EQUAL_HEX8(0x34, battery.mapping[0x1300]);
+    battery_close(&battery, &memory);
+}
+
+int main() {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_writes_are_tracked_by_page);
+    RUN_TEST(test_saved_across_runs);
+    RUN_TEST(test_trainer_is_mapped_at_0x7000);
+    RUN_TEST(test_trainer_does_not_overwrite_save);
+
+    return UNITY_END();
+}
@@ -0,0 +1,112 @@
+#include "code_map.h"
+#include "emulator.h"
+#include "test_rom.h"
+#include "unity.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+CodeMap map;
+Emulator emulator;
+
+// At 0x8000: JSR $8010, BCS +0, JMP $8000, then two bytes of data
+static const uint8_t program[] = {0x20, 0x10, 0x80, 0xb0, 0x00,
+                                  0x4c, 0x00, 0x80, 0x12, 0x34};
+// At 0x8010: LDA $8008, RTS
+static const uint8_t subroutine[] = {0xad, 0x08, 0x80, 0x60};
+
+void setUp() {
+    load_test_program(&emulator, program, sizeof(program));
+    load_test_code(&emulator, 0x8010, subroutine, sizeof(subroutine));
+    emulator.memory.rom_hash = 0x1234;
+
+    code_map_init(&map, &emulator.memory);
+}
+
+void tearDown() {
+    code_map_free(&map);
+    free_test_program(&emulator);
+}
+
+static uint8_t flags(uint16_t address) {
+    return code_map_flags(&map, &emulator.memory, address);
+}
+
+void test_analysis_follows_calls_and_jumps(void) {
+    TEST_ASSERT_EQUAL_INT(0, code_map_analyze(&map, &emulator.memory));
+
+    TEST_ASSERT_EQUAL_HEX8(CODE_MAP_OPCODE | CODE_MAP_ENTRY, flags(0x8000));
+    TEST_ASSERT_EQUAL_HEX8(CODE_MAP_OPERAND, flags(0x8001));
+    TEST_ASSERT_EQUAL_HEX8(CODE_MAP_OPCODE, flags(0x8005));
+    TEST_ASSERT_EQUAL_HEX8(CODE_MAP_OPCODE | CODE_MAP_ENTRY, flags(0x8010));
+    TEST_ASSERT_EQUAL_HEX8(CODE_MAP_OPCODE, flags(0x8013));
+    // After the jump, and only known to be data once read
+    TEST_ASSERT_EQUAL_HEX8(0, flags(0x8008));
+    TEST_ASSERT_EQUAL_HEX8(0, flags(0x8014));
+    TEST_ASSERT(map.dirty);
+}
+
+void test_records_while_running(void) {
+    memory_set_code_map(&emulator.memory, &map);
+    for (int i = 0; i < 4; i++)
+        TEST_ASSERT_EQUAL_INT(0, emulator_step(&emulator, 0));
+
+    TEST_ASSERT_EQUAL_HEX8(CODE_MAP_OPCODE | CODE_MAP_EXECUTED, flags(0x8010));
+    TEST_ASSERT_EQUAL_HEX8(CODE_MAP_OPERAND | CODE_MAP_EXECUTED,
+                           flags(0x8011));
+    TEST_ASSERT_EQUAL_HEX8(CODE_MAP_DATA, flags(0x8008));
+    TEST_ASSERT_EQUAL_HEX8(0, flags(0x8009));
+    // Not reached yet
+    TEST_ASSERT_EQUAL_HEX8(0, flags(0x8005));
+}
+
+void test_save_and_load(void) {
+    char filepath[] = "/tmp/test_code_map_XXXXXX";
+    close(mkstemp(filepath));
+
+    code_map_analyze(&map, &emulator.memory);
+    TEST_ASSERT_EQUAL_INT(0, code_map_save(&map, filepath));
+    TEST_ASSERT_FALSE(map.dirty);
+
+    CodeMap loaded;
+    code_map_init(&loaded, &emulator.memory);
+    TEST_ASSERT_EQUAL_INT(0, code_map_load(&loaded, filepath));
+    TEST_ASSERT_EQUAL_MEMORY(map.flags, loaded.flags,
+                             TEST_ROM_PRG_ROM_SIZE);
+    code_map_free(&loaded);
+
+    // Stale for another ROM
+    emulator.memory.rom_hash = 0x5678;
+    code_map_init(&loaded, &emulator.memory);
+    TEST_ASSERT_EQUAL_INT(1, code_map_load(&loaded, filepath));
+    code_map_free(&loaded);
+
+    remove(filepath);
+    TEST_ASSERT_EQUAL_INT(1, code_map_load(&map, filepath));
+}
+
+void test_listing(void) {
+    code_map_analyze(&map, &emulator.memory);
+
+    char listing[0x20000];
+    FILE *fp = fmemopen(listing, sizeof(listing), "w");
+    code_map_write_listing(&map, &emulator.memory, fp);
+    fclose(fp);
+
+    TEST_ASSERT_NOT_NULL(
+        strstr(listing, "\nreset:\n8000  20 10 80  JSR $8010"));
+    TEST_ASSERT_NOT_NULL(strstr(listing, "\nsub_8010:\n"));
+    TEST_ASSERT_NOT_NULL(strstr(listing, "8008  .byte $12,$34,$00"));
+}
+
+int main() {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_analysis_follows_calls_and_jumps);
+    RUN_TEST(test_records_while_running);
+    RUN_TEST(test_save_and_load);
+    RUN_TEST(test_listing);
+
+    return UNITY_END();
+}
@@ -0,0 +1,84 @@
+#include "controller.h"
+#include "input_queue.h"
+#include "memory.h"
+#include "unity.h"
+#include <string.h>
+
+Memory memory;
+InputQueue queue;
+
+void setUp() {
+    memset(&memory, 0, sizeof(Memory));
+    memory_init(&memory);
+    input_queue_init(&queue);
+}
+
+void tearDown() {}
+
+static void strobe(void) {
+    memory_write(&memory, 0x4016, 1);
+    memory_write(&memory, 0x4016, 0);
+}
+
+void test_buttons_shift_out_in_order() {
+    memory.controllers[0].buttons =
+        CONTROLLER_BUTTON_A | CONTROLLER_BUTTON_START | CONTROLLER_BUTTON_RIGHT;
+    memory.controllers[1].buttons = CONTROLLER_BUTTON_B;
+    strobe();
+
+    uint8_t expected_1[] = {1, 0, 0, 1, 0, 0, 0, 1, 1, 1};
+    uint8_t expected_2[] = {0, 1, 0, 0, 0, 0, 0, 0, 1, 1};
+    for (int i = 0; i < 10; i++) {
+        TEST_ASSERT_EQUAL(expected_1[i], memory_read(&memory, 0x4016) & 1);
+        TEST_ASSERT_EQUAL(expected_2[i], memory_read(&memory, 0x4017) & 1);
+    }
+}
+
+void test_strobe_high_keeps_returning_a() {
+    memory.controllers[0].buttons = CONTROLLER_BUTTON_A;
+    memory_write(&memory, 0x4016, 1);
+
+    for (int i = 0; i < 3; i++)
+        TEST_ASSERT_EQUAL(1, memory_read(&memory, 0x4016) & 1);
+
+    // Buttons are latched when the strobe goes low
+    memory.controllers[0].buttons = CONTROLLER_BUTTON_B;
+    memory_write(&memory, 0x4016, 0);
+    TEST_ASSERT_EQUAL(0, memory_read(&memory, 0x4016) & 1);
+    TEST_ASSERT_EQUAL(1, memory_read(&memory, 0x4016) & 1);
+}
+
+void test_queue_applies_due_input() {
+    input_queue_push(&queue, 100, 0, CONTROLLER_BUTTON_A);
+    input_queue_push(&queue, 200, 1, CONTROLLER_BUTTON_UP);
+    input_queue_push(&queue, 300, 0, 0);
+
+    input_queue_latch(&queue, 50, memory.controllers);
+    TEST_ASSERT_EQUAL_HEX8(0, memory.controllers[0].buttons);
+
+    input_queue_latch(&queue, 200, memory.controllers);
+    TEST_ASSERT_EQUAL_HEX8(CONTROLLER_BUTTON_A, memory.controllers[0].buttons);
+    TEST_ASSERT_EQUAL_HEX8(CONTROLLER_BUTTON_UP,
+                           memory.controllers[1].buttons);
+
+    input_queue_latch(&queue, 1000, memory.controllers);
+    TEST_ASSERT_EQUAL_HEX8(0, memory.controllers[0].buttons);
+}
+
+void test_queue_full() {
+    for (int i = 0; i < INPUT_QUEUE_CAPACITY; i++)
+        TEST_ASSERT_EQUAL(0, input_queue_push(&queue, i, 0, i));
+    TEST_ASSERT_EQUAL(1, input_queue_push(&queue, 1000, 0, 0));
+    TEST_ASSERT_EQUAL(1, input_queue_push(&queue, 1000, 2, 0));
+}
+
+int main() {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_buttons_shift_out_in_order);
+    RUN_TEST(test_strobe_high_keeps_returning_a);
+    RUN_TEST(test_queue_applies_due_input);
+    RUN_TEST(test_queue_full);
+
+    return UNITY_END();
+}
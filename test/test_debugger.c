@@ -0,0 +1,127 @@
+#include "debugger.h"
+#include "emulator.h"
+#include "test_rom.h"
+#include "unity.h"
+#include <stdlib.h>
+#include <string.h>
+
+Debugger debugger;
+Emulator emulator;
+
+void setUp() {
+    load_test_nmi_loop(&emulator);
+    debugger_init(&debugger, &emulator.memory);
+}
+
+void tearDown() {
+    free_test_program(&emulator);
+}
+
+void test_only_hooked_in_while_armed(void) {
+    TEST_ASSERT_NULL(emulator.memory.debugger);
+
+    debugger_set_breakpoint(&debugger, 0x8005);
+    debugger_add_watchpoint(&debugger, 0x10, 0x10, DEBUGGER_WRITE);
+    TEST_ASSERT_EQUAL_PTR(&debugger, emulator.memory.debugger);
+
+    debugger_clear_breakpoint(&debugger, 0x8005);
+    TEST_ASSERT_NOT_NULL(emulator.memory.debugger);
+    debugger_remove_watchpoint(&debugger, 0x10, 0x10);
+    TEST_ASSERT_NULL(emulator.memory.debugger);
+
+    TEST_ASSERT_EQUAL_INT(0, emulator_run_frame(&emulator, 0));
+}
+
+void test_breakpoint_stops_before_instruction(void) {
+    debugger_set_breakpoint(&debugger, 0x8007);
+
+    TEST_ASSERT_EQUAL_INT(EMULATOR_STOPPED, emulator_run_frame(&emulator, 0));
+    TEST_ASSERT_EQUAL_HEX16(0x8007, emulator.cpu_ctx.program_counter);
+    TEST_ASSERT_EQUAL_INT(DEBUGGER_STOP_BREAKPOINT, debugger.stop.reason);
+    TEST_ASSERT_EQUAL_HEX8(1, emulator.memory.ram[0x10]);
+
+    // Continues past it and stops there the next time around
+    debugger_resume(&debugger, emulator.cpu_ctx.program_counter);
+    TEST_ASSERT_EQUAL_INT(EMULATOR_STOPPED, emulator_run_frame(&emulator, 0));
+    TEST_ASSERT_EQUAL_HEX16(0x8007, emulator.cpu_ctx.program_counter);
+    TEST_ASSERT_EQUAL_HEX8(2, emulator.memory.ram[0x10]);
+}
+
+void test_breakpoint_on_nmi_handler(void) {
+    debugger_set_breakpoint(&debugger, 0x8020);
+
+    TEST_ASSERT_EQUAL_INT(EMULATOR_STOPPED, emulator_run_frame(&emulator, 0));
+    TEST_ASSERT_EQUAL_HEX16(0x8020, emulator.cpu_ctx.program_counter);
+}
+
+void test_watchpoint_stops_after_instruction(void) {
+    debugger_add_watchpoint(&debugger, 0x0010, 0x001f, DEBUGGER_WRITE);
+
+    TEST_ASSERT_EQUAL_INT(EMULATOR_STOPPED, emulator_run_frame(&emulator, 0));
+    TEST_ASSERT_EQUAL_HEX16(0x8007, emulator.cpu_ctx.program_counter);
+
+    char description[64];
+    debugger_describe_stop(&debugger, description, sizeof(description));
+    TEST_ASSERT_EQUAL_STRING("Watchpoint: wrote $01 to $0010", description);
+
+    // Stepping stops at watchpoints too
+    debugger_resume(&debugger, emulator.cpu_ctx.program_counter);
+    TEST_ASSERT_EQUAL_INT(0, emulator_step(&emulator, 0));
+    TEST_ASSERT_EQUAL_INT(EMULATOR_STOPPED, emulator_step(&emulator, 0));
+    TEST_ASSERT_EQUAL_HEX8(0x02, debugger.stop.value);
+}
+
+void test_parse_watchpoint(void) {
+    DebuggerWatchpoint watchpoint;
+
+    TEST_ASSERT_EQUAL_INT(0,
+                          debugger_parse_watchpoint("200-2ff:w", &watchpoint));
+    TEST_ASSERT_EQUAL_HEX16(0x0200, watchpoint.start);
+    TEST_ASSERT_EQUAL_HEX16(0x02ff, watchpoint.end);
+    TEST_ASSERT_EQUAL_INT(DEBUGGER_WRITE, watchpoint.access);
+
+    TEST_ASSERT_EQUAL_INT(0, debugger_parse_watchpoint("4016", &watchpoint));
+    TEST_ASSERT_EQUAL_HEX16(0x4016, watchpoint.end);
+    TEST_ASSERT_EQUAL_INT(DEBUGGER_READ | DEBUGGER_WRITE, watchpoint.access);
+
+    TEST_ASSERT_EQUAL_INT(1, debugger_parse_watchpoint("2ff-200", &watchpoint));
+    TEST_ASSERT_EQUAL_INT(1, debugger_parse_watchpoint("200:x", &watchpoint));
+    TEST_ASSERT_EQUAL_INT(1, debugger_parse_watchpoint("10000", &watchpoint));
+}
+
+void test_commands(void) {
+    DebuggerCommand command;
+
+    TEST_ASSERT_EQUAL_INT(0, debugger_parse_command("b 8005", &command));
+    TEST_ASSERT_EQUAL_INT(0, debugger_apply_command(&debugger, &command));
+    TEST_ASSERT(debugger_has_breakpoint(&debugger, 0x8005));
+    TEST_ASSERT_NOT_NULL(emulator.memory.debugger);
+
+    TEST_ASSERT_EQUAL_INT(0, debugger_parse_command("w 10:w", &command));
+    TEST_ASSERT_EQUAL_INT(0, debugger_apply_command(&debugger, &command));
+    TEST_ASSERT_EQUAL_INT(1, debugger.watchpoint_count);
+
+    TEST_ASSERT_EQUAL_INT(0, debugger_parse_command("db 8005", &command));
+    TEST_ASSERT_EQUAL_INT(0, debugger_apply_command(&debugger, &command));
+    TEST_ASSERT_FALSE(debugger_has_breakpoint(&debugger, 0x8005));
+    TEST_ASSERT_EQUAL_INT(0, debugger_parse_command("dw 10:w", &command));
+    TEST_ASSERT_EQUAL_INT(0, debugger_apply_command(&debugger, &command));
+    TEST_ASSERT_NULL(emulator.memory.debugger);
+
+    TEST_ASSERT_EQUAL_INT(1, debugger_parse_command("b", &command));
+    TEST_ASSERT_EQUAL_INT(1, debugger_parse_command("b 10000", &command));
+    TEST_ASSERT_EQUAL_INT(1, debugger_parse_command("x 8005", &command));
+}
+
+int main() {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_only_hooked_in_while_armed);
+    RUN_TEST(test_breakpoint_stops_before_instruction);
+    RUN_TEST(test_breakpoint_on_nmi_handler);
+    RUN_TEST(test_watchpoint_stops_after_instruction);
+    RUN_TEST(test_parse_watchpoint);
+    RUN_TEST(test_commands);
+
+    return UNITY_END();
+}
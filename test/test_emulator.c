@@ -0,0 +1,130 @@
+#include "emulator.h"
+#include "hash.h"
+#include "test_rom.h"
+#include "unity.h"
+#include <stdlib.h>
+#include <string.h>
+
+Emulator emulator;
+EmulatorState state;
+uint32_t framebuffer[PPU_FRAMEBUFFER_LENGTH];
+
+// Counts in a loop and changes the rendering settings on every NMI
+static const uint8_t program[] = {
+    0xa9, 0x80,       // LDA #$80
+    0x8d, 0x00, 0x20, // STA $2000, enable NMI
+    0xe6, 0x00,       // INC $00
+    0x4c, 0x05, 0x80, // JMP $8005
+};
+static const uint8_t nmi_handler[] = {
+    0xe6, 0x01,       // INC $01
+    0xa5, 0x01,       // LDA $01
+    0x8d, 0x01, 0x20, // STA $2001
+    0x40,             // RTI
+};
+
+void setUp() {
+    load_test_program(&emulator, program, sizeof(program));
+    load_test_code(&emulator, 0x9000, nmi_handler, sizeof(nmi_handler));
+    set_test_vector(&emulator, 0xfffa, 0x9000);
+    for (int i = 0; i < 16; i++)
+        emulator.memory.ppu_ctx.memory.palette[i] = i * 4;
+}
+
+void tearDown() {
+    free_test_program(&emulator);
+}
+
+static uint64_t run_frames(int count) {
+    uint64_t hash = HASH_FNV1A_INITIAL;
+    for (int i = 0; i < count; i++) {
+        TEST_ASSERT_EQUAL(0, emulator_run_frame(&emulator, framebuffer));
+        hash = hash_fnv1a(hash, framebuffer, sizeof(framebuffer));
+    }
+    return hash_fnv1a(hash, emulator.memory.ram, MEMORY_RAM_SIZE);
+}
+
+void test_load_state_replays_identically() {
+    run_frames(2);
+    emulator_save_state(&emulator, &state);
+    uint8_t nmi_count = emulator.memory.ram[1];
+
+    uint64_t first = run_frames(3);
+    uint64_t first_cycle = emulator.memory.cpu_cycle;
+    TEST_ASSERT_EQUAL(nmi_count + 3, emulator.memory.ram[1]);
+
+    emulator_load_state(&emulator, &state);
+    TEST_ASSERT_EQUAL(nmi_count, emulator.memory.ram[1]);
+
+    uint64_t second = run_frames(3);
+    TEST_ASSERT_EQUAL_HEX64(first, second);
+    TEST_ASSERT_EQUAL(first_cycle, emulator.memory.cpu_cycle);
+}
+
+void test_load_state_keeps_rom() {
+    emulator_save_state(&emulator, &state);
+    state.memory.prg_rom = 0;
+    state.memory.rom_hash = 1234;
+
+    emulator_load_state(&emulator, &state);
+    TEST_ASSERT_NOT_NULL(emulator.memory.prg_rom);
+    TEST_ASSERT_EQUAL_HEX8(0xa9, emulator.memory.prg_rom[0]);
+    TEST_ASSERT(emulator.memory.rom_hash != 1234);
+}
+
+void test_power_on_and_reset() {
+    emulator.cpu_ctx.program_counter = 0x1234;
+    emulator_power_on(&emulator);
+    TEST_ASSERT_EQUAL_HEX16(0x8000, emulator.cpu_ctx.program_counter);
+    TEST_ASSERT_EQUAL_HEX8(0xfd, emulator.cpu_ctx.stack_pointer);
+    TEST_ASSERT(emulator.cpu_ctx.status_register.irq_disable);
+    TEST_ASSERT_EQUAL(CPU_INTERRUPT_CYCLES, emulator.memory.cpu_cycle);
+
+    run_frames(2);
+    uint8_t stack_pointer = emulator.cpu_ctx.stack_pointer;
+    emulator_reset(&emulator);
+    TEST_ASSERT_EQUAL_HEX16(0x8000, emulator.cpu_ctx.program_counter);
+    TEST_ASSERT_EQUAL_HEX8((uint8_t)(stack_pointer - 3),
+                           emulator.cpu_ctx.stack_pointer);
+    TEST_ASSERT_EQUAL_HEX8(0, emulator.memory.ppu_ctx.ppuctrl.value);
+}
+
+void test_frame_and_cycle_limits() {
+    emulator.limits.max_frames = 2;
+    TEST_ASSERT_EQUAL(0, emulator_run_frame(&emulator, 0));
+    TEST_ASSERT_EQUAL(EMULATOR_EXITED, emulator_run_frame(&emulator, 0));
+    TEST_ASSERT_EQUAL(EMULATOR_EXIT_FRAMES, emulator.exit_reason);
+
+    emulator.limits = (EmulatorLimits){.max_cycles =
+                                           emulator.memory.cpu_cycle + 1000};
+    TEST_ASSERT_EQUAL(EMULATOR_EXITED, emulator_run_frame(&emulator, 0));
+    TEST_ASSERT_EQUAL(EMULATOR_EXIT_CYCLES, emulator.exit_reason);
+    TEST_ASSERT(emulator.memory.cpu_cycle >= emulator.limits.max_cycles);
+}
+
+void test_idle_loop_exits_only_without_interrupts() {
+    // JMP $8005, looping on itself after enabling NMI
+    load_test_code(&emulator, 0x8005, (uint8_t[]){0x4c, 0x05, 0x80}, 3);
+    emulator.limits.exit_on_idle_loop = 1;
+    emulator.cpu_ctx.status_register.irq_disable = 1;
+    run_frames(2);
+
+    // NMI off
+    emulator.memory.prg_rom[1] = 0x00;
+    emulator.cpu_ctx.program_counter = 0x8000;
+    TEST_ASSERT_EQUAL(EMULATOR_EXITED, emulator_run_frame(&emulator, 0));
+    TEST_ASSERT_EQUAL(EMULATOR_EXIT_IDLE_LOOP, emulator.exit_reason);
+    TEST_ASSERT_EQUAL_HEX16(0x8005, emulator.cpu_ctx.program_counter);
+}
+
+int main() {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_load_state_replays_identically);
+    RUN_TEST(test_load_state_keeps_rom);
+    RUN_TEST(test_power_on_and_reset);
+    RUN_TEST(test_frame_and_cycle_limits);
+    RUN_TEST(test_idle_loop_exits_only_without_interrupts);
+
+    return UNITY_END();
+}
@@ -0,0 +1,171 @@
+#include "controller.h"
+#include "environment.h"
+#include "unity.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define PRG_ROM_SIZE 0x4000
+#define CHR_ROM_SIZE 0x2000
+#define FRAME_COUNTER 0x10
+#define BUTTON_A 0x11
+#define BUS_FAULT_CODE 0x8040
+#define UNSUPPORTED_CODE 0x8050
+
+// Turns NMIs on and idles. Every NMI reads whether A is held into 0x11 and
+// counts the frame in 0x10.
+static const uint8_t reset_code[] = {
+    0xa9, 0x80, 0x8d, 0x00, 0x20, // LDA #$80, STA $2000
+    0x4c, 0x05, 0x80,             // JMP $8005
+};
+static const uint8_t nmi_code[] = {
+    0xa9, 0x01, 0x8d, 0x16, 0x40, // LDA #1, STA $4016
+    0xa9, 0x00, 0x8d, 0x16, 0x40, // LDA #0, STA $4016
+    0xad, 0x16, 0x40,             // LDA $4016
+    0x29, 0x01,                   // AND #1
+    0x85, BUTTON_A,               // STA $11
+    0xe6, FRAME_COUNTER,          // INC $10
+    0x40,                         // RTI
+};
+static const uint8_t bus_fault_code[] = {
+    0x8d, 0x00, 0x50, // STA $5000, nothing is mapped there
+};
+static const uint8_t unsupported_code[] = {
+    0x02, // An opcode that locks up the CPU
+};
+
+char filepath[] = "/tmp/test_environment_XXXXXX";
+EnvironmentBatch batch;
+EnvironmentConfig config;
+
+void setUp() {
+    uint8_t rom[16 + PRG_ROM_SIZE + CHR_ROM_SIZE] = {'N', 'E', 'S', 0x1a, 1, 1};
+    uint8_t *prg_rom = rom + 16;
+    memcpy(prg_rom, reset_code, sizeof(reset_code));
+    memcpy(prg_rom + 0x10, nmi_code, sizeof(nmi_code));
+    memcpy(prg_rom + BUS_FAULT_CODE - 0x8000, bus_fault_code,
+           sizeof(bus_fault_code));
+    memcpy(prg_rom + UNSUPPORTED_CODE - 0x8000, unsupported_code,
+           sizeof(unsupported_code));
+    // NMI at 0x8010, reset and IRQ at 0x8000
+    const uint8_t vectors[] = {0x10, 0x80, 0x00, 0x80, 0x00, 0x80};
+    memcpy(prg_rom + PRG_ROM_SIZE - 6, vectors, sizeof(vectors));
+
+    int fd = mkstemp(filepath);
+    TEST_ASSERT_EQUAL_INT(sizeof(rom), write(fd, rom, sizeof(rom)));
+    close(fd);
+
+    config = (EnvironmentConfig){.observation_type =
+                                     ENVIRONMENT_OBSERVATION_GRAY,
+                                 .downsample = 2};
+}
+
+void tearDown() {
+    environment_batch_free(&batch);
+    remove(filepath);
+    strcpy(filepath, "/tmp/test_environment_XXXXXX");
+}
+
+void test_step_runs_frameskip_frames_with_action_held() {
+    TEST_ASSERT_EQUAL_INT(
+        0, environment_batch_init(&batch, filepath, 1, 0, &config));
+    Environment *environment = &batch.environments[0];
+
+    uint8_t action = CONTROLLER_BUTTON_A;
+    environment_batch_step(&batch, &action, 4);
+    uint8_t frames = environment_ram(environment)[FRAME_COUNTER];
+    TEST_ASSERT_EQUAL_HEX8(1, environment_ram(environment)[BUTTON_A]);
+
+    action = CONTROLLER_BUTTON_B;
+    environment_batch_step(&batch, &action, 3);
+    TEST_ASSERT_EQUAL_HEX8(frames + 3,
+                           environment_peek(environment, FRAME_COUNTER));
+    TEST_ASSERT_EQUAL_HEX8(0, environment_peek(environment, BUTTON_A));
+    TEST_ASSERT_EQUAL_INT(0, batch.dones[0]);
+}
+
+void test_done_after_max_frames_then_reset() {
+    config.max_episode_frames = 5;
+    TEST_ASSERT_EQUAL_INT(
+        0, environment_batch_init(&batch, filepath, 1, 0, &config));
+    Environment *environment = &batch.environments[0];
+
+    uint8_t action = 0;
+    environment_batch_step(&batch, &action, 3);
+    TEST_ASSERT_EQUAL_INT(0, batch.dones[0]);
+    environment_batch_step(&batch, &action, 3);
+    TEST_ASSERT_EQUAL_INT(1, batch.dones[0]);
+    TEST_ASSERT_EQUAL_UINT64(5, environment->episode_frames);
+
+    // Starts over from power on
+    uint8_t frames = environment_peek(environment, FRAME_COUNTER);
+    environment_batch_step(&batch, &action, 1);
+    TEST_ASSERT_EQUAL_INT(0, batch.dones[0]);
+    TEST_ASSERT_EQUAL_UINT64(1, environment->episode_frames);
+    TEST_ASSERT_LESS_THAN_UINT8(frames,
+                                environment_peek(environment, FRAME_COUNTER));
+}
+
+void test_batch_observations_are_contiguous_and_independent() {
+    TEST_ASSERT_EQUAL_INT(
+        0, environment_batch_init(&batch, filepath, 3, 1, &config));
+    TEST_ASSERT_EQUAL_INT(128 * 120, batch.observation_size);
+
+    const uint8_t actions[] = {CONTROLLER_BUTTON_A, 0, CONTROLLER_BUTTON_A};
+    for (int i = 0; i < 5; i++)
+        environment_batch_step(&batch, actions, 2);
+
+    for (int i = 0; i < 3; i++)
+        TEST_ASSERT_EQUAL_HEX8(
+            actions[i], environment_ram(&batch.environments[i])[BUTTON_A]);
+    TEST_ASSERT_EQUAL_MEMORY(environment_ram(&batch.environments[0]),
+                             environment_ram(&batch.environments[2]),
+                             MEMORY_RAM_SIZE);
+    TEST_ASSERT_EQUAL_MEMORY(batch.observations,
+                             batch.observations + 2 * batch.observation_size,
+                             batch.observation_size);
+}
+
+void test_emulator_stopping_is_done_for_that_environment_only() {
+    TEST_ASSERT_EQUAL_INT(
+        0, environment_batch_init(&batch, filepath, 3, 1, &config));
+    batch.environments[1].emulator.cpu_ctx.program_counter = BUS_FAULT_CODE;
+    batch.environments[2].emulator.cpu_ctx.program_counter = UNSUPPORTED_CODE;
+
+    const uint8_t actions[3] = {0};
+    environment_batch_step(&batch, actions, 2);
+    TEST_ASSERT_EQUAL_INT(0, batch.dones[0]);
+    TEST_ASSERT_EQUAL_INT(1, batch.dones[1]);
+    TEST_ASSERT_EQUAL_INT(1, batch.dones[2]);
+    TEST_ASSERT_EQUAL(EMULATOR_EXIT_BUS_FAULT,
+                      batch.environments[1].emulator.exit_reason);
+    TEST_ASSERT_EQUAL_HEX16(
+        0x5000, batch.environments[1].emulator.memory.bus_fault_address);
+    TEST_ASSERT_EQUAL(EMULATOR_EXIT_UNSUPPORTED_INSTRUCTION,
+                      batch.environments[2].emulator.exit_reason);
+
+    // Both start over, and the first one never stopped
+    environment_batch_step(&batch, actions, 2);
+    TEST_ASSERT_EQUAL_MEMORY(batch.dones, (uint8_t[3]){0}, 3);
+    TEST_ASSERT_EQUAL(EMULATOR_EXIT_NONE,
+                      batch.environments[1].emulator.exit_reason);
+    TEST_ASSERT_EQUAL_UINT64(4, batch.environments[0].episode_frames);
+}
+
+void test_rejects_unsupported_downsampling() {
+    config.downsample = 3;
+    TEST_ASSERT_EQUAL_INT(
+        1, environment_batch_init(&batch, filepath, 2, 0, &config));
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_step_runs_frameskip_frames_with_action_held);
+    RUN_TEST(test_done_after_max_frames_then_reset);
+    RUN_TEST(test_batch_observations_are_contiguous_and_independent);
+    RUN_TEST(test_emulator_stopping_is_done_for_that_environment_only);
+    RUN_TEST(test_rejects_unsupported_downsampling);
+    return UNITY_END();
+}
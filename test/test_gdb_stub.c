@@ -0,0 +1,220 @@
+#include "debugger.h"
+#include "emulator.h"
+#include "gdb_stub.h"
+#include "test_rom.h"
+#include "unity.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define TEST_PORT 23456
+
+Debugger debugger;
+Emulator emulator;
+char reply[GDB_STUB_PACKET_SIZE];
+
+// JMP $8000
+static const uint8_t program[] = {0x4c, 0x00, 0x80};
+
+void setUp() {
+    load_test_program(&emulator, program, sizeof(program));
+    debugger_init(&debugger, &emulator.memory);
+}
+
+void tearDown() {
+    free_test_program(&emulator);
+}
+
+static GdbStubAction handle(const char *packet) {
+    return gdb_stub_handle_packet(&emulator, &debugger, packet, reply);
+}
+
+void test_registers(void) {
+    emulator.cpu_ctx.a = 0x12;
+    emulator.cpu_ctx.status_register.value = 0x24;
+
+    TEST_ASSERT_EQUAL_INT(GDB_STUB_STAY, handle("g"));
+    TEST_ASSERT_EQUAL_STRING("12000024fd0080", reply);
+
+    handle("G010203a5ff34c1");
+    TEST_ASSERT_EQUAL_STRING("OK", reply);
+    TEST_ASSERT_EQUAL_HEX8(0x03, emulator.cpu_ctx.y);
+    TEST_ASSERT_EQUAL_HEX8(0xff, emulator.cpu_ctx.stack_pointer);
+    TEST_ASSERT_EQUAL_HEX16(0xc134, emulator.cpu_ctx.program_counter);
+
+    handle("G0102");
+    TEST_ASSERT_EQUAL_STRING("E01", reply);
+}
+
+void test_memory(void) {
+    handle("M10,3:a1b2c3");
+    TEST_ASSERT_EQUAL_STRING("OK", reply);
+    TEST_ASSERT_EQUAL_HEX8(0xb2, emulator.memory.ram[0x11]);
+
+    handle("mf,5");
+    TEST_ASSERT_EQUAL_STRING("00a1b2c300", reply);
+    handle("m8000,3");
+    TEST_ASSERT_EQUAL_STRING("4c0080", reply);
+
+    handle("m10");
+    TEST_ASSERT_EQUAL_STRING("E01", reply);
+}
+
+void test_memory_writes_are_all_or_nothing(void) {
+    // PRG ROM is patched
+    handle("M8001,2:3412");
+    TEST_ASSERT_EQUAL_STRING("OK", reply);
+    TEST_ASSERT_EQUAL_HEX8(0x12, emulator.memory.prg_rom[2]);
+
+    // Runs into the PPU registers
+    handle("M1ffe,3:010203");
+    TEST_ASSERT_EQUAL_STRING("E01", reply);
+    TEST_ASSERT_EQUAL_HEX8(0, emulator.memory.ram[0x7fe]);
+    // Nothing is mapped to 0x5000
+    handle("M5000,1:01");
+    TEST_ASSERT_EQUAL_STRING("E01", reply);
+    TEST_ASSERT_EQUAL_INT(0, emulator.memory.bus_fault);
+
+    // Malformed in the middle, or shorter than the length
+    handle("M10,3:a1zzc3");
+    TEST_ASSERT_EQUAL_STRING("E01", reply);
+    TEST_ASSERT_EQUAL_HEX8(0, emulator.memory.ram[0x10]);
+    handle("M10,3:a1b2");
+    TEST_ASSERT_EQUAL_STRING("E01", reply);
+    TEST_ASSERT_EQUAL_HEX8(0, emulator.memory.ram[0x10]);
+}
+
+void test_breakpoints_and_watchpoints(void) {
+    handle("Z0,8000,1");
+    TEST_ASSERT_EQUAL_STRING("OK", reply);
+    TEST_ASSERT(debugger_has_breakpoint(&debugger, 0x8000));
+
+    handle("Z2,200,100");
+    TEST_ASSERT_EQUAL_STRING("OK", reply);
+    TEST_ASSERT_EQUAL_HEX16(0x02ff, debugger.watchpoints[0].end);
+    TEST_ASSERT_EQUAL_INT(DEBUGGER_WRITE, debugger.watchpoints[0].access);
+
+    handle("z0,8000,1");
+    handle("z2,200,100");
+    TEST_ASSERT_FALSE(debugger_has_breakpoint(&debugger, 0x8000));
+    TEST_ASSERT_NULL(emulator.memory.debugger);
+
+    // Past the end of the address space, however large the kind
+    handle("Z2,ffff,1");
+    TEST_ASSERT_EQUAL_STRING("OK", reply);
+    handle("Z2,ffff,2");
+    TEST_ASSERT_EQUAL_STRING("E01", reply);
+    handle("Z2,ffff,ffffffff");
+    TEST_ASSERT_EQUAL_STRING("E01", reply);
+    handle("Z2,200,100000000");
+    TEST_ASSERT_EQUAL_STRING("E01", reply);
+    TEST_ASSERT_EQUAL_INT(1, debugger.watchpoint_count);
+}
+
+void test_resuming(void) {
+    TEST_ASSERT_EQUAL_INT(GDB_STUB_CONTINUE, handle("c"));
+    TEST_ASSERT_EQUAL_INT(GDB_STUB_STEP, handle("s8010"));
+    TEST_ASSERT_EQUAL_HEX16(0x8010, emulator.cpu_ctx.program_counter);
+    TEST_ASSERT_EQUAL_INT(GDB_STUB_DETACH, handle("D"));
+
+    debugger.stop = (DebuggerStop){.reason = DEBUGGER_STOP_WATCHPOINT,
+                                   .address = 0x2002,
+                                   .access = DEBUGGER_READ};
+    handle("?");
+    TEST_ASSERT_EQUAL_STRING("T05rwatch:2002;", reply);
+}
+
+// ----- Over a socket -----
+
+static void send_packet(int fd, const char *data) {
+    uint8_t sum = 0;
+    for (const char *character = data; *character; character++)
+        sum += *character;
+
+    char frame[GDB_STUB_PACKET_SIZE * 2];
+    int length = snprintf(frame, sizeof(frame), "$%s#%02x", data, sum);
+    send(fd, frame, length, 0);
+}
+
+// Reads the data of the next packet, skipping acknowledgements
+static void receive_packet(int fd, char *data) {
+    char character = 0;
+    while (character != '$')
+        if (recv(fd, &character, 1, 0) != 1)
+            return;
+
+    int length = 0;
+    while (recv(fd, &character, 1, 0) == 1 && character != '#')
+        data[length++] = character;
+    data[length] = 0;
+
+    char checksum[2];
+    recv(fd, checksum, 2, MSG_WAITALL);
+}
+
+static char client_replies[4][GDB_STUB_PACKET_SIZE];
+
+static void *run_client(void *data) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in address = {.sin_family = AF_INET,
+                                  .sin_port = htons(TEST_PORT),
+                                  .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    connect(fd, (struct sockaddr *)&address, sizeof(address));
+
+    // Registers followed by more than fits in a packet
+    static char too_long[GDB_STUB_PACKET_SIZE + 16] = "G010203a5ff34c1";
+    memset(too_long + 15, '0', sizeof(too_long) - 16);
+
+    const char *packets[] = {"?", too_long, "g", "D"};
+    for (int i = 0; i < 4; i++) {
+        send_packet(fd, packets[i]);
+        receive_packet(fd, client_replies[i]);
+    }
+    close(fd);
+    return 0;
+}
+
+void test_client_attaches_and_detaches(void) {
+    GdbStub stub;
+    TEST_ASSERT_EQUAL_INT(0, gdb_stub_start(&stub, &debugger, TEST_PORT));
+
+    pthread_t client;
+    pthread_create(&client, 0, run_client, 0);
+
+    for (int i = 0; i < 1000 && !gdb_stub_attached(&stub); i++) {
+        usleep(1000);
+        gdb_stub_poll(&stub);
+    }
+    TEST_ASSERT(gdb_stub_attached(&stub));
+
+    // Attaching stops before the next instruction
+    TEST_ASSERT_EQUAL_INT(EMULATOR_STOPPED, emulator_run_frame(&emulator, 0));
+    TEST_ASSERT_EQUAL_INT(GDB_STUB_DETACH, gdb_stub_serve(&stub, &emulator));
+
+    pthread_join(client, 0);
+    gdb_stub_stop(&stub);
+
+    TEST_ASSERT_EQUAL_STRING("S02", client_replies[0]);
+    // Dropped rather than handled cut short
+    TEST_ASSERT_EQUAL_STRING("E01", client_replies[1]);
+    TEST_ASSERT_EQUAL_STRING("00000000fd0080", client_replies[2]);
+    TEST_ASSERT_EQUAL_STRING("OK", client_replies[3]);
+}
+
+int main() {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_registers);
+    RUN_TEST(test_memory);
+    RUN_TEST(test_memory_writes_are_all_or_nothing);
+    RUN_TEST(test_breakpoints_and_watchpoints);
+    RUN_TEST(test_resuming);
+    RUN_TEST(test_client_attaches_and_detaches);
+
+    return UNITY_END();
+}
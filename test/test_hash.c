@@ -0,0 +1,50 @@
+#include "hash.h"
+#include "unity.h"
+#include <string.h>
+
+static const char *fox = "The quick brown fox jumps over the lazy dog";
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_crc32(void) {
+    TEST_ASSERT_EQUAL_HEX32(0, hash_crc32(0, "", 0));
+    TEST_ASSERT_EQUAL_HEX32(0xcbf43926, hash_crc32(0, "123456789", 9));
+    TEST_ASSERT_EQUAL_HEX32(0x414fa339, hash_crc32(0, fox, strlen(fox)));
+
+    // In pieces not a multiple of the 8 bytes done at a time
+    uint32_t crc = hash_crc32(0, fox, 5);
+    crc = hash_crc32(crc, fox + 5, 13);
+    crc = hash_crc32(crc, fox + 18, strlen(fox) - 18);
+    TEST_ASSERT_EQUAL_HEX32(0x414fa339, crc);
+}
+
+void test_sha1(void) {
+    static const uint8_t expected[HASH_SHA1_SIZE] = {
+        0x2f, 0xd4, 0xe1, 0xc6, 0x7a, 0x2d, 0x28, 0xfc, 0xed, 0x84,
+        0x9e, 0xe1, 0xbb, 0x76, 0xe7, 0x39, 0x1b, 0x93, 0xeb, 0x12};
+    uint8_t digest[HASH_SHA1_SIZE];
+
+    HashSHA1 sha1;
+    hash_sha1_init(&sha1);
+    hash_sha1_update(&sha1, fox, strlen(fox));
+    hash_sha1_final(&sha1, digest);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, digest, HASH_SHA1_SIZE);
+
+    // A byte at a time
+    hash_sha1_init(&sha1);
+    for (const char *piece = fox; *piece; piece++)
+        hash_sha1_update(&sha1, piece, 1);
+    hash_sha1_final(&sha1, digest);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, digest, HASH_SHA1_SIZE);
+}
+
+int main() {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_crc32);
+    RUN_TEST(test_sha1);
+
+    return UNITY_END();
+}
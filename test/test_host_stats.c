@@ -0,0 +1,130 @@
+#include "host_stats.h"
+#include "unity.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+HostStats stats;
+
+// Clock advanced by hand, running at two nanoseconds per tick
+static uint64_t fake_tick = 0;
+
+static uint64_t fake_ticks(void) {
+    return fake_tick;
+}
+
+static uint64_t fake_ns(void) {
+    return fake_tick * 2;
+}
+
+void setUp() {
+    fake_tick = 1000;
+    host_stats_init(&stats, fake_ticks, fake_ns);
+}
+
+void tearDown() {}
+
+void test_nested_time_is_charged_to_innermost(void) {
+    host_stats_enter(&stats, HOST_STATS_CPU);
+    fake_tick += 10;
+    host_stats_enter(&stats, HOST_STATS_IO);
+    fake_tick += 5;
+    host_stats_enter(&stats, HOST_STATS_PPU);
+    fake_tick += 100;
+    host_stats_leave(&stats);
+    fake_tick += 3;
+    host_stats_leave(&stats);
+    fake_tick += 20;
+    host_stats_end_frame(&stats);
+    host_stats_leave(&stats);
+
+    HostStatsSnapshot snapshot;
+    host_stats_get(&stats, &snapshot);
+    TEST_ASSERT_EQUAL_UINT64(1, snapshot.frames);
+    TEST_ASSERT_EQUAL_UINT64(60,
+                             (uint64_t)snapshot.last_frame_ns[HOST_STATS_CPU]);
+    TEST_ASSERT_EQUAL_UINT64(16,
+                             (uint64_t)snapshot.last_frame_ns[HOST_STATS_IO]);
+    TEST_ASSERT_EQUAL_UINT64(200,
+                             (uint64_t)snapshot.last_frame_ns[HOST_STATS_PPU]);
+}
+
+void test_time_outside_subsystems_is_not_counted(void) {
+    fake_tick += 500;
+    host_stats_enter(&stats, HOST_STATS_CPU);
+    fake_tick += 10;
+    host_stats_leave(&stats);
+    fake_tick += 500;
+    host_stats_end_frame(&stats);
+
+    HostStatsSnapshot snapshot;
+    host_stats_get(&stats, &snapshot);
+    TEST_ASSERT_EQUAL_UINT64(20,
+                             (uint64_t)snapshot.last_frame_ns[HOST_STATS_CPU]);
+}
+
+void test_added_time_goes_to_current_frame(void) {
+    host_stats_add(&stats, HOST_STATS_PRESENT, 7);
+    fake_tick += 10;
+    host_stats_end_frame(&stats);
+    fake_tick += 10;
+    host_stats_end_frame(&stats);
+
+    HostStatsSnapshot snapshot;
+    host_stats_get(&stats, &snapshot);
+    HostStatsSubsystem present = HOST_STATS_PRESENT;
+    TEST_ASSERT_EQUAL_UINT64(0, (uint64_t)snapshot.last_frame_ns[present]);
+    TEST_ASSERT_EQUAL_UINT64(14, (uint64_t)snapshot.max_ns[present]);
+    TEST_ASSERT_EQUAL_UINT64(7, (uint64_t)snapshot.average_ns[present]);
+}
+
+void test_average_and_max(void) {
+    uint64_t frame_ticks[] = {10, 40, 25};
+    for (int i = 0; i < 3; i++) {
+        host_stats_enter(&stats, HOST_STATS_APU);
+        fake_tick += frame_ticks[i];
+        host_stats_leave(&stats);
+        host_stats_end_frame(&stats);
+    }
+
+    HostStatsSnapshot snapshot;
+    host_stats_get(&stats, &snapshot);
+    TEST_ASSERT_EQUAL_UINT64(3, snapshot.frames);
+    TEST_ASSERT_EQUAL_UINT64(50,
+                             (uint64_t)snapshot.last_frame_ns[HOST_STATS_APU]);
+    TEST_ASSERT_EQUAL_UINT64(80, (uint64_t)snapshot.max_ns[HOST_STATS_APU]);
+    TEST_ASSERT_EQUAL_UINT64(50, (uint64_t)snapshot.average_ns[HOST_STATS_APU]);
+}
+
+void test_write_json(void) {
+    host_stats_enter(&stats, HOST_STATS_DMA);
+    fake_tick += 256;
+    host_stats_leave(&stats);
+    host_stats_end_frame(&stats);
+
+    char *json;
+    size_t size;
+    FILE *fp = open_memstream(&json, &size);
+    host_stats_write_json(&stats, fp);
+    fclose(fp);
+
+    TEST_ASSERT_NOT_NULL(strstr(json, "\"frames\": 1,"));
+    TEST_ASSERT_NOT_NULL(strstr(json, "\"dma\": {\"average_ns\": 512, "
+                                      "\"max_ns\": 512, "
+                                      "\"last_frame_ns\": 512},"));
+    TEST_ASSERT_NOT_NULL(strstr(json, "\"present\": {"));
+    free(json);
+}
+
+int main() {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_nested_time_is_charged_to_innermost);
+    RUN_TEST(test_time_outside_subsystems_is_not_counted);
+    RUN_TEST(test_added_time_goes_to_current_frame);
+    RUN_TEST(test_average_and_max);
+    RUN_TEST(test_write_json);
+
+    return UNITY_END();
+}
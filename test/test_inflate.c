@@ -0,0 +1,125 @@
+#include "inflate.h"
+#include "unity.h"
+#include <string.h>
+
+#define DYNAMIC_SIZE 70000
+
+// Compressed data is fed in pieces of this many bytes
+int piece_size;
+uint8_t output[DYNAMIC_SIZE + 1];
+size_t output_size;
+// Largest piece of output handed over at once
+size_t largest_write;
+
+typedef struct {
+    const uint8_t *data;
+    int size;
+    int position;
+} Input;
+
+static int read_input(void *context, uint8_t *buffer, int size) {
+    Input *input = context;
+    if (size > piece_size)
+        size = piece_size;
+    if (size > input->size - input->position)
+        size = input->size - input->position;
+    memcpy(buffer, input->data + input->position, size);
+    input->position += size;
+    return size;
+}
+
+static int write_output(void *context, const uint8_t *data, size_t size) {
+    if (output_size + size > sizeof(output))
+        return 1;
+    memcpy(output + output_size, data, size);
+    output_size += size;
+    if (size > largest_write)
+        largest_write = size;
+    return 0;
+}
+
+static int inflate_data(const uint8_t *data, int size) {
+    Input input = {.data = data, .size = size};
+    return inflate_stream(read_input, &input, write_output, 0);
+}
+
+void setUp() {
+    piece_size = 0x1000;
+    output_size = 0;
+    largest_write = 0;
+}
+
+void tearDown() {}
+
+void test_stored_block(void) {
+    static const uint8_t data[] = {0x01, 0x05, 0x00, 0xfa, 0xff,
+                                   'h',  'e',  'l',  'l',  'o'};
+    TEST_ASSERT_EQUAL_INT(0, inflate_data(data, sizeof(data)));
+    TEST_ASSERT_EQUAL_INT(5, output_size);
+    TEST_ASSERT_EQUAL_MEMORY("hello", output, 5);
+
+    // Length and its complement don't match
+    static const uint8_t corrupted[] = {0x01, 0x05, 0x00, 0xfb, 0xff,
+                                        'h',  'e',  'l',  'l',  'o'};
+    TEST_ASSERT_EQUAL_INT(1, inflate_data(corrupted, sizeof(corrupted)));
+}
+
+void test_fixed_block(void) {
+    // "hello hello hello hello!"
+    static const uint8_t data[] = {
+        0xcb, 0x48, 0xcd, 0xc9, 0xc9, 0x57, 0xc8, 0x40, 0x27, 0x15, 0x01};
+    TEST_ASSERT_EQUAL_INT(0, inflate_data(data, sizeof(data)));
+    TEST_ASSERT_EQUAL_INT(24, output_size);
+    TEST_ASSERT_EQUAL_MEMORY("hello hello hello hello!", output, 24);
+
+    // Cut short
+    TEST_ASSERT_EQUAL_INT(1, inflate_data(data, sizeof(data) - 2));
+}
+
+// Dynamic block of 70000 bytes, back-references across the end of the window
+static const uint8_t dynamic[] = {
+    0xed, 0xdb, 0xbb, 0x15, 0x82, 0x50, 0x00, 0x44, 0xc1, 0x5a, 0x51, 0xf1,
+    0x83, 0x0a, 0xf6, 0x1f, 0x11, 0x89, 0xaf, 0x02, 0x83, 0x7b, 0x26, 0xdb,
+    0xd9, 0x1e, 0xee, 0x74, 0x3f, 0x3d, 0xce, 0xcb, 0xe5, 0x39, 0xbf, 0xae,
+    0xef, 0xdb, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x45, 0xfc,
+    0xe6, 0x3a, 0xfe, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x10, 0xc2,
+    0x31, 0xb7, 0xf1, 0x07, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x80, 0x12,
+    0xbe, 0xf3, 0x33, 0xfe, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x90,
+    0x82, 0x1a, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xa0, 0x0f, 0x35,
+    0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x40, 0x1f, 0x6a, 0x08, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x80, 0x3e, 0xd4, 0x10, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x7d, 0xa8, 0x21, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0xfa, 0x50, 0x43, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0xf4, 0xa1, 0x86, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xe8, 0x43,
+    0x0d, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xd0, 0x87, 0x1a, 0x02,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xa0, 0x0f, 0x35, 0x04, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x40, 0x1f, 0x6a, 0x08, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x80, 0x3e, 0xd4, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x7d, 0xa8, 0x21, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xfa,
+    0x50, 0x43, 0xfc, 0x17, 0x3b};
+
+void test_dynamic_block(void) {
+    // A byte at a time, the bit buffer refilled across reads
+    piece_size = 1;
+    TEST_ASSERT_EQUAL_INT(0, inflate_data(dynamic, sizeof(dynamic)));
+    TEST_ASSERT_EQUAL_INT(DYNAMIC_SIZE, output_size);
+    TEST_ASSERT_EQUAL_INT(INFLATE_WINDOW_SIZE, largest_write);
+    for (int i = 0; i < DYNAMIC_SIZE; i++)
+        TEST_ASSERT_EQUAL_HEX8(97 + (i * 7) % 13 + (i >> 12 & 3), output[i]);
+}
+
+void test_writer_can_stop(void) {
+    output_size = sizeof(output) - 100;
+    TEST_ASSERT_EQUAL_INT(1, inflate_data(dynamic, sizeof(dynamic)));
+}
+
+int main() {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_stored_block);
+    RUN_TEST(test_fixed_block);
+    RUN_TEST(test_dynamic_block);
+    RUN_TEST(test_writer_can_stop);
+
+    return UNITY_END();
+}
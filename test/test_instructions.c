@@ -10,6 +10,7 @@ Memory memory;
 void setUp() {
     memset(&ctx, 0, sizeof(CPUContext));
     memset(&memory, 0, sizeof(Memory));
+    memory_init(&memory);
 }
 
 void tearDown() {}
@@ -213,6 +214,25 @@ void test_increment_decrement() {
     TEST_ASSERT_EQUAL(12, memory_read(&memory, 0x6b));
 }
 
+void test_increment_decrement_flags() {
+    ldx(1, &ctx);
+    dex(&ctx);
+    TEST_ASSERT_TRUE(ctx.status_register.zero);
+    dex(&ctx);
+    TEST_ASSERT_EQUAL_HEX8(0xff, ctx.x);
+    TEST_ASSERT_TRUE(ctx.status_register.negative);
+    TEST_ASSERT_FALSE(ctx.status_register.zero);
+    inx(&ctx);
+    TEST_ASSERT_TRUE(ctx.status_register.zero);
+    TEST_ASSERT_FALSE(ctx.status_register.negative);
+
+    ldy(0x80, &ctx);
+    dey(&ctx);
+    TEST_ASSERT_FALSE(ctx.status_register.negative);
+    iny(&ctx);
+    TEST_ASSERT_TRUE(ctx.status_register.negative);
+}
+
 void test_bit() {
     bit(0b10000000, &ctx);
     TEST_ASSERT(ctx.status_register.negative);
@@ -229,6 +249,131 @@ void test_bit() {
     TEST_ASSERT_FALSE(ctx.status_register.zero);
 }
 
+void test_brk_and_irq() {
+    ctx.stack_pointer = 0xfd;
+    // Right after fetching a BRK at 0x0200
+    ctx.program_counter = 0x0201;
+    ctx.status_register.value = 0b10000001;
+
+    brk(&ctx, &memory);
+    // There is no ROM, so the vector reads as 0
+    TEST_ASSERT_EQUAL_HEX16(0x0000, ctx.program_counter);
+    TEST_ASSERT(ctx.status_register.irq_disable);
+    // The return address skips the byte after BRK, and B is set
+    TEST_ASSERT_EQUAL_HEX8(0x02, memory.ram[0x1fd]);
+    TEST_ASSERT_EQUAL_HEX8(0x02, memory.ram[0x1fc]);
+    TEST_ASSERT_EQUAL_HEX8(0b10110001, memory.ram[0x1fb]);
+
+    ctx.status_register.value = 0b10000001;
+    interrupt_request(&ctx, &memory);
+    TEST_ASSERT(ctx.status_register.irq_disable);
+    TEST_ASSERT_EQUAL_HEX8(0b10100001, memory.ram[0x1f8]);
+}
+
+void test_eor() {
+    lda(0xf0, &ctx);
+    eor(0xff, &ctx);
+    TEST_ASSERT_EQUAL_HEX8(0x0f, ctx.a);
+    TEST_ASSERT_FALSE(ctx.status_register.negative);
+    eor(0x0f, &ctx);
+    TEST_ASSERT_TRUE(ctx.status_register.zero);
+}
+
+void test_rotate() {
+    ctx.a = 0b10000001;
+    rol(0, 1, &ctx, &memory);
+    TEST_ASSERT_EQUAL_HEX8(0b00000010, ctx.a);
+    TEST_ASSERT_TRUE(ctx.status_register.carry);
+    rol(0, 1, &ctx, &memory);
+    TEST_ASSERT_EQUAL_HEX8(0b00000101, ctx.a);
+    TEST_ASSERT_FALSE(ctx.status_register.carry);
+
+    memory.ram[0x10] = 0b00000001;
+    ror(0x10, 0, &ctx, &memory);
+    TEST_ASSERT_EQUAL_HEX8(0, memory.ram[0x10]);
+    TEST_ASSERT_TRUE(ctx.status_register.carry);
+    TEST_ASSERT_TRUE(ctx.status_register.zero);
+    ror(0x10, 0, &ctx, &memory);
+    TEST_ASSERT_EQUAL_HEX8(0b10000000, memory.ram[0x10]);
+    TEST_ASSERT_TRUE(ctx.status_register.negative);
+}
+
+void test_branches() {
+    ctx.status_register.overflow = 1;
+    bvs(0x1234, &ctx);
+    TEST_ASSERT_EQUAL_HEX16(0x1234, ctx.program_counter);
+    bvc(0x2000, &ctx);
+    TEST_ASSERT_EQUAL_HEX16(0x1234, ctx.program_counter);
+    clv(&ctx);
+    bvc(0x2000, &ctx);
+    TEST_ASSERT_EQUAL_HEX16(0x2000, ctx.program_counter);
+
+    beq(0x3000, &ctx);
+    bmi(0x3000, &ctx);
+    TEST_ASSERT_EQUAL_HEX16(0x2000, ctx.program_counter);
+    ctx.status_register.zero = 1;
+    beq(0x3000, &ctx);
+    TEST_ASSERT_EQUAL_HEX16(0x3000, ctx.program_counter);
+    ctx.status_register.negative = 1;
+    bmi(0x4000, &ctx);
+    TEST_ASSERT_EQUAL_HEX16(0x4000, ctx.program_counter);
+}
+
+void test_indexed_indirect() {
+    // LDA ($FE,X) with X = 1, the pointer wrapping around the zero page
+    memory.ram[0x200] = 0xa1;
+    memory.ram[0x201] = 0xfe;
+    memory.ram[0xff] = 0x00;
+    memory.ram[0x00] = 0x03;
+    memory.ram[0x300] = 0x42;
+    ctx.x = 1;
+
+    instruction_execute(decode_instruction(0xa1), 0x200, &ctx, &memory);
+    TEST_ASSERT_EQUAL_HEX8(0x42, ctx.a);
+}
+
+void test_page_crossing_and_branch_cycles() {
+    const uint8_t program[] = {
+        0xbd, 0xff, 0x02, // LDA $02ff,X crossing into page 3, 4 + 1 cycles
+        0x9d, 0xff, 0x02, // STA $02ff,X, 5 cycles whatever the page
+        0xd0, 0x02,       // BNE taken to the same page, 2 + 1 cycles
+        0xea, 0xea,       // Skipped
+        0xf0, 0x10,       // BEQ not taken, 2 cycles
+        0xa0, 0x10,       // LDY #$10, 2 cycles
+        0xb1, 0x10,       // LDA ($10),Y not crossing a page, 5 cycles
+    };
+    memcpy(memory.ram + 0x200, program, sizeof(program));
+    memory.ram[0x10] = 0x20;
+    memory.ram[0x11] = 0x03;
+    ctx.program_counter = 0x200;
+    ctx.x = 1;
+
+    const int cycles[] = {5, 5, 3, 2, 2, 5};
+    for (int i = 0; i < 6; i++) {
+        uint64_t start = memory.cpu_cycle;
+        cpu_tick(&ctx, &memory, 0);
+        TEST_ASSERT_EQUAL_UINT64(cycles[i], memory.cpu_cycle - start);
+    }
+    TEST_ASSERT_EQUAL_HEX16(0x210, ctx.program_counter);
+
+    // BNE taken from page 2 to page 3, 2 + 2 cycles
+    memory.ram[0x2f0] = 0xd0;
+    memory.ram[0x2f1] = 0x20;
+    ctx.program_counter = 0x2f0;
+    uint64_t start = memory.cpu_cycle;
+    cpu_tick(&ctx, &memory, 0);
+    TEST_ASSERT_EQUAL_UINT64(4, memory.cpu_cycle - start);
+    TEST_ASSERT_EQUAL_HEX16(0x312, ctx.program_counter);
+}
+
+void test_unofficial_opcode_is_not_executed() {
+    memory.ram[0x200] = 0x04;
+    ctx.program_counter = 0x200;
+    TEST_ASSERT_EQUAL(CPU_UNSUPPORTED_INSTRUCTION, cpu_tick(&ctx, &memory, 0));
+    TEST_ASSERT_EQUAL_HEX16(0x200, ctx.program_counter);
+    TEST_ASSERT_EQUAL(0, memory.cpu_cycle);
+}
+
 int main() {
     UNITY_BEGIN();
 
@@ -243,7 +388,15 @@ int main() {
     RUN_TEST(test_stack_instructions);
     RUN_TEST(test_store_registers);
     RUN_TEST(test_increment_decrement);
+    RUN_TEST(test_increment_decrement_flags);
     RUN_TEST(test_bit);
+    RUN_TEST(test_brk_and_irq);
+    RUN_TEST(test_eor);
+    RUN_TEST(test_rotate);
+    RUN_TEST(test_branches);
+    RUN_TEST(test_indexed_indirect);
+    RUN_TEST(test_page_crossing_and_branch_cycles);
+    RUN_TEST(test_unofficial_opcode_is_not_executed);
 
     return UNITY_END();
 }
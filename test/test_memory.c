@@ -7,6 +7,7 @@ Memory memory;
 void setUp() {
     // memset(&ctx, 0, sizeof(CPUContext));
     // memset(&memory, 0, sizeof(Memory));
+    memory_init(&memory);
 }
 
 void tearDown() {}
@@ -23,10 +24,19 @@ void test_sec() {
     // TEST_ASSERT_FALSE(ctx.status_register.zero);
 }
 
+void test_prg_ram() {
+    memory_write(&memory, 0x6000, 0x80);
+    memory_write(&memory, 0x7fff, 0x12);
+    TEST_ASSERT_EQUAL_HEX8(0x80, memory_read(&memory, 0x6000));
+    TEST_ASSERT_EQUAL_HEX8(0x12, memory_read(&memory, 0x7fff));
+    TEST_ASSERT_EQUAL_HEX8(0x80, memory.prg_ram[0]);
+}
+
 int main() {
     UNITY_BEGIN();
 
     RUN_TEST(test_sec);
+    RUN_TEST(test_prg_ram);
 
     return UNITY_END();
 }
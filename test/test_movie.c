@@ -0,0 +1,114 @@
+#include "movie.h"
+#include "unity.h"
+#include <string.h>
+
+#define MOVIE_PATH "/tmp/test_movie.nesmovie"
+
+Movie movie;
+
+void setUp() {
+    movie_init(&movie, 0x1234, 0);
+}
+
+void tearDown() {
+    movie_free(&movie);
+}
+
+static void record(int frames, uint8_t port_1, uint8_t port_2) {
+    uint8_t buttons[CONTROLLER_PORT_COUNT] = {port_1, port_2};
+    for (int i = 0; i < frames; i++)
+        movie_record_frame(&movie, buttons);
+}
+
+static void expect(int frames, uint8_t port_1, uint8_t port_2) {
+    uint8_t buttons[CONTROLLER_PORT_COUNT];
+    for (int i = 0; i < frames; i++) {
+        TEST_ASSERT_EQUAL(0, movie_next_frame(&movie, buttons));
+        TEST_ASSERT_EQUAL_HEX8(port_1, buttons[0]);
+        TEST_ASSERT_EQUAL_HEX8(port_2, buttons[1]);
+    }
+}
+
+void test_identical_frames_share_a_run() {
+    record(100, CONTROLLER_BUTTON_A, 0);
+    record(1, CONTROLLER_BUTTON_A | CONTROLLER_BUTTON_RIGHT, 0);
+    record(50, CONTROLLER_BUTTON_A, CONTROLLER_BUTTON_START);
+
+    TEST_ASSERT_EQUAL(3, movie.run_count);
+    TEST_ASSERT_EQUAL(151, movie.frame_count);
+    TEST_ASSERT_EQUAL(100, movie.runs[0].length);
+}
+
+void test_playback_ends_after_last_frame() {
+    record(3, CONTROLLER_BUTTON_UP, 0);
+    record(2, 0, CONTROLLER_BUTTON_DOWN);
+
+    expect(3, CONTROLLER_BUTTON_UP, 0);
+    expect(2, 0, CONTROLLER_BUTTON_DOWN);
+
+    uint8_t buttons[CONTROLLER_PORT_COUNT];
+    TEST_ASSERT_EQUAL(1, movie_next_frame(&movie, buttons));
+}
+
+void test_save_and_load_round_trip() {
+    record(10, CONTROLLER_BUTTON_B, 0);
+    record(20, CONTROLLER_BUTTON_SELECT, CONTROLLER_BUTTON_LEFT);
+    movie_add_checkpoint(&movie, 9, 0xdeadbeefcafef00d);
+    TEST_ASSERT_EQUAL(0, movie_save(&movie, MOVIE_PATH));
+    movie_free(&movie);
+
+    TEST_ASSERT_EQUAL(0, movie_load(&movie, MOVIE_PATH));
+    TEST_ASSERT_EQUAL_HEX64(0x1234, movie.rom_hash);
+    TEST_ASSERT_NULL(movie.start_state);
+    TEST_ASSERT_EQUAL(30, movie.frame_count);
+    TEST_ASSERT_EQUAL(2, movie.run_count);
+    TEST_ASSERT_EQUAL(1, movie.checkpoint_count);
+
+    expect(10, CONTROLLER_BUTTON_B, 0);
+    expect(20, CONTROLLER_BUTTON_SELECT, CONTROLLER_BUTTON_LEFT);
+    TEST_ASSERT(movie_has_checkpoint(&movie, 9));
+    TEST_ASSERT_EQUAL(
+        0, movie_verify_checkpoint(&movie, 9, 0xdeadbeefcafef00d));
+}
+
+void test_load_rejects_runs_past_the_frame_count() {
+    record(10, CONTROLLER_BUTTON_B, 0);
+    record(20, CONTROLLER_BUTTON_SELECT, 0);
+    movie.runs[0].length = 0xffffffff;
+    TEST_ASSERT_EQUAL(0, movie_save(&movie, MOVIE_PATH));
+    movie_free(&movie);
+
+    TEST_ASSERT_EQUAL(1, movie_load(&movie, MOVIE_PATH));
+}
+
+void test_checkpoint_mismatch_is_reported() {
+    record(5, 0, 0);
+    movie_add_checkpoint(&movie, 4, 42);
+
+    TEST_ASSERT_FALSE(movie_has_checkpoint(&movie, 3));
+    TEST_ASSERT_EQUAL(0, movie_verify_checkpoint(&movie, 3, 1));
+    TEST_ASSERT_EQUAL(1, movie_verify_checkpoint(&movie, 4, 43));
+    TEST_ASSERT_EQUAL(1, movie.checkpoints_failed);
+}
+
+void test_playback_needs_the_same_rom() {
+    Emulator emulator = {0};
+    emulator.memory.rom_hash = 0x4321;
+    TEST_ASSERT_EQUAL(1, movie_start_playback(&movie, &emulator));
+
+    emulator.memory.rom_hash = 0x1234;
+    TEST_ASSERT_EQUAL(0, movie_start_playback(&movie, &emulator));
+}
+
+int main() {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_identical_frames_share_a_run);
+    RUN_TEST(test_playback_ends_after_last_frame);
+    RUN_TEST(test_save_and_load_round_trip);
+    RUN_TEST(test_load_rejects_runs_past_the_frame_count);
+    RUN_TEST(test_checkpoint_mismatch_is_reported);
+    RUN_TEST(test_playback_needs_the_same_rom);
+
+    return UNITY_END();
+}
@@ -0,0 +1,123 @@
+#include "pacing.h"
+#include "unity.h"
+#include <stdint.h>
+#include <string.h>
+
+// A clock that only moves when it's looked at or slept on
+typedef struct {
+    uint64_t now;
+    // Time passing on every read, i.e. while spinning
+    uint64_t read_cost;
+    // How much every sleep overshoots
+    uint64_t oversleep;
+    uint64_t slept;
+    int sleeps;
+} FakeClock;
+
+FakeClock clock;
+Pacing pacing;
+
+static uint64_t fake_now(void *context) {
+    FakeClock *fake = context;
+    fake->now += fake->read_cost;
+    return fake->now;
+}
+
+static void fake_sleep(void *context, uint64_t duration) {
+    FakeClock *fake = context;
+    fake->now += duration + fake->oversleep;
+    fake->slept += duration;
+    fake->sleeps++;
+}
+
+void setUp() {
+    memset(&clock, 0, sizeof(clock));
+    clock.read_cost = 1000;
+    clock.oversleep = 500000;
+    pacing_init(&pacing, PACING_NTSC_RATE, fake_now, fake_sleep, &clock);
+}
+
+void tearDown() {}
+
+void test_keeps_frame_rate() {
+    uint64_t start = clock.now;
+    for (int i = 0; i < 600; i++)
+        pacing_end_frame(&pacing);
+
+    // Ten seconds worth of frames
+    TEST_ASSERT_UINT64_WITHIN(100000, 9983559000ull, clock.now - start);
+
+    PacingStats stats;
+    pacing_get_stats(&pacing, &stats);
+    TEST_ASSERT(stats.fps > 60.09 && stats.fps < 60.11);
+    // Spinning makes up for oversleeping
+    TEST_ASSERT_LESS_THAN_UINT64(10000, stats.jitter_p99_ns);
+}
+
+void test_sleeps_for_most_of_the_frame() {
+    clock.now += 4000000;
+    pacing_end_frame(&pacing);
+
+    TEST_ASSERT_EQUAL(1, clock.sleeps);
+    TEST_ASSERT_UINT64_WITHIN(
+        10000, pacing.frame_duration_ns - 4000000 - pacing.spin_ns,
+        clock.slept);
+}
+
+void test_slow_frame_starts_over() {
+    // Running late for a couple of frames
+    clock.now += pacing.frame_duration_ns * 3;
+    pacing_end_frame(&pacing);
+    uint64_t after_slow = clock.now;
+    pacing_end_frame(&pacing);
+
+    // No catching up by running the next frame right away
+    TEST_ASSERT_UINT64_WITHIN(10000, pacing.frame_duration_ns,
+                              clock.now - after_slow);
+}
+
+void test_fast_forward() {
+    pacing_set_fast_forward(&pacing, 1, 1, 4);
+
+    int rendered = 0;
+    for (int i = 0; i < 400; i++) {
+        rendered += pacing_should_render(&pacing);
+        pacing_end_frame(&pacing);
+    }
+
+    TEST_ASSERT_EQUAL(100, rendered);
+    TEST_ASSERT_EQUAL(0, clock.sleeps);
+
+    pacing_set_fast_forward(&pacing, 0, 1, 1);
+    TEST_ASSERT(pacing_should_render(&pacing));
+    uint64_t start = clock.now;
+    pacing_end_frame(&pacing);
+    TEST_ASSERT_UINT64_WITHIN(10000, pacing.frame_duration_ns,
+                              clock.now - start);
+}
+
+void test_jitter_percentiles() {
+    // Every tenth frame runs 5 ms late
+    for (int i = 0; i < 200; i++) {
+        if (i % 10 == 0)
+            clock.now += pacing.frame_duration_ns + 5000000;
+        pacing_end_frame(&pacing);
+    }
+
+    PacingStats stats;
+    pacing_get_stats(&pacing, &stats);
+    TEST_ASSERT_LESS_THAN_UINT64(10000, stats.jitter_p50_ns);
+    TEST_ASSERT_GREATER_THAN_UINT64(5000000, stats.jitter_p95_ns);
+}
+
+int main() {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_keeps_frame_rate);
+    RUN_TEST(test_sleeps_for_most_of_the_frame);
+    RUN_TEST(test_slow_frame_starts_over);
+    RUN_TEST(test_fast_forward);
+    RUN_TEST(test_jitter_percentiles);
+
+    return UNITY_END();
+}
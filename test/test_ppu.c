@@ -0,0 +1,338 @@
+#include "memory.h"
+#include "palette.h"
+#include "ppu.h"
+#include "unity.h"
+#include <string.h>
+
+Memory memory;
+PPUContext *ppu_ctx = &memory.ppu_ctx;
+
+#define VBLANK_START_DOT (PPU_VBLANK_SCANLINE * DOTS_PER_SCANLINE + 1)
+
+void setUp() {
+    memset(&memory, 0, sizeof(Memory));
+    memory_init(&memory);
+}
+
+void tearDown() {}
+
+void test_run_until_sets_vblank() {
+    ppu_run_until(ppu_ctx, VBLANK_START_DOT);
+    TEST_ASSERT_FALSE(ppu_ctx->ppustatus.vblank);
+
+    ppu_run_until(ppu_ctx, VBLANK_START_DOT + 1);
+    TEST_ASSERT(ppu_ctx->ppustatus.vblank);
+    TEST_ASSERT_FALSE(ppu_ctx->nmi_pending);
+    TEST_ASSERT_EQUAL(VBLANK_START_DOT + 1, ppu_ctx->dots_elapsed);
+}
+
+void test_run_until_raises_nmi_when_enabled() {
+    ppu_write_ppuctrl(0x80, ppu_ctx);
+    ppu_run_until(ppu_ctx, VBLANK_START_DOT + 1);
+    TEST_ASSERT(ppu_ctx->nmi_pending);
+}
+
+void test_idle_skip_matches_ticking() {
+    PPUContext ticked = {0};
+    for (int i = 0; i < DOTS_PER_FRAME + 1000; i++)
+        ppu_tick(&ticked, 0, &ticked.nmi_pending);
+
+    ppu_run_until(ppu_ctx, DOTS_PER_FRAME + 1000);
+
+    TEST_ASSERT_EQUAL(ticked.current_dot, ppu_ctx->current_dot);
+    TEST_ASSERT_EQUAL(ticked.current_scanline, ppu_ctx->current_scanline);
+    TEST_ASSERT_EQUAL(ticked.frame_count, ppu_ctx->frame_count);
+    TEST_ASSERT_EQUAL(1, ppu_ctx->frame_count);
+}
+
+void test_next_event_dot() {
+    TEST_ASSERT_EQUAL(VBLANK_START_DOT + 1, ppu_next_event_dot(ppu_ctx));
+
+    ppu_run_until(ppu_ctx, VBLANK_START_DOT + 5);
+    TEST_ASSERT_EQUAL(DOTS_PER_FRAME + VBLANK_START_DOT + 1,
+                      ppu_next_event_dot(ppu_ctx));
+}
+
+void test_register_read_catches_up() {
+    memory.cpu_cycle = VBLANK_START_DOT / PPU_DOTS_PER_CPU_CYCLE + 1;
+    TEST_ASSERT_EQUAL(0x80, memory_read(&memory, 0x2002) & 0x80);
+    TEST_ASSERT_EQUAL(memory.cpu_cycle * PPU_DOTS_PER_CPU_CYCLE,
+                      ppu_ctx->dots_elapsed);
+}
+
+// Fills pattern tables, nametables, palettes and OAM with pseudo-random data
+// and enables rendering with a scroll offset.
+static void setup_rendering(PPUContext *ctx) {
+    uint32_t seed = 12345;
+    for (int i = 0; i < PPU_MEMORY_CARTRIDGE_MAPPED_TOTAL_SIZE; i++) {
+        seed = seed * 1103515245 + 12345;
+        ctx->memory.cartridge_mapped_memory[i] = seed >> 16;
+    }
+    for (int i = 0; i < PPU_MEMORY_PALETTE_SIZE; i++)
+        ctx->memory.palette[i] = i * 3;
+    for (int i = 0; i < PPU_OAM_SIZE; i++) {
+        seed = seed * 1103515245 + 12345;
+        ctx->oam[i] = seed >> 16;
+    }
+
+    ctx->mirroring = PPU_MIRRORING_VERTICAL;
+    ppu_write_ppuctrl(0x10, ctx);
+    ppu_write_ppumask(0x1e, ctx);
+    ppu_write_ppuscroll(0x2d, ctx);
+    ppu_write_ppuscroll(0x13, ctx);
+}
+
+static void assert_same_state(PPUContext *a, PPUContext *b) {
+    TEST_ASSERT_EQUAL(a->dots_elapsed, b->dots_elapsed);
+    TEST_ASSERT_EQUAL_HEX8(a->ppustatus.value, b->ppustatus.value);
+    TEST_ASSERT_EQUAL_HEX16(a->vram_address, b->vram_address);
+    TEST_ASSERT_EQUAL_HEX16(a->pattern_low_shifter, b->pattern_low_shifter);
+    TEST_ASSERT_EQUAL_HEX16(a->pattern_high_shifter, b->pattern_high_shifter);
+    TEST_ASSERT_EQUAL_HEX16(a->attribute_low_shifter,
+                            b->attribute_low_shifter);
+    TEST_ASSERT_EQUAL_HEX8(a->nametable_latch, b->nametable_latch);
+    TEST_ASSERT_EQUAL_HEX8(a->attribute_latch, b->attribute_latch);
+    TEST_ASSERT_EQUAL_HEX8(a->pattern_low_latch, b->pattern_low_latch);
+}
+
+static uint32_t ticked_framebuffer[PPU_FRAMEBUFFER_LENGTH];
+static uint32_t fast_framebuffer[PPU_FRAMEBUFFER_LENGTH];
+static PPUContext ticked;
+
+void test_fast_path_matches_ticking() {
+    setup_rendering(ppu_ctx);
+    ticked = *ppu_ctx;
+
+    // Two frames so that the second starts from a properly scrolled state
+    for (int i = 0; i < DOTS_PER_FRAME * 2; i++)
+        ppu_tick(&ticked, ticked_framebuffer, 0);
+
+    ppu_ctx->framebuffer = fast_framebuffer;
+    ppu_run_until(ppu_ctx, DOTS_PER_FRAME * 2);
+
+    assert_same_state(&ticked, ppu_ctx);
+    TEST_ASSERT_EQUAL_HEX32_ARRAY(ticked_framebuffer, fast_framebuffer,
+                                  PPU_FRAMEBUFFER_LENGTH);
+}
+
+void test_split_scroll() {
+    setup_rendering(ppu_ctx);
+    ticked = *ppu_ctx;
+    uint64_t split_dot = DOTS_PER_FRAME + 100 * DOTS_PER_SCANLINE + 270;
+
+    while (ticked.dots_elapsed < split_dot)
+        ppu_tick(&ticked, ticked_framebuffer, 0);
+    ppu_write_ppuscroll(0x80, &ticked);
+    ppu_write_ppuscroll(0x00, &ticked);
+    ppu_write_ppuctrl(0x11, &ticked);
+    while (ticked.dots_elapsed < DOTS_PER_FRAME * 2)
+        ppu_tick(&ticked, ticked_framebuffer, 0);
+
+    ppu_ctx->framebuffer = fast_framebuffer;
+    ppu_run_until(ppu_ctx, split_dot);
+    ppu_write_ppuscroll(0x80, ppu_ctx);
+    ppu_write_ppuscroll(0x00, ppu_ctx);
+    ppu_write_ppuctrl(0x11, ppu_ctx);
+    ppu_run_until(ppu_ctx, DOTS_PER_FRAME * 2);
+
+    assert_same_state(&ticked, ppu_ctx);
+    TEST_ASSERT_EQUAL_HEX32_ARRAY(ticked_framebuffer, fast_framebuffer,
+                                  PPU_FRAMEBUFFER_LENGTH);
+}
+
+void test_nametable_mirroring() {
+    ppu_ctx->mirroring = PPU_MIRRORING_HORIZONTAL;
+    ppu_write_ppuaddr(0x24, ppu_ctx);
+    ppu_write_ppuaddr(0x05, ppu_ctx);
+    ppu_write_ppudata(0xab, ppu_ctx);
+
+    TEST_ASSERT_EQUAL_HEX8(0xab, ppu_ctx->memory.nametable_0[5]);
+
+    ppu_ctx->mirroring = PPU_MIRRORING_VERTICAL;
+    ppu_write_ppuaddr(0x2c, ppu_ctx);
+    ppu_write_ppuaddr(0x05, ppu_ctx);
+    ppu_write_ppudata(0xcd, ppu_ctx);
+
+    TEST_ASSERT_EQUAL_HEX8(0xcd, ppu_ctx->memory.nametable_1[5]);
+}
+
+// Solid background everywhere and sprite 0 on scanline 50 at x = 100
+static void setup_sprite_0(PPUContext *ctx) {
+    memset(ctx->memory.pattern_table_0 + 16, 0xff, 8);
+    memset(ctx->memory.nametable_0, 1, PPU_MEMORY_NAMETABLE_SIZE - 64);
+    OAMEntry *sprite_0 = (OAMEntry *)ctx->oam;
+    sprite_0->pos_y = 49;
+    sprite_0->pos_x = 100;
+    sprite_0->tile_index = 1;
+    ppu_write_ppumask(0x1e, ctx);
+}
+
+#define SPRITE_0_HIT_DOT (50 * DOTS_PER_SCANLINE + 101)
+
+void test_sprite_0_hit_predicted() {
+    setup_sprite_0(ppu_ctx);
+
+    ppu_run_until(ppu_ctx, SPRITE_0_HIT_DOT);
+    TEST_ASSERT_FALSE(ppu_ctx->ppustatus.sprite_0_hit);
+    TEST_ASSERT_EQUAL(SPRITE_0_HIT_DOT + 1, ppu_next_event_dot(ppu_ctx));
+
+    ppu_run_until(ppu_ctx, SPRITE_0_HIT_DOT + 1);
+    TEST_ASSERT(ppu_ctx->ppustatus.sprite_0_hit);
+
+    // Cleared at the end of vblank
+    ppu_run_until(ppu_ctx, DOTS_PER_FRAME);
+    TEST_ASSERT_FALSE(ppu_ctx->ppustatus.sprite_0_hit);
+}
+
+void test_sprite_0_hit_fast_path() {
+    setup_sprite_0(ppu_ctx);
+
+    ppu_run_until(ppu_ctx, 60 * DOTS_PER_SCANLINE);
+    TEST_ASSERT(ppu_ctx->ppustatus.sprite_0_hit);
+}
+
+void test_sprite_0_hit_after_mid_scanline_write() {
+    setup_sprite_0(ppu_ctx);
+
+    ppu_run_until(ppu_ctx, 50 * DOTS_PER_SCANLINE + 10);
+    ppu_write_ppumask(0x1e, ppu_ctx);
+    TEST_ASSERT(ppu_ctx->sprite_0_hit_per_dot);
+
+    ppu_run_until(ppu_ctx, SPRITE_0_HIT_DOT);
+    TEST_ASSERT_FALSE(ppu_ctx->ppustatus.sprite_0_hit);
+    ppu_run_until(ppu_ctx, SPRITE_0_HIT_DOT + 1);
+    TEST_ASSERT(ppu_ctx->ppustatus.sprite_0_hit);
+}
+
+void test_sprite_overflow() {
+    ppu_write_ppumask(0x10, ppu_ctx);
+    OAMEntry *oam_entries = (OAMEntry *)ppu_ctx->oam;
+    for (int i = 0; i < PPU_OAM_ENTRY_COUNT; i++)
+        oam_entries[i].pos_y = i < 9 ? 20 : 0xff;
+
+    ppu_run_until(ppu_ctx, 21 * DOTS_PER_SCANLINE);
+    TEST_ASSERT_FALSE(ppu_ctx->ppustatus.sprite_overflow);
+    ppu_run_until(ppu_ctx, 22 * DOTS_PER_SCANLINE);
+    TEST_ASSERT(ppu_ctx->ppustatus.sprite_overflow);
+}
+
+// Frames that aren't rendered have to look the same to the CPU
+void test_no_render_matches_rendering() {
+    setup_rendering(ppu_ctx);
+    setup_sprite_0(ppu_ctx);
+    ticked = *ppu_ctx;
+
+    ticked.framebuffer = fast_framebuffer;
+    ppu_run_until(&ticked, SPRITE_0_HIT_DOT - 50);
+    ppu_run_until(ppu_ctx, SPRITE_0_HIT_DOT - 50);
+    assert_same_state(&ticked, ppu_ctx);
+
+    // Falls back to checking sprite 0 hit dot by dot
+    ppu_write_ppumask(0x1e, &ticked);
+    ppu_write_ppumask(0x1e, ppu_ctx);
+    uint64_t checkpoints[] = {SPRITE_0_HIT_DOT + 1,
+                              DOTS_PER_FRAME + SPRITE_0_HIT_DOT + 1,
+                              DOTS_PER_FRAME * 2 + 1000};
+
+    for (int i = 0; i < 3; i++) {
+        ppu_run_until(&ticked, checkpoints[i]);
+        ppu_run_until(ppu_ctx, checkpoints[i]);
+        assert_same_state(&ticked, ppu_ctx);
+    }
+    TEST_ASSERT(ppu_ctx->frame_count == 2);
+}
+
+static uint8_t luma(uint32_t rgb) {
+    return ((rgb >> 16 & 0xff) * 77 + (rgb >> 8 & 0xff) * 150 +
+            (rgb & 0xff) * 29) >>
+           8;
+}
+
+// Renders a frame in full color into `ticked_framebuffer` and in `output` into
+// `fast_framebuffer`.
+static void render_in_both(PPUOutput output) {
+    setup_rendering(ppu_ctx);
+    ticked = *ppu_ctx;
+    ticked.framebuffer = ticked_framebuffer;
+    ppu_run_until(&ticked, DOTS_PER_FRAME * 2);
+
+    ppu_ctx->output = output;
+    ppu_ctx->framebuffer = fast_framebuffer;
+    ppu_run_until(ppu_ctx, DOTS_PER_FRAME * 2);
+}
+
+void test_gray_output_downsampled() {
+    PPUOutput output;
+    TEST_ASSERT_EQUAL_INT(0, ppu_output_init(&output, PPU_OUTPUT_GRAY, 2));
+    TEST_ASSERT_EQUAL_INT(128 * 120, ppu_output_size(&output));
+    render_in_both(output);
+
+    uint8_t *gray = (uint8_t *)fast_framebuffer;
+    for (int y = 0; y < 120; y++) {
+        for (int x = 0; x < 128; x++) {
+            uint32_t *square = ticked_framebuffer +
+                               y * 2 * PPU_VISIBLE_AREA_WIDTH + x * 2;
+            int sum = luma(square[0]) + luma(square[1]) +
+                      luma(square[PPU_VISIBLE_AREA_WIDTH]) +
+                      luma(square[PPU_VISIBLE_AREA_WIDTH + 1]);
+            TEST_ASSERT_EQUAL_UINT8(sum / 4, gray[y * 128 + x]);
+        }
+    }
+}
+
+void test_output_downsampling_is_checked() {
+    PPUOutput output;
+    TEST_ASSERT_EQUAL_INT(0, ppu_output_init(&output, PPU_OUTPUT_GRAY, 4));
+    TEST_ASSERT_EQUAL_INT(64 * 60, ppu_output_size(&output));
+    TEST_ASSERT_EQUAL_INT(1, ppu_output_init(&output, PPU_OUTPUT_GRAY, 3));
+    TEST_ASSERT_EQUAL_INT(
+        1, ppu_output_init(&output, PPU_OUTPUT_PALETTE_INDEX, 8));
+    TEST_ASSERT_EQUAL_INT(PPU_FRAMEBUFFER_LENGTH, ppu_output_size(&output));
+    // Full color isn't downsampled
+    TEST_ASSERT_EQUAL_INT(0, ppu_output_init(&output, PPU_OUTPUT_RGB, 4));
+    TEST_ASSERT_EQUAL_INT(PPU_FRAMEBUFFER_LENGTH * 4, ppu_output_size(&output));
+}
+
+void test_palette_index_output() {
+    render_in_both((PPUOutput){.format = PPU_OUTPUT_PALETTE_INDEX});
+
+    uint8_t *indices = (uint8_t *)fast_framebuffer;
+    for (int i = 0; i < PPU_FRAMEBUFFER_LENGTH; i++) {
+        TEST_ASSERT_LESS_THAN_UINT8(64, indices[i]);
+        TEST_ASSERT_EQUAL_HEX32(ticked_framebuffer[i],
+                                default_palette[indices[i]]);
+    }
+
+    // Ticking dot by dot gives the same, one pixel of every square
+    ppu_output_init(&ticked.output, PPU_OUTPUT_PALETTE_INDEX, 4);
+    for (int i = 0; i < DOTS_PER_FRAME; i++)
+        ppu_tick(&ticked, ticked_framebuffer, 0);
+    uint8_t *downsampled = (uint8_t *)ticked_framebuffer;
+    for (int y = 0; y < 60; y++)
+        for (int x = 0; x < 64; x++)
+            TEST_ASSERT_EQUAL_HEX8(indices[y * 4 * 256 + x * 4],
+                                   downsampled[y * 64 + x]);
+}
+
+int main() {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_run_until_sets_vblank);
+    RUN_TEST(test_run_until_raises_nmi_when_enabled);
+    RUN_TEST(test_idle_skip_matches_ticking);
+    RUN_TEST(test_next_event_dot);
+    RUN_TEST(test_register_read_catches_up);
+    RUN_TEST(test_fast_path_matches_ticking);
+    RUN_TEST(test_split_scroll);
+    RUN_TEST(test_nametable_mirroring);
+    RUN_TEST(test_sprite_0_hit_predicted);
+    RUN_TEST(test_sprite_0_hit_fast_path);
+    RUN_TEST(test_sprite_0_hit_after_mid_scanline_write);
+    RUN_TEST(test_sprite_overflow);
+    RUN_TEST(test_no_render_matches_rendering);
+    RUN_TEST(test_gray_output_downsampled);
+    RUN_TEST(test_output_downsampling_is_checked);
+    RUN_TEST(test_palette_index_output);
+
+    return UNITY_END();
+}
@@ -0,0 +1,143 @@
+#include "emulator.h"
+#include "instructions.h"
+#include "profiler.h"
+#include "test_rom.h"
+#include "unity.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+Profiler profiler;
+Emulator emulator;
+
+// JSR $8010, JMP $8000, and at 0x8010: INC $00, RTS
+static const uint8_t program[] = {0x20, 0x10, 0x80, 0x4c, 0x00, 0x80};
+static const uint8_t subroutine[] = {0xe6, 0x00, 0x60};
+
+void setUp() {
+    profiler_init(&profiler, 0);
+
+    load_test_program(&emulator, program, sizeof(program));
+    load_test_code(&emulator, 0x8010, subroutine, sizeof(subroutine));
+    emulator.cpu_ctx.profiler = &profiler;
+}
+
+void tearDown() {
+    free_test_program(&emulator);
+}
+
+// Returns what `write` wrote, to be freed
+static char *written(void (*write)(FILE *fp)) {
+    char *text;
+    size_t size;
+    FILE *fp = open_memstream(&text, &size);
+    write(fp);
+    fclose(fp);
+    return text;
+}
+
+static void write_folded(FILE *fp) {
+    profiler_write_folded(&profiler, fp);
+}
+
+static void write_report(FILE *fp) {
+    profiler_write_report(&profiler, &emulator.memory, fp);
+}
+
+void test_call_tree_self_cycles() {
+    profiler_enter(&profiler, 0xa000, 0, 10);
+    profiler_enter(&profiler, 0xb000, 0, 20);
+    profiler_leave(&profiler, 0, 50);
+    profiler_leave(&profiler, 0, 60);
+    profiler_charge(&profiler, 100);
+
+    char *folded = written(write_folded);
+    TEST_ASSERT_EQUAL_STRING("reset 50\n"
+                             "reset;sub_A000 20\n"
+                             "reset;sub_A000;sub_B000 30\n",
+                             folded);
+    free(folded);
+}
+
+void test_interrupt_return_unwinds() {
+    profiler_enter(&profiler, 0xa000, 0, 0);
+    profiler_enter(&profiler, 0xc000, PROFILER_NMI, 10);
+    // Left without RTS, e.g. through a jump table
+    profiler_enter(&profiler, 0xd000, 0, 20);
+    profiler_leave(&profiler, 1, 30);
+
+    TEST_ASSERT_EQUAL(2, profiler.depth);
+    TEST_ASSERT_EQUAL_HEX16(0xa000, profiler.nodes[profiler.stack[1]].address);
+
+    // More returns than calls stay at the root
+    profiler_leave(&profiler, 0, 40);
+    profiler_leave(&profiler, 0, 50);
+    TEST_ASSERT_EQUAL(1, profiler.depth);
+}
+
+void test_interrupts_named_by_vector() {
+    // NMI handler at 0x8020, IRQ and BRK handler at 0x8030
+    set_test_vector(&emulator, 0xfffa, 0x8020);
+    set_test_vector(&emulator, 0xfffe, 0x8030);
+
+    non_maskable_interrupt(&emulator.cpu_ctx, &emulator.memory);
+    profiler_leave(&profiler, 1, 10);
+    emulator.memory.cpu_cycle = 10;
+    interrupt_request(&emulator.cpu_ctx, &emulator.memory);
+    profiler_leave(&profiler, 1, 30);
+    emulator.memory.cpu_cycle = 30;
+    // The ROM is all BRK there
+    emulator.cpu_ctx.program_counter = 0x8040;
+    TEST_ASSERT_EQUAL(0, emulator_step(&emulator, 0));
+    profiler_charge(&profiler, 100);
+
+    TEST_ASSERT_EQUAL(PROFILER_BRK,
+                      profiler.nodes[profiler.stack[1]].interrupt);
+    char *folded = written(write_folded);
+    TEST_ASSERT_NOT_NULL(strstr(folded, "reset;nmi_8020 10\n"));
+    TEST_ASSERT_NOT_NULL(strstr(folded, "reset;irq_8030 20\n"));
+    TEST_ASSERT_NOT_NULL(strstr(folded, "reset;brk_8030 "));
+    free(folded);
+}
+
+void test_counts_cycles_per_address() {
+    // Three times around the loop
+    for (int i = 0; i < 12; i++)
+        TEST_ASSERT_EQUAL(0, emulator_step(&emulator, 0));
+
+    TEST_ASSERT_EQUAL(3 * 6, profiler.cycles[0x8000]);
+    TEST_ASSERT_EQUAL(3 * 5, profiler.cycles[0x8010]);
+    TEST_ASSERT_EQUAL(3 * 6, profiler.cycles[0x8012]);
+
+    profiler_charge(&profiler, emulator.memory.cpu_cycle);
+    TEST_ASSERT_EQUAL(2, profiler.node_count);
+    TEST_ASSERT_EQUAL(3, profiler.nodes[1].calls);
+    // JSR and JMP outside, INC and RTS inside
+    TEST_ASSERT_EQUAL(3 * (6 + 3), profiler.nodes[PROFILER_ROOT].cycles);
+    TEST_ASSERT_EQUAL(3 * (5 + 6), profiler.nodes[1].cycles);
+}
+
+void test_report() {
+    for (int i = 0; i < 12; i++)
+        emulator_step(&emulator, 0);
+    profiler_charge(&profiler, emulator.memory.cpu_cycle);
+
+    char *report = written(write_report);
+    TEST_ASSERT_NOT_NULL(strstr(report, "PRG ROM bank 0"));
+    TEST_ASSERT_NOT_NULL(strstr(report, "sub_8010"));
+    TEST_ASSERT_NOT_NULL(strstr(report, "8010  INC $00"));
+    TEST_ASSERT_NOT_NULL(strstr(report, "8000  JSR $8010"));
+    free(report);
+}
+
+int main() {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_call_tree_self_cycles);
+    RUN_TEST(test_interrupt_return_unwinds);
+    RUN_TEST(test_interrupts_named_by_vector);
+    RUN_TEST(test_counts_cycles_per_address);
+    RUN_TEST(test_report);
+
+    return UNITY_END();
+}
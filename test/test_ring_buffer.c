@@ -0,0 +1,101 @@
+#include "ring_buffer.h"
+#include "unity.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <string.h>
+
+#define CAPACITY 16
+
+RingBuffer ring;
+uint32_t storage[CAPACITY];
+
+void setUp() {
+    memset(storage, 0, sizeof(storage));
+    ring_buffer_init(&ring, storage, sizeof(uint32_t), CAPACITY);
+}
+
+void tearDown() {}
+
+void test_capacity_must_be_power_of_two() {
+    RingBuffer other;
+    TEST_ASSERT_EQUAL(1, ring_buffer_init(&other, storage, 4, 12));
+    TEST_ASSERT_EQUAL(1, ring_buffer_init(&other, storage, 4, 0));
+    TEST_ASSERT_EQUAL(0, ring_buffer_init(&other, storage, 4, 8));
+}
+
+void test_write_until_full() {
+    uint32_t in[CAPACITY + 4];
+    for (int i = 0; i < CAPACITY + 4; i++)
+        in[i] = i;
+
+    TEST_ASSERT_EQUAL(CAPACITY, ring_buffer_write(&ring, in, CAPACITY + 4));
+    TEST_ASSERT_EQUAL(CAPACITY, ring_buffer_count(&ring));
+    TEST_ASSERT_EQUAL(0, ring_buffer_write(&ring, in, 1));
+
+    uint32_t out[CAPACITY + 4];
+    TEST_ASSERT_EQUAL(CAPACITY, ring_buffer_read(&ring, out, CAPACITY + 4));
+    TEST_ASSERT_EQUAL_UINT32_ARRAY(in, out, CAPACITY);
+    TEST_ASSERT_EQUAL(0, ring_buffer_read(&ring, out, 1));
+}
+
+void test_wraps_around() {
+    uint32_t in[10], out[10];
+
+    for (uint32_t round = 0; round < 20; round++) {
+        for (int i = 0; i < 10; i++)
+            in[i] = round * 10 + i;
+
+        TEST_ASSERT_EQUAL(10, ring_buffer_write(&ring, in, 10));
+        TEST_ASSERT_EQUAL(10, ring_buffer_read(&ring, out, 10));
+        TEST_ASSERT_EQUAL_UINT32_ARRAY(in, out, 10);
+    }
+}
+
+#define THREADED_COUNT 100000
+
+static void *produce(void *arg) {
+    uint32_t next = 0;
+    while (next < THREADED_COUNT) {
+        uint32_t chunk[7];
+        for (int i = 0; i < 7; i++)
+            chunk[i] = next + i;
+        size_t count = THREADED_COUNT - next < 7 ? THREADED_COUNT - next : 7;
+        size_t written = ring_buffer_write(&ring, chunk, count);
+        if (!written)
+            sched_yield();
+        next += written;
+    }
+    return 0;
+}
+
+void test_threaded_order() {
+    pthread_t producer;
+    pthread_create(&producer, 0, produce, 0);
+
+    uint32_t expected = 0;
+    int in_order = 1;
+    while (expected < THREADED_COUNT) {
+        uint32_t chunk[5];
+        size_t count = ring_buffer_read(&ring, chunk, 5);
+        if (!count)
+            sched_yield();
+        for (size_t i = 0; i < count; i++)
+            in_order &= chunk[i] == expected++;
+    }
+
+    pthread_join(producer, 0);
+    TEST_ASSERT(in_order);
+    TEST_ASSERT_EQUAL(0, ring_buffer_count(&ring));
+}
+
+int main() {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_capacity_must_be_power_of_two);
+    RUN_TEST(test_write_until_full);
+    RUN_TEST(test_wraps_around);
+    RUN_TEST(test_threaded_order);
+
+    return UNITY_END();
+}
@@ -0,0 +1,67 @@
+// Emulators running a few bytes of code out of a 32 KB PRG ROM, mapped to
+// 0x8000-0xffff, for tests that need the CPU to run something.
+
+#ifndef _TEST_ROM
+#define _TEST_ROM
+
+#include "emulator.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TEST_ROM_PRG_ROM_SIZE 0x8000
+
+// Copies `code` into the PRG ROM at `address`, 0x8000 or above.
+static inline void load_test_code(Emulator *emulator, uint16_t address,
+                                  const uint8_t *code, size_t size) {
+    memcpy(emulator->memory.prg_rom + address - 0x8000, code, size);
+}
+
+// Points the vector at `vector` (0xfffa NMI, 0xfffc reset, 0xfffe IRQ) to
+// `address`.
+static inline void set_test_vector(Emulator *emulator, uint16_t vector,
+                                   uint16_t address) {
+    uint8_t *prg_rom = emulator->memory.prg_rom + vector - 0x8000;
+    prg_rom[0] = address & 0xff;
+    prg_rom[1] = address >> 8;
+}
+
+// Starts `emulator` over with `program` at 0x8000, where the reset vector
+// points and the CPU is, and the stack pointer as after power on. `program`
+// can be null to load code later. The PRG ROM is freed with
+// `free_test_program`.
+static inline void load_test_program(Emulator *emulator,
+                                     const uint8_t *program, size_t size) {
+    memset(emulator, 0, sizeof(Emulator));
+    emulator_init(emulator);
+    emulator->cpu_ctx.program_counter = 0x8000;
+    emulator->cpu_ctx.stack_pointer = 0xfd;
+
+    emulator->memory.prg_rom = calloc(TEST_ROM_PRG_ROM_SIZE, 1);
+    emulator->memory.prg_rom_size = TEST_ROM_PRG_ROM_SIZE;
+    if (program)
+        load_test_code(emulator, 0x8000, program, size);
+    set_test_vector(emulator, 0xfffc, 0x8000);
+}
+
+// Turns NMIs on and counts in 0x10 in a loop from 0x8005, with an NMI handler
+// at 0x8020 that returns straight away.
+static inline void load_test_nmi_loop(Emulator *emulator) {
+    // LDA #$80, STA $2000 (enable NMI), and at 0x8005: INC $10, JMP $8005
+    static const uint8_t program[] = {0xa9, 0x80, 0x8d, 0x00, 0x20,
+                                      0xe6, 0x10, 0x4c, 0x05, 0x80};
+    // RTI
+    static const uint8_t nmi_handler[] = {0x40};
+
+    load_test_program(emulator, program, sizeof(program));
+    load_test_code(emulator, 0x8020, nmi_handler, sizeof(nmi_handler));
+    set_test_vector(emulator, 0xfffa, 0x8020);
+}
+
+static inline void free_test_program(Emulator *emulator) {
+    free(emulator->memory.prg_rom);
+    emulator->memory.prg_rom = 0;
+}
+
+#endif
@@ -0,0 +1,223 @@
+#include "emulator.h"
+#include "hash_cache.h"
+#include "rom_db.h"
+#include "rom_file.h"
+#include "unity.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define PRG_ROM_SIZE 0x4000
+#define CHR_ROM_SIZE 0x4000
+#define FILE_SIZE (INES_HEADER_SIZE + PRG_ROM_SIZE + CHR_ROM_SIZE)
+
+uint8_t file[FILE_SIZE];
+Emulator emulator;
+RomInfo info;
+
+void setUp() {
+    memset(file, 0, sizeof(file));
+    memcpy(file, "NES\032", 4);
+    file[4] = PRG_ROM_SIZE / 0x4000;
+    file[5] = CHR_ROM_SIZE / 0x2000;
+    // Vertical mirroring
+    file[6] = 0x01;
+    for (int i = 0; i < PRG_ROM_SIZE + CHR_ROM_SIZE; i++)
+        file[INES_HEADER_SIZE + i] = i * 7;
+
+    memset(&emulator, 0, sizeof(Emulator));
+    emulator_init(&emulator);
+}
+
+void tearDown() {
+    free(emulator.memory.prg_rom);
+    free(emulator.memory.chr_rom);
+}
+
+static void write_file(const char *filepath, const void *data, int size) {
+    FILE *fp = fopen(filepath, "wb");
+    fwrite(data, size, 1, fp);
+    fclose(fp);
+}
+
+void test_ines_header(void) {
+    TEST_ASSERT_EQUAL_INT(0, rom_file_parse_header(file, FILE_SIZE, &info));
+    TEST_ASSERT_FALSE(info.nes_2_0);
+    TEST_ASSERT_EQUAL_INT(PPU_MIRRORING_VERTICAL, info.mirroring);
+    TEST_ASSERT_EQUAL_INT(PRG_ROM_SIZE, info.prg_rom_size);
+    TEST_ASSERT_EQUAL_INT(CHR_ROM_SIZE, info.chr_rom_size);
+    TEST_ASSERT_EQUAL_INT(0x2000, info.prg_ram_size);
+
+    // Garbage over the end of the header, the upper mapper nibble with it
+    file[7] = 'D' & 0xf0;
+    memcpy(file + 12, "ude!", 4);
+    TEST_ASSERT_EQUAL_INT(0, rom_file_parse_header(file, FILE_SIZE, &info));
+    TEST_ASSERT_EQUAL_INT(0, info.mapper);
+
+    // More ROM than there is file
+    file[4] = 2;
+    TEST_ASSERT_EQUAL_INT(1, rom_file_parse_header(file, FILE_SIZE, &info));
+    TEST_ASSERT_EQUAL_INT(1, rom_file_parse_header(file, 10, &info));
+}
+
+void test_nes_2_0_header(void) {
+    // Mapper 0x2a1, submapper 3, PAL
+    file[6] |= 0x10;
+    file[7] = 0xa8;
+    file[8] = 0x32;
+    file[10] = 0x70;
+    file[11] = 0x07;
+    file[12] = 0x01;
+    TEST_ASSERT_EQUAL_INT(0, rom_file_parse_header(file, FILE_SIZE, &info));
+    TEST_ASSERT_TRUE(info.nes_2_0);
+    TEST_ASSERT_EQUAL_INT(0x2a1, info.mapper);
+    TEST_ASSERT_EQUAL_INT(3, info.submapper);
+    TEST_ASSERT_EQUAL_INT(ROM_TIMING_PAL, info.timing);
+    TEST_ASSERT_EQUAL_INT(0, info.prg_ram_size);
+    TEST_ASSERT_EQUAL_INT(0x2000, info.prg_nvram_size);
+    TEST_ASSERT_EQUAL_INT(0x2000, info.chr_ram_size);
+
+    // Exponent-multiplier sizes: 2^12 * 3 bytes of PRG ROM
+    file[4] = 12 << 2 | 1;
+    file[5] = 0;
+    file[9] = 0x0f;
+    TEST_ASSERT_EQUAL_INT(0, rom_file_parse_header(file, FILE_SIZE, &info));
+    TEST_ASSERT_EQUAL_INT(0x3000, info.prg_rom_size);
+    TEST_ASSERT_EQUAL_INT(0, info.chr_rom_size);
+}
+
+void test_read_keeps_all_chr_rom(void) {
+    char filepath[] = "/tmp/test_rom_file_XXXXXX";
+    close(mkstemp(filepath));
+    write_file(filepath, file, FILE_SIZE);
+
+    TEST_ASSERT_EQUAL_INT(
+        0, rom_file_read(filepath, &emulator.memory, &info, 0));
+    remove(filepath);
+
+    TEST_ASSERT_EQUAL_INT(CHR_ROM_SIZE, emulator.memory.chr_rom_size);
+    uint8_t *chr_rom = file + INES_HEADER_SIZE + PRG_ROM_SIZE;
+    TEST_ASSERT_EQUAL_MEMORY(chr_rom, emulator.memory.chr_rom, CHR_ROM_SIZE);
+    TEST_ASSERT_EQUAL_MEMORY(
+        chr_rom, emulator.memory.ppu_ctx.memory.cartridge_mapped_memory,
+        0x2000);
+    TEST_ASSERT_EQUAL_UINT32(
+        hash_crc32(0, file + INES_HEADER_SIZE, PRG_ROM_SIZE + CHR_ROM_SIZE),
+        info.digests.crc32);
+}
+
+void test_database_corrects_header(void) {
+    TEST_ASSERT_EQUAL_INT(0, rom_file_parse_header(file, FILE_SIZE, &info));
+    info.digests.crc32 = 0x1a2b3c4d;
+
+    char filepath[] = "/tmp/test_rom_db_XXXXXX";
+    close(mkstemp(filepath));
+    const char *text = "# comment\n"
+                       "ffffffff 4 - - Other Game\n"
+                       "1a2b3c4d - h pal Some Game\n"
+                       "not an entry\n";
+    write_file(filepath, text, strlen(text));
+
+    RomDatabase database;
+    TEST_ASSERT_EQUAL_INT(0, rom_db_load(&database, filepath));
+    remove(filepath);
+    TEST_ASSERT_EQUAL_INT(2, database.count);
+    TEST_ASSERT_NULL(rom_db_find(&database, 0x12345678));
+
+    const RomDatabaseEntry *entry = rom_db_find(&database, 0x1a2b3c4d);
+    TEST_ASSERT_NOT_NULL(entry);
+    TEST_ASSERT_EQUAL_INT(1, rom_db_apply(entry, &info));
+    TEST_ASSERT_EQUAL_INT(0, info.mapper);
+    TEST_ASSERT_EQUAL_INT(PPU_MIRRORING_HORIZONTAL, info.mirroring);
+    TEST_ASSERT_EQUAL_INT(ROM_TIMING_PAL, info.timing);
+    TEST_ASSERT_EQUAL_STRING("Some Game", info.title);
+    TEST_ASSERT_TRUE(info.corrected);
+
+    // Nothing left to correct
+    TEST_ASSERT_EQUAL_INT(0, rom_db_apply(entry, &info));
+    rom_db_free(&database);
+}
+
+void test_hash_cache(void) {
+    char filepath[] = "/tmp/test_hash_cache_XXXXXX";
+    close(mkstemp(filepath));
+
+    struct stat file_stat = {.st_size = 1234};
+    file_stat.st_mtim.tv_sec = 5678;
+    HashDigests digests = {.crc32 = 0xdeadbeef, .sha1 = {1, 2, 3}};
+    HashDigests found;
+
+    HashCache cache;
+    hash_cache_init(&cache);
+    TEST_ASSERT_EQUAL_INT(1, hash_cache_find(&cache, "/a b", &file_stat,
+                                             &found));
+    TEST_ASSERT_EQUAL_INT(0, hash_cache_store(&cache, "/a b", &file_stat,
+                                              &digests));
+    TEST_ASSERT_EQUAL_INT(0, hash_cache_save(&cache, filepath));
+    hash_cache_free(&cache);
+
+    hash_cache_init(&cache);
+    TEST_ASSERT_EQUAL_INT(0, hash_cache_load(&cache, filepath));
+    remove(filepath);
+    TEST_ASSERT_EQUAL_INT(0, hash_cache_find(&cache, "/a b", &file_stat,
+                                             &found));
+    TEST_ASSERT_EQUAL_MEMORY(&digests, &found, sizeof(HashDigests));
+
+    // Modified since
+    file_stat.st_mtim.tv_sec++;
+    TEST_ASSERT_EQUAL_INT(1, hash_cache_find(&cache, "/a b", &file_stat,
+                                             &found));
+    hash_cache_free(&cache);
+}
+
+void test_hash_cache_many_files(void) {
+    char filepath[] = "/tmp/test_hash_cache_XXXXXX";
+    close(mkstemp(filepath));
+
+    struct stat file_stat = {0};
+    HashDigests digests = {0};
+    HashDigests found;
+    char path[32];
+
+    HashCache cache;
+    hash_cache_init(&cache);
+    for (int i = 0; i < 5000; i++) {
+        sprintf(path, "/roms/%d.nes", i);
+        digests.crc32 = i;
+        TEST_ASSERT_EQUAL_INT(
+            0, hash_cache_store(&cache, path, &file_stat, &digests));
+    }
+    // Replaced, not added again
+    digests.crc32 = 1234;
+    hash_cache_store(&cache, "/roms/17.nes", &file_stat, &digests);
+    TEST_ASSERT_EQUAL_INT(5000, cache.count);
+    TEST_ASSERT_EQUAL_INT(0, hash_cache_save(&cache, filepath));
+    hash_cache_free(&cache);
+
+    hash_cache_init(&cache);
+    TEST_ASSERT_EQUAL_INT(0, hash_cache_load(&cache, filepath));
+    remove(filepath);
+    TEST_ASSERT_EQUAL_INT(5000, cache.count);
+    for (int i = 0; i < 5000; i++) {
+        sprintf(path, "/roms/%d.nes", i);
+        TEST_ASSERT_EQUAL_INT(
+            0, hash_cache_find(&cache, path, &file_stat, &found));
+        TEST_ASSERT_EQUAL_HEX32(i == 17 ? 1234 : i, found.crc32);
+    }
+    hash_cache_free(&cache);
+}
+
+int main() {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_ines_header);
+    RUN_TEST(test_nes_2_0_header);
+    RUN_TEST(test_read_keeps_all_chr_rom);
+    RUN_TEST(test_database_corrects_header);
+    RUN_TEST(test_hash_cache);
+    RUN_TEST(test_hash_cache_many_files);
+
+    return UNITY_END();
+}
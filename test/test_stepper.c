@@ -0,0 +1,118 @@
+#include "debugger.h"
+#include "emulator.h"
+#include "ppu.h"
+#include "stepper.h"
+#include "test_rom.h"
+#include "unity.h"
+#include <stdlib.h>
+#include <string.h>
+
+Emulator emulator;
+StepperCommand command;
+
+void setUp() {
+    load_test_nmi_loop(&emulator);
+}
+
+void tearDown() {
+    free_test_program(&emulator);
+}
+
+static int run(const char *line) {
+    TEST_ASSERT_EQUAL_INT(0, stepper_parse(line, &command));
+    return stepper_run(&command, &emulator, 0);
+}
+
+void test_parse(void) {
+    TEST_ASSERT_EQUAL_INT(0, stepper_parse("\n", &command));
+    TEST_ASSERT_EQUAL_INT(STEPPER_INSTRUCTIONS, command.type);
+    TEST_ASSERT_EQUAL_UINT64(1, command.count);
+
+    TEST_ASSERT_EQUAL_INT(0, stepper_parse("l 12\n", &command));
+    TEST_ASSERT_EQUAL_INT(STEPPER_SCANLINES, command.type);
+    TEST_ASSERT_EQUAL_UINT64(12, command.count);
+
+    TEST_ASSERT_EQUAL_INT(0, stepper_parse("w 200-2ff:w\n", &command));
+    TEST_ASSERT_EQUAL_INT(STEPPER_DEBUGGER, command.type);
+    TEST_ASSERT_EQUAL_STRING("w 200-2ff:w", command.text);
+
+    TEST_ASSERT_EQUAL_INT(1, stepper_parse("cy\n", &command));
+    TEST_ASSERT_EQUAL_INT(1, stepper_parse("s 0\n", &command));
+    TEST_ASSERT_EQUAL_INT(1, stepper_parse("c 3\n", &command));
+    TEST_ASSERT_EQUAL_INT(1, stepper_parse("b\n", &command));
+    TEST_ASSERT_EQUAL_INT(1, stepper_parse("x\n", &command));
+}
+
+void test_instructions_and_cycles(void) {
+    TEST_ASSERT_EQUAL_INT(0, run("s 3"));
+    TEST_ASSERT_EQUAL_HEX16(0x8007, emulator.cpu_ctx.program_counter);
+
+    uint64_t cycle = emulator.memory.cpu_cycle;
+    TEST_ASSERT_EQUAL_INT(0, run("cy 100"));
+    TEST_ASSERT(emulator.memory.cpu_cycle - cycle >= 100);
+    // Never more than an instruction over
+    TEST_ASSERT(emulator.memory.cpu_cycle - cycle < 108);
+}
+
+void test_scanlines_and_frames(void) {
+    PPUContext *ppu_ctx = &emulator.memory.ppu_ctx;
+
+    TEST_ASSERT_EQUAL_INT(0, run("l 5"));
+    TEST_ASSERT_EQUAL_INT(5, ppu_ctx->current_scanline);
+
+    TEST_ASSERT_EQUAL_INT(0, run("f 2"));
+    TEST_ASSERT_EQUAL_UINT64(2, ppu_ctx->frame_count);
+}
+
+void test_stops_at_nmi_handler(void) {
+    TEST_ASSERT_EQUAL_INT(0, run("n"));
+    TEST_ASSERT_EQUAL_HEX16(0x8020, emulator.cpu_ctx.program_counter);
+    TEST_ASSERT_EQUAL_INT(0, run("s"));
+    TEST_ASSERT(emulator.cpu_ctx.program_counter >= 0x8005);
+    TEST_ASSERT(emulator.cpu_ctx.program_counter < 0x800a);
+}
+
+void test_breakpoint_stops_run(void) {
+    Debugger debugger;
+    debugger_init(&debugger, &emulator.memory);
+    debugger_set_breakpoint(&debugger, 0x8007);
+
+    TEST_ASSERT_EQUAL_INT(EMULATOR_STOPPED, run("f"));
+    TEST_ASSERT_EQUAL_HEX16(0x8007, emulator.cpu_ctx.program_counter);
+    debugger_resume(&debugger, 0x8007);
+    // Stepping off a breakpoint isn't stopped by it
+    TEST_ASSERT_EQUAL_INT(0, run("s"));
+}
+
+void test_queue(void) {
+    Stepper stepper;
+    TEST_ASSERT_EQUAL_INT(0, stepper_init(&stepper));
+    TEST_ASSERT_FALSE(stepper_pending(&stepper));
+
+    for (int i = 0; i < STEPPER_QUEUE_CAPACITY; i++) {
+        command = (StepperCommand){.type = STEPPER_FRAMES, .count = i + 1};
+        TEST_ASSERT_EQUAL_INT(0, stepper_push(&stepper, &command));
+    }
+    TEST_ASSERT_EQUAL_INT(1, stepper_push(&stepper, &command));
+
+    StepperCommand out;
+    TEST_ASSERT_EQUAL_INT(0, stepper_peek(&stepper, &out));
+    TEST_ASSERT_EQUAL_UINT64(1, out.count);
+    TEST_ASSERT_EQUAL_INT(0, stepper_pop(&stepper, &out));
+    TEST_ASSERT_EQUAL_UINT64(1, out.count);
+    TEST_ASSERT_EQUAL_INT(0, stepper_pop(&stepper, &out));
+    TEST_ASSERT_EQUAL_UINT64(2, out.count);
+}
+
+int main() {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_parse);
+    RUN_TEST(test_instructions_and_cycles);
+    RUN_TEST(test_scanlines_and_frames);
+    RUN_TEST(test_stops_at_nmi_handler);
+    RUN_TEST(test_breakpoint_stops_run);
+    RUN_TEST(test_queue);
+
+    return UNITY_END();
+}
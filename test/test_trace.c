@@ -0,0 +1,136 @@
+#include "test_rom.h"
+#include "trace.h"
+#include "unity.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+Emulator emulator;
+char line[TRACE_LINE_SIZE];
+
+// Loads `program` to 0xc000, where nestest starts
+static void load_program(const uint8_t *program, size_t size) {
+    load_test_code(&emulator, 0xc000, program, size);
+}
+
+void setUp() {
+    load_test_program(&emulator, 0, 0);
+    trace_start_nestest(&emulator);
+}
+
+void tearDown() {
+    free_test_program(&emulator);
+}
+
+void test_first_nestest_line() {
+    load_program((uint8_t[]){0x4c, 0xf5, 0xc5}, 3);
+
+    trace_format(&emulator.cpu_ctx, &emulator.memory, line);
+    TEST_ASSERT_EQUAL_STRING("C000  4C F5 C5  JMP $C5F5                       "
+                             "A:00 X:00 Y:00 P:24 SP:FD PPU:  0, 21 CYC:7",
+                             line);
+}
+
+// Disassembly starts at column 16 and is padded to column 48
+static void assert_disassembly(const char *expected) {
+    trace_format(&emulator.cpu_ctx, &emulator.memory, line);
+    char disassembly[33];
+    memcpy(disassembly, line + 16, 32);
+    disassembly[32] = 0;
+    disassembly[strlen(expected)] = 0;
+    TEST_ASSERT_EQUAL_STRING(expected, disassembly);
+}
+
+void test_addressing_modes() {
+    emulator.memory.ram[0x89] = 0x00;
+    emulator.memory.ram[0x8a] = 0x03;
+    emulator.memory.ram[0x0300] = 0x89;
+    emulator.memory.ram[0x0302] = 0x55;
+    emulator.memory.ram[0x00ff] = 0x34;
+    emulator.memory.ram[0x0000] = 0x12;
+    emulator.cpu_ctx.x = 2;
+    emulator.cpu_ctx.y = 2;
+
+    load_program((uint8_t[]){0xb1, 0x89}, 2);
+    assert_disassembly("LDA ($89),Y = 0300 @ 0302 = 55");
+
+    load_program((uint8_t[]){0xb5, 0xfe}, 2);
+    assert_disassembly("LDA $FE,X @ 00 = 12");
+
+    load_program((uint8_t[]){0xbd, 0x00, 0x03}, 3);
+    assert_disassembly("LDA $0300,X @ 0302 = 55");
+
+    load_program((uint8_t[]){0x8d, 0x00, 0x03}, 3);
+    assert_disassembly("STA $0300 = 89");
+
+    // Pointer high byte comes from 0x0000, not 0x0100
+    load_program((uint8_t[]){0x6c, 0xff, 0x00}, 3);
+    assert_disassembly("JMP ($00FF) = 1234");
+
+    load_program((uint8_t[]){0xd0, 0xfe}, 2);
+    assert_disassembly("BNE $C000");
+
+    load_program((uint8_t[]){0x4a}, 1);
+    assert_disassembly("LSR A");
+}
+
+// LDX #$05, STX $10, JMP $C000
+static const uint8_t loop[] = {0xa2, 0x05, 0x86, 0x10, 0x4c, 0x00, 0xc0};
+static const char *loop_log =
+    "C000  A2 05     LDX #$05                        "
+    "A:00 X:00 Y:00 P:24 SP:FD PPU:  0, 21 CYC:7\r\n"
+    "C002  86 10     STX $10 = 00                    "
+    "A:00 X:05 Y:00 P:24 SP:FD PPU:  0, 27 CYC:9\r\n"
+    "C004  4C 00 C0  JMP $C000                       "
+    "A:00 X:05 Y:00 P:24 SP:FD PPU:  0, 36 CYC:12\r\n"
+    "C000  A2 05     LDX #$05                        "
+    "A:00 X:05 Y:00 P:24 SP:FD PPU:  0, 45 CYC:15\r\n";
+
+void test_compare_matching_log() {
+    load_program(loop, sizeof(loop));
+
+    FILE *golden = fmemopen((void *)loop_log, strlen(loop_log), "r");
+    TEST_ASSERT_EQUAL(0, trace_compare(&emulator, golden, 0));
+    fclose(golden);
+
+    // Stops at the end of the golden log
+    TEST_ASSERT_EQUAL_HEX16(0xc002, emulator.cpu_ctx.program_counter);
+    TEST_ASSERT_EQUAL(0x05, emulator.memory.ram[0x10]);
+}
+
+void test_compare_stops_at_difference() {
+    load_program(loop, sizeof(loop));
+
+    char log[512];
+    strcpy(log, loop_log);
+    // Expect STX to have taken a cycle more
+    memcpy(strstr(log, "CYC:12"), "CYC:13", 6);
+
+    FILE *golden = fmemopen(log, strlen(log), "r");
+    TEST_ASSERT_EQUAL(1, trace_compare(&emulator, golden, 0));
+    fclose(golden);
+
+    TEST_ASSERT_EQUAL_HEX16(0xc004, emulator.cpu_ctx.program_counter);
+}
+
+void test_compare_stops_at_unsupported_instruction() {
+    // LDX #$05, then an unofficial NOP
+    load_program((uint8_t[]){0xa2, 0x05, 0x04, 0x10}, 4);
+
+    TEST_ASSERT_EQUAL(1, trace_compare(&emulator, 0, 0));
+    TEST_ASSERT_EQUAL(EMULATOR_EXIT_UNSUPPORTED_INSTRUCTION,
+                      emulator.exit_reason);
+    TEST_ASSERT_EQUAL_HEX16(0xc002, emulator.cpu_ctx.program_counter);
+}
+
+int main() {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_first_nestest_line);
+    RUN_TEST(test_addressing_modes);
+    RUN_TEST(test_compare_matching_log);
+    RUN_TEST(test_compare_stops_at_difference);
+    RUN_TEST(test_compare_stops_at_unsupported_instruction);
+
+    return UNITY_END();
+}
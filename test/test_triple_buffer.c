@@ -0,0 +1,99 @@
+#include "triple_buffer.h"
+#include "unity.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <string.h>
+
+#define BUFFER_SIZE 1024
+
+TripleBuffer triple;
+uint32_t storage[3][BUFFER_SIZE];
+
+void setUp() {
+    memset(storage, 0, sizeof(storage));
+    void *buffers[] = {storage[0], storage[1], storage[2]};
+    triple_buffer_init(&triple, buffers);
+}
+
+void tearDown() {}
+
+void test_nothing_to_consume_at_first() {
+    TEST_ASSERT_FALSE(triple_buffer_consume(&triple));
+}
+
+void test_buffers_stay_distinct() {
+    for (int i = 0; i < 10; i++) {
+        TEST_ASSERT(triple_buffer_back(&triple) !=
+                    triple_buffer_front(&triple));
+        triple_buffer_publish(&triple);
+        TEST_ASSERT(triple_buffer_back(&triple) !=
+                    triple_buffer_front(&triple));
+        if (i % 3)
+            triple_buffer_consume(&triple);
+    }
+}
+
+void test_consumes_newest() {
+    uint32_t *back = triple_buffer_back(&triple);
+    back[0] = 1;
+    back = triple_buffer_publish(&triple);
+    back[0] = 2;
+    back = triple_buffer_publish(&triple);
+    back[0] = 3;
+
+    TEST_ASSERT(triple_buffer_consume(&triple));
+    TEST_ASSERT_EQUAL(2, ((uint32_t *)triple_buffer_front(&triple))[0]);
+    TEST_ASSERT_FALSE(triple_buffer_consume(&triple));
+    TEST_ASSERT_EQUAL(2, ((uint32_t *)triple_buffer_front(&triple))[0]);
+}
+
+#define FRAME_COUNT 20000
+
+static void *produce(void *arg) {
+    uint32_t *back = triple_buffer_back(&triple);
+    for (uint32_t frame = 1; frame <= FRAME_COUNT; frame++) {
+        for (int i = 0; i < BUFFER_SIZE; i++)
+            back[i] = frame;
+        back = triple_buffer_publish(&triple);
+        if (frame % 64 == 0)
+            sched_yield();
+    }
+    return 0;
+}
+
+// Every frame the consumer gets has to be complete and newer than the last
+void test_threaded_frames_are_whole() {
+    pthread_t producer;
+    pthread_create(&producer, 0, produce, 0);
+
+    uint32_t last_frame = 0;
+    int whole = 1, in_order = 1;
+    while (last_frame < FRAME_COUNT) {
+        if (!triple_buffer_consume(&triple)) {
+            sched_yield();
+            continue;
+        }
+
+        uint32_t *front = triple_buffer_front(&triple);
+        for (int i = 1; i < BUFFER_SIZE; i++)
+            whole &= front[i] == front[0];
+        in_order &= front[0] > last_frame;
+        last_frame = front[0];
+    }
+
+    pthread_join(producer, 0);
+    TEST_ASSERT(whole);
+    TEST_ASSERT(in_order);
+}
+
+int main() {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_nothing_to_consume_at_first);
+    RUN_TEST(test_buffers_stay_distinct);
+    RUN_TEST(test_consumes_newest);
+    RUN_TEST(test_threaded_frames_are_whole);
+
+    return UNITY_END();
+}
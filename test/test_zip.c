@@ -0,0 +1,136 @@
+#include "emulator.h"
+#include "rom_file.h"
+#include "unity.h"
+#include "zip.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// A stored "readme.txt" and a deflated "Game.NES", a ROM with 16 KB of PRG
+// ROM of i % 5 and 8 KB of CHR ROM continuing with 0x80 + i % 3
+static const uint8_t archive_data[] = {
+    0x50, 0x4b, 0x03, 0x04, 0x14, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x21, 0x00, 0xf1, 0x2a, 0x9b, 0xe6, 0x09, 0x00, 0x00, 0x00, 0x09, 0x00,
+    0x00, 0x00, 0x0a, 0x00, 0x00, 0x00, 0x72, 0x65, 0x61, 0x64, 0x6d, 0x65,
+    0x2e, 0x74, 0x78, 0x74, 0x6e, 0x6f, 0x74, 0x20, 0x61, 0x20, 0x72, 0x6f,
+    0x6d, 0x50, 0x4b, 0x03, 0x04, 0x14, 0x00, 0x00, 0x00, 0x08, 0x00, 0x00,
+    0x00, 0x21, 0x00, 0x55, 0xbc, 0xee, 0x0c, 0x4a, 0x00, 0x00, 0x00, 0x10,
+    0x60, 0x00, 0x00, 0x08, 0x00, 0x00, 0x00, 0x47, 0x61, 0x6d, 0x65, 0x2e,
+    0x4e, 0x45, 0x53, 0xed, 0xc4, 0xc1, 0x0d, 0x00, 0x11, 0x14, 0x40, 0x41,
+    0x1f, 0x55, 0x6c, 0x3f, 0xae, 0x2e, 0x1a, 0x42, 0xe5, 0x7b, 0xd3, 0x82,
+    0x48, 0xe6, 0xe5, 0x65, 0x7a, 0x1b, 0x5f, 0x44, 0xa4, 0x53, 0xe4, 0x52,
+    0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xc0,
+    0x55, 0xd6, 0x9e, 0xb6, 0x6d, 0xdb, 0xb6, 0x6d, 0xdb, 0xb6, 0x6d, 0xdb,
+    0xb6, 0x6d, 0xfb, 0xf1, 0x7f, 0x50, 0x4b, 0x01, 0x02, 0x14, 0x03, 0x14,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x21, 0x00, 0xf1, 0x2a, 0x9b,
+    0xe6, 0x09, 0x00, 0x00, 0x00, 0x09, 0x00, 0x00, 0x00, 0x0a, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x80, 0x01, 0x00,
+    0x00, 0x00, 0x00, 0x72, 0x65, 0x61, 0x64, 0x6d, 0x65, 0x2e, 0x74, 0x78,
+    0x74, 0x50, 0x4b, 0x01, 0x02, 0x14, 0x03, 0x14, 0x00, 0x00, 0x00, 0x08,
+    0x00, 0x00, 0x00, 0x21, 0x00, 0x55, 0xbc, 0xee, 0x0c, 0x4a, 0x00, 0x00,
+    0x00, 0x10, 0x60, 0x00, 0x00, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x80, 0x01, 0x31, 0x00, 0x00, 0x00, 0x47,
+    0x61, 0x6d, 0x65, 0x2e, 0x4e, 0x45, 0x53, 0x50, 0x4b, 0x05, 0x06, 0x00,
+    0x00, 0x00, 0x00, 0x02, 0x00, 0x02, 0x00, 0x6e, 0x00, 0x00, 0x00, 0xa1,
+    0x00, 0x00, 0x00, 0x00, 0x00};
+
+char filepath[] = "/tmp/test_zip_XXXXXX.zip";
+ZipArchive archive;
+Emulator emulator;
+
+void setUp() {
+    close(mkstemps(filepath, 4));
+    FILE *fp = fopen(filepath, "wb");
+    fwrite(archive_data, sizeof(archive_data), 1, fp);
+    fclose(fp);
+
+    memset(&emulator, 0, sizeof(Emulator));
+    emulator_init(&emulator);
+}
+
+void tearDown() {
+    zip_close(&archive);
+    remove(filepath);
+    strcpy(filepath, "/tmp/test_zip_XXXXXX.zip");
+    free(emulator.memory.prg_rom);
+    free(emulator.memory.chr_rom);
+}
+
+static int collect(void *context, const uint8_t *data, size_t size) {
+    char *text = context;
+    strncat(text, (const char *)data, size);
+    return 0;
+}
+
+void test_index(void) {
+    TEST_ASSERT_EQUAL_INT(0, zip_open(&archive, filepath));
+    TEST_ASSERT_EQUAL_INT(2, archive.count);
+    // Sorted by name
+    TEST_ASSERT_EQUAL_STRING("Game.NES", archive.entries[0].name);
+
+    const ZipEntry *entry = zip_find(&archive, "readme.txt");
+    TEST_ASSERT_NOT_NULL(entry);
+    TEST_ASSERT_EQUAL_INT(ZIP_METHOD_STORED, entry->method);
+    TEST_ASSERT_NULL(zip_find(&archive, "readme"));
+    TEST_ASSERT_EQUAL_PTR(&archive.entries[0],
+                          zip_find_extension(&archive, ".nes"));
+
+    char text[16] = "";
+    TEST_ASSERT_EQUAL_INT(0, zip_extract(&archive, entry, collect, text));
+    TEST_ASSERT_EQUAL_STRING("not a rom", text);
+}
+
+void test_not_a_zip_file(void) {
+    FILE *fp = fopen(filepath, "wb");
+    fwrite(archive_data, 100, 1, fp);
+    fclose(fp);
+    TEST_ASSERT_EQUAL_INT(1, zip_open(&archive, filepath));
+}
+
+static void expect_rom(void) {
+    TEST_ASSERT_EQUAL_INT(0x4000, emulator.memory.prg_rom_size);
+    TEST_ASSERT_EQUAL_INT(0x2000, emulator.memory.chr_rom_size);
+    for (int i = 0; i < 0x4000; i++)
+        TEST_ASSERT_EQUAL_HEX8(i % 5, emulator.memory.prg_rom[i]);
+    for (int i = 0; i < 0x2000; i++)
+        TEST_ASSERT_EQUAL_HEX8(0x80 + (0x4000 + i) % 3,
+                               emulator.memory.chr_rom[i]);
+    TEST_ASSERT_EQUAL_MEMORY(
+        emulator.memory.chr_rom,
+        emulator.memory.ppu_ctx.memory.cartridge_mapped_memory, 0x2000);
+}
+
+void test_read_rom(void) {
+    RomInfo info;
+    TEST_ASSERT_EQUAL_INT(
+        0, rom_file_read(filepath, &emulator.memory, &info, 0));
+    expect_rom();
+    TEST_ASSERT_EQUAL_INT(PPU_MIRRORING_VERTICAL, info.mirroring);
+}
+
+void test_read_rom_by_name(void) {
+    char path[64];
+    snprintf(path, sizeof(path), "%s#Game.NES", filepath);
+    TEST_ASSERT_EQUAL_INT(0, rom_file_read(path, &emulator.memory, 0, 0));
+    expect_rom();
+    free(emulator.memory.prg_rom);
+    free(emulator.memory.chr_rom);
+
+    // Not a ROM
+    snprintf(path, sizeof(path), "%s#readme.txt", filepath);
+    TEST_ASSERT_EQUAL_INT(1, rom_file_read(path, &emulator.memory, 0, 0));
+    TEST_ASSERT_NULL(emulator.memory.prg_rom);
+}
+
+int main() {
+    UNITY_BEGIN();
+
+    RUN_TEST(test_index);
+    RUN_TEST(test_not_a_zip_file);
+    RUN_TEST(test_read_rom);
+    RUN_TEST(test_read_rom_by_name);
+
+    return UNITY_END();
+}